@@ -0,0 +1,146 @@
+/// Check and compare the throughput of the Base64 codecs
+///
+/// Usage: zordzman-bench-base64 [--fuzz <iterations>]
+///
+/// Encodes and decodes buffers of a few sizes with each code path in
+/// common::util::base64 the CPU supports, and with the old implementation in
+/// common/extlib/base64 for comparison.
+///
+/// With --fuzz, random inputs are instead round-tripped through every path
+/// and the results compared with each other and the old implementation.
+/// Random corruptions of valid encodings must be rejected or decoded the
+/// same way by every path. Exits with a non-zero status on any mismatch.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "base64.hpp"
+#include "bench/bench.hpp"
+#include "common/util/base64.hpp"
+
+using namespace common::util;
+
+namespace {
+base64::Path const paths[] = {
+    base64::Path::Scalar, base64::Path::SSSE3, base64::Path::AVX2,
+};
+
+char const * pathName(base64::Path path) {
+    switch (path) {
+    case base64::Path::SSSE3:
+        return "ssse3";
+    case base64::Path::AVX2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
+
+/// Run `work` on `size` bytes repeatedly, returning MiB/s
+template <typename Work> double measure(std::size_t size, Work work) {
+    return bench::measure(work) * size / (1024 * 1024);
+}
+
+void benchmark() {
+    std::mt19937 random(42);
+    for (std::size_t size : {1024, 16 * 1024, 1024 * 1024, 16 * 1024 * 1024}) {
+        std::string data(size, '\0');
+        for (auto & byte : data) {
+            byte = (char)random();
+        }
+        std::string encoded = base64::encode(data.data(), data.size());
+        std::printf("%zu bytes\n", size);
+        std::printf("  %-8s %12s %12s\n", "codec", "encode MiB/s",
+                    "decode MiB/s");
+        std::printf(
+            "  %-8s %12.1f %12.1f\n", "extlib",
+            measure(size,
+                    [&] {
+                        base64_encode((unsigned char const *)data.data(),
+                                      data.size());
+                    }),
+            measure(size, [&] { base64_decode(encoded); }));
+        std::vector<char> out(base64::encodedSize(size));
+        for (auto path : paths) {
+            if (!base64::isSupported(path)) {
+                continue;
+            }
+            base64::usePath(path);
+            std::printf(
+                "  %-8s %12.1f %12.1f\n", pathName(path),
+                measure(size,
+                        [&] {
+                            base64::encode(data.data(), data.size(),
+                                           out.data());
+                        }),
+                measure(size, [&] {
+                    base64::decode(encoded.data(), encoded.size(),
+                                   out.data());
+                }));
+        }
+    }
+}
+
+int fuzz(long iterations) {
+    std::mt19937 random(1);
+    long failures = 0;
+    for (long i = 0; i < iterations; i++) {
+        std::size_t size = random() % (i % 100 == 0 ? 4096 : 200);
+        std::string data(size, '\0');
+        for (auto & byte : data) {
+            byte = (char)random();
+        }
+        std::string expected =
+            base64_encode((unsigned char const *)data.data(), data.size());
+        // Corrupt a copy, and sometimes drop the padding
+        std::string corrupt = expected;
+        if (!corrupt.empty()) {
+            corrupt[random() % corrupt.size()] = (char)random();
+        }
+        std::string unpadded = expected.substr(0, expected.find('='));
+        std::string reference;
+        bool reference_valid = false;
+        for (auto path : paths) {
+            if (!base64::isSupported(path)) {
+                continue;
+            }
+            base64::usePath(path);
+            std::string encoded = base64::encode(data.data(), data.size());
+            std::string decoded, decoded_unpadded, decoded_corrupt;
+            bool ok = encoded == expected &&
+                      base64::decode(encoded, decoded) && decoded == data &&
+                      base64::decode(unpadded, decoded_unpadded) &&
+                      decoded_unpadded == data;
+            bool valid = base64::decode(corrupt, decoded_corrupt);
+            if (path == base64::Path::Scalar) {
+                reference = decoded_corrupt;
+                reference_valid = valid;
+            } else if (valid != reference_valid ||
+                       decoded_corrupt != reference) {
+                ok = false;
+            }
+            if (!ok) {
+                std::printf("Mismatch: path %s, %zu bytes, iteration %ld\n",
+                            pathName(path), size, i);
+                failures++;
+            }
+        }
+    }
+    std::printf("%ld iterations, %ld failures\n", iterations, failures);
+    return failures == 0 ? 0 : 1;
+}
+} // Anonymous namespace
+
+int main(int argc, char ** argv) {
+    std::printf("Best path: %s\n", pathName(base64::bestPath()));
+    if (argc == 3 && !std::strcmp(argv[1], "--fuzz")) {
+        return fuzz(std::strtol(argv[2], nullptr, 10));
+    }
+    benchmark();
+    return 0;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+/// What the benchmarks have in common
+///
+/// Each benchmark is a single file, which includes this once. It replaces
+/// the global operator new so that allocations can be counted.
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <string>
+
+#include "json11.hpp"
+
+namespace bench {
+/// Heap allocations made since the program started
+std::uint64_t allocations = 0;
+} // namespace bench
+
+void * operator new(std::size_t size) {
+    bench::allocations++;
+    void * memory = std::malloc(size == 0 ? 1 : size);
+    if (memory == nullptr) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void * memory) noexcept { std::free(memory); }
+
+namespace bench {
+
+/// Run `work` repeatedly for at least half a second
+///
+/// Returns how many times a second it ran, and sets `allocated` to how many
+/// allocations it made each time. The clock is only looked at after every
+/// `batch` runs, so that it isn't most of what's timed for quick work.
+template <typename Work>
+double measure(Work work, double & allocated, unsigned batch = 1) {
+    typedef std::chrono::steady_clock clock;
+    std::uint64_t runs = 0;
+    std::uint64_t before = allocations;
+    auto start = clock::now();
+    std::chrono::duration<double> elapsed;
+    do {
+        for (unsigned i = 0; i < batch; i++) {
+            work();
+        }
+        runs += batch;
+        elapsed = clock::now() - start;
+    } while (elapsed.count() < 0.5);
+    allocated = (double)(allocations - before) / runs;
+    return runs / elapsed.count();
+}
+
+/// Run `work` repeatedly for at least half a second, returning how many
+/// times a second it ran
+template <typename Work> double measure(Work work, unsigned batch = 1) {
+    double allocated;
+    return measure(work, allocated, batch);
+}
+
+/// A random JSON value of up to `depth` levels of nesting, for fuzzing
+///
+/// Strings include characters JSON has to escape, numbers include integers
+/// either side of what fits in 32 bits and beyond what a double holds
+/// exactly, and now and then strings and arrays are long enough to need
+/// more than one byte for their size in the binary framing.
+inline json11::Json randomValue(std::mt19937 & random, int depth) {
+    static char const characters[] =
+        "ab\"\\/\n\t\x01\x1f \xC3\xA9{}[]:,0\xE2\x80\xA8";
+    switch (random() % (depth > 0 ? 8 : 6)) {
+    case 0:
+        return nullptr;
+    case 1:
+        return random() % 2 == 0;
+    case 2:
+        return (int)(random() % 2000) - 1000;
+    case 3:
+        return std::ldexp((double)random() - 2147483648.0,
+                          (int)(random() % 80) - 40);
+    case 4:
+        return std::ldexp((double)random() - 2147483648.0,
+                          (int)(random() % 40));
+    case 5: {
+        std::string string;
+        for (std::size_t i = random() % (random() % 8 == 0 ? 300 : 12);
+             i > 0; i--) {
+            string += characters[random() % (sizeof characters - 1)];
+        }
+        return string;
+    }
+    case 6: {
+        json11::Json::array array;
+        for (std::size_t i = random() % (random() % 8 == 0 ? 200 : 6);
+             i > 0; i--) {
+            array.push_back(randomValue(random, depth - 1));
+        }
+        return array;
+    }
+    default: {
+        json11::Json::object object;
+        for (std::size_t i = random() % 6; i > 0; i--) {
+            std::string key(1 + random() % 2, (char)('a' + random() % 4));
+            object[key] = randomValue(random, depth - 1);
+        }
+        return object;
+    }
+    }
+}
+
+} // namespace bench
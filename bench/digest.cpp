@@ -0,0 +1,69 @@
+/// Compare the throughput of the map digests
+///
+/// Usage: zordzman-bench-digest [file...]
+///
+/// Each file (or 64 MiB of pseudo-random data if none are given) is hashed
+/// whole, as when identifying a map, and in 16 KiB pieces, as when
+/// checksumming map chunks, with every digest in common::util::digest.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bench/bench.hpp"
+#include "common/util/digest.hpp"
+#include "common/util/mappedfile.hpp"
+
+using namespace common::util;
+
+namespace {
+std::size_t const CHUNK_SIZE = 16 * 1024;
+
+/// Hash `data` repeatedly for at least half a second, returning MiB/s
+double measure(std::string const & name, char const * data, std::size_t size,
+               std::size_t piece) {
+    std::unique_ptr<digest::Digest> digest = digest::create(name);
+    return bench::measure([&] {
+               for (std::size_t offset = 0; offset < size; offset += piece) {
+                   digest->reset();
+                   digest->add(data + offset, std::min(piece, size - offset));
+                   digest->getHash();
+               }
+           }) *
+           size / (1024 * 1024);
+}
+
+void run(std::string const & label, char const * data, std::size_t size) {
+    std::printf("%s (%zu bytes)\n", label.c_str(), size);
+    std::printf("  %-8s %12s %12s\n", "digest", "whole MiB/s", "chunk MiB/s");
+    for (auto const & name : digest::names()) {
+        std::printf("  %-8s %12.1f %12.1f\n", name.c_str(),
+                    measure(name, data, size, size),
+                    measure(name, data, size, CHUNK_SIZE));
+    }
+}
+} // Anonymous namespace
+
+int main(int argc, char ** argv) {
+    if (argc < 2) {
+        std::vector<char> data(64 * 1024 * 1024);
+        std::uint32_t state = 2463534242u;
+        for (auto & byte : data) {
+            // xorshift32
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            byte = (char)state;
+        }
+        run("random", data.data(), data.size());
+        return 0;
+    }
+    for (int i = 1; i < argc; i++) {
+        file::MappedFile file(argv[i]);
+        run(argv[i], file.data(), file.size());
+    }
+    return 0;
+}
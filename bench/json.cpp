@@ -0,0 +1,170 @@
+/// Check and compare the JSON DOMs used for received messages
+///
+/// Usage: zordzman-bench-json [--fuzz <iterations>]
+///
+/// Parses a few typical messages, as JSON text and as binary frame bodies,
+/// into json11::Json and into a reused common::util::json::Document, and
+/// reports how many of each are parsed a second and how many heap
+/// allocations each takes.
+///
+/// With --fuzz, random values are instead encoded both ways and parsed with
+/// both, then random corruptions of the encodings are parsed too. Both must
+/// agree on whether each is valid and, if it is, on its value. Exits with a
+/// non-zero status on any mismatch.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+
+#include "json11.hpp"
+#include "bench/bench.hpp"
+#include "common/net/wire.hpp"
+#include "common/util/json.hpp"
+
+using namespace common::util;
+
+namespace {
+struct Sample {
+    char const * name;
+    char const * text;
+};
+
+Sample const samples[] = {
+    {"world.ack", R"({"type": "world.ack", "entity": 1234})"},
+    {"input", R"({"type": "input", "entity": [5678, 5]})"},
+    {"map.request", R"({"type": "map.request", "entity": {"offset": 65536}})"},
+    {"net.ping", R"({"type": "net.ping", "entity": 1459012345678.25})"},
+    {"nested",
+     R"({"type": "custom", "entity": {"name": "Eyenado \"7\"",)"
+     R"( "position": [12.5, -3.75], "tags": ["mob", "hostile", "fast"],)"
+     R"( "stats": {"health": 100, "speed": 2.5, "alive": true,)"
+     R"( "target": null}, "path": [[1, 2], [3, 4], [5, 6], [7, 8]]}})"},
+};
+
+void benchmark() {
+    json::Document document;
+    std::printf("  %-12s %-10s %14s %10s %14s %10s\n", "message", "framing",
+                "json11 msg/s", "allocs", "arena msg/s", "allocs");
+    for (auto const & sample : samples) {
+        std::string text = sample.text;
+        std::string error;
+        json11::Json message = json11::Json::parse(text, error);
+        std::string frame;
+        net::encodeMessage(net::Framing::Binary,
+                           message["type"].string_value(), message["entity"],
+                           frame);
+        // Skip the length prefix, as the framer does
+        std::uint64_t length;
+        int prefix = net::wire::getVarint(frame.data(), frame.size(), length);
+        char const * body = frame.data() + prefix;
+
+        double json11_allocated, arena_allocated;
+        double json11_rate = bench::measure(
+            [&] {
+                json11::Json value = json11::Json::parse(text, error);
+            },
+            json11_allocated, 100);
+        double arena_rate = bench::measure(
+            [&] {
+                json::Value value;
+                document.parse(text.data(), text.size(), value, error);
+                document.clear();
+            },
+            arena_allocated, 100);
+        std::printf("  %-12s %-10s %14.0f %10.1f %14.0f %10.1f\n",
+                    sample.name, "json", json11_rate, json11_allocated,
+                    arena_rate, arena_allocated);
+
+        net::MessageType type;
+        json11_rate = bench::measure(
+            [&] {
+                json11::Json entity;
+                net::wire::decodeMessage(body, length, type, entity, error);
+            },
+            json11_allocated, 100);
+        arena_rate = bench::measure(
+            [&] {
+                json::Value entity;
+                net::wire::decodeMessage(body, length, type, document, entity,
+                                         error);
+                document.clear();
+            },
+            arena_allocated, 100);
+        std::printf("  %-12s %-10s %14.0f %10.1f %14.0f %10.1f\n",
+                    sample.name, "binary", json11_rate, json11_allocated,
+                    arena_rate, arena_allocated);
+    }
+}
+
+/// Check both DOMs parse `text` the same way
+bool compareText(json::Document & document, std::string const & text) {
+    std::string error;
+    json11::Json expected = json11::Json::parse(text, error);
+    bool expected_valid = error.empty();
+    json::Value value;
+    bool valid = document.parse(text.data(), text.size(), value, error);
+    bool same = valid == expected_valid &&
+                (!valid || value.toJson11().dump() == expected.dump());
+    document.clear();
+    return same;
+}
+
+/// Check both DOMs decode the binary encoding `data` the same way
+///
+/// Values are compared by their dumps, as a corrupt double may be NaN.
+bool compareBinary(json::Document & document, std::string const & data) {
+    char const * begin = data.data();
+    json11::Json expected;
+    bool expected_valid =
+        net::wire::decodeEntity(begin, data.data() + data.size(), expected);
+    char const * expected_end = begin;
+    begin = data.data();
+    json::Value value;
+    bool valid = net::wire::decodeEntity(begin, data.data() + data.size(),
+                                         document, value);
+    bool same = valid == expected_valid &&
+                (!valid ||
+                 (begin == expected_end &&
+                  value.toJson11().dump() == expected.dump()));
+    document.clear();
+    return same;
+}
+
+int fuzz(long iterations) {
+    std::mt19937 random(1);
+    json::Document document(256);
+    long failures = 0;
+    for (long i = 0; i < iterations; i++) {
+        json11::Json value = bench::randomValue(random, 4);
+        std::string text = value.dump();
+        std::string binary;
+        net::wire::encodeEntity(binary, value);
+        std::string corrupt_text = text;
+        corrupt_text[random() % corrupt_text.size()] =
+            "{}[]\",:\\0-.eE tfnu\x01"[random() % 20];
+        std::string corrupt_binary = binary;
+        corrupt_binary[random() % corrupt_binary.size()] = (char)random();
+        if (!compareText(document, text) ||
+            !compareText(document, corrupt_text) ||
+            !compareBinary(document, binary) ||
+            !compareBinary(document, corrupt_binary)) {
+            std::printf("Mismatch: iteration %ld: %s / %s\n", i,
+                        text.c_str(), corrupt_text.c_str());
+            failures++;
+        }
+    }
+    std::printf("%ld iterations, %ld failures\n", iterations, failures);
+    return failures == 0 ? 0 : 1;
+}
+} // Anonymous namespace
+
+int main(int argc, char ** argv) {
+    if (argc == 3 && !std::strcmp(argv[1], "--fuzz")) {
+        return fuzz(std::strtol(argv[2], nullptr, 10));
+    }
+    benchmark();
+    return 0;
+}
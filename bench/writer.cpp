@@ -0,0 +1,224 @@
+/// Check and compare the ways of encoding messages to send
+///
+/// Usage: zordzman-bench-writer [--fuzz <iterations>]
+///
+/// Encodes a few typical server messages in each framing, first as sending
+/// them used to: building the entity as a json11::Json and then dumping it
+/// (or encoding it, for the binary framing) into a fresh string; then with a
+/// net::Writer into a reused buffer. Reports how many of each are encoded a
+/// second and how many heap allocations each takes.
+///
+/// With --fuzz, random values are instead written with a Writer in both
+/// framings. The JSON must parse back to the same value, and the binary
+/// frame must be exactly what wire::encodeEntity() makes. Exits with a
+/// non-zero status on any mismatch.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+
+#include "json11.hpp"
+#include "bench/bench.hpp"
+#include "common/net/snapshot.hpp"
+#include "common/net/wire.hpp"
+#include "common/net/writer.hpp"
+
+namespace {
+/// Encode a message the way encodeMessage() did before there was a Writer
+std::string encodeJson11(net::Framing framing, net::MessageType const & type,
+                         json11::Json const & entity) {
+    std::string out;
+    if (framing == net::Framing::Json) {
+        json11::Json message = json11::Json::object{
+            {"type", type}, {"entity", entity},
+        };
+        message.dump(out);
+        out += ' ';
+        return out;
+    }
+    std::string body;
+    unsigned id = net::wire::messageTypeId(type);
+    net::wire::putVarint(body, id);
+    if (id == 0) {
+        net::wire::putVarint(body, type.size());
+        body += type;
+    }
+    net::wire::encodeEntity(body, entity);
+    net::wire::putVarint(out, body.size());
+    out += body;
+    return out;
+}
+
+/// A world of `count` entities, with every other one moved by `moved`
+net::snapshot::Snapshot makeSnapshot(std::uint64_t tick, int count,
+                                     int moved) {
+    net::snapshot::Snapshot snapshot;
+    snapshot.tick = tick;
+    for (int i = 0; i < count; i++) {
+        net::snapshot::EntityState entity;
+        entity.id = 100 + i;
+        entity.fields[net::snapshot::EntityState::KIND] = i % 3;
+        entity.fields[net::snapshot::EntityState::X] =
+            i * 160 + (i % 2 == 0 ? moved : 0);
+        entity.fields[net::snapshot::EntityState::Y] = i * 48;
+        entity.fields[net::snapshot::EntityState::DIRECTION] = i % 4;
+        entity.fields[net::snapshot::EntityState::HEALTH] = 100;
+        entity.fields[net::snapshot::EntityState::FRAME] = (int)tick % 8;
+        snapshot.entities.push_back(entity);
+    }
+    return snapshot;
+}
+
+/// A snapshot entity built as a json11::Json, as snapshot::encode() used
+/// to
+json11::Json snapshotJson11(net::snapshot::Snapshot const & snapshot,
+                            net::snapshot::Snapshot const * baseline) {
+    json11::Json::array entities;
+    for (std::size_t i = 0; i < snapshot.entities.size(); i++) {
+        auto const & entity = snapshot.entities[i];
+        json11::Json::array fields{(double)entity.id, 0};
+        unsigned mask = 0;
+        for (int field = 0; field < net::snapshot::EntityState::FIELD_COUNT;
+             field++) {
+            if (baseline == nullptr ||
+                baseline->entities[i].fields[field] != entity.fields[field]) {
+                mask |= 1 << field;
+                fields.push_back(entity.fields[field]);
+            }
+        }
+        if (mask != 0) {
+            fields[1] = (int)mask;
+            entities.push_back(fields);
+        }
+    }
+    return json11::Json::array{
+        (double)snapshot.tick, baseline ? (double)baseline->tick : 0.0,
+        json11::Json::array{}, entities,
+    };
+}
+
+struct Sample {
+    char const * name;
+    net::MessageType type;
+    /// Build the entity as a json11::Json
+    std::function<json11::Json()> build;
+    /// Write the same entity
+    std::function<void(net::Writer &)> write;
+};
+
+int benchmark() {
+    net::snapshot::Snapshot baseline = makeSnapshot(1000, 64, 0);
+    net::snapshot::Snapshot world = makeSnapshot(1001, 64, 16);
+    Sample const samples[] = {
+        {"world.join", "world.join", [] { return json11::Json(1234.0); },
+         [](net::Writer & writer) { writer.value(1234u); }},
+        {"net.ping", "net.ping",
+         [] { return json11::Json(1459012345678.0); },
+         [](net::Writer & writer) {
+             writer.value((std::uint64_t)1459012345678);
+         }},
+        {"snapshot", "world.snapshot",
+         [&] { return snapshotJson11(world, nullptr); },
+         [&](net::Writer & writer) {
+             net::snapshot::encode(writer, world, nullptr);
+         }},
+        {"delta", "world.snapshot",
+         [&] { return snapshotJson11(world, &baseline); },
+         [&](net::Writer & writer) {
+             net::snapshot::encode(writer, world, &baseline);
+         }},
+    };
+    int failures = 0;
+    net::Writer writer;
+    std::string buffer;
+    std::printf("  %-12s %-10s %14s %10s %14s %10s\n", "message", "framing",
+                "json11 msg/s", "allocs", "writer msg/s", "allocs");
+    for (auto const & sample : samples) {
+        for (net::Framing framing :
+             {net::Framing::Json, net::Framing::Binary}) {
+            auto write = [&] {
+                buffer.clear();
+                sample.write(
+                    writer.begin(framing, sample.type, buffer));
+                writer.end();
+            };
+            // Both must encode the same message. The JSON's members are in
+            // a different order, so it's compared by parsing it.
+            write();
+            std::string expected =
+                encodeJson11(framing, sample.type, sample.build());
+            std::string error;
+            bool same = framing == net::Framing::Binary
+                            ? buffer == expected
+                            : json11::Json::parse(buffer, error).dump() ==
+                                  json11::Json::parse(expected, error).dump();
+            if (!same) {
+                std::printf("Mismatch: %s\n", sample.name);
+                failures++;
+            }
+
+            double json11_allocated, writer_allocated;
+            double json11_rate = bench::measure(
+                [&] {
+                    std::string frame =
+                        encodeJson11(framing, sample.type, sample.build());
+                },
+                json11_allocated, 100);
+            double writer_rate =
+                bench::measure(write, writer_allocated, 100);
+            std::printf("  %-12s %-10s %14.0f %10.1f %14.0f %10.1f\n",
+                        sample.name,
+                        framing == net::Framing::Json ? "json" : "binary",
+                        json11_rate, json11_allocated, writer_rate,
+                        writer_allocated);
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+int fuzz(long iterations) {
+    static net::MessageType const types[] = {"world.snapshot", "custom"};
+    std::mt19937 random(1);
+    net::Writer writer;
+    std::string text;
+    std::string binary;
+    long failures = 0;
+    for (long i = 0; i < iterations; i++) {
+        json11::Json value = bench::randomValue(random, 4);
+        net::MessageType const & type = types[random() % 2];
+        text.clear();
+        writer.begin(net::Framing::Json, type, text).value(value);
+        writer.end();
+        binary.clear();
+        writer.begin(net::Framing::Binary, type, binary).value(value);
+        writer.end();
+        std::string error;
+        json11::Json message = json11::Json::parse(text, error);
+        // The JSON is compared by value, as its numbers are formatted
+        // differently where the value is an integer
+        bool same = error.empty() && text.back() == ' ' &&
+                    message["type"].string_value() == type &&
+                    message["entity"] ==
+                        json11::Json::parse(value.dump(), error) &&
+                    binary == encodeJson11(net::Framing::Binary, type, value);
+        if (!same) {
+            std::printf("Mismatch: iteration %ld: %s\n", i,
+                        value.dump().c_str());
+            failures++;
+        }
+    }
+    std::printf("%ld iterations, %ld failures\n", iterations, failures);
+    return failures == 0 ? 0 : 1;
+}
+} // Anonymous namespace
+
+int main(int argc, char ** argv) {
+    if (argc == 3 && !std::strcmp(argv[1], "--fuzz")) {
+        return fuzz(std::strtol(argv[2], nullptr, 10));
+    }
+    return benchmark();
+}
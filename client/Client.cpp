@@ -1,7 +1,6 @@
 #include "Client.hpp"
 
 #include "gfx/drawingOperations.hpp"
-#include "net/net.hpp"
 #include "json11.hpp"
 #include "weapons/weaponList.hpp"
 #include "entity/Eyenado.hpp"
@@ -9,15 +8,9 @@
 #include <stdexcept>
 #include <format.h>
 #include <thread>
-#include <dirent.h>
 
 #include <SDL_mixer.h>
 
-#include "json11.hpp"
-#include "common/util/stream.hpp"
-#include "common/util/fileutil.hpp"
-#include "common/extlib/hash-library/md5.h"
-
 namespace client {
 
 using namespace json11;
@@ -25,14 +18,20 @@ using namespace json11;
 namespace {
 Client * game_instance;
 std::string const title = "Zordzman v0.0.3";
+std::string const levels_directory = "resources/levels";
 Mix_Music * music = nullptr;
 } // Anonymous namespace
 
 Client::Client(Config const & cfg, HUD hud)
-    : m_window(800, 600, title), m_player(new Player(cfg.name, 0, 0, 1)),
-      m_cfg(cfg), m_hud(hud) {
+    : m_window(800, 600, title), m_map_cache(levels_directory),
+      m_connection(m_map_cache, levels_directory, cfg.framing),
+      m_player(new Player(cfg.name, 0, 0, 1)), m_cfg(cfg), m_hud(hud) {
     game_instance = this;
 
+    m_connection.on_map = [this](std::string const & level_name) {
+        m_level = Level(level_name);
+    };
+
     if (!joinServer()) {
         throw std::runtime_error("Couldn't connect to server.");
     }
@@ -59,8 +58,7 @@ Client::Client(Config const & cfg, HUD hud)
 Client::~Client() { game_instance = nullptr; }
 
 bool Client::joinServer() {
-    return m_socket.connectToHost(m_cfg.host, m_cfg.port) &&
-    m_socket.send(net::MAGIC_NUMBER); // Hand shake
+    return m_connection.connect(m_cfg.host, m_cfg.port);
 }
 
 void Client::exec() {
@@ -92,80 +90,9 @@ void Client::exec() {
     }
 }
 
-void Client::readData() {
-    // Read shit from socket
-    std::string data = m_socket.read();
-    data += "\0";
-    if (data.size() < 1) { // The connection may have ended or
-                           // an error may have occured.
-        return;
-    }
-
-    std::string err;
-
-    Json json = Json::parse(data, err); // Turn it into a Json object
-                                        // so we can access members
-
-    if (!err.empty()) {
-        printf("Server sent bad JSON string\n");
-        printf("Error: %s\n", err.c_str());
-        return;
-    }
-
-    if (json["type"].string_value() == "disconnect") {
-        printf("Disconnected: %s\n",
-               json["entity"]["reason"].string_value().c_str());
-    } else if (json["type"].string_value() == "map-hash") {
-        checkForMap(json);
-    }
-}
-
-void Client::checkForMap(Json json) {
-    using namespace common::util::file;
-    bool found_match = false;
+void Client::readData() { m_connection.readData(); }
 
-    m_map_name = fileFromPath(json["entity"]["name"].string_value());
-
-    // The client is going to now look for that map file.
-    DIR * dir;
-    struct dirent * ent;
-
-    if ((dir = opendir("resources/levels/")) == NULL) {
-        throw std::runtime_error(
-            fmt::format("Couldn't open directory \"{}\"", "resources/levels"));
-    }
-
-    while ((ent = readdir(dir)) != NULL) {
-        // Does the map hash match the file name?
-        if (!strcmp(ent->d_name,
-                    json["entity"]["hash"].string_value().c_str())) {
-            // Open a stream to the file.
-            std::ifstream mapfile(
-                fmt::format("resources/levels/{}", ent->d_name),
-                std::ios::binary | std::ios::in);
-
-            // Read all data...
-            std::vector<char> mapdata =
-                common::util::stream::readToEnd(mapfile);
-
-            MD5 md5;
-            /// Generate a hash from the map data
-            md5.add(mapdata.data(), mapdata.size());
-            if (!strcmp(md5.getHash().c_str(), ent->d_name)) {
-                found_match = true;
-                m_level = Level(json["entity"]["hash"].string_value());
-            }
-
-            mapfile.close();
-        }
-    }
-
-    // Send to the server whether or not we have the map.
-    Json hasmap =
-        Json::object{{"type", "has-map"},
-                     {"entity", Json::object{{"has-map", found_match}}}};
-    m_socket.send(hasmap.dump());
-}
+void Client::sendInput(unsigned buttons) { m_connection.sendInput(buttons); }
 
 void Client::drawHUD() {
     using namespace drawingOperations;
@@ -219,8 +146,10 @@ void Client::drawHUD() {
 
     glColor3f(1, 1, 1);
     std::string serverstr =
-        fmt::format("Server: {}", m_socket.getFormattedServerAddr());
-    std::string mapstr = fmt::format("Map: {}", m_map_name);
+        fmt::format("Server: {}",
+                    m_connection.getSocket().getFormattedServerAddr());
+    std::string mapstr =
+        fmt::format("Map: {}", m_connection.getMapName());
     drawText(serverstr, 800 - (8 * serverstr.size()), m_hud.border.y - 8, 8, 8);
     drawText(mapstr, 800 - (8 * mapstr.size()), m_hud.border.y - 16, 8, 8);
 }
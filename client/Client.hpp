@@ -3,11 +3,14 @@
 #include "sys/RenderWindow.hpp"
 #include "sys/SysContext.hpp"
 #include "level/Level.hpp"
-#include "sys/TCPSocket.hpp"
 #include "entity/Player.hpp"
 #include "Config.hpp"
 #include "ResourceManager.hpp"
 #include "HUD.hpp"
+#include "MapCache.hpp"
+#include "net/Connection.hpp"
+
+#include <memory>
 
 #include "json11.hpp"
 
@@ -30,24 +33,26 @@ public:
     bool joinServer();
     /// Draw the HUD.
     void drawHUD();
-    /// Read data from m_socket
+    /// Read data from the server
     void readData();
-    /// Check of the client has the map the server has
-    void checkForMap(Json json);
+    /// Tell the server which buttons the player is holding
+    ///
+    /// @param buttons A bit set of net::input::Button
+    void sendInput(unsigned buttons);
 
 private:
     Client(const Client &) = delete;
     Client & operator=(const Client &) = delete;
     sys::SysContext m_system;
     sys::RenderWindow m_window;
-    sys::TCPSocket m_socket;
 
 public:
     ResourceManager resources;
 
 private:
     Level m_level;
-    std::string m_map_name;
+    MapCache m_map_cache;
+    Connection m_connection;
     Player * m_player;
     Config const & m_cfg;
     HUD m_hud;
@@ -2,6 +2,8 @@
 
 #include <string>
 
+#include "common/net/wire.hpp"
+
 namespace client {
 
 /// The configuration structure that holds
@@ -11,5 +13,8 @@ struct Config {
     int port = 4544;
 
     std::string name = "SneakySnake";
+
+    /// Protocol framing to ask the server for
+    net::Framing framing = net::Framing::Binary;
 };
 } // namespace client
@@ -0,0 +1,207 @@
+#include "MapCache.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+#include <dirent.h>
+#include <format.h>
+#include <sys/stat.h>
+
+#include "json11.hpp"
+#include "common/util/digest.hpp"
+#include "common/util/mappedfile.hpp"
+#include "common/util/stream.hpp"
+
+namespace client {
+
+using namespace json11;
+
+namespace {
+/// Check if a directory entry could be a map
+bool isMapName(std::string const & name) {
+    // Skip the index, other hidden files and partial downloads
+    std::string const part = ".part";
+    return !name.empty() && name[0] != '.' &&
+           !(name.size() >= part.size() &&
+             name.compare(name.size() - part.size(), part.size(), part) == 0);
+}
+} // Anonymous namespace
+
+MapCache::MapCache(std::string const & directory)
+    : m_directory(directory), m_index_path(directory + "/.index") {
+    load();
+    bool changed = false;
+    // Drop maps that have been deleted or changed since they were indexed
+    for (auto file = m_files.begin(); file != m_files.end();) {
+        if (isCurrent(file->first, file->second)) {
+            for (auto const & hash : file->second.hashes) {
+                m_maps[hash.first + ":" + hash.second] = file->first;
+            }
+            ++file;
+        } else {
+            file = m_files.erase(file);
+            changed = true;
+        }
+    }
+    // Index maps that are new or have changed
+    DIR * dir = opendir(directory.c_str());
+    if (dir == nullptr) {
+        throw std::runtime_error(
+            fmt::format("Couldn't open directory \"{}\"", directory));
+    }
+    struct dirent * ent;
+    while ((ent = readdir(dir)) != nullptr) {
+        std::string name = ent->d_name;
+        if (!isMapName(name) || m_files.count(name)) {
+            continue;
+        }
+        struct stat st;
+        if (stat((directory + "/" + name).c_str(), &st) != 0 ||
+            !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        add(name);
+        changed = true;
+    }
+    closedir(dir);
+    if (changed) {
+        save();
+    }
+}
+
+bool MapCache::find(std::string const & digest, std::string const & hash,
+                    std::string & name) {
+    if (!m_digests.count(digest)) {
+        // Never been asked for this one before, so nothing's hashed with it
+        for (auto & file : m_files) {
+            try {
+                hashFile(file.first, file.second, {digest});
+            } catch (std::runtime_error const &) {
+                // It's been deleted, which is noticed when it's looked up
+            }
+        }
+        m_digests.insert(digest);
+        save();
+    }
+    auto map = m_maps.find(digest + ":" + hash);
+    if (map == m_maps.end()) {
+        return false;
+    }
+    auto file = m_files.find(map->second);
+    if (file == m_files.end() || !isCurrent(file->first, file->second)) {
+        // It's been changed since it was indexed, so it may well be a
+        // different map now
+        std::string changed_name = map->second;
+        m_maps.erase(map);
+        m_files.erase(changed_name);
+        try {
+            add(changed_name);
+        } catch (std::runtime_error const &) {
+            // It's been deleted
+        }
+        save();
+        map = m_maps.find(digest + ":" + hash);
+        if (map == m_maps.end()) {
+            return false;
+        }
+    }
+    name = map->second;
+    return true;
+}
+
+void MapCache::add(std::string const & name) {
+    struct stat st;
+    if (stat((m_directory + "/" + name).c_str(), &st) != 0) {
+        throw std::runtime_error(
+            fmt::format("Couldn't stat \"{}\"", m_directory + "/" + name));
+    }
+    Entry & entry = m_files[name];
+    entry = Entry{(std::size_t)st.st_size, st.st_mtime, {}};
+    hashFile(name, entry, m_digests);
+}
+
+void MapCache::hashFile(std::string const & name, Entry & entry,
+                        std::set<std::string> const & digests) {
+    if (digests.empty()) {
+        return;
+    }
+    common::util::file::MappedFile file(m_directory + "/" + name);
+    for (auto const & digest : digests) {
+        entry.hashes[digest] =
+            common::util::digest::hash(digest, file.data(), file.size());
+        m_maps[digest + ":" + entry.hashes[digest]] = name;
+    }
+}
+
+void MapCache::save() const {
+    Json::object files;
+    for (auto const & file : m_files) {
+        Json::object hashes;
+        for (auto const & hash : file.second.hashes) {
+            hashes[hash.first] = hash.second;
+        }
+        files[file.first] = Json::object{
+            {"size", (double)file.second.size},
+            {"mtime", (double)file.second.mtime},
+            {"hashes", hashes},
+        };
+    }
+    Json::array digests(m_digests.begin(), m_digests.end());
+    Json index = Json::object{{"digests", digests}, {"files", files}};
+    // Write then rename so that a crash can't leave a truncated index
+    std::string temp_path = m_index_path + ".tmp";
+    std::ofstream file(temp_path, std::ios::out | std::ios::trunc);
+    file << index.dump();
+    file.close();
+    if (!file || std::rename(temp_path.c_str(), m_index_path.c_str()) != 0) {
+        fmt::print("Couldn't save the map index \"{}\"\n", m_index_path);
+    }
+}
+
+void MapCache::load() {
+    std::ifstream file(m_index_path, std::ios::in | std::ios::binary);
+    if (!file.is_open()) {
+        return;
+    }
+    std::vector<char> data = common::util::stream::readToEnd(file);
+    std::string error;
+    Json index = Json::parse(std::string(data.begin(), data.end()), error);
+    if (!error.empty()) {
+        // It'll be rebuilt from scratch
+        fmt::print("Ignoring corrupt map index \"{}\": {}\n", m_index_path,
+                   error);
+        return;
+    }
+    for (auto const & digest : index["digests"].array_items()) {
+        m_digests.insert(digest.string_value());
+    }
+    for (auto const & file : index["files"].object_items()) {
+        if (!isMapName(file.first)) {
+            continue;
+        }
+        Entry entry{(std::size_t)file.second["size"].number_value(),
+                    (std::time_t)file.second["mtime"].number_value(),
+                    {}};
+        for (auto const & digest : m_digests) {
+            Json const & hash = file.second["hashes"][digest];
+            if (!hash.is_string()) {
+                // Not fully indexed, so hash it again
+                entry.size = -1;
+                break;
+            }
+            entry.hashes[digest] = hash.string_value();
+        }
+        m_files[file.first] = entry;
+    }
+}
+
+bool MapCache::isCurrent(std::string const & name, Entry const & entry) const {
+    struct stat st;
+    return stat((m_directory + "/" + name).c_str(), &st) == 0 &&
+           (std::size_t)st.st_size == entry.size &&
+           st.st_mtime == entry.mtime;
+}
+
+} // namespace client
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <ctime>
+#include <cstddef>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+
+namespace client {
+
+/// An index of the maps the client has, by hash
+///
+/// Finding out whether the client has the map a server offers would mean
+/// hashing every map file. Instead the hashes, size and modification time of
+/// each map file are kept in an index file (`.index` in the maps directory)
+/// which is loaded at startup. A file is only hashed again if its size or
+/// modification time has changed since it was indexed, and looking up a hash
+/// is a single hash table lookup plus a stat(2) of the one file.
+///
+/// Servers may identify maps with any of the digests in
+/// common::util::digest. The first time a map is looked up by a digest the
+/// index hasn't seen before, every map is hashed with it once and from then
+/// on that digest is kept up to date along with the others.
+class MapCache {
+public:
+    /// Load the index for the maps in `directory`
+    ///
+    /// The index is brought up to date with the directory, hashing only files
+    /// which are new or have changed, and saved if anything changed.
+    MapCache(std::string const & directory);
+
+    /// Find a map by its hash
+    ///
+    /// @param digest The name of the digest the hash was made with.
+    /// @param hash The hash of the map.
+    /// @param name Set to the map's file name in the directory if it's found.
+    ///
+    /// @return Whether the map was found.
+    bool find(std::string const & digest, std::string const & hash,
+              std::string & name);
+
+    /// Index a map file, such as one that's just been downloaded
+    ///
+    /// @param name The map's file name in the directory.
+    void add(std::string const & name);
+
+    /// Write the index to disk
+    void save() const;
+
+private:
+    struct Entry {
+        std::size_t size;
+        std::time_t mtime;
+        /// Hashes by digest name
+        std::map<std::string, std::string> hashes;
+    };
+
+    std::string m_directory;
+    std::string m_index_path;
+    /// Digests every file has been hashed with
+    std::set<std::string> m_digests;
+    /// Indexed map files by name
+    std::unordered_map<std::string, Entry> m_files;
+    /// Names of indexed map files by digest name and hash
+    std::unordered_map<std::string, std::string> m_maps;
+
+    void load();
+
+    /// Hash a file with `digests` and index it under the new hashes
+    void hashFile(std::string const & name, Entry & entry,
+                  std::set<std::string> const & digests);
+
+    /// Check if an entry still describes the file on disk
+    bool isCurrent(std::string const & name, Entry const & entry) const;
+};
+
+} // namespace client
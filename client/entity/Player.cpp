@@ -1,6 +1,7 @@
 #include "Player.hpp"
 #include "gfx/drawingOperations.hpp"
 #include "Client.hpp"
+#include "common/net/input.hpp"
 
 namespace client {
 Player::Player(std::string username, float x, float y, float speed)
@@ -69,6 +70,21 @@ void Player::input() {
         }
     }
 
+    // The server runs the same movement on its copy of the player
+    using namespace net::input;
+    unsigned buttons = 0;
+    if (keys[SDL_SCANCODE_UP])
+        buttons |= Up;
+    if (keys[SDL_SCANCODE_DOWN])
+        buttons |= Down;
+    if (keys[SDL_SCANCODE_LEFT])
+        buttons |= Left;
+    if (keys[SDL_SCANCODE_RIGHT])
+        buttons |= Right;
+    if (keys[SDL_SCANCODE_SPACE])
+        buttons |= Fire;
+    Client::get().sendInput(buttons);
+
     // Check if they've pressed the arrow keys, and move them if they have.
     if (keys[SDL_SCANCODE_LEFT]) {
         moveLeft();
@@ -0,0 +1,182 @@
+#include "Connection.hpp"
+
+#include <cstdio>
+
+#include "common/util/fileutil.hpp"
+
+namespace client {
+
+using namespace json11;
+
+Connection::Connection(MapCache & maps, std::string const & directory,
+                       net::Framing framing)
+    : m_map_cache(maps), m_directory(directory), m_framing(framing) {}
+
+bool Connection::connect(std::string const & host, int port, bool wait) {
+    if (!m_socket.connectToHost(host, port, wait)) {
+        return false;
+    }
+    return !wait || m_socket.handshake(m_framing);
+}
+
+bool Connection::isConnecting() const { return m_socket.isConnecting(); }
+
+bool Connection::finishConnecting() {
+    return m_socket.finishConnecting() && m_socket.handshake(m_framing);
+}
+
+bool Connection::isOpen() const { return m_socket.isOpen(); }
+
+void Connection::readData() {
+    // The connection may have ended or an error may have occured, in which
+    // case there are no messages.
+    for (auto const & message : m_socket.readMessages()) {
+        handleMessage(std::get<0>(message), std::get<1>(message));
+    }
+    for (auto const & message : m_udp.readMessages()) {
+        handleMessage(std::get<0>(message), std::get<1>(message));
+    }
+}
+
+void Connection::handleMessage(net::MessageType const & type,
+                               Json const & entity) {
+    if (on_message) {
+        on_message(type, entity);
+    }
+    if (type == "disconnect") {
+        printf("Disconnected: %s\n", entity.string_value().c_str());
+    } else if (type == "map.offer") {
+        checkForMap(entity);
+    } else if (type == "map.chunk") {
+        receiveMapChunk(entity);
+    } else if (type == "net.udp") {
+        openUDP(entity);
+    } else if (type == "net.channel") {
+        sockaddr_in server = m_socket.getServerAddress();
+        server.sin_port = htons(m_udp_port);
+        m_udp.connect(server, entity.int_value());
+    } else if (type == "world.join") {
+        m_player_id = entity.int_value();
+    } else if (type == "world.snapshot") {
+        receiveSnapshot(entity);
+    } else if (type == "net.ping") {
+        m_socket.sendMessage("net.pong", entity);
+    }
+}
+
+bool Connection::send(net::MessageType const & type, Json const & entity) {
+    return m_socket.sendMessage(type, entity);
+}
+
+void Connection::openUDP(Json const & entity) {
+    m_udp_port = entity.int_value();
+    // Everything can go over TCP instead, so there's nothing to do if this
+    // fails
+    if (m_udp_port > 0 && m_udp.open()) {
+        m_socket.sendMessage("net.udp", m_udp.getPort());
+    }
+}
+
+void Connection::checkForMap(Json const & entity) {
+    using namespace common::util::file;
+    bool found_match = false;
+
+    // The offer is either just the MD5 hash or an object with the hash, the
+    // digest it was made with and maybe the map's name too
+    std::string hash = entity.is_string() ? entity.string_value()
+                                          : entity["hash"].string_value();
+    std::string digest = entity["digest"].is_string()
+                             ? entity["digest"].string_value()
+                             : "md5";
+    m_map_name = entity["name"].is_string()
+                     ? fileFromPath(entity["name"].string_value())
+                     : hash;
+
+    std::string level_name;
+    if (m_map_cache.find(digest, hash, level_name)) {
+        found_match = true;
+        if (on_map) {
+            on_map(level_name);
+        }
+    }
+
+    // Send to the server whether or not we have the map.
+    m_socket.sendMessage("has-map", Json::object{{"has-map", found_match}});
+
+    if (!found_match) {
+        // Ask for the map, carrying on from where any earlier attempt to
+        // download it got to
+        m_map_transfer.reset(
+            new MapTransfer(m_directory, digest, hash, m_framing));
+        m_socket.sendMessage(
+            "map.request",
+            Json::object{{"offset", (double)m_map_transfer->getOffset()}});
+    }
+}
+
+void Connection::receiveMapChunk(Json const & entity) {
+    if (!m_map_transfer) {
+        return;
+    }
+    switch (m_map_transfer->receive(entity)) {
+    case MapTransfer::Receiving:
+        break;
+    case MapTransfer::Resend:
+        m_socket.sendMessage(
+            "map.request",
+            Json::object{{"offset", (double)m_map_transfer->getOffset()}});
+        break;
+    case MapTransfer::Complete: {
+        // Received maps are named after their hash
+        std::string level_name = m_map_transfer->getHash();
+        m_map_cache.add(level_name);
+        m_map_cache.save();
+        m_map_transfer.reset();
+        if (on_map) {
+            on_map(level_name);
+        }
+        break;
+    }
+    }
+}
+
+void Connection::receiveSnapshot(Json const & entity) {
+    if (!m_world.receive(entity)) {
+        return;
+    }
+    Json tick = (double)m_world.getLatest()->tick;
+    if (m_udp.isConfirmed()) {
+        m_udp.sendMessage("world.ack", tick);
+    } else {
+        m_socket.sendMessage("world.ack", tick);
+    }
+}
+
+void Connection::sendInput(unsigned buttons) {
+    bool changed = buttons != m_input_buttons;
+    if (changed) {
+        m_input_buttons = buttons;
+        m_input_sequence++;
+    }
+    Json input =
+        Json::array{(double)m_input_sequence, (double)m_input_buttons};
+    // Sending over UDP every time also shows the server that datagrams get
+    // through. Until the server has sent one back they might not, so changes
+    // go over TCP too; the server ignores whichever copy arrives second.
+    m_udp.sendMessage("input", input);
+    if (changed && !m_udp.isConfirmed()) {
+        m_socket.sendMessage("input", input);
+    }
+}
+
+sys::TCPSocket & Connection::getSocket() { return m_socket; }
+
+sys::UDPSocket & Connection::getUDPSocket() { return m_udp; }
+
+std::string const & Connection::getMapName() const { return m_map_name; }
+
+std::uint32_t Connection::getPlayerId() const { return m_player_id; }
+
+SnapshotReceiver const & Connection::getWorld() const { return m_world; }
+
+} // namespace client
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "json11.hpp"
+#include "common/net/message.hpp"
+#include "common/net/wire.hpp"
+#include "MapCache.hpp"
+#include "net/MapTransfer.hpp"
+#include "net/SnapshotReceiver.hpp"
+#include "sys/TCPSocket.hpp"
+#include "sys/UDPSocket.hpp"
+
+namespace client {
+
+/// The client's side of the multiplayer protocol
+///
+/// Connects to a server, gets the map it offers from the MapCache or by
+/// downloading it, sets up the UDP channel, keeps up with the server's world
+/// from its snapshots and sends it the player's input. What to do with the
+/// map and the world is left to the owner, which is told about them through
+/// the callbacks below.
+///
+/// This doesn't depend on anything graphical so it can be used by headless
+/// clients too.
+class Connection {
+public:
+    typedef std::function<void(net::MessageType const &,
+                               json11::Json const &)> MessageHandler;
+    typedef std::function<void(std::string const &)> MapHandler;
+
+    /// @param maps The maps the client has
+    /// @param directory Where the maps are, and where new ones are saved
+    /// @param framing The framing to ask the server for
+    Connection(MapCache & maps, std::string const & directory,
+               net::Framing framing);
+
+    /// Called with every message received, before it's handled
+    MessageHandler on_message;
+    /// Called with the map's file name in the maps directory once the client
+    /// has the map the server offered
+    MapHandler on_map;
+
+    /// Connect to a server and perform the protocol handshake
+    ///
+    /// @param wait Whether to wait until the connection is made. If not, it's
+    ///        only started; call finishConnecting() once the socket is
+    ///        writable.
+    ///
+    /// @return Whether or not connecting (or starting to) was successful.
+    bool connect(std::string const & host, int port, bool wait = true);
+
+    /// Whether a connection started without waiting hasn't been finished
+    bool isConnecting() const;
+
+    /// Perform the handshake once a connection started without waiting has
+    /// been made
+    ///
+    /// @return Whether or not the connection was made.
+    bool finishConnecting();
+
+    /// Whether the TCP connection is still open
+    bool isOpen() const;
+
+    /// Read and handle every message received over TCP and UDP
+    void readData();
+
+    /// Handle a message from the server
+    void handleMessage(net::MessageType const & type,
+                       json11::Json const & entity);
+
+    /// Send a message to the server over TCP
+    bool send(net::MessageType const & type, json11::Json const & entity);
+
+    /// Tell the server which buttons the player is holding
+    ///
+    /// The server keeps applying them until told otherwise, so over TCP an
+    /// `input` message is only sent when they change. Over UDP one is sent
+    /// every time, as any of them could be lost.
+    ///
+    /// @param buttons A bit set of net::input::Button
+    void sendInput(unsigned buttons);
+
+    sys::TCPSocket & getSocket();
+    sys::UDPSocket & getUDPSocket();
+
+    /// The name of the map the server offered, or its hash if it didn't say
+    std::string const & getMapName() const;
+
+    /// ID of the player in the server's world, 0 until it's joined
+    std::uint32_t getPlayerId() const;
+
+    /// The server's world
+    SnapshotReceiver const & getWorld() const;
+
+private:
+    Connection(Connection const &) = delete;
+    Connection & operator=(Connection const &) = delete;
+
+    /// Set up the UDP channel
+    ///
+    /// @param entity The `net.udp` message entity; the server's UDP port
+    void openUDP(json11::Json const & entity);
+    /// Check if the client has the map the server has
+    ///
+    /// @param entity The `map.offer` message entity
+    void checkForMap(json11::Json const & entity);
+    /// Handle a chunk of the map the server is sending
+    ///
+    /// @param entity The `map.chunk` message entity
+    void receiveMapChunk(json11::Json const & entity);
+    /// Handle a snapshot of the server's world
+    ///
+    /// @param entity The `world.snapshot` message entity
+    void receiveSnapshot(json11::Json const & entity);
+
+    MapCache & m_map_cache;
+    std::string m_directory;
+    net::Framing m_framing;
+    sys::TCPSocket m_socket;
+    sys::UDPSocket m_udp;
+    /// The server's UDP port, 0 until it's said
+    int m_udp_port = 0;
+    std::string m_map_name;
+    /// The map being received from the server, if any
+    std::unique_ptr<MapTransfer> m_map_transfer;
+    SnapshotReceiver m_world;
+    std::uint32_t m_player_id = 0;
+    /// Buttons in the last `input` message sent
+    unsigned m_input_buttons = 0;
+    /// Sequence number of the last `input` message sent
+    unsigned m_input_sequence = 0;
+};
+
+} // namespace client
@@ -0,0 +1,111 @@
+#include "MapTransfer.hpp"
+
+#include <cstdio>
+#include <stdexcept>
+
+#include <format.h>
+#include <unistd.h>
+
+#include "common/util/base64.hpp"
+#include "common/util/mappedfile.hpp"
+
+namespace client {
+
+MapTransfer::MapTransfer(std::string const & directory,
+                         std::string const & digest, std::string const & hash,
+                         net::Framing framing)
+    : m_digest(common::util::digest::create(digest)), m_hash(hash),
+      m_path(directory + "/" + hash), m_part_path(m_path + ".part"),
+      m_framing(framing), m_offset(0) {
+    if (!m_digest) {
+        throw std::runtime_error(fmt::format("Unknown digest \"{}\"", digest));
+    }
+    // Pick up where an earlier transfer left off, if there was one
+    m_part.open(m_part_path,
+                std::ios::in | std::ios::out | std::ios::binary);
+    if (m_part.is_open()) {
+        m_part.seekg(0, std::ios::end);
+        m_offset = m_part.tellg();
+    } else {
+        m_part.open(m_part_path, std::ios::in | std::ios::out |
+                                     std::ios::binary | std::ios::trunc);
+    }
+    if (!m_part.is_open()) {
+        throw std::runtime_error(
+            fmt::format("Couldn't open \"{}\" for writing", m_part_path));
+    }
+}
+
+std::size_t MapTransfer::getOffset() const { return m_offset; }
+
+std::string const & MapTransfer::getHash() const { return m_hash; }
+
+std::string const & MapTransfer::getPath() const { return m_path; }
+
+MapTransfer::Status MapTransfer::receive(json11::Json const & chunk) {
+    auto const & items = chunk.array_items();
+    if (items.size() != 4 || !items[3].is_string()) {
+        return Resend;
+    }
+    std::size_t offset = items[0].number_value();
+    std::size_t size = items[1].number_value();
+    std::string data;
+    if (m_framing == net::Framing::Binary) {
+        data = items[3].string_value();
+    } else if (!common::util::base64::decode(items[3].string_value(), data)) {
+        return Resend;
+    }
+    if (offset > m_offset) {
+        // Something before this chunk is missing and has been asked for
+        // again
+        return Receiving;
+    }
+    m_digest->reset();
+    m_digest->add(data.data(), data.size());
+    if (m_digest->getHash() != items[2].string_value() ||
+        offset + data.size() > size) {
+        return Resend;
+    }
+    // A resumed transfer starts from the beginning of a chunk, so the start
+    // of it may already have been received. Writing it again is harmless.
+    m_part.seekp(offset);
+    m_part.write(data.data(), data.size());
+    if (offset + data.size() > m_offset) {
+        m_offset = offset + data.size();
+    }
+    if (m_offset == size) {
+        return finish(size);
+    }
+    return Receiving;
+}
+
+MapTransfer::Status MapTransfer::finish(std::size_t size) {
+    m_part.close();
+    // Whatever was there before may have been longer than the map
+    if (truncate(m_part_path.c_str(), size) != 0) {
+        throw std::runtime_error(
+            fmt::format("Couldn't truncate \"{}\"", m_part_path));
+    }
+    bool matches;
+    {
+        common::util::file::MappedFile file(m_part_path);
+        m_digest->reset();
+        m_digest->add(file.data(), file.size());
+        matches = m_digest->getHash() == m_hash;
+    }
+    if (!matches) {
+        // No telling which chunk was wrong, so start again
+        m_offset = 0;
+        m_part.open(m_part_path, std::ios::in | std::ios::out |
+                                     std::ios::binary | std::ios::trunc);
+        return Resend;
+    }
+    if (std::rename(m_part_path.c_str(), m_path.c_str()) != 0) {
+        throw std::runtime_error(
+            fmt::format("Couldn't move \"{}\" to \"{}\"", m_part_path,
+                        m_path));
+    }
+    return Complete;
+}
+
+} // namespace client
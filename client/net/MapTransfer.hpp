@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <fstream>
+#include <memory>
+#include <string>
+
+#include "json11.hpp"
+#include "common/net/wire.hpp"
+#include "common/util/digest.hpp"
+
+namespace client {
+
+/// Receives a map from the server as `map.chunk` messages
+///
+/// Chunks are written to `<directory>/<hash>.part` as they arrive, so if the
+/// connection drops the transfer can be resumed from where it got to by
+/// requesting the map from getOffset() again. Once the whole map has arrived
+/// and its hash checked it's moved to `<directory>/<hash>`.
+///
+/// Each chunk is an array of its offset in the map, the size of the whole
+/// map, the checksum of its bytes and then the bytes themselves
+/// (Base64-encoded with the JSON framing, raw with the binary framing). The
+/// map and chunks are hashed with the digest the server offered the map with.
+class MapTransfer {
+public:
+    enum Status {
+        /// The chunk was stored or skipped; more chunks are needed
+        Receiving,
+        /// A chunk was corrupt, so the map has to be requested again from
+        /// getOffset(). Chunks are skipped until the one at that offset
+        /// arrives.
+        Resend,
+        /// The whole map has been received and checked
+        Complete,
+    };
+
+    /// @param directory Where maps are stored
+    /// @param digest The name of the digest the map and chunks are hashed with
+    /// @param hash The hash of the map being received
+    /// @param framing The framing the chunks are received with
+    ///
+    /// Throws std::runtime_error if the digest isn't known.
+    MapTransfer(std::string const & directory, std::string const & digest,
+                std::string const & hash, net::Framing framing);
+
+    /// Offset the map should be requested from
+    ///
+    /// For a new transfer this is zero. If a previous transfer of the same
+    /// map was interrupted it's how much of the map was received.
+    std::size_t getOffset() const;
+
+    /// The hash of the map being received
+    std::string const & getHash() const;
+
+    /// Path the map will be at once complete
+    std::string const & getPath() const;
+
+    /// Handle a `map.chunk` message entity
+    Status receive(json11::Json const & chunk);
+
+private:
+    std::unique_ptr<common::util::digest::Digest> m_digest;
+    std::string m_hash;
+    std::string m_path;
+    std::string m_part_path;
+    net::Framing m_framing;
+    std::fstream m_part;
+    /// Everything before this has been received
+    std::size_t m_offset;
+
+    /// Check the hash of the received map and move it into place
+    Status finish(std::size_t size);
+};
+
+} // namespace client
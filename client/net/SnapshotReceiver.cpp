@@ -0,0 +1,36 @@
+#include "SnapshotReceiver.hpp"
+
+#include <memory>
+
+namespace client {
+
+using namespace net::snapshot;
+
+bool SnapshotReceiver::receive(json11::Json const & entity) {
+    Snapshot const * latest = m_snapshots.latest();
+    if (latest && (std::uint64_t)entity[0].number_value() <= latest->tick) {
+        return false;
+    }
+    std::uint64_t baseline_tick = baselineTick(entity);
+    Snapshot const * baseline = nullptr;
+    if (baseline_tick != 0) {
+        baseline = m_snapshots.find(baseline_tick);
+        if (baseline == nullptr) {
+            return false;
+        }
+    }
+    auto snapshot = std::make_shared<Snapshot>();
+    if (!decode(entity, baseline, *snapshot)) {
+        return false;
+    }
+    m_snapshots.push(snapshot);
+    return true;
+}
+
+Snapshot const * SnapshotReceiver::getLatest() const {
+    return m_snapshots.latest();
+}
+
+void SnapshotReceiver::reset() { m_snapshots.clear(); }
+
+} // namespace client
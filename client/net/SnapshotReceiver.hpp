@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+
+#include "json11.hpp"
+#include "common/net/snapshot.hpp"
+
+namespace client {
+
+/// Rebuilds the server's world from `world.snapshot` messages
+///
+/// Each snapshot is decoded against the baseline it was encoded relative to,
+/// which is looked up among the snapshots received recently. Every snapshot
+/// decoded should be acknowledged to the server with a `world.ack` message
+/// so that it can be used as the baseline for later ones (see
+/// net::snapshot).
+class SnapshotReceiver {
+public:
+    /// Decode a `world.snapshot` message entity
+    ///
+    /// Snapshots which aren't newer than the latest one are stale and
+    /// ignored, as are those whose baseline is no longer known.
+    ///
+    /// Returns true if the snapshot was decoded and should be acknowledged.
+    bool receive(json11::Json const & entity);
+
+    /// The latest snapshot received, or nullptr if there hasn't been one
+    net::snapshot::Snapshot const * getLatest() const;
+
+    /// Forget all the snapshots received, e.g. after reconnecting
+    void reset();
+
+private:
+    net::snapshot::SnapshotRing m_snapshots;
+};
+} // namespace client
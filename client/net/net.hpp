@@ -1,8 +0,0 @@
-#pragma once
-
-namespace client {
-namespace net {
-std::string MAGIC_NUMBER = "\xCA\xC3\x55\x01";
-
-} // namespace net
-} // namespace client
@@ -16,25 +16,43 @@ namespace client {
 namespace sys {
 using fmt::print;
 
-bool TCPSocket::connectToHost(std::string host, int portnum) {
+bool TCPSocket::connectToHost(std::string host, int portnum, bool wait) {
     if ((m_socket = socket(PF_INET, SOCK_STREAM, 0)) < 0) {
         print(stderr, "[ERROR] Could not open socket: {}\n", strerror(errno));
         return false;
     }
+    net::ignoreSigPipe(m_socket);
 
-    memset(&m_address, 0, sizeof m_address);
-    m_address.sin_port = htons(portnum);
-
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
     struct addrinfo *result;
     int error;
 
-    if ((error = getaddrinfo(host.c_str(), NULL, NULL, &result))) {
+    if ((error = getaddrinfo(host.c_str(), NULL, &hints, &result))) {
         print(stderr, "[ERROR] Could not resolve domain name: {}\n",
               gai_strerror(error));
+        ::close(m_socket);
         return false;
     }
 
-    if (connect(m_socket, (struct sockaddr*)&m_address, sizeof m_address) < 0) {
+    // The server's address is kept for sending it datagrams later
+    memcpy(&m_server, result->ai_addr, sizeof m_server);
+    freeaddrinfo(result);
+    m_server.sin_port = htons(portnum);
+    m_address = m_server;
+
+    if (!wait) {
+        fcntl(m_socket, F_SETFL, O_NONBLOCK);
+    }
+
+    if (connect(m_socket, (struct sockaddr*)&m_server, sizeof m_server) < 0) {
+        if (!wait && errno == EINPROGRESS) {
+            m_open = true;
+            m_connecting = true;
+            return true;
+        }
         print(stderr, "[ERROR] Could not connect to host: {}\n",
               strerror(errno));
         ::close(m_socket);
@@ -49,6 +67,31 @@ bool TCPSocket::connectToHost(std::string host, int portnum) {
     return true;
 }
 
+bool TCPSocket::isConnecting() const { return m_connecting; }
+
+bool TCPSocket::finishConnecting() {
+    if (!m_open) {
+        return false;
+    }
+    m_connecting = false;
+    int error = 0;
+    socklen_t size = sizeof error;
+    if (getsockopt(m_socket, SOL_SOCKET, SO_ERROR, &error, &size) < 0) {
+        error = errno;
+    }
+    if (error != 0) {
+        print(stderr, "[ERROR] Could not connect to host: {}\n",
+              strerror(error));
+        close();
+        return false;
+    }
+    return true;
+}
+
+Socket TCPSocket::getSocket() const { return m_socket; }
+
+bool TCPSocket::isOpen() const { return m_open; }
+
 std::string TCPSocket::read() {
     if (!m_open) {
         return std::string();
@@ -75,15 +118,70 @@ bool TCPSocket::send(const void * buf, size_t len) {
     if (!m_open || buf == NULL)
         return false;
 
+    auto data = static_cast<char const *>(buf);
     size_t total_bytes_sent = 0;
 
     // Keep sending until we've sent all the data.
     while (total_bytes_sent < len) {
-        total_bytes_sent += write(m_socket, buf, len);
+        ssize_t bytes_sent = ::send(m_socket, data + total_bytes_sent,
+                                    len - total_bytes_sent, net::SEND_FLAGS);
+        if (bytes_sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                continue;
+            }
+            close();
+            return false;
+        }
+        total_bytes_sent += bytes_sent;
     }
     return true;
 }
 
+bool TCPSocket::handshake(Framing framing) {
+    m_framer.setFraming(framing);
+    std::string magic = magicNumber(framing);
+    return send(magic.data(), magic.size());
+}
+
+bool TCPSocket::sendMessage(MessageType const & type,
+                            MessageEntity const & entity) {
+    std::string encoded;
+    encodeMessage(m_framer.getFraming(), type, entity, encoded);
+    return send(encoded.data(), encoded.size());
+}
+
+std::vector<Message> TCPSocket::readMessages() {
+    std::vector<Message> messages;
+    if (!m_open) {
+        return messages;
+    }
+    for (;;) {
+        ssize_t bytes_recv = ::read(m_socket, m_framer.prepare(8192), 8192);
+        if (bytes_recv > 0) {
+            m_framer.commit(bytes_recv);
+            continue;
+        }
+        if (bytes_recv < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_recv == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            close();
+        }
+        break;
+    }
+    MessageType type;
+    MessageEntity entity;
+    std::string error;
+    while (m_framer.next(type, entity, error)) {
+        if (!error.empty()) {
+            print(stderr, "[ERROR] Server sent a bad message: {}\n", error);
+            continue;
+        }
+        messages.emplace_back(std::move(type), std::move(entity));
+    }
+    return messages;
+}
+
 sockaddr_in TCPSocket::getServerAddress() { return m_server; }
 
 std::string TCPSocket::getFormattedServerAddr() {
@@ -101,6 +199,7 @@ void TCPSocket::close() {
     if (m_open) {
         ::close(m_socket);
         m_open = false;
+        m_connecting = false;
     }
 }
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -9,7 +10,9 @@
 
 #include <unistd.h>
 
+#include "common/net/framer.hpp"
 #include "common/net/message.hpp"
+#include "common/net/wire.hpp"
 
 using namespace net;
 
@@ -18,15 +21,39 @@ using namespace net;
 namespace client {
 namespace sys {
 /// A TCPSocket object one can use to send and receive data.
+///
+/// As well as raw data, the socket can send and receive messages once the
+/// protocol handshake has been performed with `handshake`. These are encoded
+/// with whichever `Framing` the handshake asked for.
 class TCPSocket {
 public:
     /// Connect to a host.
     ///
     /// @param host The host name of the server.
     /// @param portnum The port number.
+    /// @param wait Whether to wait until the connection is made. If not, the
+    ///        connection is only started and isConnecting() is true until
+    ///        finishConnecting() is called.
     ///
     /// @return Whether or not connecting to the host was successful.
-    bool connectToHost(std::string host, int portnum);
+    bool connectToHost(std::string host, int portnum, bool wait = true);
+
+    /// Whether a connection started without waiting hasn't been finished
+    bool isConnecting() const;
+
+    /// Find out whether a connection started without waiting was made
+    ///
+    /// Call this once the socket is writable. If the connection failed the
+    /// socket is closed.
+    ///
+    /// @return Whether or not the connection was made.
+    bool finishConnecting();
+
+    /// The socket's file descriptor, e.g. to wait for it with poll(2)
+    Socket getSocket() const;
+
+    /// Whether the socket is open; it's closed if the connection ends
+    bool isOpen() const;
     /// Receive data from the host.
     ///
     /// @return Received data.
@@ -53,6 +80,28 @@ public:
     bool send(T const & data) {
         return send(&data, sizeof(T));
     }
+    /// Perform the protocol handshake.
+    ///
+    /// Sends the magic number asking the server to use `framing`. Messages
+    /// sent and received afterwards by sendMessage() and readMessages() are
+    /// encoded with it.
+    ///
+    /// @return If sending the magic number was successful.
+    bool handshake(Framing framing);
+    /// Send a message to the host.
+    ///
+    /// @param type The message type.
+    /// @param entity The message entity.
+    ///
+    /// @return If the sending was successful.
+    bool sendMessage(MessageType const & type, MessageEntity const & entity);
+    /// Receive messages from the host.
+    ///
+    /// Reads everything available on the socket without blocking.
+    ///
+    /// @return All the complete messages received. Partially received
+    ///         messages are kept until the rest of them arrives.
+    std::vector<Message> readMessages();
     /// Close the socket.
     void close();
     /// Close the socket when destroyed.
@@ -71,6 +120,10 @@ private:
     sockaddr_in m_address;
     // Whether it is open or not.
     bool m_open = false;
+    // Whether the connection is still being made.
+    bool m_connecting = false;
+    // Received data that hasn't been decoded into messages yet.
+    Framer m_framer;
 };
 
 } // namespace sys
@@ -0,0 +1,122 @@
+#include "UDPSocket.hpp"
+
+#include <format.h>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+
+namespace client {
+namespace sys {
+using fmt::print;
+using namespace net;
+
+bool UDPSocket::open() {
+    close();
+    m_socket = socket(PF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (m_socket < 0) {
+        print(stderr, "[ERROR] Could not open UDP socket: {}\n",
+              strerror(errno));
+        return false;
+    }
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof address);
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    socklen_t size = sizeof address;
+    if (bind(m_socket, (struct sockaddr *)&address, sizeof address) < 0 ||
+        getsockname(m_socket, (struct sockaddr *)&address, &size) < 0) {
+        print(stderr, "[ERROR] Could not bind UDP socket: {}\n",
+              strerror(errno));
+        close();
+        return false;
+    }
+    m_port = ntohs(address.sin_port);
+    return true;
+}
+
+int UDPSocket::getPort() const { return m_port; }
+
+void UDPSocket::connect(sockaddr_in server, std::uint32_t channel) {
+    if (m_socket < 0) {
+        return;
+    }
+    // Connecting means only the server's datagrams are received
+    if (::connect(m_socket, (struct sockaddr *)&server, sizeof server) < 0) {
+        print(stderr, "[ERROR] Could not connect UDP socket: {}\n",
+              strerror(errno));
+        return;
+    }
+    m_channel = channel;
+    m_connected = true;
+    m_received = false;
+}
+
+bool UDPSocket::isConnected() const { return m_connected; }
+
+bool UDPSocket::isConfirmed() const { return m_connected && m_received; }
+
+Socket UDPSocket::getSocket() const { return m_socket; }
+
+bool UDPSocket::sendMessage(MessageType const & type,
+                            MessageEntity const & entity) {
+    if (!m_connected) {
+        return false;
+    }
+    std::string encoded =
+        datagram::encode(m_channel, ++m_sent_sequence, type, entity);
+    return ::send(m_socket, encoded.data(), encoded.size(), SEND_FLAGS) ==
+           (ssize_t)encoded.size();
+}
+
+std::vector<Message> UDPSocket::readMessages() {
+    std::vector<Message> messages;
+    if (!m_connected) {
+        return messages;
+    }
+    char buffer[datagram::MAX_SIZE];
+    for (;;) {
+        ssize_t size = ::recv(m_socket, buffer, sizeof buffer, 0);
+        if (size < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Earlier datagrams being refused is reported here too, but
+            // doesn't stop later ones arriving
+            if (errno == ECONNREFUSED) {
+                continue;
+            }
+            break;
+        }
+        std::uint32_t channel;
+        std::uint32_t sequence;
+        MessageType type;
+        MessageEntity entity;
+        std::string error;
+        if (!datagram::decode(buffer, size, channel, sequence, type, entity,
+                              error) ||
+            channel != m_channel ||
+            (m_received && !datagram::isNewer(sequence, m_received_sequence))) {
+            continue;
+        }
+        m_received_sequence = sequence;
+        m_received = true;
+        messages.emplace_back(std::move(type), std::move(entity));
+    }
+    return messages;
+}
+
+void UDPSocket::close() {
+    if (m_socket >= 0) {
+        ::close(m_socket);
+        m_socket = -1;
+    }
+    m_connected = false;
+}
+
+UDPSocket::~UDPSocket() { close(); }
+} // namespace sys
+} // namespace client
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <netinet/in.h>
+
+#include "common/net/datagram.hpp"
+#include "common/net/message.hpp"
+
+namespace client {
+namespace sys {
+/// A UDP socket for exchanging unreliable messages with the server
+///
+/// Messages are sent in datagrams marked with the channel the server gave
+/// the client and a sequence number (see net::datagram). Datagrams which
+/// arrive out of order or twice are dropped, so only the newest message
+/// received is ever returned. Only messages where a newer one supersedes
+/// older ones should be sent like this.
+class UDPSocket {
+public:
+    /// Open the socket on an ephemeral port
+    ///
+    /// @return Whether or not opening the socket was successful.
+    bool open();
+    /// The local port the socket is bound to, to tell the server
+    int getPort() const;
+    /// Start exchanging messages with the server
+    ///
+    /// @param server The server's UDP address.
+    /// @param channel The channel the server gave the client.
+    void connect(sockaddr_in server, std::uint32_t channel);
+    /// Whether or not messages can be sent
+    bool isConnected() const;
+
+    /// The socket's file descriptor, or -1 if it isn't open
+    net::Socket getSocket() const;
+    /// Whether or not a message has been received from the server
+    ///
+    /// Until then there's no knowing if datagrams can get through at all, so
+    /// anything that matters should be sent over TCP as well.
+    bool isConfirmed() const;
+    /// Send a message to the server.
+    ///
+    /// @param type The message type.
+    /// @param entity The message entity.
+    ///
+    /// @return If the message was sent. It may still never arrive.
+    bool sendMessage(net::MessageType const & type,
+                     net::MessageEntity const & entity);
+    /// Receive messages from the server.
+    ///
+    /// Reads everything available on the socket without blocking.
+    std::vector<net::Message> readMessages();
+    /// Close the socket.
+    void close();
+    /// Close the socket when destroyed.
+    ~UDPSocket();
+
+private:
+    net::Socket m_socket = -1;
+    int m_port = 0;
+    bool m_connected = false;
+    std::uint32_t m_channel = 0;
+    // Sequence numbers of the last datagrams sent and received
+    std::uint32_t m_sent_sequence = 0;
+    std::uint32_t m_received_sequence = 0;
+    bool m_received = false;
+};
+
+} // namespace sys
+} // namespace client
@@ -1,8 +1,302 @@
 #include "Logger.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 namespace common {
+
+namespace {
+
+/// How long the background thread sleeps when there's nothing to write
+std::chrono::milliseconds const POLL_INTERVAL(5);
+
+/// Heads each message in a ring buffer
+struct RecordHeader {
+    /// Where the message goes; null for padding up to the end of the ring
+    FILE * fd;
+    std::size_t size;
+};
+
+std::size_t const RECORD_ALIGNMENT = sizeof(RecordHeader);
+
+std::size_t recordSize(std::size_t text_size) {
+    std::size_t size = sizeof(RecordHeader) + text_size;
+    return (size + RECORD_ALIGNMENT - 1) & ~(RECORD_ALIGNMENT - 1);
+}
+
+/// A ring buffer of messages from one thread to the background thread
+///
+/// This is a single producer, single consumer queue of variable length
+/// records, so neither side ever takes a lock. Positions only ever increase
+/// and are masked to index the buffer. A record never wraps around the end
+/// of the buffer; if one doesn't fit before the end then the space left is
+/// filled with padding and it goes at the start.
+struct Ring {
+    explicit Ring(std::size_t capacity)
+        : buffer(capacity), head(0), tail(0), dropped(0), abandoned(false) {}
+
+    /// Called by the owning thread
+    void push(FILE * fd, char const * data, std::size_t size) {
+        std::size_t capacity = buffer.size();
+        // Leave room for padding so a huge message still fits eventually
+        size = std::min(size, capacity / 2 - sizeof(RecordHeader));
+        std::size_t needed = recordSize(size);
+        std::size_t position = tail.load(std::memory_order_relaxed);
+        std::size_t offset = position & (capacity - 1);
+        std::size_t padding = capacity - offset < needed ? capacity - offset
+                                                         : 0;
+        if (capacity - (position - head.load(std::memory_order_acquire)) <
+            padding + needed) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        if (padding != 0) {
+            RecordHeader header{nullptr, padding - sizeof(RecordHeader)};
+            std::memcpy(&buffer[offset], &header, sizeof header);
+            position += padding;
+            offset = 0;
+        }
+        RecordHeader header{fd, size};
+        std::memcpy(&buffer[offset], &header, sizeof header);
+        std::memcpy(&buffer[offset + sizeof header], data, size);
+        tail.store(position + needed, std::memory_order_release);
+    }
+
+    /// Called by the background thread
+    ///
+    /// Returns false if there was nothing to write.
+    bool drain() {
+        std::size_t position = head.load(std::memory_order_relaxed);
+        std::size_t end = tail.load(std::memory_order_acquire);
+        if (position == end) {
+            return false;
+        }
+        while (position != end) {
+            RecordHeader header;
+            char const * record = &buffer[position & (buffer.size() - 1)];
+            std::memcpy(&header, record, sizeof header);
+            if (header.fd != nullptr) {
+                fwrite(record + sizeof header, 1, header.size, header.fd);
+            }
+            position += recordSize(header.size);
+        }
+        head.store(position, std::memory_order_release);
+        return true;
+    }
+
+    std::vector<char> buffer;
+    /// Position of the oldest record; only written by the background thread
+    std::atomic<std::size_t> head;
+    /// Keeps the two positions off the same cache line, so each side's
+    /// writes don't slow down the other
+    char separator[64];
+    /// Position after the newest record; only written by the owning thread
+    std::atomic<std::size_t> tail;
+    std::atomic<std::uint64_t> dropped;
+    /// Set once the owning thread has exited
+    std::atomic<bool> abandoned;
+};
+
+/// The background thread and the ring buffers it drains
+struct Backend {
+    explicit Backend(std::size_t ring_size)
+        : ring_size(ring_size), running(true), dropped(0), reported(0) {}
+
+    /// Write out everything in the rings; returns false if there was nothing
+    bool drain() {
+        std::vector<std::shared_ptr<Ring>> current;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            current = rings;
+        }
+        bool wrote = false;
+        std::uint64_t total_dropped = 0;
+        for (auto & ring : current) {
+            wrote = ring->drain() || wrote;
+            total_dropped += ring->dropped.load(std::memory_order_relaxed);
+        }
+        if (total_dropped != reported) {
+            fmt::print(stderr, "LOGGER: [WARNING]  {} messages dropped\n",
+                       total_dropped - reported);
+            reported = total_dropped;
+        }
+        if (wrote) {
+            fflush(nullptr);
+        }
+        return wrote;
+    }
+
+    void run() {
+        while (running.load(std::memory_order_acquire)) {
+            if (!drain()) {
+                std::this_thread::sleep_for(POLL_INTERVAL);
+            }
+            forgetAbandoned();
+        }
+        drain();
+    }
+
+    /// Free the rings of threads which have exited once they're empty
+    void forgetAbandoned() {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (std::size_t i = 0; i < rings.size();) {
+            Ring & ring = *rings[i];
+            if (ring.abandoned.load(std::memory_order_acquire) &&
+                ring.head.load(std::memory_order_relaxed) ==
+                    ring.tail.load(std::memory_order_acquire)) {
+                dropped += ring.dropped.load(std::memory_order_relaxed);
+                reported -= ring.dropped.load(std::memory_order_relaxed);
+                rings[i] = rings.back();
+                rings.pop_back();
+            } else {
+                i++;
+            }
+        }
+    }
+
+    std::size_t ring_size;
+    std::atomic<bool> running;
+    std::thread thread;
+    /// Guards `rings`, which only changes when a thread first logs
+    std::mutex mutex;
+    std::vector<std::shared_ptr<Ring>> rings;
+    /// Messages dropped by the rings of exited threads
+    std::atomic<std::uint64_t> dropped;
+    /// Messages dropped by the current rings as of the last report
+    std::uint64_t reported;
+};
+
+std::atomic<int> g_level((int)LogLevel::Info);
+std::atomic<Backend *> g_backend(nullptr);
+/// Bumped whenever a backend starts, so threads notice their ring is stale
+std::atomic<unsigned> g_generation(0);
+std::atomic<std::uint64_t> g_dropped(0);
+
+/// The calling thread's ring, which is abandoned when the thread exits
+struct ThreadRing {
+    ThreadRing() : generation(0) {}
+    ~ThreadRing() {
+        if (ring) {
+            ring->abandoned.store(true, std::memory_order_release);
+        }
+    }
+
+    std::shared_ptr<Ring> ring;
+    unsigned generation;
+};
+
+thread_local ThreadRing t_ring;
+
+Ring & getRing(Backend & backend) {
+    unsigned generation = g_generation.load(std::memory_order_acquire);
+    if (!t_ring.ring || t_ring.generation != generation) {
+        t_ring.ring = std::make_shared<Ring>(backend.ring_size);
+        t_ring.generation = generation;
+        std::lock_guard<std::mutex> lock(backend.mutex);
+        backend.rings.push_back(t_ring.ring);
+    }
+    return *t_ring.ring;
+}
+
+void stopAtExit() { Logger::stopAsync(); }
+
+} // Anonymous namespace
+
 Logger::Logger(FILE * fd, std::function<std::string()> prefix)
-    : m_fd(fd), m_prefix(prefix) {}
+    : m_fd(fd), m_prefix(prefix), m_prefix_cached(false) {}
+
+void Logger::setLevel(LogLevel level) {
+    g_level.store((int)level, std::memory_order_relaxed);
+}
+
+bool Logger::isEnabled(LogLevel level) {
+    return (int)level >= g_level.load(std::memory_order_relaxed);
+}
+
+void Logger::startAsync(std::size_t ring_size) {
+    if (g_backend.load() != nullptr) {
+        return;
+    }
+    std::size_t capacity = 256;
+    while (capacity < ring_size) {
+        capacity *= 2;
+    }
+    Backend * backend = new Backend(capacity);
+    g_generation++;
+    backend->thread = std::thread([backend] { backend->run(); });
+    g_backend.store(backend, std::memory_order_release);
+    static bool registered = false;
+    if (!registered) {
+        std::atexit(stopAtExit);
+        registered = true;
+    }
+}
+
+void Logger::stopAsync() {
+    Backend * backend = g_backend.exchange(nullptr);
+    if (backend == nullptr) {
+        return;
+    }
+    backend->running.store(false, std::memory_order_release);
+    backend->thread.join();
+    std::uint64_t dropped = backend->dropped;
+    for (auto & ring : backend->rings) {
+        dropped += ring->dropped.load(std::memory_order_relaxed);
+    }
+    g_dropped += dropped;
+    delete backend;
+}
+
+std::uint64_t Logger::getDropped() {
+    std::uint64_t dropped = g_dropped.load();
+    Backend * backend = g_backend.load(std::memory_order_acquire);
+    if (backend != nullptr) {
+        dropped += backend->dropped.load();
+        std::lock_guard<std::mutex> lock(backend->mutex);
+        for (auto & ring : backend->rings) {
+            dropped += ring->dropped.load(std::memory_order_relaxed);
+        }
+    }
+    return dropped;
+}
 
 std::string Logger::no_prefix() { return std::string(); }
+
+char const * Logger::getTag(LogLevel level) {
+    switch (level) {
+    case LogLevel::Debug:
+        return "[DEBUG] ";
+    case LogLevel::Info:
+        return "[INFO] ";
+    case LogLevel::Warning:
+        return "[WARNING]  ";
+    case LogLevel::Error:
+        return "[ERR]  ";
+    }
+    return "";
+}
+
+std::string const & Logger::getPrefix() {
+    if (!m_prefix_cached) {
+        m_prefix_text = m_prefix();
+        m_prefix_cached = true;
+    }
+    return m_prefix_text;
+}
+
+void Logger::write(char const * data, std::size_t size) {
+    Backend * backend = g_backend.load(std::memory_order_acquire);
+    if (backend == nullptr) {
+        fwrite(data, 1, size, m_fd);
+        return;
+    }
+    getRing(*backend).push(m_fd, data, size);
+}
 } // namespace common
@@ -1,23 +1,88 @@
 #pragma once
 
 #include <format.h>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <string>
 
 namespace common {
 
+/// How important a log message is
+enum class LogLevel { Debug, Info, Warning, Error };
+
+/// Writes log messages, each starting with the logger's prefix
+///
+/// By default messages are written straight to the logger's file. Once
+/// startAsync() has been called they're instead formatted into a ring buffer
+/// belonging to the calling thread and written out by a background thread,
+/// so logging never waits on the file. If a thread's ring buffer is full its
+/// messages are dropped and counted, rather than the thread waiting; see
+/// getDropped().
+///
+/// Messages below the level set by setLevel() are discarded before they're
+/// formatted, so leaving debug logging in hot code costs next to nothing.
 class Logger {
 public:
+    /// The prefix is only worked out once, the first time something is
+    /// logged, so it mustn't change after that
     Logger(FILE * fd = stderr, std::function<std::string()> prefix = no_prefix);
+
     template <typename... Args>
     /// Prints out formatted text with a prefix to `m_fd`
     ///        (file descriptor)
     void log(std::string const & format, Args... args) {
-        fmt::print(m_fd, "{}{}\n", m_prefix(), fmt::format(format, args...));
+        if (isEnabled(LogLevel::Info)) {
+            fmt::Writer writer;
+            writer << getPrefix();
+            writer.write(format, args...);
+            writer << '\n';
+            write(writer.data(), writer.size());
+        }
+    }
+
+    /// Log a message tagged with its level, unless the level is disabled
+    template <typename... Args>
+    void log(LogLevel level, std::string const & format, Args... args) {
+        if (isEnabled(level)) {
+            fmt::Writer writer;
+            writer << getPrefix() << getTag(level);
+            writer.write(format, args...);
+            writer << '\n';
+            write(writer.data(), writer.size());
+        }
     }
 
+    /// Discard messages below `level`; Info by default
+    static void setLevel(LogLevel level);
+
+    static bool isEnabled(LogLevel level);
+
+    /// Write log messages on a background thread from now on
+    ///
+    /// Each thread that logs gets a ring buffer of `ring_size` bytes, which
+    /// is rounded up to a power of two. The background thread is stopped,
+    /// and whatever has been logged written out, when the program exits.
+    static void startAsync(std::size_t ring_size = 1 << 16);
+
+    /// Write out everything logged so far and go back to logging directly
+    ///
+    /// No other thread may log whilst this runs.
+    static void stopAsync();
+
+    /// Number of messages dropped because a ring buffer was full
+    static std::uint64_t getDropped();
+
 private:
     FILE * m_fd;
     std::function<std::string()> m_prefix;
+    std::string m_prefix_text;
+    bool m_prefix_cached;
+
     static std::string no_prefix();
+    static char const * getTag(LogLevel level);
+    std::string const & getPrefix();
+    /// Write a formatted message, or queue it if logging asynchronously
+    void write(char const * data, std::size_t size);
 };
 } // namespace common
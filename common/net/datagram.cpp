@@ -0,0 +1,79 @@
+#include "common/net/datagram.hpp"
+
+namespace net {
+namespace datagram {
+
+namespace {
+void putU32(std::string & out, std::uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out += (char)(value >> (i * 8));
+    }
+}
+
+std::uint32_t getU32(char const * data) {
+    std::uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        value |= (std::uint32_t)(unsigned char)data[i] << (i * 8);
+    }
+    return value;
+}
+
+/// Decode the header, leaving `data` and `size` the frame body
+bool decodeHeader(char const *& data, std::size_t & size,
+                  std::uint32_t & channel, std::uint32_t & sequence,
+                  std::string & error) {
+    if (size < HEADER_SIZE) {
+        error = "Truncated datagram header";
+        return false;
+    }
+    channel = getU32(data);
+    sequence = getU32(data + 4);
+    data += HEADER_SIZE;
+    size -= HEADER_SIZE;
+    std::uint64_t length;
+    int prefix = wire::getVarint(data, size, length);
+    if (prefix <= 0 || length != size - prefix) {
+        error = "Bad datagram frame length";
+        return false;
+    }
+    data += prefix;
+    size = length;
+    return true;
+}
+} // Anonymous namespace
+
+void encodeHeader(std::string & out, std::uint32_t channel,
+                  std::uint32_t sequence) {
+    putU32(out, channel);
+    putU32(out, sequence);
+}
+
+std::string encode(std::uint32_t channel, std::uint32_t sequence,
+                   MessageType const & type, MessageEntity const & entity) {
+    std::string out;
+    encodeHeader(out, channel, sequence);
+    encodeMessage(Framing::Binary, type, entity, out);
+    return out;
+}
+
+bool decode(char const * data, std::size_t size, std::uint32_t & channel,
+            std::uint32_t & sequence, MessageType & type,
+            MessageEntity & entity, std::string & error) {
+    return decodeHeader(data, size, channel, sequence, error) &&
+           wire::decodeMessage(data, size, type, entity, error);
+}
+
+bool decode(char const * data, std::size_t size, std::uint32_t & channel,
+            std::uint32_t & sequence, MessageType & type,
+            common::util::json::Document & document,
+            common::util::json::Value & entity, std::string & error) {
+    return decodeHeader(data, size, channel, sequence, error) &&
+           wire::decodeMessage(data, size, type, document, entity, error);
+}
+
+bool isNewer(std::uint32_t sequence, std::uint32_t latest) {
+    return (std::int32_t)(sequence - latest) > 0;
+}
+
+} // namespace datagram
+} // namespace net
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "common/net/wire.hpp"
+
+namespace net {
+
+/// Messages sent unreliably over UDP
+///
+/// Each datagram holds one message, encoded as a binary frame (see
+/// `Framing::Binary`) whatever framing the TCP connection uses, after an
+/// eight byte header:
+///
+///     channel (u32 LE) | sequence (u32 LE) | frame
+///
+/// The channel is the number the server gave the client in a `net.channel`
+/// message and identifies which client a datagram is to or from. The sequence
+/// number goes up by one with every datagram sent in each direction. Datagrams
+/// can be lost, duplicated or reordered, so receivers drop any which aren't
+/// newer than the newest they've already accepted. This is only suitable for
+/// messages where the latest one supersedes all those before it, such as
+/// world snapshots and input.
+namespace datagram {
+
+std::size_t const HEADER_SIZE = 8;
+
+/// Largest datagram sent
+///
+/// Small enough to get through most paths without being fragmented.
+/// Messages which don't fit are sent over TCP instead.
+std::size_t const MAX_SIZE = 1200;
+
+/// Append a datagram header to `out`
+void encodeHeader(std::string & out, std::uint32_t channel,
+                  std::uint32_t sequence);
+
+/// Encode a whole datagram
+std::string encode(std::uint32_t channel, std::uint32_t sequence,
+                   MessageType const & type, MessageEntity const & entity);
+
+/// Decode a datagram
+///
+/// Returns false and sets `error` if the datagram is malformed.
+bool decode(char const * data, std::size_t size, std::uint32_t & channel,
+            std::uint32_t & sequence, MessageType & type,
+            MessageEntity & entity, std::string & error);
+
+/// Decode a datagram into a document
+///
+/// See wire::decodeMessage(); the entity refers to `data`.
+bool decode(char const * data, std::size_t size, std::uint32_t & channel,
+            std::uint32_t & sequence, MessageType & type,
+            common::util::json::Document & document,
+            common::util::json::Value & entity, std::string & error);
+
+/// Check if a sequence number is newer than `latest`
+///
+/// Sequence numbers are compared modulo 2^32 so they can wrap around.
+bool isNewer(std::uint32_t sequence, std::uint32_t latest);
+
+} // namespace datagram
+} // namespace net
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+#include "common/net/wire.hpp"
+#include "common/util/function.hpp"
+
+namespace net {
+
+/// Calls the handlers registered for each type of message
+///
+/// Message types are interned to small, dense integer IDs as handlers are
+/// registered for them. The handlers for every type are kept in one vector,
+/// grouped by type, and a type's ID indexes the span of that vector holding
+/// its handlers. Dispatching a message takes a single lookup of its type,
+/// which never inserts anything, and then calls each handler in its span.
+/// Handlers are `InlineFunction`s rather than std::functions, so dispatching
+/// never allocates.
+///
+/// Messages of types without handlers are ignored. In particular, made up
+/// types sent by a misbehaving peer leave nothing behind.
+///
+/// Handlers must not be added whilst dispatching.
+template <class ... Args> class Dispatcher {
+public:
+    typedef common::util::function::InlineFunction<void(Args ...)> Handler;
+
+    Dispatcher() : m_spans(1) {}
+
+    /// Register a handler for a message type
+    ///
+    /// Handlers for the same type are called in the order they were added.
+    ///
+    /// @return The type's ID
+    unsigned add(MessageType const & type, Handler handler) {
+        auto id = m_ids.find(type);
+        if (id == m_ids.end()) {
+            id = m_ids.emplace(type, m_spans.size()).first;
+            m_spans.push_back(Span{m_handlers.size(), m_handlers.size()});
+        }
+        std::size_t position = m_spans[id->second].end;
+        m_handlers.insert(m_handlers.begin() + position, std::move(handler));
+        m_spans[id->second].end++;
+        // Make room in the spans of the types after this one
+        for (std::size_t other = 1; other < m_spans.size(); other++) {
+            if (other != id->second && m_spans[other].begin >= position) {
+                m_spans[other].begin++;
+                m_spans[other].end++;
+            }
+        }
+        return id->second;
+    }
+
+    /// Get the ID of a message type, or zero if it has no handlers
+    unsigned find(MessageType const & type) const {
+        auto id = m_ids.find(type);
+        return id == m_ids.end() ? 0 : id->second;
+    }
+
+    /// Call the handlers for a message type ID from find()
+    void dispatch(unsigned id, Args ... args) const {
+        Span const & span = m_spans[id];
+        for (std::size_t handler = span.begin; handler < span.end;
+             handler++) {
+            m_handlers[handler](args ...);
+        }
+    }
+
+    /// Call the handlers for a message type
+    ///
+    /// @return False if the type has no handlers
+    bool dispatch(MessageType const & type, Args ... args) const {
+        unsigned id = find(type);
+        dispatch(id, args ...);
+        return id != 0;
+    }
+
+private:
+    struct Span {
+        std::size_t begin;
+        std::size_t end;
+    };
+
+    std::unordered_map<MessageType, unsigned> m_ids;
+    /// Indexed by type ID; the first is the empty span of ID zero
+    std::vector<Span> m_spans;
+    std::vector<Handler> m_handlers;
+};
+
+} // namespace net
@@ -0,0 +1,234 @@
+#include "common/net/framer.hpp"
+
+#include <cstring>
+
+namespace json = common::util::json;
+
+namespace net {
+
+namespace {
+bool isWhitespace(char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\0';
+}
+
+/// Characters that terminate a top-level scalar such as a number or `true`
+bool isDelimiter(char c) {
+    return isWhitespace(c) || c == '{' || c == '}' || c == '[' || c == ']' ||
+           c == '"' || c == ',' || c == ':';
+}
+} // Anonymous namespace
+
+Framer::Framer(Framing framing, std::size_t capacity)
+    : m_framing(framing), m_buffer(capacity), m_begin(0), m_end(0), m_scan(0),
+      m_in_value(false), m_in_string(false), m_in_scalar(false),
+      m_escape(false), m_depth(0), m_lost(false) {}
+
+void Framer::setFraming(Framing framing) { m_framing = framing; }
+
+Framing Framer::getFraming() const { return m_framing; }
+
+char * Framer::prepare(std::size_t size) {
+    if (m_buffer.size() - m_end < size) {
+        // Reclaim the consumed space at the front before growing
+        std::size_t used = m_end - m_begin;
+        if (m_begin > 0) {
+            std::memmove(m_buffer.data(), m_buffer.data() + m_begin, used);
+            m_scan -= m_begin;
+            m_end = used;
+            m_begin = 0;
+        }
+        if (m_buffer.size() - m_end < size) {
+            std::size_t capacity = m_buffer.size() * 2;
+            while (capacity - m_end < size) {
+                capacity *= 2;
+            }
+            m_buffer.resize(capacity);
+        }
+    }
+    return m_buffer.data() + m_end;
+}
+
+void Framer::commit(std::size_t size) { m_end += size; }
+
+void Framer::append(char const * data, std::size_t size) {
+    std::memcpy(prepare(size), data, size);
+    commit(size);
+}
+
+char const * Framer::data() const { return m_buffer.data() + m_begin; }
+
+std::size_t Framer::size() const { return m_end - m_begin; }
+
+bool Framer::isLost() const { return m_lost; }
+
+void Framer::consume(std::size_t size) { consumeTo(m_begin + size); }
+
+std::size_t Framer::scanJson() {
+    for (; m_scan < m_end; m_scan++) {
+        char c = m_buffer[m_scan];
+        if (!m_in_value) {
+            if (isWhitespace(c)) {
+                // Nothing to keep between values
+                m_begin = m_scan + 1;
+                continue;
+            }
+            m_in_value = true;
+            m_begin = m_scan;
+            if (c == '{' || c == '[') {
+                m_depth = 1;
+            } else if (c == '"') {
+                m_in_string = true;
+            } else if (c == '}' || c == ']' || c == ',' || c == ':') {
+                // Stray punctuation; let the parser report it
+                return ++m_scan;
+            } else {
+                m_in_scalar = true;
+            }
+            continue;
+        }
+        if (m_in_scalar) {
+            if (isDelimiter(c)) {
+                // The delimiter belongs to whatever follows the scalar
+                return m_scan;
+            }
+        } else if (m_in_string) {
+            if (m_escape) {
+                m_escape = false;
+            } else if (c == '\\') {
+                m_escape = true;
+            } else if (c == '"') {
+                m_in_string = false;
+                if (m_depth == 0) {
+                    return ++m_scan;
+                }
+            }
+        } else if (c == '"') {
+            m_in_string = true;
+        } else if (c == '{' || c == '[') {
+            m_depth++;
+        } else if (c == '}' || c == ']') {
+            if (--m_depth == 0) {
+                return ++m_scan;
+            }
+        }
+    }
+    return 0;
+}
+
+bool Framer::nextFrame(char const *& data, std::size_t & size,
+                       std::string & error) {
+    if (m_framing == Framing::Json) {
+        std::size_t end = scanJson();
+        if (end == 0) {
+            if (m_in_value && m_scan - m_begin > wire::MAX_FRAME_SIZE) {
+                // Otherwise a value that never ends would grow the buffer
+                // for as long as the peer keeps sending
+                error = "JSON message too long";
+                m_in_value = m_in_string = m_in_scalar = m_escape = false;
+                m_depth = 0;
+                m_lost = true;
+                consumeTo(m_end);
+                return true;
+            }
+            return false;
+        }
+        data = m_buffer.data() + m_begin;
+        size = end - m_begin;
+        m_in_value = m_in_string = m_in_scalar = m_escape = false;
+        m_depth = 0;
+        consumeTo(end);
+        return true;
+    }
+    std::uint64_t length;
+    int prefix = wire::getVarint(m_buffer.data() + m_begin, this->size(),
+                                 length);
+    if (prefix == 0) {
+        return false;
+    }
+    if (prefix < 0 || length > wire::MAX_FRAME_SIZE) {
+        error = "Bad frame length";
+        m_lost = true;
+        consumeTo(m_end);
+        return true;
+    }
+    if (this->size() - prefix < length) {
+        return false;
+    }
+    std::size_t body = m_begin + prefix;
+    data = m_buffer.data() + body;
+    size = length;
+    consumeTo(body + length);
+    return true;
+}
+
+bool Framer::next(MessageType & type, MessageEntity & entity,
+                  std::string & error) {
+    error.clear();
+    char const * data = nullptr;
+    std::size_t size = 0;
+    if (!nextFrame(data, size, error)) {
+        return false;
+    }
+    if (!error.empty()) {
+        return true;
+    }
+    if (m_framing == Framing::Binary) {
+        wire::decodeMessage(data, size, type, entity, error);
+        return true;
+    }
+    json11::Json message =
+        json11::Json::parse(std::string(data, size), error);
+    if (error.empty()) {
+        // If the 'type' field doesn't exist then is_string() is falsey
+        json11::Json const & message_type = message["type"];
+        if (message_type.is_string()) {
+            type = message_type.string_value();
+            entity = message["entity"];
+        } else {
+            error = "Message has no type";
+        }
+    }
+    return true;
+}
+
+bool Framer::next(MessageType & type, json::Document & document,
+                  json::Value & entity, std::string & error) {
+    error.clear();
+    char const * data = nullptr;
+    std::size_t size = 0;
+    if (!nextFrame(data, size, error)) {
+        return false;
+    }
+    if (!error.empty()) {
+        return true;
+    }
+    if (m_framing == Framing::Binary) {
+        wire::decodeMessage(data, size, type, document, entity, error);
+        return true;
+    }
+    json::Value message;
+    if (document.parse(data, size, message, error)) {
+        json::Value const & message_type = message["type"];
+        if (message_type.is_string()) {
+            json::StringView name = message_type.string_value();
+            type.assign(name.data(), name.size());
+            entity = message["entity"];
+        } else {
+            error = "Message has no type";
+        }
+    }
+    return true;
+}
+
+void Framer::consumeTo(std::size_t end) {
+    m_begin = end;
+    if (m_scan < m_begin) {
+        m_scan = m_begin;
+    }
+    if (m_begin == m_end) {
+        // Cheap to reset when empty, saves a memmove later
+        m_begin = m_end = m_scan = 0;
+    }
+}
+
+} // namespace net
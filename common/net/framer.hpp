@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "common/net/wire.hpp"
+
+namespace net {
+
+/// Incrementally split a received byte stream into messages
+///
+/// Received bytes are appended to a contiguous buffer and complete messages
+/// are extracted with `next`, leaving an incomplete trailing message in
+/// place until the rest of it arrives. Consumed bytes are reclaimed lazily:
+/// the unconsumed tail is moved to the front of the buffer only when there
+/// isn't enough free space at the end for the next read.
+///
+/// With `Framing::Json` the framer scans only the bytes that haven't been
+/// scanned before, tracking nesting depth and string state, to find where
+/// each whitespace-delimited top-level value ends. Only complete values are
+/// handed to the JSON parser, so each byte is scanned once and parsed once
+/// regardless of how many reads a message is split across.
+///
+/// With `Framing::Binary` the varint length prefix says up front how many
+/// bytes the message needs, so nothing is looked at until they've all been
+/// received.
+///
+/// @code
+/// Framer framer(Framing::Binary);
+/// ssize_t n = recv(socket, framer.prepare(1024), 1024, 0);
+/// framer.commit(n);
+/// MessageType type;
+/// MessageEntity entity;
+/// std::string error;
+/// while (framer.next(type, entity, error)) {
+///     ...
+/// }
+/// @endcode
+class Framer {
+public:
+    /// @param framing How messages are encoded
+    /// @param capacity Initial buffer capacity in bytes
+    Framer(Framing framing = Framing::Json, std::size_t capacity = 8192);
+
+    /// Change how subsequent messages are decoded
+    ///
+    /// This must only be called between messages, e.g. once the handshake
+    /// has been consumed.
+    void setFraming(Framing framing);
+
+    Framing getFraming() const;
+
+    /// Get a pointer to at least `size` bytes of writable space
+    ///
+    /// The space is at the end of the buffer. After writing to it call
+    /// `commit` with the number of bytes actually written.
+    char * prepare(std::size_t size);
+
+    /// Mark `size` bytes written to the space from `prepare` as received
+    void commit(std::size_t size);
+
+    /// Copy bytes into the end of the buffer
+    void append(char const * data, std::size_t size);
+
+    /// Extract the next complete message
+    ///
+    /// If there is a complete message then it's decoded into `type` and
+    /// `entity`, consumed from the buffer and true is returned. If the message
+    /// was malformed then `error` is set to describe why, but the message is
+    /// still consumed so that one bad message doesn't wedge the stream.
+    ///
+    /// A malformed binary frame length can't be skipped over, however, and
+    /// neither can a JSON value which grows past `wire::MAX_FRAME_SIZE`
+    /// without ending. In those cases the whole buffer is discarded, `error`
+    /// is set and isLost() is true; the stream is no longer usable.
+    ///
+    /// Returns false, leaving the buffer untouched, if there is no complete
+    /// message yet.
+    bool next(MessageType & type, MessageEntity & entity,
+              std::string & error);
+
+    /// Extract the next complete message into a document
+    ///
+    /// Like the other next(), but without copying: the entity's strings
+    /// refer to the framer's buffer and its arrays and objects are kept in
+    /// `document` (see common::util::json). The entity is only valid until
+    /// the next call to prepare() or append(), or until the document is
+    /// cleared.
+    bool next(MessageType & type, common::util::json::Document & document,
+              common::util::json::Value & entity, std::string & error);
+
+    /// Pointer to the first unconsumed byte
+    char const * data() const;
+
+    /// Number of unconsumed bytes
+    std::size_t size() const;
+
+    /// Check if next() has lost track of where messages start
+    bool isLost() const;
+
+    /// Discard `size` unconsumed bytes from the front of the buffer
+    ///
+    /// This is for consuming raw data such as the handshake magic number. It
+    /// must not be used part way through a message.
+    void consume(std::size_t size);
+
+private:
+    Framing m_framing;
+    std::vector<char> m_buffer;
+    /// Start of the unconsumed data
+    std::size_t m_begin;
+    /// End of the received data
+    std::size_t m_end;
+    /// Everything before this offset has been scanned
+    std::size_t m_scan;
+
+    /// JSON scanner state for the value that starts at m_begin
+    bool m_in_value;
+    bool m_in_string;
+    bool m_in_scalar;
+    bool m_escape;
+    std::size_t m_depth;
+    /// Whether the buffer had to be discarded part way through a message
+    bool m_lost;
+
+    /// Scan forward for the end of the current JSON value
+    ///
+    /// Returns the offset one past the end of the value, or zero if the
+    /// value isn't complete yet.
+    std::size_t scanJson();
+
+    /// Find and consume the next complete message
+    ///
+    /// `data` and `size` are set to the message's JSON text or binary frame
+    /// body, which stays in the buffer until the next prepare(). Returns
+    /// false if there is no complete message yet, or sets `error` if the
+    /// binary frame length is malformed or the JSON value is too long.
+    bool nextFrame(char const *& data, std::size_t & size,
+                   std::string & error);
+
+    /// Consume everything up to `end`
+    void consumeTo(std::size_t end);
+};
+
+} // namespace net
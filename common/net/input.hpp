@@ -0,0 +1,27 @@
+#pragma once
+
+namespace net {
+
+/// Player input sent from clients to the server
+///
+/// Clients send an `input` message whenever the set of buttons held by the
+/// player changes. The entity is the array `[sequence, buttons]` where
+/// `sequence` increases by one with each `input` message sent and `buttons`
+/// is a bit set of `Button`s. The server keeps applying the last buttons
+/// received on every tick until they change.
+namespace input {
+
+/// Buttons which can be held by a player
+enum Button : unsigned {
+    Up = 1 << 0,
+    Down = 1 << 1,
+    Left = 1 << 2,
+    Right = 1 << 3,
+    Fire = 1 << 4,
+};
+
+/// All the buttons; any other bits in an `input` message are ignored
+unsigned const ALL_BUTTONS = Up | Down | Left | Right | Fire;
+
+} // namespace input
+} // namespace net
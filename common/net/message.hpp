@@ -1,7 +1,5 @@
 #pragma once
 
-#include <functional>
-#include <map>
 #include <queue>
 #include <string>
 #include <tuple>
@@ -11,18 +9,42 @@
 #include <sys/types.h>
 
 #include "common/extlib/json11/json11.hpp"
+#include "common/net/dispatch.hpp"
+#include "common/net/framer.hpp"
+#include "common/net/wire.hpp"
 
 /// Networking utilities common to both the server and client
 namespace net {
 
-typedef std::string MessageType;
-typedef json11::Json MessageEntity;
 typedef int Socket;
 
-/// Handle sending and receiving JSON-encoded messages over a socket.
+/// Flags to send with, so that a peer which has gone is an error to the
+/// sender rather than a SIGPIPE
 ///
-/// This class operators on a TCP socket to communicate whitespace-separated,
-/// JSON-encoded messages. Each 'message' is a JSON object with two fields.
+/// Where there's no MSG_NOSIGNAL, such as OS X, the socket has to be told
+/// instead when it's created, by ignoreSigPipe().
+#ifdef MSG_NOSIGNAL
+int const SEND_FLAGS = MSG_NOSIGNAL;
+#else
+int const SEND_FLAGS = 0;
+#endif
+
+/// Stop sending on `socket` raising SIGPIPE, where that's up to the socket
+inline void ignoreSigPipe(Socket socket) {
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof on);
+#else
+    (void)socket;
+#endif
+}
+
+/// Handle sending and receiving messages over a socket.
+///
+/// This class operators on a TCP socket to communicate messages using one of
+/// the `Framing`s: either whitespace-separated JSON or length-prefixed binary
+/// frames. Either way, each 'message' is logically a JSON object with two
+/// fields.
 /// The `type` field is a string that identifies the type of the message and
 /// is used to map messages to callbacks.
 ///
@@ -90,23 +112,25 @@ typedef int Socket;
 /// @endcode
 template <class ... Args> class MessageProcessor {
 
-using Handler = std::function<void(
+using Handlers = Dispatcher<
     MessageProcessor<Args ...> *,
-    MessageEntity,
+    MessageEntity const &,
     Args ...
-)>;
+>;
 
-using MutedHandler = std::function<void(
-    MessageEntity,
+using Handler = typename Handlers::Handler;
+
+/// Smaller than a Handler so one fits in the Handler which wraps it
+using MutedHandler = common::util::function::InlineFunction<void(
+    MessageEntity const &,
     Args ...
-)>;
+), 2 * sizeof(void *)>;
 
 public:
     /// @param socket A connected socket descriptor
-    MessageProcessor(Socket socket) {
-        m_socket = socket;
-        m_buffer.reserve(8192);
-    }
+    /// @param framing The framing negotiated during the handshake
+    MessageProcessor(Socket socket, Framing framing = Framing::Json)
+        : m_socket(socket), m_framing(framing), m_buffer(framing) {}
 
     /// Register a callback for a given message type
     ///
@@ -122,7 +146,7 @@ public:
     /// Multiple handlers can be registered for a single type. Each handler is
     /// called once for each message received.
     void addHandler(MessageType type, Handler handler) {
-        m_handlers[type].push_back(handler);
+        m_handlers.add(type, std::move(handler));
     }
 
     /// Register a muted callback for a given message type
@@ -134,8 +158,8 @@ public:
     ///
     /// This mostly exists to save keystrokes.
     void addHandler(MessageType type, MutedHandler handler) {
-        addHandler(type, [handler](MessageProcessor<Args ...> *processor,
-                MessageEntity entity, Args ... args){
+        addHandler(type, [handler](MessageProcessor<Args ...> *,
+                MessageEntity const & entity, Args ... args){
             return handler(entity, args ...);
         });
     }
@@ -147,16 +171,15 @@ public:
     /// handler calls.
     void dispatch(Args ... args) {
         while (!m_ingress.empty()) {
-            for (auto &handler : m_handlers[std::get<0>(m_ingress.front())]) {
-                handler(this, std::get<1>(m_ingress.front()), args ...);
-            }
+            m_handlers.dispatch(std::get<0>(m_ingress.front()), this,
+                                std::get<1>(m_ingress.front()), args ...);
             m_ingress.pop();
         }
     }
 
     /// Receive and parse messages
     ///
-    /// This will attempt to receive JSON-endoded messages from the associated
+    /// This will attempt to receive encoded messages from the associated
     /// socket. Note that this method doesn't call the message handlers
     /// immediately. Instead they are enqueued for deferred dispatching via
     /// `dispatch`.
@@ -165,27 +188,21 @@ public:
     /// dispatched.
     void proccess() {
         // TODO: Propagation of errors
-        auto free_buffer = m_buffer.capacity() - m_buffer.size();
-        if (free_buffer == 0) {
-            // What do?
-            return;
-        }
-        ssize_t data_or_error = recv(m_socket,
-             m_buffer().data() + m_buffer.size(), free_buffer);
+        ssize_t data_or_error = recv(m_socket, m_buffer.prepare(8192), 8192, 0);
         if (data_or_error == 0) {
             return;
         } else if (data_or_error == -1) {
             // Error, need to check errno, may be EAGAIN/EWOULDBLOCK
             return;
         }
+        m_buffer.commit(data_or_error);
         parseBuffer();
     }
 
     /// Enqueue a message to be sent
     ///
-    /// The message will be encoded as a JSON object with two fields: the
-    /// `type` and `entity` which will be set to given corresponding
-    /// parameters.
+    /// The message will be encoded with two fields: the `type` and `entity`
+    /// which will be set to given corresponding parameters.
     ///
     /// Note that this doesn't necessarily result in the message being sent
     /// immediately. Rather a buffer of pending messages is maintained which
@@ -199,44 +216,43 @@ public:
 
     /// Encode and send all enqueued messages
     ///
-    /// Each JSON message that has been enqueued by send() is encoded into JSON
-    /// and is sent over the associated socket with a null terminator.
+    /// Each message that has been enqueued by send() is encoded with the
+    /// processor's framing and is sent over the associated socket.
     ///
     /// This consumes the send queue entirely.
     void flushSendQueue() {
+        std::string encoded_messages;
         while (!m_egress.empty()) {
-            json11::Json message = json11::Json::object{
-                { "type", std::get<0>(m_egress.front()) },
-                { "entity", std::get<1>(m_egress.front()) },
-            };
+            encodeMessage(m_framing, std::get<0>(m_egress.front()),
+                          std::get<1>(m_egress.front()), encoded_messages);
             m_egress.pop();
-            std::string encoded_message = message.dump() + " ";
-            int sent = 0;
-            while (sent < encoded_message.size()) {
-                ssize_t data_or_error = ::send(m_socket,
-                                             encoded_message.data() + sent,
-                                             encoded_message.size() - sent, 0);
-                if (data_or_error == -1) {
-                    // TODO: Handle/propagate error
-                } else {
-                    sent = sent + data_or_error;
-                }
+        }
+        std::size_t sent = 0;
+        while (sent < encoded_messages.size()) {
+            ssize_t data_or_error = ::send(m_socket,
+                                           encoded_messages.data() + sent,
+                                           encoded_messages.size() - sent,
+                                           SEND_FLAGS);
+            if (data_or_error == -1) {
+                // TODO: Handle/propagate error
+            } else {
+                sent = sent + data_or_error;
             }
         }
     }
 
 private:
     Socket m_socket;
-    std::string m_buffer;
-    std::map<MessageType, std::vector<Handler>> m_handlers;
-    std::queue<std::tuple<MessageType, MessageEntity>> m_ingress;
-    std::queue<std::tuple<MessageType, MessageEntity>> m_egress;
+    Framing m_framing;
+    Framer m_buffer;
+    Handlers m_handlers;
+    std::queue<Message> m_ingress;
+    std::queue<Message> m_egress;
 
-    /// Attempt to parse all JSON-encoded messages from the buffer
+    /// Parse all complete messages from the buffer
     ///
-    /// This parses all whitespace-delimited JSON objects from the buffer and
-    /// calls and adds them to the m_ingress message queue to be dispatched
-    /// later.
+    /// This decodes all complete messages from the buffer and adds them to
+    /// the m_ingress message queue to be dispatched later.
     ///
     /// Each JSON message should be an object at the top level with a string
     /// `type` field. There should also be a `entity` field which can be of any
@@ -247,33 +263,19 @@ private:
     /// type field is the wrong type then the message is ignored. The buffer
     /// will still be consumed as if it were a valid message.
     ///
-    /// If the buffer contains incomplete or malformed JSON then no messages
-    /// are processed. No messages are added to `m_ingress`. The buffer is not
-    /// consumed.
+    /// A trailing incomplete message is left in the buffer. Parsing resumes
+    /// where it left off once the rest of it is received, so large messages
+    /// split over many reads are only parsed once.
     void parseBuffer() {
-        if (m_buffer.empty()) {
-            return;
-        }
-        std::string json_error;
-        std::vector<json11::Json> messages =
-            json11::Json::parse_multi(m_buffer, json_error);
-        // Parsing will fail if the buffer contains a partial message, so the
-        // JSON may be well formed but incomplete. This is not ideal. Ideally
-        // we should be able to read all the complete messages and only leave
-        // the incomplete one in the buffer. This may be an argument in favour
-        // of not using `parse_multi`.
-        if (json_error.size()) {
-            // TODO: Log JSON decode error?
-        } else {
-            m_buffer.clear();
-            for (auto &message : messages) {
-                json11::Json type = message["type"];
-                // If the 'type' field doesn't exist then is_string()
-                // is falsey
-                if (type.is_string()) {
-                    m_ingress.emplace(type.string_value(), message["entity"]);
-                }
+        MessageType type;
+        MessageEntity entity;
+        std::string error;
+        while (m_buffer.next(type, entity, error)) {
+            if (error.size()) {
+                // TODO: Log decode error?
+                continue;
             }
+            m_ingress.emplace(std::move(type), std::move(entity));
         }
     }
 };
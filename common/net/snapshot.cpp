@@ -0,0 +1,189 @@
+#include "common/net/snapshot.hpp"
+
+#include <algorithm>
+
+namespace net {
+namespace snapshot {
+
+namespace {
+unsigned const ALL_FIELDS = (1 << EntityState::FIELD_COUNT) - 1;
+
+bool byId(EntityState const & a, EntityState const & b) {
+    return a.id < b.id;
+}
+
+/// Get the bit mask of the fields which differ from `previous`
+unsigned changedFields(EntityState const & entity,
+                       EntityState const * previous) {
+    unsigned mask = 0;
+    for (int field = 0; field < EntityState::FIELD_COUNT; field++) {
+        if (previous == nullptr ||
+            previous->fields[field] != entity.fields[field]) {
+            mask |= 1 << field;
+        }
+    }
+    return mask;
+}
+
+bool isInteger(json11::Json const & value) {
+    return value.is_number() && value.number_value() == value.int_value();
+}
+} // Anonymous namespace
+
+EntityState const * Snapshot::find(std::uint32_t id) const {
+    EntityState key;
+    key.id = id;
+    auto entity =
+        std::lower_bound(entities.begin(), entities.end(), key, byId);
+    return entity == entities.end() || entity->id != id ? nullptr : &*entity;
+}
+
+void encode(Writer & writer, Snapshot const & snapshot,
+            Snapshot const * baseline) {
+    writer.beginArray();
+    writer.value(snapshot.tick);
+    writer.value(baseline ? baseline->tick : 0);
+    // Both are sorted by ID, so they're walked together: once for the
+    // removed entities and again for the changed ones, as the removed ones
+    // are written first
+    writer.beginArray();
+    if (baseline) {
+        auto entity = snapshot.entities.begin();
+        for (auto const & previous : baseline->entities) {
+            while (entity != snapshot.entities.end() &&
+                   entity->id < previous.id) {
+                ++entity;
+            }
+            if (entity == snapshot.entities.end() ||
+                entity->id != previous.id) {
+                writer.value(previous.id);
+            }
+        }
+    }
+    writer.endArray();
+    writer.beginArray();
+    auto previous = baseline ? baseline->entities.begin()
+                             : snapshot.entities.end();
+    auto previous_end = baseline ? baseline->entities.end()
+                                 : snapshot.entities.end();
+    for (auto const & entity : snapshot.entities) {
+        while (previous != previous_end && previous->id < entity.id) {
+            ++previous;
+        }
+        EntityState const * match = nullptr;
+        if (previous != previous_end && previous->id == entity.id) {
+            match = &*previous++;
+        }
+        unsigned mask = changedFields(entity, match);
+        if (mask == 0) {
+            continue;
+        }
+        writer.beginArray();
+        writer.value(entity.id);
+        writer.value(mask);
+        for (int field = 0; field < EntityState::FIELD_COUNT; field++) {
+            if (mask & (1 << field)) {
+                writer.value(entity.fields[field]);
+            }
+        }
+        writer.endArray();
+    }
+    writer.endArray();
+    writer.endArray();
+}
+
+std::uint64_t baselineTick(json11::Json const & entity) {
+    return (std::uint64_t)entity[1].number_value();
+}
+
+bool decode(json11::Json const & entity, Snapshot const * baseline,
+            Snapshot & snapshot) {
+    if (!entity[0].is_number() || !entity[2].is_array() ||
+        !entity[3].is_array()) {
+        return false;
+    }
+    std::vector<EntityState> entities;
+    if (baseline != nullptr) {
+        entities = baseline->entities;
+    }
+    // Entities from the baseline are looked up by binary search, so new ones
+    // are appended after them and everything is sorted at the end
+    auto const existing = entities.size();
+    auto indexOf = [&entities, existing](std::uint32_t id) -> long {
+        EntityState key;
+        key.id = id;
+        auto end = entities.begin() + existing;
+        auto entity = std::lower_bound(entities.begin(), end, key, byId);
+        return entity == end || entity->id != id
+                   ? -1
+                   : entity - entities.begin();
+    };
+    std::vector<bool> removed(existing);
+    for (auto const & id : entity[2].array_items()) {
+        long index = indexOf(id.int_value());
+        if (index < 0) {
+            return false;
+        }
+        removed[index] = true;
+    }
+    for (auto const & fields : entity[3].array_items()) {
+        if (!isInteger(fields[0]) || !isInteger(fields[1])) {
+            return false;
+        }
+        std::uint32_t id = fields[0].int_value();
+        unsigned mask = fields[1].int_value();
+        long index = indexOf(id);
+        if (index < 0 || removed[index]) {
+            // New entities are sent in full
+            if (mask != ALL_FIELDS) {
+                return false;
+            }
+            index = entities.size();
+            entities.push_back(EntityState());
+            entities.back().id = id;
+        }
+        std::size_t next = 2;
+        for (int field = 0; field < EntityState::FIELD_COUNT; field++) {
+            if (mask & (1 << field)) {
+                if (!isInteger(fields[next])) {
+                    return false;
+                }
+                entities[index].fields[field] = fields[next++].int_value();
+            }
+        }
+    }
+    snapshot.tick = (std::uint64_t)entity[0].number_value();
+    snapshot.entities.clear();
+    for (std::size_t i = 0; i < entities.size(); i++) {
+        if (i >= existing || !removed[i]) {
+            snapshot.entities.push_back(entities[i]);
+        }
+    }
+    std::sort(snapshot.entities.begin(), snapshot.entities.end(), byId);
+    return true;
+}
+
+void SnapshotRing::push(std::shared_ptr<Snapshot const> snapshot) {
+    if (m_snapshots.size() == SNAPSHOT_HISTORY) {
+        m_snapshots.pop_front();
+    }
+    m_snapshots.push_back(std::move(snapshot));
+}
+
+Snapshot const * SnapshotRing::find(std::uint64_t tick) const {
+    for (auto const & snapshot : m_snapshots) {
+        if (snapshot->tick == tick) {
+            return snapshot.get();
+        }
+    }
+    return nullptr;
+}
+
+Snapshot const * SnapshotRing::latest() const {
+    return m_snapshots.empty() ? nullptr : m_snapshots.back().get();
+}
+
+void SnapshotRing::clear() { m_snapshots.clear(); }
+
+} // namespace snapshot
+} // namespace net
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "common/extlib/json11/json11.hpp"
+#include "common/net/writer.hpp"
+
+namespace net {
+
+/// World state sent from the server to clients
+///
+/// The server sends `world.snapshot` messages with the state of every entity
+/// in the world as of a tick. Each snapshot is encoded relative to a baseline:
+/// an earlier snapshot the client has acknowledged receiving with a
+/// `world.ack` message. Only entities which were added, changed or removed
+/// since the baseline are included, and only the fields of an entity that
+/// changed, so how much is sent depends on how much is going on rather than
+/// on how big the world is. A snapshot with no baseline is sent in full.
+///
+/// Both ends keep the last SNAPSHOT_HISTORY snapshots they've sent or
+/// received in a `SnapshotRing`. If a client's last acknowledgement falls
+/// out of the server's ring, e.g. because acknowledgements were lost or the
+/// client stopped sending them, it's sent full snapshots again until it
+/// acknowledges one of those.
+namespace snapshot {
+
+/// Number of past snapshots kept to be used as baselines
+std::size_t const SNAPSHOT_HISTORY = 32;
+
+/// Positions are sent as integers in units of 1 / POSITION_SCALE pixels
+int const POSITION_SCALE = 16;
+
+/// The state of an entity as it's sent to clients
+///
+/// Everything is quantized to integers so that changes too small to be seen
+/// aren't sent and the binary framing can send them as small varints.
+struct EntityState {
+    /// The fields, in the order they're sent. An entity's bit mask of
+    /// changed fields has bit `1 << field` set for each field included.
+    enum Field {
+        KIND,
+        X,
+        Y,
+        DIRECTION,
+        HEALTH,
+        /// Animation frame counter
+        FRAME,
+        FIELD_COUNT,
+    };
+
+    std::uint32_t id;
+    std::int32_t fields[FIELD_COUNT];
+};
+
+/// The state of every entity as of a tick
+struct Snapshot {
+    std::uint64_t tick;
+    /// Sorted by ID
+    std::vector<EntityState> entities;
+
+    /// Find an entity, or nullptr if it isn't in the snapshot
+    EntityState const * find(std::uint32_t id) const;
+};
+
+/// Write a `world.snapshot` entity for `snapshot` relative to `baseline`
+///
+/// The entity is the array `[tick, baseline tick, removed, entities]`. The
+/// baseline tick is zero for a full snapshot. `removed` is an array of the
+/// IDs of entities in the baseline but not in the snapshot. `entities` is an
+/// array with an array for each entity which is new or has changed of its
+/// ID, a bit mask of the fields included and then those fields in order.
+///
+/// @param writer Where the entity is written, once the message is begun
+/// @param baseline The snapshot to encode the differences from, or nullptr
+///     to encode the whole snapshot
+void encode(Writer & writer, Snapshot const & snapshot,
+            Snapshot const * baseline);
+
+/// Get the baseline tick of an encoded `world.snapshot` entity
+///
+/// Returns zero for a full snapshot.
+std::uint64_t baselineTick(json11::Json const & entity);
+
+/// Decode a `world.snapshot` entity
+///
+/// @param entity The encoded snapshot
+/// @param baseline The snapshot it was encoded relative to, which must be
+///     nullptr for a full snapshot
+/// @param snapshot Set to the decoded snapshot
+///
+/// Returns false if the entity is malformed.
+bool decode(json11::Json const & entity, Snapshot const * baseline,
+            Snapshot & snapshot);
+
+/// The most recent SNAPSHOT_HISTORY snapshots sent or received
+class SnapshotRing {
+public:
+    /// Add a snapshot, discarding the oldest if the ring is full
+    ///
+    /// Snapshots must be added in tick order.
+    void push(std::shared_ptr<Snapshot const> snapshot);
+
+    /// Find the snapshot for a tick, or nullptr if it isn't in the ring
+    Snapshot const * find(std::uint64_t tick) const;
+
+    /// The most recently added snapshot, or nullptr if the ring is empty
+    Snapshot const * latest() const;
+
+    void clear();
+
+private:
+    std::deque<std::shared_ptr<Snapshot const>> m_snapshots;
+};
+
+} // namespace snapshot
+} // namespace net
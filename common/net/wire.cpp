@@ -0,0 +1,431 @@
+#include "common/net/wire.hpp"
+#include "common/net/writer.hpp"
+
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+namespace json = common::util::json;
+
+namespace net {
+
+namespace {
+/// Message types with a numeric ID in the binary framing
+///
+/// A type's ID is its index in this list plus one. Only ever append to this
+/// list, otherwise clients and servers built at different times will
+/// disagree about the IDs.
+MessageType const message_types[] = {
+    "disconnect",
+    "map.offer",
+    "map.request",
+    "map.contents",
+    "net.udp",
+    "has-map",
+    "map.chunk",
+    "input",
+    "world.join",
+    "world.snapshot",
+    "world.ack",
+    "net.channel",
+    "net.ping",
+    "net.pong",
+};
+
+std::size_t const message_type_count =
+    sizeof message_types / sizeof message_types[0];
+
+/// Deeper nesting than this is treated as malformed so that a hostile peer
+/// can't exhaust the stack
+int const MAX_DEPTH = 64;
+
+void putString(std::string & out, std::string const & value) {
+    wire::putVarint(out, value.size());
+    out.append(value);
+}
+
+bool readVarint(char const *& data, char const * end, std::uint64_t & value) {
+    int length = wire::getVarint(data, end - data, value);
+    if (length <= 0) {
+        return false;
+    }
+    data += length;
+    return true;
+}
+
+bool readString(char const *& data, char const * end, std::string & value) {
+    std::uint64_t size;
+    if (!readVarint(data, end, size) || size > (std::uint64_t)(end - data)) {
+        return false;
+    }
+    value.assign(data, size);
+    data += size;
+    return true;
+}
+
+bool readString(char const *& data, char const * end,
+                json::StringView & value) {
+    std::uint64_t size;
+    if (!readVarint(data, end, size) || size > (std::uint64_t)(end - data)) {
+        return false;
+    }
+    value = json::StringView(data, size);
+    data += size;
+    return true;
+}
+
+/// Decode the tags which mean the same thing whatever they're decoded into
+template <class Entity>
+bool decodeScalar(unsigned char tag, char const *& data, char const * end,
+                  Entity & entity) {
+    switch (tag) {
+    case wire::TAG_NULL:
+        entity = nullptr;
+        return true;
+    case wire::TAG_FALSE:
+        entity = false;
+        return true;
+    case wire::TAG_TRUE:
+        entity = true;
+        return true;
+    case wire::TAG_INT: {
+        std::uint64_t zigzag;
+        if (!readVarint(data, end, zigzag) || zigzag > 0xFFFFFFFF) {
+            return false;
+        }
+        std::int32_t value = (std::int32_t)((zigzag >> 1) ^ -(zigzag & 1));
+        entity = (int)value;
+        return true;
+    }
+    case wire::TAG_DOUBLE: {
+        if (end - data < 8) {
+            return false;
+        }
+        std::uint64_t bits = 0;
+        for (int i = 0; i < 8; i++) {
+            bits |= (std::uint64_t)(unsigned char)data[i] << (i * 8);
+        }
+        double value;
+        std::memcpy(&value, &bits, sizeof value);
+        data += 8;
+        entity = value;
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+bool decodeValue(char const *& data, char const * end,
+                 MessageEntity & entity, int depth) {
+    if (data == end || depth > MAX_DEPTH) {
+        return false;
+    }
+    unsigned char tag = *data++;
+    switch (tag) {
+    case wire::TAG_STRING: {
+        std::string value;
+        if (!readString(data, end, value)) {
+            return false;
+        }
+        entity = std::move(value);
+        return true;
+    }
+    case wire::TAG_ARRAY: {
+        std::uint64_t count;
+        // Every element takes at least one byte, so a count larger than the
+        // remaining data is bogus and mustn't be used to reserve memory
+        if (!readVarint(data, end, count) ||
+            count > (std::uint64_t)(end - data)) {
+            return false;
+        }
+        json11::Json::array array;
+        array.reserve(count);
+        for (std::uint64_t i = 0; i < count; i++) {
+            MessageEntity element;
+            if (!decodeValue(data, end, element, depth + 1)) {
+                return false;
+            }
+            array.push_back(std::move(element));
+        }
+        entity = std::move(array);
+        return true;
+    }
+    case wire::TAG_OBJECT: {
+        std::uint64_t count;
+        if (!readVarint(data, end, count) ||
+            count > (std::uint64_t)(end - data)) {
+            return false;
+        }
+        json11::Json::object object;
+        for (std::uint64_t i = 0; i < count; i++) {
+            std::string key;
+            MessageEntity value;
+            if (!readString(data, end, key) ||
+                !decodeValue(data, end, value, depth + 1)) {
+                return false;
+            }
+            // The last of any repeated key wins, as in JSON text
+            object[std::move(key)] = std::move(value);
+        }
+        entity = std::move(object);
+        return true;
+    }
+    default:
+        return decodeScalar(tag, data, end, entity);
+    }
+}
+
+bool decodeValue(char const *& data, char const * end,
+                 json::Document & document, json::Value & entity,
+                 int depth) {
+    if (data == end || depth > MAX_DEPTH) {
+        return false;
+    }
+    unsigned char tag = *data++;
+    switch (tag) {
+    case wire::TAG_STRING: {
+        json::StringView value;
+        if (!readString(data, end, value)) {
+            return false;
+        }
+        entity = json::Value(value);
+        return true;
+    }
+    case wire::TAG_ARRAY: {
+        std::uint64_t count;
+        if (!readVarint(data, end, count) ||
+            count > (std::uint64_t)(end - data)) {
+            return false;
+        }
+        json::Value * items =
+            document.getArena().allocate<json::Value>(count);
+        for (std::uint64_t i = 0; i < count; i++) {
+            if (!decodeValue(data, end, document, items[i], depth + 1)) {
+                return false;
+            }
+        }
+        entity = json::Value::array(items, count);
+        return true;
+    }
+    case wire::TAG_OBJECT: {
+        std::uint64_t count;
+        if (!readVarint(data, end, count) ||
+            count > (std::uint64_t)(end - data)) {
+            return false;
+        }
+        json::Member * members =
+            document.getArena().allocate<json::Member>(count);
+        for (std::uint64_t i = 0; i < count; i++) {
+            if (!readString(data, end, members[i].first) ||
+                !decodeValue(data, end, document, members[i].second,
+                             depth + 1)) {
+                return false;
+            }
+        }
+        entity = document.makeObject(members, count);
+        return true;
+    }
+    default:
+        return decodeScalar(tag, data, end, entity);
+    }
+}
+
+/// Decode the message type at the start of a binary frame body
+bool decodeType(char const *& data, char const * end, MessageType & type,
+                std::string & error) {
+    std::uint64_t id;
+    if (!readVarint(data, end, id)) {
+        error = "Truncated message type";
+        return false;
+    }
+    if (id == 0) {
+        if (!readString(data, end, type)) {
+            error = "Truncated message type name";
+            return false;
+        }
+    } else {
+        MessageType const * name = wire::messageTypeName(id);
+        if (name == nullptr) {
+            error = "Unknown message type ID";
+            return false;
+        }
+        type = *name;
+    }
+    return true;
+}
+} // Anonymous namespace
+
+std::string magicNumber(Framing framing) {
+    return std::string(MAGIC_PREFIX) + (char)framing;
+}
+
+bool isSupportedFraming(unsigned char version) {
+    return version == (unsigned char)Framing::Json ||
+           version == (unsigned char)Framing::Binary;
+}
+
+void encodeMessage(Framing framing, MessageType const & type,
+                   MessageEntity const & entity, std::string & out) {
+    Writer writer;
+    writer.begin(framing, type, out).value(entity);
+    writer.end();
+}
+
+Frame encodeFrame(Framing framing, MessageType const & type,
+                  MessageEntity const & entity) {
+    std::shared_ptr<std::string> frame = std::make_shared<std::string>();
+    encodeMessage(framing, type, entity, *frame);
+    return frame;
+}
+
+namespace wire {
+
+void putVarint(std::string & out, std::uint64_t value) {
+    while (value >= 0x80) {
+        out += (char)((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out += (char)value;
+}
+
+int getVarint(char const * data, std::size_t size, std::uint64_t & value) {
+    value = 0;
+    for (std::size_t i = 0; i < 10; i++) {
+        if (i == size) {
+            return 0;
+        }
+        unsigned char byte = data[i];
+        value |= (std::uint64_t)(byte & 0x7F) << (i * 7);
+        if (!(byte & 0x80)) {
+            return i + 1;
+        }
+    }
+    return -1;
+}
+
+void encodeEntity(std::string & out, MessageEntity const & entity) {
+    switch (entity.type()) {
+    case json11::Json::NUL:
+        out += (char)TAG_NULL;
+        break;
+    case json11::Json::BOOL:
+        out += (char)(entity.bool_value() ? TAG_TRUE : TAG_FALSE);
+        break;
+    case json11::Json::NUMBER: {
+        double value = entity.number_value();
+        if (value >= -2147483648.0 && value <= 2147483647.0 &&
+            value == (double)(std::int32_t)value) {
+            std::int32_t integer = (std::int32_t)value;
+            out += (char)TAG_INT;
+            putVarint(out, ((std::uint32_t)integer << 1) ^
+                                (std::uint32_t)(integer >> 31));
+        } else {
+            std::uint64_t bits;
+            std::memcpy(&bits, &value, sizeof bits);
+            out += (char)TAG_DOUBLE;
+            for (int i = 0; i < 8; i++) {
+                out += (char)(bits >> (i * 8));
+            }
+        }
+        break;
+    }
+    case json11::Json::STRING:
+        out += (char)TAG_STRING;
+        putString(out, entity.string_value());
+        break;
+    case json11::Json::ARRAY:
+        out += (char)TAG_ARRAY;
+        putVarint(out, entity.array_items().size());
+        for (auto const & element : entity.array_items()) {
+            encodeEntity(out, element);
+        }
+        break;
+    case json11::Json::OBJECT:
+        out += (char)TAG_OBJECT;
+        putVarint(out, entity.object_items().size());
+        for (auto const & pair : entity.object_items()) {
+            putString(out, pair.first);
+            encodeEntity(out, pair.second);
+        }
+        break;
+    }
+}
+
+bool decodeEntity(char const *& data, char const * end,
+                  MessageEntity & entity) {
+    return decodeValue(data, end, entity, 0);
+}
+
+bool decodeEntity(char const *& data, char const * end,
+                  json::Document & document, json::Value & entity) {
+    return decodeValue(data, end, document, entity, 0);
+}
+
+void encodeArrayPrefix(std::string & out, MessageType const & type,
+                       json11::Json::array const & head, std::size_t size) {
+    std::string body;
+    unsigned id = messageTypeId(type);
+    putVarint(body, id);
+    if (id == 0) {
+        putString(body, type);
+    }
+    body += (char)TAG_ARRAY;
+    putVarint(body, head.size() + 1);
+    for (auto const & element : head) {
+        encodeEntity(body, element);
+    }
+    body += (char)TAG_STRING;
+    putVarint(body, size);
+    putVarint(out, body.size() + size);
+    out.append(body);
+}
+
+bool decodeMessage(char const * data, std::size_t size, MessageType & type,
+                   MessageEntity & entity, std::string & error) {
+    char const * end = data + size;
+    if (!decodeType(data, end, type, error)) {
+        return false;
+    }
+    if (!decodeEntity(data, end, entity) || data != end) {
+        error = "Malformed message entity";
+        return false;
+    }
+    return true;
+}
+
+bool decodeMessage(char const * data, std::size_t size, MessageType & type,
+                   json::Document & document, json::Value & entity,
+                   std::string & error) {
+    char const * end = data + size;
+    if (!decodeType(data, end, type, error)) {
+        return false;
+    }
+    if (!decodeEntity(data, end, document, entity) || data != end) {
+        error = "Malformed message entity";
+        return false;
+    }
+    return true;
+}
+
+unsigned messageTypeId(MessageType const & type) {
+    static std::unordered_map<MessageType, unsigned> const ids = [] {
+        std::unordered_map<MessageType, unsigned> ids;
+        for (std::size_t i = 0; i < message_type_count; i++) {
+            ids[message_types[i]] = i + 1;
+        }
+        return ids;
+    }();
+    auto id = ids.find(type);
+    return id == ids.end() ? 0 : id->second;
+}
+
+MessageType const * messageTypeName(unsigned id) {
+    if (id == 0 || id > message_type_count) {
+        return nullptr;
+    }
+    return &message_types[id - 1];
+}
+
+} // namespace wire
+} // namespace net
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <tuple>
+
+#include "common/extlib/json11/json11.hpp"
+#include "common/util/json.hpp"
+
+/// The handshake magic number minus its last octet
+///
+/// The last octet is the protocol version, which selects the `Framing` used
+/// for the rest of the connection.
+#define MAGIC_PREFIX "\xCA\xC3\x55"
+#define MAGIC_PREFIX_SIZE 3
+#define MAGIC_NUMBER_SIZE 4
+
+namespace net {
+
+typedef std::string MessageType;
+typedef json11::Json MessageEntity;
+typedef std::tuple<MessageType, MessageEntity> Message;
+
+/// An encoded message which can be shared between connections
+///
+/// Frames are immutable once encoded, so a message that's broadcast to many
+/// connections can be encoded once and queued on each of them by pointer.
+typedef std::shared_ptr<std::string const> Frame;
+
+/// How messages are encoded on a connection
+///
+/// The value of each framing is the protocol version octet which requests it
+/// during the handshake.
+enum class Framing : unsigned char {
+    /// Whitespace-delimited JSON objects with `type` and `entity` fields
+    Json = 0x01,
+    /// Length-prefixed binary frames
+    ///
+    /// Each frame is a varint length followed by that many bytes of body.
+    /// The body is the varint message type ID (see `wire::messageTypeId`),
+    /// followed by the entity in the compact encoding described by
+    /// `wire::encodeEntity`. Message types without an ID are sent as ID zero
+    /// followed by the type name as a varint-length-prefixed string.
+    Binary = 0x02,
+};
+
+/// Get the handshake magic number which requests the given framing
+std::string magicNumber(Framing framing);
+
+/// Check if a protocol version octet is one we can speak
+bool isSupportedFraming(unsigned char version);
+
+/// Encode a message and append it to `out`
+///
+/// JSON messages are terminated with a single space. See `Writer` for
+/// encoding messages without building a json11::Json first.
+void encodeMessage(Framing framing, MessageType const & type,
+                   MessageEntity const & entity, std::string & out);
+
+/// Encode a message into a new frame
+Frame encodeFrame(Framing framing, MessageType const & type,
+                  MessageEntity const & entity);
+
+/// Low-level encoding used by the binary framing
+namespace wire {
+
+/// Largest binary frame body that will be accepted
+const std::size_t MAX_FRAME_SIZE = 16 * 1024 * 1024;
+
+/// The tag byte each value in the compact binary encoding starts with
+enum Tag : unsigned char {
+    TAG_NULL = 0,
+    TAG_FALSE,
+    TAG_TRUE,
+    TAG_INT,
+    TAG_DOUBLE,
+    TAG_STRING,
+    TAG_ARRAY,
+    TAG_OBJECT,
+};
+
+/// Append an unsigned LEB128 varint to `out`
+void putVarint(std::string & out, std::uint64_t value);
+
+/// Decode an unsigned LEB128 varint
+///
+/// @return The number of bytes consumed, zero if `size` bytes aren't enough
+///     to hold the whole varint, or -1 if the varint is too long to be valid.
+int getVarint(char const * data, std::size_t size, std::uint64_t & value);
+
+/// Append the compact binary encoding of a JSON value to `out`
+///
+/// Each value starts with a tag byte. Integral numbers that fit in 32 bits
+/// are encoded as zigzag varints and other numbers as little-endian IEEE
+/// doubles. Strings are varint-length-prefixed, arrays are a varint count
+/// followed by the values, and objects a varint count followed by key/value
+/// pairs with the keys encoded like strings but without a tag.
+void encodeEntity(std::string & out, MessageEntity const & entity);
+
+/// Decode a value encoded by `encodeEntity`
+///
+/// `data` is advanced past the decoded value. Returns false if the encoding
+/// is malformed or truncated.
+bool decodeEntity(char const *& data, char const * end,
+                  MessageEntity & entity);
+
+/// Decode a value encoded by `encodeEntity` into a document
+///
+/// Strings refer to the encoded data rather than being copied, so it must
+/// outlive the value, and arrays and objects are kept in `document`.
+bool decodeEntity(char const *& data, char const * end,
+                  common::util::json::Document & document,
+                  common::util::json::Value & entity);
+
+/// Encode a binary frame for an array ending in a string, up to its bytes
+///
+/// The entity is the elements of `head` followed by a string of `size`
+/// bytes. The string's bytes themselves aren't included and must be sent
+/// straight after the prefix. This is so large payloads such as files can be
+/// sent as they are rather than first being copied into a frame.
+void encodeArrayPrefix(std::string & out, MessageType const & type,
+                       json11::Json::array const & head, std::size_t size);
+
+/// Decode a binary frame body
+bool decodeMessage(char const * data, std::size_t size, MessageType & type,
+                   MessageEntity & entity, std::string & error);
+
+/// Decode a binary frame body into a document; see the decodeEntity() that
+/// takes one
+bool decodeMessage(char const * data, std::size_t size, MessageType & type,
+                   common::util::json::Document & document,
+                   common::util::json::Value & entity, std::string & error);
+
+/// Get the numeric ID of a message type, or zero if it doesn't have one
+unsigned messageTypeId(MessageType const & type);
+
+/// Get the message type for a numeric ID, or nullptr if there isn't one
+MessageType const * messageTypeName(unsigned id);
+
+} // namespace wire
+} // namespace net
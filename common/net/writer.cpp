@@ -0,0 +1,360 @@
+#include "common/net/writer.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace json = common::util::json;
+
+namespace net {
+
+namespace {
+char const hex_digits[] = "0123456789abcdef";
+
+/// The largest magnitude below which every integer is exactly a double
+double const MAX_EXACT_INTEGER = 9007199254740992.0;
+} // Anonymous namespace
+
+Writer::Writer() : m_framing(Framing::Json), m_out(nullptr), m_start(0) {}
+
+Writer & Writer::begin(Framing framing, MessageType const & type,
+                       std::string & out) {
+    m_framing = framing;
+    m_out = &out;
+    m_start = out.size();
+    m_open.clear();
+    if (framing == Framing::Json) {
+        out += "{\"type\": ";
+        quote(type.data(), type.size());
+        out += ", \"entity\": ";
+        return *this;
+    }
+    // Room for the length prefix
+    out += '\0';
+    unsigned id = wire::messageTypeId(type);
+    wire::putVarint(out, id);
+    if (id == 0) {
+        wire::putVarint(out, type.size());
+        out.append(type);
+    }
+    return *this;
+}
+
+void Writer::end() {
+    if (m_framing == Framing::Json) {
+        *m_out += "} ";
+    } else {
+        patchVarint(m_start, m_out->size() - m_start - 1);
+    }
+    m_out = nullptr;
+}
+
+Writer & Writer::beginArray() { return open('[', wire::TAG_ARRAY, false); }
+
+Writer & Writer::endArray() { return close(']'); }
+
+Writer & Writer::beginObject() { return open('{', wire::TAG_OBJECT, true); }
+
+Writer & Writer::endObject() { return close('}'); }
+
+Writer & Writer::key(json::StringView key) {
+    Container & container = m_open.back();
+    if (m_framing == Framing::Json) {
+        if (container.count > 0) {
+            *m_out += ", ";
+        }
+        quote(key.data(), key.size());
+        *m_out += ": ";
+    } else {
+        wire::putVarint(*m_out, key.size());
+        m_out->append(key.data(), key.size());
+    }
+    container.count++;
+    return *this;
+}
+
+Writer & Writer::value(std::nullptr_t) {
+    separate();
+    if (m_framing == Framing::Json) {
+        *m_out += "null";
+    } else {
+        *m_out += (char)wire::TAG_NULL;
+    }
+    return *this;
+}
+
+Writer & Writer::value(bool value) {
+    separate();
+    if (m_framing == Framing::Json) {
+        *m_out += value ? "true" : "false";
+    } else {
+        *m_out += (char)(value ? wire::TAG_TRUE : wire::TAG_FALSE);
+    }
+    return *this;
+}
+
+Writer & Writer::value(int value) {
+    return this->value((std::int64_t)value);
+}
+
+Writer & Writer::value(unsigned value) {
+    return this->value((std::uint64_t)value);
+}
+
+Writer & Writer::value(std::int64_t value) {
+    separate();
+    // Negated as unsigned, as -INT64_MIN overflows
+    writeInteger(value < 0, value < 0 ? -(std::uint64_t)value : value);
+    return *this;
+}
+
+Writer & Writer::value(std::uint64_t value) {
+    separate();
+    writeInteger(false, value);
+    return *this;
+}
+
+Writer & Writer::value(double value) {
+    separate();
+    // Numbers are all doubles to JSON, so ones which hold integers (which
+    // is nearly all of them) are written like integers. The range check
+    // comes first as converting anything outside it, such as NaN, is
+    // undefined.
+    if (value >= -MAX_EXACT_INTEGER && value <= MAX_EXACT_INTEGER &&
+        value == (double)(std::int64_t)value) {
+        writeInteger(value < 0, (std::uint64_t)std::fabs(value));
+    } else if (m_framing == Framing::Json) {
+        if (std::isfinite(value)) {
+            char buffer[32];
+            int size = std::snprintf(buffer, sizeof buffer, "%.17g", value);
+            m_out->append(buffer, size);
+        } else {
+            // JSON has no infinity or NaN
+            *m_out += "null";
+        }
+    } else {
+        std::uint64_t bits;
+        std::memcpy(&bits, &value, sizeof bits);
+        *m_out += (char)wire::TAG_DOUBLE;
+        for (int i = 0; i < 8; i++) {
+            *m_out += (char)(bits >> (i * 8));
+        }
+    }
+    return *this;
+}
+
+Writer & Writer::value(char const * value) {
+    return this->value(json::StringView(value));
+}
+
+Writer & Writer::value(std::string const & value) {
+    return this->value(json::StringView(value));
+}
+
+Writer & Writer::value(json::StringView value) {
+    separate();
+    if (m_framing == Framing::Json) {
+        quote(value.data(), value.size());
+    } else {
+        *m_out += (char)wire::TAG_STRING;
+        wire::putVarint(*m_out, value.size());
+        m_out->append(value.data(), value.size());
+    }
+    return *this;
+}
+
+Writer & Writer::value(json::Value const & value) {
+    switch (value.type()) {
+    case json::Value::NUL:
+        return this->value(nullptr);
+    case json::Value::NUMBER:
+        return this->value(value.number_value());
+    case json::Value::BOOL:
+        return this->value(value.bool_value());
+    case json::Value::STRING:
+        return this->value(value.string_value());
+    case json::Value::ARRAY:
+        beginArray();
+        for (auto const & item : value.array_items()) {
+            this->value(item);
+        }
+        return endArray();
+    case json::Value::OBJECT:
+        beginObject();
+        for (auto const & member : value.object_items()) {
+            key(member.first).value(member.second);
+        }
+        return endObject();
+    }
+    return *this;
+}
+
+Writer & Writer::value(json11::Json const & value) {
+    switch (value.type()) {
+    case json11::Json::NUL:
+        return this->value(nullptr);
+    case json11::Json::NUMBER:
+        return this->value(value.number_value());
+    case json11::Json::BOOL:
+        return this->value(value.bool_value());
+    case json11::Json::STRING:
+        return this->value(value.string_value());
+    case json11::Json::ARRAY:
+        beginArray();
+        for (auto const & item : value.array_items()) {
+            this->value(item);
+        }
+        return endArray();
+    case json11::Json::OBJECT:
+        beginObject();
+        for (auto const & member : value.object_items()) {
+            key(member.first).value(member.second);
+        }
+        return endObject();
+    }
+    return *this;
+}
+
+void Writer::separate() {
+    // Members of objects are counted and separated by key()
+    if (m_open.empty() || m_open.back().object) {
+        return;
+    }
+    Container & container = m_open.back();
+    if (m_framing == Framing::Json && container.count > 0) {
+        *m_out += ", ";
+    }
+    container.count++;
+}
+
+Writer & Writer::open(char bracket, wire::Tag tag, bool object) {
+    separate();
+    if (m_framing == Framing::Json) {
+        *m_out += bracket;
+    } else {
+        *m_out += (char)tag;
+        // Room for the count
+        *m_out += '\0';
+    }
+    m_open.push_back(Container{m_out->size() - 1, 0, object});
+    return *this;
+}
+
+Writer & Writer::close(char bracket) {
+    if (m_framing == Framing::Json) {
+        *m_out += bracket;
+    } else {
+        patchVarint(m_open.back().count_offset, m_open.back().count);
+    }
+    m_open.pop_back();
+    return *this;
+}
+
+void Writer::patchVarint(std::size_t offset, std::uint64_t value) {
+    if (value < 0x80) {
+        (*m_out)[offset] = (char)value;
+        return;
+    }
+    char bytes[10];
+    std::size_t size = 0;
+    while (value >= 0x80) {
+        bytes[size++] = (char)((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    bytes[size++] = (char)value;
+    (*m_out)[offset] = bytes[0];
+    m_out->insert(offset + 1, bytes + 1, size - 1);
+}
+
+void Writer::writeInteger(bool negative, std::uint64_t magnitude) {
+    if (m_framing == Framing::Json) {
+        // Digits are produced backwards from the end of the buffer
+        char buffer[21];
+        char * digits = buffer + sizeof buffer;
+        do {
+            *--digits = (char)('0' + magnitude % 10);
+            magnitude /= 10;
+        } while (magnitude > 0);
+        if (negative) {
+            *--digits = '-';
+        }
+        m_out->append(digits, buffer + sizeof buffer - digits);
+        return;
+    }
+    // The same as wire::encodeEntity(): 32 bit integers as zigzag varints
+    // and anything bigger as a double
+    if (magnitude <= (negative ? 0x80000000u : 0x7FFFFFFFu)) {
+        std::uint32_t zigzag = negative ? (std::uint32_t)(magnitude * 2 - 1)
+                                        : (std::uint32_t)(magnitude * 2);
+        *m_out += (char)wire::TAG_INT;
+        wire::putVarint(*m_out, zigzag);
+        return;
+    }
+    double value = negative ? -(double)magnitude : (double)magnitude;
+    std::uint64_t bits;
+    std::memcpy(&bits, &value, sizeof bits);
+    *m_out += (char)wire::TAG_DOUBLE;
+    for (int i = 0; i < 8; i++) {
+        *m_out += (char)(bits >> (i * 8));
+    }
+}
+
+void Writer::quote(char const * data, std::size_t size) {
+    *m_out += '"';
+    // Runs of characters which don't need escaping are appended whole
+    std::size_t run = 0;
+    for (std::size_t i = 0; i < size; i++) {
+        unsigned char ch = data[i];
+        char escape[7] = {'\\', 0, 0, 0, 0, 0, 0};
+        std::size_t length = 2;
+        std::size_t skip = 0;
+        switch (ch) {
+        case '"':
+        case '\\':
+            escape[1] = ch;
+            break;
+        case '\b':
+            escape[1] = 'b';
+            break;
+        case '\f':
+            escape[1] = 'f';
+            break;
+        case '\n':
+            escape[1] = 'n';
+            break;
+        case '\r':
+            escape[1] = 'r';
+            break;
+        case '\t':
+            escape[1] = 't';
+            break;
+        default:
+            if (ch <= 0x1F) {
+                std::memcpy(escape + 1, "u00", 3);
+                escape[4] = hex_digits[ch >> 4];
+                escape[5] = hex_digits[ch & 0xF];
+                length = 6;
+            } else if (ch == 0xE2 && i + 2 < size &&
+                       (unsigned char)data[i + 1] == 0x80 &&
+                       ((unsigned char)data[i + 2] == 0xA8 ||
+                        (unsigned char)data[i + 2] == 0xA9)) {
+                // U+2028 and U+2029 are valid in JSON strings but not in
+                // JavaScript ones, so json11 escapes them too
+                std::memcpy(escape + 1, "u202", 4);
+                escape[5] = data[i + 2] == '\xA8' ? '8' : '9';
+                length = 6;
+                skip = 2;
+            } else {
+                continue;
+            }
+        }
+        m_out->append(data + run, i - run);
+        m_out->append(escape, length);
+        i += skip;
+        run = i + 1;
+    }
+    m_out->append(data + run, size - run);
+    *m_out += '"';
+}
+
+} // namespace net
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "common/extlib/json11/json11.hpp"
+#include "common/net/wire.hpp"
+#include "common/util/json.hpp"
+
+namespace net {
+
+/// Encode a message straight into a buffer, one value at a time
+///
+/// `encodeMessage` needs the entity built as a json11::Json first, which
+/// costs an allocation for every value in it, and then for JSON wraps it in
+/// another object and dumps that to a string of its own. A writer instead
+/// appends the message to the end of a buffer as it's described, in either
+/// framing, so a buffer which is reused doesn't allocate at all once it's
+/// grown big enough.
+///
+/// The entity is described the way a SAX parser reports one: containers are
+/// opened and closed around their values, and each member of an object is a
+/// key() followed by its value. The binary framing needs the number of
+/// values in each container and the size of the frame up front, so a byte is
+/// set aside for each and filled in when it's closed. Only if it turns out
+/// to need a longer varint is what follows moved along.
+///
+/// Integers are formatted without going through printf, as are numbers
+/// which are doubles holding an integer. Other doubles are formatted like
+/// json11 does so they survive the trip exactly.
+///
+/// @code
+/// Writer writer;
+/// writer.begin(Framing::Binary, "input", out);
+/// writer.beginArray().value(entity).value(buttons).endArray();
+/// writer.end();
+/// @endcode
+class Writer {
+public:
+    Writer();
+
+    /// Start a message, which is appended to `out`
+    ///
+    /// The message's entity must then be written as exactly one value,
+    /// followed by a call to end(). `out` mustn't be changed in between.
+    Writer & begin(Framing framing, MessageType const & type,
+                   std::string & out);
+
+    /// Finish the message
+    void end();
+
+    Writer & beginArray();
+    Writer & endArray();
+    Writer & beginObject();
+    Writer & endObject();
+
+    /// Start a member of an object, which must be followed by its value
+    Writer & key(common::util::json::StringView key);
+
+    Writer & value(std::nullptr_t);
+    Writer & value(bool value);
+    Writer & value(int value);
+    Writer & value(unsigned value);
+    Writer & value(std::int64_t value);
+    Writer & value(std::uint64_t value);
+    Writer & value(double value);
+    Writer & value(char const * value);
+    Writer & value(std::string const & value);
+    Writer & value(common::util::json::StringView value);
+    /// Write a whole value, such as one which was received
+    Writer & value(common::util::json::Value const & value);
+    Writer & value(json11::Json const & value);
+
+private:
+    /// An array or object which hasn't been closed yet
+    struct Container {
+        /// Where its count's byte was set aside, for the binary framing
+        std::size_t count_offset;
+        /// Values or members written to it so far
+        std::size_t count;
+        bool object;
+    };
+
+    Framing m_framing;
+    std::string * m_out;
+    /// Where the message starts in `m_out`
+    std::size_t m_start;
+    /// The containers that are open, innermost last
+    ///
+    /// This keeps its capacity between messages, so it's only allocated
+    /// when a message is nested deeper than any before it.
+    std::vector<Container> m_open;
+
+    /// Count a value and write what goes before it
+    void separate();
+    /// Open a container which starts with `bracket` or `tag`
+    Writer & open(char bracket, wire::Tag tag, bool object);
+    /// Close the innermost container with `bracket`
+    Writer & close(char bracket);
+    /// Fill in a varint set aside as one byte at `offset`
+    void patchVarint(std::size_t offset, std::uint64_t value);
+
+    /// Write an integer, given its sign and magnitude so that the whole
+    /// range of both int64_t and uint64_t fits
+    void writeInteger(bool negative, std::uint64_t magnitude);
+    /// Append a string quoted and escaped for JSON
+    void quote(char const * data, std::size_t size);
+};
+
+} // namespace net
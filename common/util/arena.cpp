@@ -0,0 +1,48 @@
+#include "common/util/arena.hpp"
+
+namespace common {
+namespace util {
+namespace container {
+
+Arena::Arena(std::size_t block_size)
+    : m_block_size(block_size), m_current(0), m_offset(0) {}
+
+void * Arena::allocate(std::size_t size, std::size_t alignment) {
+    while (m_current < m_blocks.size()) {
+        Block & block = m_blocks[m_current];
+        std::size_t offset = (m_offset + alignment - 1) & ~(alignment - 1);
+        if (offset + size <= block.size) {
+            m_offset = offset + size;
+            return block.data.get() + offset;
+        }
+        // Move on to the next block, which may be big enough if it was
+        // added for a large allocation before the last clear()
+        m_current++;
+        m_offset = 0;
+    }
+    // new[] returns memory aligned for any fundamental type, so only
+    // over-aligned types would need more than the start of a block
+    std::size_t block_size = size > m_block_size ? size : m_block_size;
+    m_blocks.push_back(Block{std::unique_ptr<char[]>(new char[block_size]),
+                             block_size});
+    m_current = m_blocks.size() - 1;
+    m_offset = size;
+    return m_blocks.back().data.get();
+}
+
+void Arena::clear() {
+    m_current = 0;
+    m_offset = 0;
+}
+
+std::size_t Arena::capacity() const {
+    std::size_t capacity = 0;
+    for (auto const & block : m_blocks) {
+        capacity += block.size;
+    }
+    return capacity;
+}
+
+} // namespace container
+} // namespace util
+} // namespace common
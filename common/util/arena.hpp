@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace common {
+
+namespace util {
+namespace container {
+
+/// A bump allocator for short-lived objects which are all freed at once
+///
+/// Memory is handed out from the front of large blocks by advancing an
+/// offset, and is only ever reclaimed by clear(), which frees everything
+/// allocated since the last clear. The blocks themselves are kept for reuse,
+/// so once an arena has grown to the most it's needed at once it never
+/// allocates again.
+///
+/// Only trivially destructible objects should be put in an arena, as nothing
+/// in it is ever destroyed.
+///
+/// @code
+/// Arena arena;
+/// int * numbers = arena.allocate<int>(16);
+/// ...
+/// arena.clear();
+/// @endcode
+class Arena {
+public:
+    /// @param block_size Size of each block in bytes; larger allocations get
+    ///     a block of their own
+    explicit Arena(std::size_t block_size = 4096);
+
+    /// Allocate `size` bytes aligned to `alignment`, a power of two
+    void * allocate(std::size_t size, std::size_t alignment);
+
+    /// Allocate uninitialised space for `count` objects of type `T`
+    template <class T> T * allocate(std::size_t count) {
+        return static_cast<T *>(allocate(count * sizeof(T), alignof(T)));
+    }
+
+    /// Free everything allocated, keeping the blocks for reuse
+    void clear();
+
+    /// Number of bytes in all the arena's blocks
+    std::size_t capacity() const;
+
+    Arena(Arena const &) = delete;
+    Arena & operator=(Arena const &) = delete;
+
+private:
+    struct Block {
+        std::unique_ptr<char[]> data;
+        std::size_t size;
+    };
+
+    std::size_t m_block_size;
+    std::vector<Block> m_blocks;
+    /// Index of the block being allocated from
+    std::size_t m_current;
+    /// Offset of the free space in the current block
+    std::size_t m_offset;
+};
+
+} // namespace container
+} // namespace util
+} // namespace common
@@ -0,0 +1,386 @@
+#include "base64.hpp"
+
+#include <cstdint>
+
+#if (defined(__GNUC__) || defined(__clang__)) &&                             \
+    (defined(__x86_64__) || defined(__i386__))
+#define BASE64_X86
+#include <immintrin.h>
+#endif
+
+namespace common {
+namespace util {
+namespace base64 {
+
+namespace {
+char const alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/// Value of each character, or 0xFF if it isn't in the alphabet
+struct DecodeTable {
+    unsigned char values[256];
+
+    DecodeTable() {
+        for (auto & value : values) {
+            value = 0xFF;
+        }
+        for (int i = 0; i < 64; i++) {
+            values[(unsigned char)alphabet[i]] = i;
+        }
+    }
+};
+
+DecodeTable const decode_table;
+
+/// Encode whole groups of three bytes, returning how many bytes were used
+typedef std::size_t (*EncodeBlocks)(unsigned char const * data,
+                                    std::size_t size, char * out);
+
+/// Decode whole groups of four characters, stopping at the first group
+/// which isn't valid, and returning how many characters were used
+typedef std::size_t (*DecodeBlocks)(char const * data, std::size_t size,
+                                    unsigned char * out);
+
+std::size_t encodeScalar(unsigned char const * data, std::size_t size,
+                         char * out) {
+    std::size_t i = 0;
+    for (; size - i >= 3; i += 3) {
+        std::uint32_t group = (std::uint32_t)data[i] << 16 |
+                              (std::uint32_t)data[i + 1] << 8 | data[i + 2];
+        *out++ = alphabet[group >> 18];
+        *out++ = alphabet[(group >> 12) & 0x3F];
+        *out++ = alphabet[(group >> 6) & 0x3F];
+        *out++ = alphabet[group & 0x3F];
+    }
+    return i;
+}
+
+std::size_t decodeScalar(char const * data, std::size_t size,
+                         unsigned char * out) {
+    unsigned char const * values = decode_table.values;
+    std::size_t i = 0;
+    for (; size - i >= 4; i += 4) {
+        std::uint32_t a = values[(unsigned char)data[i]];
+        std::uint32_t b = values[(unsigned char)data[i + 1]];
+        std::uint32_t c = values[(unsigned char)data[i + 2]];
+        std::uint32_t d = values[(unsigned char)data[i + 3]];
+        if ((a | b | c | d) & 0x80) {
+            break;
+        }
+        std::uint32_t group = a << 18 | b << 12 | c << 6 | d;
+        *out++ = group >> 16;
+        *out++ = group >> 8;
+        *out++ = group;
+    }
+    return i;
+}
+
+#ifdef BASE64_X86
+// These follow Wojciech Muła and Daniel Lemire, "Faster Base64 Encoding and
+// Decoding Using AVX2 Instructions" (2018).
+
+/// Split 12 bytes in each 128-bit lane into 16 six-bit indices and map them
+/// to the alphabet
+__attribute__((target("ssse3"))) __m128i encodeLane(__m128i in) {
+    // Gather each group of three bytes into a 32-bit word, as bytes
+    // b1 b0 b2 b1, then move each six bits to the bottom of its own byte
+    in = _mm_shuffle_epi8(
+        in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0FC0FC00));
+    __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003F03F0));
+    __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    __m128i indices = _mm_or_si128(t1, t3);
+    // Each range of the alphabet is a run of ASCII, so the character is the
+    // index plus an offset which depends on which range it's in
+    __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    __m128i lower = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    range = _mm_or_si128(range, _mm_and_si128(lower, _mm_set1_epi8(13)));
+    __m128i offsets = _mm_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    return _mm_add_epi8(indices, _mm_shuffle_epi8(offsets, range));
+}
+
+__attribute__((target("ssse3"))) std::size_t
+encodeSSSE3(unsigned char const * data, std::size_t size, char * out) {
+    std::size_t i = 0;
+    // Each step loads 16 bytes but only uses 12
+    for (; size - i >= 16; i += 12, out += 16) {
+        __m128i in = _mm_loadu_si128((__m128i const *)(data + i));
+        _mm_storeu_si128((__m128i *)out, encodeLane(in));
+    }
+    return i + encodeScalar(data + i, size - i, out);
+}
+
+__attribute__((target("avx2"))) std::size_t
+encodeAVX2(unsigned char const * data, std::size_t size, char * out) {
+    std::size_t i = 0;
+    // Each step loads 28 bytes but only uses 24
+    for (; size - i >= 28; i += 24, out += 32) {
+        __m256i in = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(
+                _mm_loadu_si128((__m128i const *)(data + i))),
+            _mm_loadu_si128((__m128i const *)(data + i + 12)), 1);
+        in = _mm256_shuffle_epi8(
+            in, _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0,
+                                1, 10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1,
+                                2, 0, 1));
+        __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0FC0FC00));
+        __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003F03F0));
+        __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        __m256i indices = _mm256_or_si256(t1, t3);
+        __m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        __m256i lower = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+        range = _mm256_or_si256(range,
+                                _mm256_and_si256(lower, _mm256_set1_epi8(13)));
+        __m256i offsets = _mm256_setr_epi8(
+            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+            '/' - 63, 'A', 0, 0, 'a' - 26, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+        __m256i result =
+            _mm256_add_epi8(indices, _mm256_shuffle_epi8(offsets, range));
+        _mm256_storeu_si256((__m256i *)out, result);
+    }
+    return i + encodeSSSE3(data + i, size - i, out);
+}
+
+/// Map 16 characters to their six-bit values
+///
+/// Returns false if any of them aren't in the alphabet.
+__attribute__((target("ssse3"))) bool decodeLane(__m128i & in) {
+    // Classify each character by its high and low nibbles; a character is
+    // invalid if the classes of its nibbles have a bit in common
+    __m128i high = _mm_and_si128(_mm_srli_epi32(in, 4), _mm_set1_epi8(0x0F));
+    __m128i low = _mm_and_si128(in, _mm_set1_epi8(0x0F));
+    __m128i low_classes = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                        0x11, 0x11, 0x11, 0x11, 0x13, 0x1A,
+                                        0x1B, 0x1B, 0x1B, 0x1A);
+    __m128i high_classes = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08,
+                                         0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+                                         0x10, 0x10, 0x10, 0x10);
+    __m128i invalid =
+        _mm_and_si128(_mm_shuffle_epi8(low_classes, low),
+                      _mm_shuffle_epi8(high_classes, high));
+    if (_mm_movemask_epi8(_mm_cmpgt_epi8(invalid, _mm_setzero_si128()))) {
+        return false;
+    }
+    // Then it's the character plus an offset which depends on the high
+    // nibble, except '/' which shares a high nibble with '+'
+    __m128i slash = _mm_cmpeq_epi8(in, _mm_set1_epi8('/'));
+    __m128i offsets = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0,
+                                    0, 0, 0, 0, 0, 0);
+    in = _mm_add_epi8(
+        in, _mm_shuffle_epi8(offsets, _mm_add_epi8(slash, high)));
+    return true;
+}
+
+/// Pack 16 six-bit values into 12 bytes at the start of the lane
+__attribute__((target("ssse3"))) __m128i packLane(__m128i values) {
+    __m128i pairs =
+        _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    __m128i words = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+    return _mm_shuffle_epi8(words, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8,
+                                                 14, 13, 12, -1, -1, -1, -1));
+}
+
+__attribute__((target("ssse3"))) std::size_t
+decodeSSSE3(char const * data, std::size_t size, unsigned char * out) {
+    std::size_t i = 0;
+    // Each step stores 16 bytes but only 12 are decoded, so stop while
+    // there's certainly enough input left for the rest of them to be
+    // overwritten
+    for (; size - i >= 24; i += 16, out += 12) {
+        __m128i in = _mm_loadu_si128((__m128i const *)(data + i));
+        if (!decodeLane(in)) {
+            break;
+        }
+        _mm_storeu_si128((__m128i *)out, packLane(in));
+    }
+    return i + decodeScalar(data + i, size - i, out);
+}
+
+__attribute__((target("avx2"))) std::size_t
+decodeAVX2(char const * data, std::size_t size, unsigned char * out) {
+    std::size_t i = 0;
+    for (; size - i >= 48; i += 32, out += 24) {
+        __m256i in = _mm256_loadu_si256((__m256i const *)(data + i));
+        __m256i high =
+            _mm256_and_si256(_mm256_srli_epi32(in, 4), _mm256_set1_epi8(0x0F));
+        __m256i low = _mm256_and_si256(in, _mm256_set1_epi8(0x0F));
+        __m256i low_classes = _mm256_setr_epi8(
+            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13,
+            0x1A, 0x1B, 0x1B, 0x1B, 0x1A, 0x15, 0x11, 0x11, 0x11, 0x11, 0x11,
+            0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+        __m256i high_classes = _mm256_setr_epi8(
+            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10,
+            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x01, 0x02, 0x04, 0x08,
+            0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+        __m256i invalid =
+            _mm256_and_si256(_mm256_shuffle_epi8(low_classes, low),
+                             _mm256_shuffle_epi8(high_classes, high));
+        if (_mm256_movemask_epi8(
+                _mm256_cmpgt_epi8(invalid, _mm256_setzero_si256()))) {
+            break;
+        }
+        __m256i slash = _mm256_cmpeq_epi8(in, _mm256_set1_epi8('/'));
+        __m256i offsets = _mm256_setr_epi8(
+            0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0, 0, 16,
+            19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+        in = _mm256_add_epi8(
+            in, _mm256_shuffle_epi8(offsets, _mm256_add_epi8(slash, high)));
+        __m256i pairs =
+            _mm256_maddubs_epi16(in, _mm256_set1_epi32(0x01400140));
+        __m256i words = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+        __m256i packed = _mm256_shuffle_epi8(
+            words, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1,
+                                    -1, -1, -1, 2, 1, 0, 6, 5, 4, 10, 9, 8, 14,
+                                    13, 12, -1, -1, -1, -1));
+        // Close the gap between the 12 bytes from each lane
+        packed = _mm256_permutevar8x32_epi32(
+            packed, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+        _mm256_storeu_si256((__m256i *)out, packed);
+    }
+    return i + decodeSSSE3(data + i, size - i, out);
+}
+#endif
+
+struct Codec {
+    Path path;
+    EncodeBlocks encode;
+    DecodeBlocks decode;
+};
+
+Codec codecFor(Path path) {
+    if (!isSupported(path)) {
+        path = bestPath();
+    }
+    switch (path) {
+#ifdef BASE64_X86
+    case Path::AVX2:
+        return Codec{path, encodeAVX2, decodeAVX2};
+    case Path::SSSE3:
+        return Codec{path, encodeSSSE3, decodeSSSE3};
+#endif
+    default:
+        return Codec{Path::Scalar, encodeScalar, decodeScalar};
+    }
+}
+
+Codec & codec() {
+    static Codec codec = codecFor(bestPath());
+    return codec;
+}
+} // Anonymous namespace
+
+Path bestPath() {
+    if (isSupported(Path::AVX2)) {
+        return Path::AVX2;
+    } else if (isSupported(Path::SSSE3)) {
+        return Path::SSSE3;
+    }
+    return Path::Scalar;
+}
+
+bool isSupported(Path path) {
+#ifdef BASE64_X86
+    // Needed in case this is called before main()
+    __builtin_cpu_init();
+#endif
+    switch (path) {
+    case Path::Scalar:
+        return true;
+#ifdef BASE64_X86
+    case Path::SSSE3:
+        return __builtin_cpu_supports("ssse3");
+    case Path::AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+void usePath(Path path) { codec() = codecFor(path); }
+
+Path currentPath() { return codec().path; }
+
+std::size_t encodedSize(std::size_t size) { return (size + 2) / 3 * 4; }
+
+std::size_t decodedSizeBound(std::size_t size) { return (size + 3) / 4 * 3; }
+
+void encode(void const * data, std::size_t size, char * out) {
+    unsigned char const * in = (unsigned char const *)data;
+    std::size_t used = codec().encode(in, size, out);
+    in += used;
+    out += used / 3 * 4;
+    std::size_t left = size - used;
+    if (left > 0) {
+        std::uint32_t group = (std::uint32_t)in[0] << 16;
+        if (left == 2) {
+            group |= (std::uint32_t)in[1] << 8;
+        }
+        out[0] = alphabet[group >> 18];
+        out[1] = alphabet[(group >> 12) & 0x3F];
+        out[2] = left == 2 ? alphabet[(group >> 6) & 0x3F] : '=';
+        out[3] = '=';
+    }
+}
+
+std::string encode(void const * data, std::size_t size) {
+    std::string out(encodedSize(size), '\0');
+    encode(data, size, &out[0]);
+    return out;
+}
+
+long decode(char const * data, std::size_t size, void * out) {
+    unsigned char * bytes = (unsigned char *)out;
+    // Strip the padding, so what's left is whole groups of four plus two or
+    // three characters at the end
+    for (int i = 0; i < 2 && size > 0 && data[size - 1] == '='; i++) {
+        size--;
+    }
+    std::size_t used = codec().decode(data, size, bytes);
+    long length = used / 4 * 3;
+    std::size_t left = size - used;
+    if (left >= 4) {
+        // The block decoders stopped early at an invalid character
+        return -1;
+    }
+    if (left == 1) {
+        return -1;
+    }
+    if (left > 0) {
+        unsigned char const * values = decode_table.values;
+        std::uint32_t a = values[(unsigned char)data[used]];
+        std::uint32_t b = values[(unsigned char)data[used + 1]];
+        std::uint32_t c = left == 3 ? values[(unsigned char)data[used + 2]] : 0;
+        if ((a | b | c) & 0x80) {
+            return -1;
+        }
+        std::uint32_t group = a << 18 | b << 12 | c << 6;
+        bytes[length++] = group >> 16;
+        if (left == 3) {
+            bytes[length++] = group >> 8;
+        }
+    }
+    return length;
+}
+
+bool decode(std::string const & encoded, std::string & out) {
+    out.resize(decodedSizeBound(encoded.size()));
+    long length = decode(encoded.data(), encoded.size(), &out[0]);
+    if (length < 0) {
+        out.clear();
+        return false;
+    }
+    out.resize(length);
+    return true;
+}
+
+} // namespace base64
+} // namespace util
+} // namespace common
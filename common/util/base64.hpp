@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace common {
+namespace util {
+namespace base64 {
+
+/// Ways of encoding and decoding
+///
+/// The SIMD paths process 12 bytes (SSSE3) or 24 bytes (AVX2) per step with
+/// shuffles and multiplies in place of per-character table lookups, and fall
+/// back to the scalar path for whatever is left over at the end.
+enum class Path { Scalar, SSSE3, AVX2 };
+
+/// The fastest path the CPU running the program supports
+Path bestPath();
+
+/// Check if the CPU running the program supports a path
+bool isSupported(Path path);
+
+/// Use `path` for encode() and decode()
+///
+/// By default the best path is used. This is for testing and benchmarking.
+/// If `path` isn't supported the best path is used instead.
+void usePath(Path path);
+
+/// The path encode() and decode() are using
+Path currentPath();
+
+/// Number of characters encoding `size` bytes takes, including padding
+std::size_t encodedSize(std::size_t size);
+
+/// Upper bound on the number of bytes `size` characters decode to
+std::size_t decodedSizeBound(std::size_t size);
+
+/// Encode `size` bytes into `out`
+///
+/// `out` must have room for encodedSize() characters. It isn't terminated.
+void encode(void const * data, std::size_t size, char * out);
+
+/// Encode `size` bytes, padded with '='
+std::string encode(void const * data, std::size_t size);
+
+/// Decode `size` characters into `out`
+///
+/// `out` must have room for decodedSizeBound() bytes. Padding is optional,
+/// but anything else that isn't in the Base64 alphabet is an error.
+///
+/// @return The number of bytes decoded, or -1 if the input isn't valid.
+long decode(char const * data, std::size_t size, void * out);
+
+/// Decode a string, returning false if it isn't valid Base64
+bool decode(std::string const & encoded, std::string & out);
+
+} // namespace base64
+} // namespace util
+} // namespace common
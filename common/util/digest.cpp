@@ -0,0 +1,74 @@
+#include "digest.hpp"
+#include "xxhash.hpp"
+
+#include <stdexcept>
+
+#include "format.h"
+#include "common/extlib/hash-library/crc32.h"
+#include "common/extlib/hash-library/keccak.h"
+#include "common/extlib/hash-library/md5.h"
+#include "common/extlib/hash-library/sha1.h"
+#include "common/extlib/hash-library/sha256.h"
+#include "common/extlib/hash-library/sha3.h"
+
+namespace common {
+namespace util {
+namespace digest {
+
+namespace {
+/// Adapts any of the hash-library classes, which all share the same methods
+/// but not a base class
+template <typename Hash> class Adaptor : public Digest {
+public:
+    void add(void const * data, std::size_t size) override {
+        m_hash.add(data, size);
+    }
+    std::string getHash() override { return m_hash.getHash(); }
+    void reset() override { m_hash.reset(); }
+
+private:
+    Hash m_hash;
+};
+} // Anonymous namespace
+
+Digest::~Digest() {}
+
+std::unique_ptr<Digest> create(std::string const & name) {
+    if (name == "xxh64") {
+        return std::unique_ptr<Digest>(new Adaptor<XXH64>());
+    } else if (name == "crc32") {
+        return std::unique_ptr<Digest>(new Adaptor<CRC32>());
+    } else if (name == "md5") {
+        return std::unique_ptr<Digest>(new Adaptor<MD5>());
+    } else if (name == "sha1") {
+        return std::unique_ptr<Digest>(new Adaptor<SHA1>());
+    } else if (name == "sha256") {
+        return std::unique_ptr<Digest>(new Adaptor<SHA256>());
+    } else if (name == "sha3") {
+        return std::unique_ptr<Digest>(new Adaptor<SHA3>());
+    } else if (name == "keccak") {
+        return std::unique_ptr<Digest>(new Adaptor<Keccak>());
+    }
+    return nullptr;
+}
+
+std::vector<std::string> const & names() {
+    static std::vector<std::string> const names{
+        "xxh64", "crc32", "md5", "sha1", "sha256", "sha3", "keccak",
+    };
+    return names;
+}
+
+std::string hash(std::string const & name, void const * data,
+                 std::size_t size) {
+    std::unique_ptr<Digest> digest = create(name);
+    if (!digest) {
+        throw std::runtime_error(fmt::format("Unknown digest \"{}\"", name));
+    }
+    digest->add(data, size);
+    return digest->getHash();
+}
+
+} // namespace digest
+} // namespace util
+} // namespace common
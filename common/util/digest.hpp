@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace common {
+namespace util {
+namespace digest {
+
+/// A streaming message digest
+///
+/// This puts the hashes in `common/extlib/hash-library` and XXH64 behind one
+/// interface so that which is used can be picked at runtime by name.
+class Digest {
+public:
+    virtual ~Digest();
+
+    /// Hash `size` more bytes
+    virtual void add(void const * data, std::size_t size) = 0;
+
+    /// The hash of everything added so far, hex encoded
+    virtual std::string getHash() = 0;
+
+    /// Start again
+    virtual void reset() = 0;
+};
+
+/// Create a digest by name
+///
+/// @return The digest, or nullptr if there isn't one called `name`.
+std::unique_ptr<Digest> create(std::string const & name);
+
+/// Names of all the digests, fastest first
+///
+/// These are "xxh64", "crc32", "md5", "sha1", "sha256", "sha3" (256 bits)
+/// and "keccak" (256 bits).
+std::vector<std::string> const & names();
+
+/// Hash a block of memory in one go
+///
+/// Throws std::runtime_error if there's no digest called `name`.
+std::string hash(std::string const & name, void const * data,
+                 std::size_t size);
+
+} // namespace digest
+} // namespace util
+} // namespace common
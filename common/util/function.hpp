@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace common {
+
+namespace util {
+namespace function {
+
+/// A callable stored inside the object, like a std::function that never
+/// allocates
+///
+/// Anything callable with the signature can be stored as long as it fits in
+/// `Capacity` bytes, which is checked at compile time. That's plenty for a
+/// lambda capturing a few pointers or a std::bind of a member function to an
+/// object. Like std::function, the stored callable must be copyable; it must
+/// also have a move constructor which doesn't throw, so these can be kept in
+/// vectors and moved around cheaply.
+template <class Signature, std::size_t Capacity = 4 * sizeof(void *)>
+class InlineFunction;
+
+/// Check if `F` can be called with `Args` and the result converted to `R`
+template <class F, class Signature, class = void> struct IsCallable
+    : std::false_type {};
+
+template <class F, class R, class ... Args>
+struct IsCallable<
+    F, R(Args ...),
+    decltype(void(std::declval<F &>()(std::declval<Args>() ...)))>
+    : std::integral_constant<
+          bool, std::is_void<R>::value ||
+                    std::is_convertible<
+                        typename std::result_of<F &(Args ...)>::type,
+                        R>::value> {};
+
+template <class R, class ... Args, std::size_t Capacity>
+class InlineFunction<R(Args ...), Capacity> {
+public:
+    InlineFunction() : m_invoke(nullptr), m_manage(nullptr) {}
+
+    InlineFunction(std::nullptr_t) : InlineFunction() {}
+
+    template <class F,
+              class Stored = typename std::decay<F>::type,
+              class = typename std::enable_if<
+                  !std::is_same<Stored, InlineFunction>::value &&
+                  IsCallable<Stored, R(Args ...)>::value>::type>
+    InlineFunction(F && callable) {
+        static_assert(sizeof(Stored) <= Capacity,
+                      "Callable is too big for this InlineFunction");
+        static_assert(alignof(Stored) <= alignof(Storage),
+                      "Callable is too strictly aligned for InlineFunction");
+        static_assert(std::is_nothrow_move_constructible<Stored>::value,
+                      "Callable must have a noexcept move constructor");
+        new (&m_storage) Stored(std::forward<F>(callable));
+        m_invoke = &invoke<Stored>;
+        m_manage = &manage<Stored>;
+    }
+
+    InlineFunction(InlineFunction const & other)
+        : m_invoke(other.m_invoke), m_manage(other.m_manage) {
+        if (m_manage) {
+            m_manage(Operation::Copy, &m_storage,
+                     const_cast<Storage *>(&other.m_storage));
+        }
+    }
+
+    InlineFunction(InlineFunction && other) noexcept
+        : m_invoke(other.m_invoke), m_manage(other.m_manage) {
+        if (m_manage) {
+            m_manage(Operation::Move, &m_storage, &other.m_storage);
+        }
+    }
+
+    ~InlineFunction() { reset(); }
+
+    InlineFunction & operator=(InlineFunction const & other) {
+        if (this != &other) {
+            InlineFunction copy(other);
+            *this = std::move(copy);
+        }
+        return *this;
+    }
+
+    InlineFunction & operator=(InlineFunction && other) noexcept {
+        if (this != &other) {
+            reset();
+            m_invoke = other.m_invoke;
+            m_manage = other.m_manage;
+            if (m_manage) {
+                m_manage(Operation::Move, &m_storage, &other.m_storage);
+            }
+        }
+        return *this;
+    }
+
+    /// Call the stored callable, which there must be
+    R operator()(Args ... args) const {
+        return m_invoke(&m_storage, std::forward<Args>(args) ...);
+    }
+
+    explicit operator bool() const { return m_invoke != nullptr; }
+
+private:
+    typedef typename std::aligned_storage<
+        Capacity, std::alignment_of<std::max_align_t>::value>::type Storage;
+
+    enum class Operation { Copy, Move, Destroy };
+
+    template <class Stored>
+    static R invoke(void * storage, Args && ... args) {
+        return (*static_cast<Stored *>(storage))(std::forward<Args>(args) ...);
+    }
+
+    /// Copy or move `from` into the uninitialised `to`, or destroy `to`
+    template <class Stored>
+    static void manage(Operation operation, void * to, void * from) {
+        Stored * stored = static_cast<Stored *>(from);
+        switch (operation) {
+        case Operation::Copy:
+            new (to) Stored(*stored);
+            break;
+        case Operation::Move:
+            new (to) Stored(std::move(*stored));
+            break;
+        case Operation::Destroy:
+            static_cast<Stored *>(to)->~Stored();
+            break;
+        }
+    }
+
+    void reset() {
+        if (m_manage) {
+            m_manage(Operation::Destroy, &m_storage, nullptr);
+        }
+        m_invoke = nullptr;
+        m_manage = nullptr;
+    }
+
+    /// Mutable as, like std::function, calling a const InlineFunction can
+    /// change the state of the callable it holds
+    mutable Storage m_storage;
+    R (*m_invoke)(void *, Args && ...);
+    void (*m_manage)(Operation, void *, void *);
+};
+
+} // namespace function
+} // namespace util
+} // namespace common
@@ -0,0 +1,597 @@
+#include "common/util/json.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "format.h"
+
+namespace common {
+namespace util {
+namespace json {
+
+namespace {
+/// Deeper nesting than this is an error, as it is for json11
+int const MAX_DEPTH = 200;
+
+/// Objects with at most this many members are sorted by insertion, which is
+/// stable without needing a temporary buffer
+std::size_t const INSERTION_SORT_SIZE = 16;
+
+/// Returned for missing array values and object members
+Value const null_value;
+
+bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+int hexDigit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/// Append a code point to `out` as UTF-8, returning the end of it
+char * putUtf8(char * out, long code_point) {
+    if (code_point < 0x80) {
+        *out++ = (char)code_point;
+    } else if (code_point < 0x800) {
+        *out++ = (char)((code_point >> 6) | 0xC0);
+        *out++ = (char)((code_point & 0x3F) | 0x80);
+    } else if (code_point < 0x10000) {
+        *out++ = (char)((code_point >> 12) | 0xE0);
+        *out++ = (char)(((code_point >> 6) & 0x3F) | 0x80);
+        *out++ = (char)((code_point & 0x3F) | 0x80);
+    } else {
+        *out++ = (char)((code_point >> 18) | 0xF0);
+        *out++ = (char)(((code_point >> 12) & 0x3F) | 0x80);
+        *out++ = (char)(((code_point >> 6) & 0x3F) | 0x80);
+        *out++ = (char)((code_point & 0x3F) | 0x80);
+    }
+    return out;
+}
+} // Anonymous namespace
+
+int StringView::compare(StringView other) const {
+    int order = std::memcmp(m_data, other.m_data, std::min(m_size,
+                                                           other.m_size));
+    if (order != 0) {
+        return order;
+    }
+    return m_size < other.m_size ? -1 : m_size > other.m_size ? 1 : 0;
+}
+
+Value::Value(StringView value)
+    : m_type(STRING), m_size(value.size()), m_string(value.data()) {}
+
+Value Value::array(Value const * items, std::size_t size) {
+    Value value;
+    value.m_type = ARRAY;
+    value.m_size = size;
+    value.m_items = items;
+    return value;
+}
+
+Value Value::object(Member const * members, std::size_t size) {
+    Value value;
+    value.m_type = OBJECT;
+    value.m_size = size;
+    value.m_members = members;
+    return value;
+}
+
+StringView Value::string_value() const {
+    if (m_type != STRING) {
+        return StringView();
+    }
+    return StringView(m_string, m_size);
+}
+
+Range<Value> Value::array_items() const {
+    if (m_type != ARRAY) {
+        return Range<Value>(nullptr, 0);
+    }
+    return Range<Value>(m_items, m_size);
+}
+
+Range<Member> Value::object_items() const {
+    if (m_type != OBJECT) {
+        return Range<Member>(nullptr, 0);
+    }
+    return Range<Member>(m_members, m_size);
+}
+
+Value const & Value::operator[](std::size_t index) const {
+    if (m_type != ARRAY || index >= m_size) {
+        return null_value;
+    }
+    return m_items[index];
+}
+
+Value const & Value::operator[](StringView key) const {
+    if (m_type != OBJECT) {
+        return null_value;
+    }
+    Member const * end = m_members + m_size;
+    Member const * member = std::lower_bound(
+        m_members, end, key,
+        [](Member const & member, StringView key) {
+            return member.first < key;
+        });
+    if (member == end || member->first != key) {
+        return null_value;
+    }
+    return member->second;
+}
+
+json11::Json Value::toJson11() const {
+    switch (m_type) {
+    case NUMBER:
+        return m_number;
+    case BOOL:
+        return m_boolean;
+    case STRING:
+        return std::string(m_string, m_size);
+    case ARRAY: {
+        json11::Json::array array;
+        array.reserve(m_size);
+        for (auto const & item : array_items()) {
+            array.push_back(item.toJson11());
+        }
+        return array;
+    }
+    case OBJECT: {
+        json11::Json::object object;
+        for (auto const & member : object_items()) {
+            object.emplace(member.first.str(), member.second.toJson11());
+        }
+        return object;
+    }
+    default:
+        return nullptr;
+    }
+}
+
+/// Recursive descent parser for Document::parse()
+///
+/// Array values and object members are gathered on the document's stacks
+/// whilst they're parsed, as how many there are isn't known until the end,
+/// and then copied into the arena in one piece.
+class Parser {
+public:
+    Parser(Document & document, char const * data, std::size_t size,
+           std::string & error)
+        : m_document(document), m_begin(data), m_data(data),
+          m_end(data + size), m_error(error) {}
+
+    bool parse(Value & value) {
+        if (!parseValue(value, 0)) {
+            return false;
+        }
+        skipWhitespace();
+        if (m_data != m_end) {
+            return fail("Unexpected trailing {}", describe());
+        }
+        return true;
+    }
+
+private:
+    Document & m_document;
+    char const * m_begin;
+    char const * m_data;
+    char const * m_end;
+    std::string & m_error;
+
+    template <class ... Args>
+    bool fail(char const * format, Args const & ... args) {
+        m_error = fmt::format("{} at offset {}", fmt::format(format, args ...),
+                              m_data - m_begin);
+        return false;
+    }
+
+    /// What's next in the text, for error messages
+    std::string describe() const {
+        if (m_data == m_end) {
+            return "end of input";
+        }
+        return fmt::format("'{}'", *m_data);
+    }
+
+    void skipWhitespace() {
+        while (m_data != m_end && (*m_data == ' ' || *m_data == '\t' ||
+                                   *m_data == '\n' || *m_data == '\r')) {
+            m_data++;
+        }
+    }
+
+    bool expect(char const * literal) {
+        std::size_t size = std::strlen(literal);
+        if ((std::size_t)(m_end - m_data) < size ||
+            std::memcmp(m_data, literal, size) != 0) {
+            return fail("Expected {}", literal);
+        }
+        m_data += size;
+        return true;
+    }
+
+    bool parseValue(Value & value, int depth) {
+        if (depth > MAX_DEPTH) {
+            return fail("Exceeded maximum nesting depth");
+        }
+        skipWhitespace();
+        if (m_data == m_end) {
+            return fail("Unexpected end of input");
+        }
+        switch (*m_data) {
+        case '{':
+            return parseObject(value, depth);
+        case '[':
+            return parseArray(value, depth);
+        case '"': {
+            StringView string;
+            if (!parseString(string)) {
+                return false;
+            }
+            value = Value(string);
+            return true;
+        }
+        case 't':
+            value = Value(true);
+            return expect("true");
+        case 'f':
+            value = Value(false);
+            return expect("false");
+        case 'n':
+            value = Value();
+            return expect("null");
+        default:
+            if (*m_data == '-' || isDigit(*m_data)) {
+                return parseNumber(value);
+            }
+            return fail("Unexpected {}", describe());
+        }
+    }
+
+    bool parseNumber(Value & value) {
+        char const * start = m_data;
+        if (*m_data == '-') {
+            m_data++;
+        }
+        if (m_data == m_end || !isDigit(*m_data)) {
+            return fail("Expected a digit");
+        }
+        // Leading zeros aren't allowed
+        if (*m_data == '0') {
+            m_data++;
+        } else {
+            while (m_data != m_end && isDigit(*m_data)) {
+                m_data++;
+            }
+        }
+        bool integral = true;
+        if (m_data != m_end && *m_data == '.') {
+            m_data++;
+            integral = false;
+            if (m_data == m_end || !isDigit(*m_data)) {
+                return fail("Expected a digit after the decimal point");
+            }
+            while (m_data != m_end && isDigit(*m_data)) {
+                m_data++;
+            }
+        }
+        if (m_data != m_end && (*m_data == 'e' || *m_data == 'E')) {
+            m_data++;
+            integral = false;
+            if (m_data != m_end && (*m_data == '+' || *m_data == '-')) {
+                m_data++;
+            }
+            if (m_data == m_end || !isDigit(*m_data)) {
+                return fail("Expected a digit in the exponent");
+            }
+            while (m_data != m_end && isDigit(*m_data)) {
+                m_data++;
+            }
+        }
+        std::size_t length = m_data - start;
+        bool negative = *start == '-';
+        // Integers of up to 15 digits are exact as doubles, so the common
+        // case needs no strtod(3)
+        if (integral && length - negative <= 15) {
+            std::uint64_t integer = 0;
+            for (char const * digit = start + negative; digit != m_data;
+                 digit++) {
+                integer = integer * 10 + (*digit - '0');
+            }
+            // As integers, so that -0 is 0 as it is for json11
+            std::int64_t signed_integer = (std::int64_t)integer;
+            value = Value((double)(negative ? -signed_integer
+                                            : signed_integer));
+            return true;
+        }
+        // strtod(3) needs the number terminated, which the text isn't
+        char buffer[64];
+        if (length < sizeof buffer) {
+            std::memcpy(buffer, start, length);
+            buffer[length] = '\0';
+            value = Value(std::strtod(buffer, nullptr));
+        } else {
+            value = Value(std::strtod(std::string(start, length).c_str(),
+                                      nullptr));
+        }
+        return true;
+    }
+
+    /// Parse a string, leaving `string` referring to the text unless it has
+    /// escapes that need decoding
+    bool parseString(StringView & string) {
+        char const * start = ++m_data;
+        bool escaped = false;
+        for (;;) {
+            if (m_data == m_end) {
+                return fail("Unterminated string");
+            }
+            char c = *m_data;
+            if (c == '"') {
+                break;
+            }
+            if ((unsigned char)c < 0x20) {
+                return fail("Unescaped control character in string");
+            }
+            if (c == '\\') {
+                escaped = true;
+                if (++m_data == m_end) {
+                    return fail("Unterminated string");
+                }
+            }
+            m_data++;
+        }
+        char const * end = m_data++;
+        if (!escaped) {
+            string = StringView(start, end - start);
+            return true;
+        }
+        // Decoding only ever makes a string shorter
+        char * decoded =
+            m_document.getArena().allocate<char>(end - start);
+        char * out = decoded;
+        for (char const * in = start; in != end; in++) {
+            if (*in != '\\') {
+                *out++ = *in;
+                continue;
+            }
+            switch (*++in) {
+            case '"':
+            case '\\':
+            case '/':
+                *out++ = *in;
+                break;
+            case 'b':
+                *out++ = '\b';
+                break;
+            case 'f':
+                *out++ = '\f';
+                break;
+            case 'n':
+                *out++ = '\n';
+                break;
+            case 'r':
+                *out++ = '\r';
+                break;
+            case 't':
+                *out++ = '\t';
+                break;
+            case 'u': {
+                long code_point = readHex(in + 1, end);
+                if (code_point < 0) {
+                    m_data = in;
+                    return fail("Bad \\u escape");
+                }
+                in += 4;
+                // Join surrogate pairs; a lone surrogate is kept as it is,
+                // as json11 does
+                if (code_point >= 0xD800 && code_point <= 0xDBFF &&
+                    end - in > 6 && in[1] == '\\' && in[2] == 'u') {
+                    long low = readHex(in + 3, end);
+                    if (low >= 0xDC00 && low <= 0xDFFF) {
+                        code_point = (((code_point - 0xD800) << 10) |
+                                      (low - 0xDC00)) + 0x10000;
+                        in += 6;
+                    }
+                }
+                out = putUtf8(out, code_point);
+                break;
+            }
+            default:
+                m_data = in;
+                return fail("Unknown escape \\{}", *in);
+            }
+        }
+        string = StringView(decoded, out - decoded);
+        return true;
+    }
+
+    /// Read the four hex digits of a \u escape, or -1 if they aren't
+    static long readHex(char const * data, char const * end) {
+        if (end - data < 4) {
+            return -1;
+        }
+        long value = 0;
+        for (int i = 0; i < 4; i++) {
+            int digit = hexDigit(data[i]);
+            if (digit < 0) {
+                return -1;
+            }
+            value = value * 16 + digit;
+        }
+        return value;
+    }
+
+    bool parseArray(Value & value, int depth) {
+        m_data++;
+        std::vector<Value> & stack = m_document.m_values;
+        std::size_t mark = stack.size();
+        skipWhitespace();
+        if (m_data != m_end && *m_data == ']') {
+            m_data++;
+            value = Value::array(nullptr, 0);
+            return true;
+        }
+        for (;;) {
+            Value item;
+            if (!parseValue(item, depth + 1)) {
+                return false;
+            }
+            stack.push_back(item);
+            skipWhitespace();
+            if (m_data != m_end && *m_data == ',') {
+                m_data++;
+                continue;
+            }
+            if (m_data != m_end && *m_data == ']') {
+                m_data++;
+                break;
+            }
+            return fail("Expected ',' or ']' in array, got {}", describe());
+        }
+        std::size_t size = stack.size() - mark;
+        Value * items = m_document.getArena().allocate<Value>(size);
+        std::copy(stack.begin() + mark, stack.end(), items);
+        stack.resize(mark);
+        value = Value::array(items, size);
+        return true;
+    }
+
+    bool parseObject(Value & value, int depth) {
+        m_data++;
+        std::vector<Member> & stack = m_document.m_members;
+        std::size_t mark = stack.size();
+        skipWhitespace();
+        if (m_data != m_end && *m_data == '}') {
+            m_data++;
+            value = Value::object(nullptr, 0);
+            return true;
+        }
+        for (;;) {
+            skipWhitespace();
+            if (m_data == m_end || *m_data != '"') {
+                return fail("Expected a key in object, got {}", describe());
+            }
+            Member member;
+            if (!parseString(member.first)) {
+                return false;
+            }
+            skipWhitespace();
+            if (m_data == m_end || *m_data != ':') {
+                return fail("Expected ':' in object, got {}", describe());
+            }
+            m_data++;
+            if (!parseValue(member.second, depth + 1)) {
+                return false;
+            }
+            stack.push_back(member);
+            skipWhitespace();
+            if (m_data != m_end && *m_data == ',') {
+                m_data++;
+                continue;
+            }
+            if (m_data != m_end && *m_data == '}') {
+                m_data++;
+                break;
+            }
+            return fail("Expected ',' or '}}' in object, got {}", describe());
+        }
+        std::size_t size = stack.size() - mark;
+        Member * members = m_document.getArena().allocate<Member>(size);
+        std::copy(stack.begin() + mark, stack.end(), members);
+        stack.resize(mark);
+        value = m_document.makeObject(members, size);
+        return true;
+    }
+};
+
+Document::Document(std::size_t block_size) : m_arena(block_size) {}
+
+bool Document::parse(char const * data, std::size_t size, Value & value,
+                     std::string & error) {
+    // A failed parse can leave partial arrays and objects behind
+    m_values.clear();
+    m_members.clear();
+    if (!Parser(*this, data, size, error).parse(value)) {
+        value = Value();
+        return false;
+    }
+    return true;
+}
+
+Value Document::makeObject(Member * members, std::size_t size) {
+    auto less = [](Member const & a, Member const & b) {
+        return a.first < b.first;
+    };
+    if (size <= INSERTION_SORT_SIZE) {
+        for (std::size_t i = 1; i < size; i++) {
+            Member member = members[i];
+            std::size_t j = i;
+            for (; j > 0 && less(member, members[j - 1]); j--) {
+                members[j] = members[j - 1];
+            }
+            members[j] = member;
+        }
+    } else {
+        std::stable_sort(members, members + size, less);
+    }
+    // Being stable, the last of the members with the same key is the one
+    // which came last
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < size; i++) {
+        if (i + 1 < size && members[i].first == members[i + 1].first) {
+            continue;
+        }
+        members[kept++] = members[i];
+    }
+    return Value::object(members, kept);
+}
+
+Value Document::fromJson11(json11::Json const & json) {
+    switch (json.type()) {
+    case json11::Json::NUMBER:
+        return json.number_value();
+    case json11::Json::BOOL:
+        return json.bool_value();
+    case json11::Json::STRING:
+        return StringView(json.string_value());
+    case json11::Json::ARRAY: {
+        auto const & array = json.array_items();
+        Value * items = m_arena.allocate<Value>(array.size());
+        for (std::size_t i = 0; i < array.size(); i++) {
+            items[i] = fromJson11(array[i]);
+        }
+        return Value::array(items, array.size());
+    }
+    case json11::Json::OBJECT: {
+        // A std::map is already sorted by key, in the same order
+        auto const & object = json.object_items();
+        Member * members = m_arena.allocate<Member>(object.size());
+        std::size_t size = 0;
+        for (auto const & pair : object) {
+            members[size].first = StringView(pair.first);
+            members[size].second = fromJson11(pair.second);
+            size++;
+        }
+        return Value::object(members, size);
+    }
+    default:
+        return Value();
+    }
+}
+
+void Document::clear() { m_arena.clear(); }
+
+container::Arena & Document::getArena() { return m_arena; }
+
+} // namespace json
+} // namespace util
+} // namespace common
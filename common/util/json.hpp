@@ -0,0 +1,225 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "common/extlib/json11/json11.hpp"
+
+#include "common/util/arena.hpp"
+
+namespace common {
+
+namespace util {
+
+/// A read-only JSON DOM which doesn't allocate per value
+///
+/// json11 gives every value its own reference counted heap allocation, every
+/// string its own std::string and every object a std::map, so parsing even a
+/// small message means a good many allocations. Values here are instead
+/// small, trivially copyable handles into memory owned by a Document:
+/// strings refer straight to the text they were parsed from unless they had
+/// escapes to decode, and arrays and objects are flat runs of values in the
+/// document's arena. Objects are kept sorted by key, so looking a key up is
+/// a binary search. Clearing the document frees everything at once, keeping
+/// the memory for the next parse, so a document which is reused doesn't
+/// allocate once it's grown to the size of the largest message.
+///
+/// The interface mirrors json11's closely enough that code reading a
+/// json11::Json ports by changing its type: `value["key"]`, `value[0]`,
+/// `is_number()`, `int_value()`, `array_items()` and so on all work alike.
+/// The differences are that `string_value()` returns a StringView and that
+/// values can't be built or changed other than by a Document.
+///
+/// @code
+/// json::Document document;
+/// json::Value message;
+/// std::string error;
+/// if (document.parse(data, size, message, error)) {
+///     int buttons = message["entity"][1].int_value();
+/// }
+/// document.clear();
+/// @endcode
+namespace json {
+
+/// A string which belongs to something else
+class StringView {
+public:
+    StringView() : m_data(""), m_size(0) {}
+    StringView(char const * data, std::size_t size)
+        : m_data(data), m_size(size) {}
+    StringView(char const * string)
+        : m_data(string), m_size(std::strlen(string)) {}
+    StringView(std::string const & string)
+        : m_data(string.data()), m_size(string.size()) {}
+
+    char const * data() const { return m_data; }
+    std::size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    /// Copy the string
+    std::string str() const { return std::string(m_data, m_size); }
+
+    /// Compare bytewise, as unsigned chars, like std::string
+    int compare(StringView other) const;
+
+    bool operator==(StringView other) const {
+        return m_size == other.m_size &&
+               std::memcmp(m_data, other.m_data, m_size) == 0;
+    }
+    bool operator!=(StringView other) const { return !(*this == other); }
+    bool operator<(StringView other) const { return compare(other) < 0; }
+
+private:
+    char const * m_data;
+    std::size_t m_size;
+};
+
+/// The values of an array or members of an object
+template <class T> class Range {
+public:
+    Range(T const * items, std::size_t size) : m_items(items), m_size(size) {}
+
+    T const * begin() const { return m_items; }
+    T const * end() const { return m_items + m_size; }
+    std::size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    T const & operator[](std::size_t index) const { return m_items[index]; }
+
+private:
+    T const * m_items;
+    std::size_t m_size;
+};
+
+struct Member;
+
+/// A JSON value, which refers to memory owned by a Document
+///
+/// Values are only valid as long as the document they came from hasn't been
+/// cleared, and as long as the text they were parsed from is unchanged.
+class Value {
+public:
+    /// The same as json11::Json::Type
+    enum Type { NUL, NUMBER, BOOL, STRING, ARRAY, OBJECT };
+
+    Value() : m_type(NUL), m_size(0), m_number(0) {}
+    Value(std::nullptr_t) : Value() {}
+    Value(double value) : m_type(NUMBER), m_size(0), m_number(value) {}
+    Value(int value) : Value((double)value) {}
+    Value(bool value) : m_type(BOOL), m_size(0), m_boolean(value) {}
+    /// The string must outlive the value
+    Value(StringView value);
+    /// Stops string literals from silently becoming booleans
+    Value(void const *) = delete;
+
+    /// An array of `size` values, which must outlive it
+    static Value array(Value const * items, std::size_t size);
+
+    /// An object of `size` members, which must outlive it
+    ///
+    /// The members must already be sorted by key, with no key repeated; see
+    /// Document::makeObject().
+    static Value object(Member const * members, std::size_t size);
+
+    Type type() const { return m_type; }
+
+    bool is_null() const { return m_type == NUL; }
+    bool is_number() const { return m_type == NUMBER; }
+    bool is_bool() const { return m_type == BOOL; }
+    bool is_string() const { return m_type == STRING; }
+    bool is_array() const { return m_type == ARRAY; }
+    bool is_object() const { return m_type == OBJECT; }
+
+    /// The number, or 0 if this isn't one
+    double number_value() const { return m_type == NUMBER ? m_number : 0; }
+    /// The number converted to an int, or 0 if this isn't one
+    int int_value() const { return (int)number_value(); }
+    /// The boolean, or false if this isn't one
+    bool bool_value() const { return m_type == BOOL && m_boolean; }
+    /// The string, or an empty one if this isn't one
+    StringView string_value() const;
+    /// The array's values, or none if this isn't an array
+    Range<Value> array_items() const;
+    /// The object's members sorted by key, or none if this isn't an object
+    Range<Member> object_items() const;
+
+    /// An array's value at `index`, or null if there isn't one
+    Value const & operator[](std::size_t index) const;
+    /// An object's value for `key`, or null if there isn't one
+    Value const & operator[](StringView key) const;
+
+    /// Copy the value into a json11::Json
+    json11::Json toJson11() const;
+
+private:
+    Type m_type;
+    /// Length of a string, array or object
+    std::uint32_t m_size;
+    union {
+        double m_number;
+        bool m_boolean;
+        char const * m_string;
+        Value const * m_items;
+        Member const * m_members;
+    };
+};
+
+/// A member of an object
+///
+/// Named like the std::pair of a json11::Json::object's members.
+struct Member {
+    StringView first;
+    Value second;
+};
+
+/// Owns the memory of values and parses JSON into it
+class Document {
+public:
+    /// @param block_size Size of each block of the document's arena
+    explicit Document(std::size_t block_size = 4096);
+
+    /// Parse `size` bytes of JSON text
+    ///
+    /// The text must be a single value, optionally surrounded by whitespace.
+    /// Strings in `value` refer to the text, which mustn't change whilst
+    /// it's in use. Returns false and sets `error` if the text isn't valid
+    /// JSON, leaving `value` null.
+    bool parse(char const * data, std::size_t size, Value & value,
+               std::string & error);
+
+    /// Make an object from members allocated from the document's arena
+    ///
+    /// The members are sorted by key in place. Where a key is repeated, the
+    /// last member with it is kept and the others dropped, as json11 does.
+    Value makeObject(Member * members, std::size_t size);
+
+    /// Copy a json11::Json into the document
+    ///
+    /// Strings in the copy refer to the json11::Json's strings, so it must
+    /// outlive the copy.
+    Value fromJson11(json11::Json const & json);
+
+    /// Free every value in the document, keeping the memory for reuse
+    void clear();
+
+    /// Where the document's arrays, objects and unescaped strings are kept
+    container::Arena & getArena();
+
+    Document(Document const &) = delete;
+    Document & operator=(Document const &) = delete;
+
+private:
+    friend class Parser;
+
+    container::Arena m_arena;
+    /// Values and members of the arrays and objects being parsed, until
+    /// they're complete and their size is known
+    std::vector<Value> m_values;
+    std::vector<Member> m_members;
+};
+
+} // namespace json
+} // namespace util
+} // namespace common
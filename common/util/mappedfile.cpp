@@ -0,0 +1,63 @@
+#include "mappedfile.hpp"
+
+#include "format.h"
+
+#include <cerrno>
+#include <stdexcept>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace common {
+namespace util {
+namespace file {
+
+MappedFile::MappedFile(std::string const & path)
+    : m_descriptor(-1), m_data(nullptr), m_size(0) {
+    m_descriptor = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (m_descriptor == -1) {
+        throw std::runtime_error(fmt::format("Failed to open {}: {}", path,
+                                             strerror(errno)));
+    }
+    struct stat st;
+    if (fstat(m_descriptor, &st) == -1) {
+        int error = errno;
+        close(m_descriptor);
+        throw std::runtime_error(
+            fmt::format("Failed to stat {}: {}", path, strerror(error)));
+    }
+    m_size = st.st_size;
+    if (m_size == 0) {
+        // mmap(2) refuses zero length mappings
+        return;
+    }
+    void * data =
+        mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_descriptor, 0);
+    if (data == MAP_FAILED) {
+        int error = errno;
+        close(m_descriptor);
+        throw std::runtime_error(
+            fmt::format("Failed to map {}: {}", path, strerror(error)));
+    }
+    m_data = (char const *)data;
+}
+
+MappedFile::~MappedFile() {
+    if (m_data != nullptr) {
+        munmap((void *)m_data, m_size);
+    }
+    close(m_descriptor);
+}
+
+char const * MappedFile::data() const { return m_data; }
+
+std::size_t MappedFile::size() const { return m_size; }
+
+int MappedFile::descriptor() const { return m_descriptor; }
+
+} // namespace file
+} // namespace util
+} // namespace common
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace common {
+namespace util {
+namespace file {
+
+/// A read-only memory mapping of a whole file
+///
+/// The file's contents are paged in by the kernel on demand and the pages are
+/// shared with the page cache, so mapping a file costs no heap memory however
+/// large it is or however many times it's read. The descriptor is kept open
+/// so the file can also be handed to system calls such as sendfile(2).
+class MappedFile {
+public:
+    /// Map the file at `path`
+    ///
+    /// Throws std::runtime_error if the file can't be opened or mapped.
+    MappedFile(std::string const & path);
+    ~MappedFile();
+
+    MappedFile(MappedFile const &) = delete;
+    MappedFile & operator=(MappedFile const &) = delete;
+
+    char const * data() const;
+    std::size_t size() const;
+
+    /// The open file descriptor the mapping was made from
+    int descriptor() const;
+
+private:
+    int m_descriptor;
+    char const * m_data;
+    std::size_t m_size;
+};
+
+} // namespace file
+} // namespace util
+} // namespace common
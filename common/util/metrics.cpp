@@ -0,0 +1,124 @@
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <limits>
+
+namespace common {
+namespace util {
+namespace metrics {
+
+namespace {
+/// Add to an atomic which only the calling thread writes
+void addOwned(std::atomic<std::uint64_t> & value, std::uint64_t amount) {
+    value.store(value.load(std::memory_order_relaxed) + amount,
+                std::memory_order_relaxed);
+}
+} // Anonymous namespace
+
+Counter::Counter() : m_value(0) {}
+
+void Counter::add(std::uint64_t amount) { addOwned(m_value, amount); }
+
+std::uint64_t Counter::get() const {
+    return m_value.load(std::memory_order_relaxed);
+}
+
+Histogram::Snapshot::Snapshot()
+    : count(0), sum(0), min(std::numeric_limits<std::uint64_t>::max()),
+      max(0) {
+    counts.fill(0);
+}
+
+void Histogram::Snapshot::merge(Snapshot const & other) {
+    for (std::size_t bucket = 0; bucket < BUCKETS; bucket++) {
+        counts[bucket] += other.counts[bucket];
+    }
+    count += other.count;
+    sum += other.sum;
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+}
+
+std::uint64_t Histogram::Snapshot::getPercentile(double percentile) const {
+    if (count == 0) {
+        return 0;
+    }
+    // The rank of the value wanted, counting from one
+    std::uint64_t rank = std::max<std::uint64_t>(
+        1, (std::uint64_t)(percentile / 100 * count + 0.5));
+    std::uint64_t seen = 0;
+    for (std::size_t bucket = 0; bucket < BUCKETS; bucket++) {
+        seen += counts[bucket];
+        if (seen >= rank) {
+            // Nothing recorded is more than the maximum
+            return std::min(bucketMax(bucket), max);
+        }
+    }
+    return max;
+}
+
+double Histogram::Snapshot::getMean() const {
+    return count == 0 ? 0 : (double)sum / count;
+}
+
+Histogram::Histogram()
+    : m_count(0), m_sum(0), m_min(std::numeric_limits<std::uint64_t>::max()),
+      m_max(0) {
+    for (auto & count : m_counts) {
+        count.store(0, std::memory_order_relaxed);
+    }
+}
+
+void Histogram::record(std::uint64_t value) {
+    addOwned(m_counts[bucketOf(value)], 1);
+    addOwned(m_count, 1);
+    addOwned(m_sum, value);
+    if (value < m_min.load(std::memory_order_relaxed)) {
+        m_min.store(value, std::memory_order_relaxed);
+    }
+    if (value > m_max.load(std::memory_order_relaxed)) {
+        m_max.store(value, std::memory_order_relaxed);
+    }
+}
+
+Histogram::Snapshot Histogram::snapshot() const {
+    Snapshot snapshot;
+    for (std::size_t bucket = 0; bucket < BUCKETS; bucket++) {
+        snapshot.counts[bucket] =
+            m_counts[bucket].load(std::memory_order_relaxed);
+    }
+    // Values may be recorded whilst the buckets are read, so the count is
+    // worked out from them to keep the percentiles consistent
+    snapshot.count = 0;
+    for (auto count : snapshot.counts) {
+        snapshot.count += count;
+    }
+    snapshot.sum = m_sum.load(std::memory_order_relaxed);
+    snapshot.min = m_min.load(std::memory_order_relaxed);
+    snapshot.max = m_max.load(std::memory_order_relaxed);
+    return snapshot;
+}
+
+std::size_t Histogram::bucketOf(std::uint64_t value) {
+    if (value < SUB_BUCKETS) {
+        return value;
+    }
+    // Shift the value down so its top SUB_BUCKET_BITS bits are left; the
+    // shift picks the power of two and those bits the bucket within it
+    unsigned top_bit = 63 - __builtin_clzll(value);
+    unsigned shift = top_bit - (SUB_BUCKET_BITS - 1);
+    return shift * (SUB_BUCKETS / 2) + (value >> shift);
+}
+
+std::uint64_t Histogram::bucketMax(std::size_t bucket) {
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    unsigned shift = bucket / (SUB_BUCKETS / 2) - 1;
+    std::uint64_t top = bucket % (SUB_BUCKETS / 2) + SUB_BUCKETS / 2;
+    return ((top + 1) << shift) - 1;
+}
+
+} // namespace metrics
+} // namespace util
+} // namespace common
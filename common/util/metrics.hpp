@@ -0,0 +1,101 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace common {
+
+namespace util {
+namespace metrics {
+
+/// A count which one thread adds to and any thread can read
+///
+/// As only one thread ever writes it, adding is a plain load and store with
+/// no locked instruction, so counting costs next to nothing on hot paths.
+/// Readers see a recent value, though not necessarily the latest.
+class Counter {
+public:
+    Counter();
+
+    /// Add to the count; only ever from the owning thread
+    void add(std::uint64_t amount = 1);
+
+    std::uint64_t get() const;
+
+    Counter(Counter const &) = delete;
+    Counter & operator=(Counter const &) = delete;
+
+private:
+    std::atomic<std::uint64_t> m_value;
+};
+
+/// A histogram of non-negative integers in the style of HdrHistogram
+///
+/// Values are counted in buckets whose width grows with the value, so any
+/// value from 0 to 2^64 - 1 can be recorded in a fixed amount of memory.
+/// Values below SUB_BUCKETS are counted exactly, and each power of two above
+/// that is split into SUB_BUCKETS / 2 buckets, so every value is known to
+/// within 2 / SUB_BUCKETS of itself, about 6%.
+///
+/// Like Counter, one thread records values and any thread can take a
+/// snapshot() of them.
+class Histogram {
+public:
+    /// Values counted exactly, as a power of two
+    static unsigned const SUB_BUCKET_BITS = 5;
+    static unsigned const SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static std::size_t const BUCKETS =
+        (64 - SUB_BUCKET_BITS + 1) * (SUB_BUCKETS / 2) + SUB_BUCKETS / 2;
+
+    /// The recorded values at some point in time
+    struct Snapshot {
+        Snapshot();
+
+        /// Add the values of another snapshot
+        void merge(Snapshot const & other);
+
+        /// The value `percentile`% of values are at or below
+        ///
+        /// This is the largest value in the bucket the percentile falls in,
+        /// so it's never less than the true value. Zero if there are no
+        /// values.
+        std::uint64_t getPercentile(double percentile) const;
+
+        double getMean() const;
+
+        std::array<std::uint64_t, BUCKETS> counts;
+        std::uint64_t count;
+        std::uint64_t sum;
+        std::uint64_t min;
+        std::uint64_t max;
+    };
+
+    Histogram();
+
+    /// Record a value; only ever from the owning thread
+    void record(std::uint64_t value);
+
+    Snapshot snapshot() const;
+
+    /// Index of the bucket counting `value`
+    static std::size_t bucketOf(std::uint64_t value);
+
+    /// Largest value counted by a bucket
+    static std::uint64_t bucketMax(std::size_t bucket);
+
+    Histogram(Histogram const &) = delete;
+    Histogram & operator=(Histogram const &) = delete;
+
+private:
+    std::array<std::atomic<std::uint64_t>, BUCKETS> m_counts;
+    std::atomic<std::uint64_t> m_count;
+    std::atomic<std::uint64_t> m_sum;
+    std::atomic<std::uint64_t> m_min;
+    std::atomic<std::uint64_t> m_max;
+};
+
+} // namespace metrics
+} // namespace util
+} // namespace common
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <utility>
+#include <vector>
+
+namespace common {
+
+namespace util {
+namespace container {
+
+/// Identifies a value in a SlotMap
+///
+/// A handle stays valid until its value is removed and is never valid again
+/// after that, even if the slot it refers to is reused. A default constructed
+/// handle is never valid.
+struct SlotHandle {
+    std::uint32_t index;
+    /// Odd whilst the slot is in use; never zero in a valid handle
+    std::uint32_t generation;
+
+    SlotHandle() : index(0), generation(0) {}
+    SlotHandle(std::uint32_t index, std::uint32_t generation)
+        : index(index), generation(generation) {}
+
+    bool operator==(SlotHandle const & other) const {
+        return index == other.index && generation == other.generation;
+    }
+
+    bool operator!=(SlotHandle const & other) const {
+        return !(*this == other);
+    }
+};
+
+/// A container of values which are referred to by handles
+///
+/// Adding, removing and looking up values all take constant time. The values
+/// are kept packed together, in no particular order, so iterating over them
+/// is as quick as for a std::deque no matter how many have been removed.
+///
+/// Handles, unlike pointers or iterators, aren't invalidated by other values
+/// being added or removed, and looking up the handle of a removed value
+/// safely finds nothing. Each slot has a generation which is bumped whenever
+/// its value is removed, so a handle to a removed value doesn't match a new
+/// value that reuses its slot.
+///
+/// Values are stored in a std::deque so adding them never moves the others.
+/// Removing one moves the last value into its place. Pointers and references
+/// to values are invalidated by removing any value; handles aren't.
+template <class T> class SlotMap {
+public:
+    typedef typename std::deque<T>::iterator iterator;
+    typedef typename std::deque<T>::const_iterator const_iterator;
+
+    SlotMap() : m_free(NONE) {}
+
+    /// Construct a value in place
+    template <class ... Args> SlotHandle emplace(Args && ... args) {
+        std::uint32_t index;
+        if (m_free != NONE) {
+            index = m_free;
+            m_free = m_slots[index].position;
+        } else {
+            index = m_slots.size();
+            m_slots.push_back(Slot{0, 0});
+        }
+        Slot & slot = m_slots[index];
+        m_values.emplace_back(std::forward<Args>(args) ...);
+        m_value_slots.push_back(index);
+        slot.position = m_values.size() - 1;
+        slot.generation++;
+        return SlotHandle(index, slot.generation);
+    }
+
+    /// Remove a value
+    ///
+    /// Returns false if the handle isn't valid.
+    bool erase(SlotHandle handle) {
+        if (!contains(handle)) {
+            return false;
+        }
+        Slot & slot = m_slots[handle.index];
+        std::uint32_t position = slot.position;
+        if (position != m_values.size() - 1) {
+            // Fill the gap with the last value
+            m_values[position] = std::move(m_values.back());
+            m_value_slots[position] = m_value_slots.back();
+            m_slots[m_value_slots[position]].position = position;
+        }
+        m_values.pop_back();
+        m_value_slots.pop_back();
+        slot.generation++;
+        slot.position = m_free;
+        m_free = handle.index;
+        return true;
+    }
+
+    /// Check if a handle refers to a value
+    bool contains(SlotHandle handle) const {
+        return handle.index < m_slots.size() &&
+               m_slots[handle.index].generation == handle.generation &&
+               (handle.generation & 1);
+    }
+
+    /// Get the value a handle refers to, or nullptr if it isn't valid
+    T * get(SlotHandle handle) {
+        return contains(handle) ? &m_values[m_slots[handle.index].position]
+                                : nullptr;
+    }
+
+    T const * get(SlotHandle handle) const {
+        return contains(handle) ? &m_values[m_slots[handle.index].position]
+                                : nullptr;
+    }
+
+    /// Get the handle of the value at `position` in iteration order
+    SlotHandle handleAt(std::size_t position) const {
+        std::uint32_t index = m_value_slots[position];
+        return SlotHandle(index, m_slots[index].generation);
+    }
+
+    /// Get the value at `position` in iteration order
+    T & operator[](std::size_t position) { return m_values[position]; }
+    T const & operator[](std::size_t position) const {
+        return m_values[position];
+    }
+
+    std::size_t size() const { return m_values.size(); }
+    bool empty() const { return m_values.empty(); }
+
+    iterator begin() { return m_values.begin(); }
+    iterator end() { return m_values.end(); }
+    const_iterator begin() const { return m_values.begin(); }
+    const_iterator end() const { return m_values.end(); }
+
+private:
+    static std::uint32_t const NONE = 0xFFFFFFFF;
+
+    struct Slot {
+        /// Position of the slot's value in m_values whilst the slot is in
+        /// use, otherwise the index of the next free slot
+        std::uint32_t position;
+        std::uint32_t generation;
+    };
+
+    std::vector<Slot> m_slots;
+    /// Head of the list of free slots
+    std::uint32_t m_free;
+    std::deque<T> m_values;
+    /// The slot of each value in m_values
+    std::vector<std::uint32_t> m_value_slots;
+};
+
+} // namespace container
+} // namespace util
+} // namespace common
@@ -0,0 +1,170 @@
+#include "timerwheel.hpp"
+
+#include <utility>
+
+namespace common {
+namespace util {
+namespace timer {
+
+namespace {
+/// Index of the list head of the timers being fired
+std::uint32_t const FIRING = TimerWheel::LEVELS * TimerWheel::SLOTS;
+/// Index of the first timer node
+std::uint32_t const FIRST_TIMER = FIRING + 1;
+
+/// Number of ticks the wheels up to and including `level` reach
+std::uint64_t reach(unsigned level) {
+    return (std::uint64_t)1 << (TimerWheel::SLOT_BITS * (level + 1));
+}
+} // Anonymous namespace
+
+TimerWheel::TimerWheel(std::uint64_t now)
+    : m_now(now), m_free(NONE), m_count(0) {
+    m_nodes.resize(FIRST_TIMER);
+    for (std::uint32_t head = 0; head < FIRST_TIMER; head++) {
+        m_nodes[head].previous = head;
+        m_nodes[head].next = head;
+        m_nodes[head].generation = 0;
+        m_nodes[head].deadline = 0;
+    }
+}
+
+TimerId TimerWheel::schedule(std::uint64_t delay, Callback callback) {
+    std::uint32_t timer = m_free;
+    if (timer != NONE) {
+        m_free = m_nodes[timer].next;
+    } else {
+        timer = m_nodes.size();
+        m_nodes.push_back(Node{NONE, NONE, 0, 0, Callback()});
+    }
+    Node & node = m_nodes[timer];
+    node.generation++;
+    node.deadline = m_now + (delay == 0 ? 1 : delay);
+    node.callback = std::move(callback);
+    place(timer);
+    m_count++;
+    return TimerId(timer, node.generation);
+}
+
+bool TimerWheel::cancel(TimerId timer) {
+    if (!isScheduled(timer)) {
+        return false;
+    }
+    unlink(timer.index);
+    release(timer.index);
+    return true;
+}
+
+bool TimerWheel::isScheduled(TimerId timer) const {
+    return timer.index >= FIRST_TIMER && timer.index < m_nodes.size() &&
+           m_nodes[timer.index].generation == timer.generation &&
+           (timer.generation & 1);
+}
+
+void TimerWheel::advance(std::uint64_t now) {
+    while (m_now < now) {
+        if (m_count == 0) {
+            m_now = now;
+            return;
+        }
+        m_now++;
+        // Coarser wheels move on when all the finer wheels wrap around
+        unsigned level = 0;
+        while (level + 1 < LEVELS && (m_now & (reach(level) - 1)) == 0) {
+            level++;
+        }
+        for (; level > 0; level--) {
+            cascade(level);
+        }
+        fire();
+    }
+}
+
+std::uint64_t TimerWheel::getNow() const { return m_now; }
+
+std::size_t TimerWheel::size() const { return m_count; }
+
+std::uint32_t TimerWheel::slotHead(unsigned level, std::uint32_t slot) {
+    return level * SLOTS + slot;
+}
+
+void TimerWheel::place(std::uint32_t timer) {
+    std::uint64_t deadline = m_nodes[timer].deadline;
+    std::uint64_t delay = deadline - m_now;
+    unsigned level = 0;
+    while (level + 1 < LEVELS && delay >= reach(level)) {
+        level++;
+    }
+    if (delay >= reach(level)) {
+        // Too far away for any wheel, so park it in the furthest slot
+        deadline = m_now + reach(level) - 1;
+    }
+    std::uint32_t slot = (deadline >> (SLOT_BITS * level)) & (SLOTS - 1);
+    link(slotHead(level, slot), timer);
+}
+
+void TimerWheel::link(std::uint32_t head, std::uint32_t node) {
+    std::uint32_t last = m_nodes[head].previous;
+    m_nodes[node].previous = last;
+    m_nodes[node].next = head;
+    m_nodes[last].next = node;
+    m_nodes[head].previous = node;
+}
+
+void TimerWheel::unlink(std::uint32_t node) {
+    std::uint32_t previous = m_nodes[node].previous;
+    std::uint32_t next = m_nodes[node].next;
+    m_nodes[previous].next = next;
+    m_nodes[next].previous = previous;
+}
+
+void TimerWheel::release(std::uint32_t timer) {
+    Node & node = m_nodes[timer];
+    node.generation++;
+    node.callback = nullptr;
+    node.next = m_free;
+    m_free = timer;
+    m_count--;
+}
+
+void TimerWheel::cascade(unsigned level) {
+    std::uint32_t slot = (m_now >> (SLOT_BITS * level)) & (SLOTS - 1);
+    std::uint32_t head = slotHead(level, slot);
+    // Everything in the slot is now due within the reach of a finer wheel,
+    // or is parked and goes back to a different slot, so this terminates
+    while (m_nodes[head].next != head) {
+        std::uint32_t timer = m_nodes[head].next;
+        unlink(timer);
+        place(timer);
+    }
+}
+
+void TimerWheel::fire() {
+    std::uint32_t head = slotHead(0, m_now & (SLOTS - 1));
+    if (m_nodes[head].next == head) {
+        return;
+    }
+    // Move the whole slot onto the firing list first, so callbacks can
+    // cancel timers due on the same tick, or add to the slot, safely
+    std::uint32_t first = m_nodes[head].next;
+    std::uint32_t last = m_nodes[head].previous;
+    m_nodes[FIRING].next = first;
+    m_nodes[FIRING].previous = last;
+    m_nodes[first].previous = FIRING;
+    m_nodes[last].next = FIRING;
+    m_nodes[head].next = head;
+    m_nodes[head].previous = head;
+    while (m_nodes[FIRING].next != FIRING) {
+        std::uint32_t timer = m_nodes[FIRING].next;
+        unlink(timer);
+        // The callback is taken out first as it may schedule timers, which
+        // can reallocate m_nodes, and may reschedule itself
+        Callback callback = std::move(m_nodes[timer].callback);
+        release(timer);
+        callback();
+    }
+}
+
+} // namespace timer
+} // namespace util
+} // namespace common
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "common/util/function.hpp"
+
+namespace common {
+namespace util {
+namespace timer {
+
+/// Identifies a timer scheduled on a TimerWheel
+///
+/// IDs of timers which have fired or been cancelled are never valid again,
+/// even once their storage is reused. A default constructed ID is never
+/// valid.
+struct TimerId {
+    std::uint32_t index;
+    /// Odd whilst the timer is scheduled
+    std::uint32_t generation;
+
+    TimerId() : index(0), generation(0) {}
+    TimerId(std::uint32_t index, std::uint32_t generation)
+        : index(index), generation(generation) {}
+};
+
+/// A hashed hierarchical timing wheel
+///
+/// Time is measured in whole ticks of whatever the owner advances the wheel
+/// by, such as the server tick. Timers are kept in LEVELS wheels of
+/// SLOTS slots each. The first wheel has a slot for each of the next SLOTS
+/// ticks; each wheel after that has slots SLOTS times as wide as the one
+/// before. A timer goes in the slot of the finest wheel that reaches its
+/// deadline, and as time passes the timers in each slot of a coarser wheel
+/// are moved down to the finer wheels once their slot comes round.
+///
+/// Scheduling and cancelling a timer take constant time, however many timers
+/// there are. Advancing by a tick in which nothing fires looks at a single
+/// empty slot, plus a slot of each coarser wheel once every SLOTS ticks, so
+/// thousands of idle timers cost nothing.
+///
+/// Timers further away than the wheels reach are parked in the furthest slot
+/// and moved along again until they come within reach.
+///
+/// Timers due on the same tick fire in no particular order. Callbacks may
+/// schedule and cancel timers, including rescheduling themselves.
+class TimerWheel {
+public:
+    typedef function::InlineFunction<void()> Callback;
+
+    /// Bits of a deadline each wheel covers
+    static unsigned const SLOT_BITS = 6;
+    static std::uint32_t const SLOTS = 1 << SLOT_BITS;
+    static unsigned const LEVELS = 4;
+
+    /// @param now The tick the wheel starts at
+    TimerWheel(std::uint64_t now = 0);
+
+    /// Call `callback` once `delay` ticks from now
+    ///
+    /// A delay of zero is treated as one, so the callback never runs before
+    /// the wheel is next advanced.
+    TimerId schedule(std::uint64_t delay, Callback callback);
+
+    /// Stop a timer from firing
+    ///
+    /// Returns false if it has already fired or been cancelled.
+    bool cancel(TimerId timer);
+
+    /// Check if a timer is yet to fire
+    bool isScheduled(TimerId timer) const;
+
+    /// Advance to tick `now`, firing every timer due by then
+    ///
+    /// Does nothing if `now` isn't after the current tick.
+    void advance(std::uint64_t now);
+
+    /// The current tick
+    std::uint64_t getNow() const;
+
+    /// Number of timers yet to fire
+    std::size_t size() const;
+
+    TimerWheel(TimerWheel const &) = delete;
+    TimerWheel & operator=(TimerWheel const &) = delete;
+
+private:
+    static std::uint32_t const NONE = 0xFFFFFFFF;
+
+    /// A timer, or the head of a slot's circular list of timers
+    struct Node {
+        std::uint32_t previous;
+        std::uint32_t next;
+        std::uint32_t generation;
+        std::uint64_t deadline;
+        Callback callback;
+    };
+
+    /// Index of the list head of a slot
+    static std::uint32_t slotHead(unsigned level, std::uint32_t slot);
+
+    /// Put a timer in the slot for its deadline
+    void place(std::uint32_t timer);
+    void link(std::uint32_t head, std::uint32_t node);
+    void unlink(std::uint32_t node);
+    /// Free the node of an unlinked timer
+    void release(std::uint32_t timer);
+    /// Move the timers in a slot of a coarser wheel to where they now belong
+    void cascade(unsigned level);
+    /// Fire the timers in the first wheel's slot for the current tick
+    void fire();
+
+    std::uint64_t m_now;
+    /// Slot list heads come first, then a list head for the timers being
+    /// fired, then the timers
+    std::vector<Node> m_nodes;
+    /// Free timer nodes, linked through their `next`
+    std::uint32_t m_free;
+    std::size_t m_count;
+};
+
+} // namespace timer
+} // namespace util
+} // namespace common
@@ -0,0 +1,156 @@
+#include "xxhash.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace common {
+namespace util {
+namespace digest {
+
+namespace {
+std::uint64_t const PRIME1 = 11400714785074694791ULL;
+std::uint64_t const PRIME2 = 14029467366897019727ULL;
+std::uint64_t const PRIME3 = 1609587929392839161ULL;
+std::uint64_t const PRIME4 = 9650029242287828579ULL;
+std::uint64_t const PRIME5 = 2870177450012600261ULL;
+
+std::uint64_t rotl(std::uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+/// Read a little-endian 64-bit word
+///
+/// memcpy() rather than a cast as the data needn't be aligned; it compiles
+/// to a single load.
+std::uint64_t read64(unsigned char const * data) {
+    std::uint64_t value;
+    std::memcpy(&value, data, sizeof value);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+    return value;
+}
+
+std::uint32_t read32(unsigned char const * data) {
+    std::uint32_t value;
+    std::memcpy(&value, data, sizeof value);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap32(value);
+#endif
+    return value;
+}
+
+std::uint64_t round(std::uint64_t lane, std::uint64_t input) {
+    lane += input * PRIME2;
+    return rotl(lane, 31) * PRIME1;
+}
+
+std::uint64_t merge(std::uint64_t hash, std::uint64_t lane) {
+    hash ^= round(0, lane);
+    return hash * PRIME1 + PRIME4;
+}
+
+/// Consume as many whole stripes as there are in `data`
+///
+/// Returns the number of bytes consumed.
+std::size_t consumeStripes(std::uint64_t * lanes, unsigned char const * data,
+                           std::size_t size) {
+    std::uint64_t lane0 = lanes[0];
+    std::uint64_t lane1 = lanes[1];
+    std::uint64_t lane2 = lanes[2];
+    std::uint64_t lane3 = lanes[3];
+    std::size_t offset = 0;
+    for (; size - offset >= 32; offset += 32) {
+        lane0 = round(lane0, read64(data + offset));
+        lane1 = round(lane1, read64(data + offset + 8));
+        lane2 = round(lane2, read64(data + offset + 16));
+        lane3 = round(lane3, read64(data + offset + 24));
+    }
+    lanes[0] = lane0;
+    lanes[1] = lane1;
+    lanes[2] = lane2;
+    lanes[3] = lane3;
+    return offset;
+}
+} // Anonymous namespace
+
+XXH64::XXH64(std::uint64_t seed) : m_seed(seed) { reset(); }
+
+void XXH64::reset() {
+    m_lanes[0] = m_seed + PRIME1 + PRIME2;
+    m_lanes[1] = m_seed + PRIME2;
+    m_lanes[2] = m_seed;
+    m_lanes[3] = m_seed - PRIME1;
+    m_total = 0;
+    m_stripe_size = 0;
+}
+
+void XXH64::add(void const * data, std::size_t size) {
+    unsigned char const * input = (unsigned char const *)data;
+    m_total += size;
+    if (m_stripe_size > 0) {
+        // Finish off the stripe started by the last call first
+        std::size_t fill = std::min(size, sizeof m_stripe - m_stripe_size);
+        std::memcpy(m_stripe + m_stripe_size, input, fill);
+        m_stripe_size += fill;
+        input += fill;
+        size -= fill;
+        if (m_stripe_size < sizeof m_stripe) {
+            return;
+        }
+        consumeStripes(m_lanes, m_stripe, sizeof m_stripe);
+        m_stripe_size = 0;
+    }
+    std::size_t consumed = consumeStripes(m_lanes, input, size);
+    std::memcpy(m_stripe, input + consumed, size - consumed);
+    m_stripe_size = size - consumed;
+}
+
+std::uint64_t XXH64::getValue() const {
+    std::uint64_t hash;
+    if (m_total >= 32) {
+        hash = rotl(m_lanes[0], 1) + rotl(m_lanes[1], 7) +
+               rotl(m_lanes[2], 12) + rotl(m_lanes[3], 18);
+        for (int i = 0; i < 4; i++) {
+            hash = merge(hash, m_lanes[i]);
+        }
+    } else {
+        hash = m_seed + PRIME5;
+    }
+    hash += m_total;
+    std::size_t offset = 0;
+    for (; m_stripe_size - offset >= 8; offset += 8) {
+        hash ^= round(0, read64(m_stripe + offset));
+        hash = rotl(hash, 27) * PRIME1 + PRIME4;
+    }
+    if (m_stripe_size - offset >= 4) {
+        hash ^= (std::uint64_t)read32(m_stripe + offset) * PRIME1;
+        hash = rotl(hash, 23) * PRIME2 + PRIME3;
+        offset += 4;
+    }
+    for (; offset < m_stripe_size; offset++) {
+        hash ^= m_stripe[offset] * PRIME5;
+        hash = rotl(hash, 11) * PRIME1;
+    }
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+std::string XXH64::getHash() const {
+    static char const hex[] = "0123456789abcdef";
+    std::uint64_t value = getValue();
+    std::string hash(16, '0');
+    for (int i = 15; i >= 0; i--) {
+        hash[i] = hex[value & 0xF];
+        value >>= 4;
+    }
+    return hash;
+}
+
+} // namespace digest
+} // namespace util
+} // namespace common
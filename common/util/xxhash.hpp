@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace common {
+namespace util {
+namespace digest {
+
+/// Streaming XXH64, a fast non-cryptographic 64-bit hash
+///
+/// The input is consumed in 32 byte stripes split across four independent
+/// accumulators, so the multiplies of neighbouring lanes overlap in the
+/// pipeline and the hash runs at close to memory bandwidth. It is fine for
+/// telling maps apart and catching corrupted chunks, but not for anything
+/// an attacker could choose the input of to get a collision.
+///
+/// The output is compatible with the reference implementation.
+class XXH64 {
+public:
+    explicit XXH64(std::uint64_t seed = 0);
+
+    /// Hash `size` more bytes
+    void add(void const * data, std::size_t size);
+
+    /// The hash of everything added so far
+    std::uint64_t getValue() const;
+
+    /// The hash of everything added so far as 16 hex characters
+    std::string getHash() const;
+
+    /// Start again with the same seed
+    void reset();
+
+private:
+    std::uint64_t m_seed;
+    std::uint64_t m_lanes[4];
+    std::uint64_t m_total;
+    /// Input not yet making up a whole stripe
+    unsigned char m_stripe[32];
+    std::size_t m_stripe_size;
+};
+
+} // namespace digest
+} // namespace util
+} // namespace common
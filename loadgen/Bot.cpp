@@ -0,0 +1,161 @@
+#include "Bot.hpp"
+
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include <sys/stat.h>
+
+#include "format.h"
+
+namespace loadgen {
+
+using namespace json11;
+
+namespace {
+/// Make sure a directory exists before anything is put in it
+std::string const & makeDirectory(std::string const & path) {
+    if (mkdir(path.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw std::runtime_error(fmt::format(
+            "Couldn't create directory \"{}\": {}", path, strerror(errno)));
+    }
+    return path;
+}
+
+/// Microseconds on the clock, for the entity of a `net.ping`
+double timestamp(Clock::time_point time) {
+    return (double)std::chrono::duration_cast<std::chrono::microseconds>(
+               time.time_since_epoch()).count();
+}
+
+Clock::duration interval(double rate) {
+    return std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(1 / rate));
+}
+
+/// The buttons held `seconds` into a script played on a loop
+unsigned scriptButtons(std::vector<Step> const & script, double seconds) {
+    double length = 0;
+    for (auto const & step : script) {
+        length += step.seconds;
+    }
+    if (length <= 0) {
+        return 0;
+    }
+    seconds = std::fmod(seconds, length);
+    for (auto const & step : script) {
+        if (seconds < step.seconds) {
+            return step.buttons;
+        }
+        seconds -= step.seconds;
+    }
+    return script.back().buttons;
+}
+} // Anonymous namespace
+
+Bot::Bot(std::string const & maps_directory, net::Framing framing,
+         Behaviour const & behaviour, Stats & stats)
+    : m_behaviour(behaviour), m_stats(stats),
+      m_map_cache(makeDirectory(maps_directory)),
+      m_connection(m_map_cache, maps_directory, framing) {
+    m_connection.on_message = [this](net::MessageType const & type,
+                                     Json const & entity) {
+        handleMessage(type, entity);
+    };
+    m_connection.on_map = [this](std::string const &) {
+        m_stats.map_transfer.record(since(m_offered));
+    };
+}
+
+bool Bot::start(std::string const & host, int port, Clock::time_point now) {
+    m_started = now;
+    if (!m_connection.connect(host, port, false)) {
+        m_stats.failed.add();
+        m_closed = true;
+        return false;
+    }
+    return true;
+}
+
+void Bot::finishConnecting() {
+    if (!m_connection.finishConnecting()) {
+        m_stats.failed.add();
+        m_closed = true;
+        return;
+    }
+    m_connected = true;
+    m_stats.connected.add();
+}
+
+void Bot::read() {
+    m_connection.readData();
+    if (m_connected && !m_closed && !m_connection.isOpen()) {
+        m_stats.disconnected.add();
+        close();
+    }
+}
+
+void Bot::update(Clock::time_point now) {
+    if (m_closed || m_connection.getPlayerId() == 0) {
+        return;
+    }
+    if (m_behaviour.input_rate > 0 && now >= m_next_input) {
+        double seconds =
+            std::chrono::duration<double>(now - m_joined).count();
+        m_connection.sendInput(scriptButtons(m_behaviour.script, seconds));
+        m_stats.inputs_out.add();
+        m_next_input += interval(m_behaviour.input_rate);
+        if (m_next_input < now) {
+            // Fell behind, so don't send a burst to catch up
+            m_next_input = now;
+        }
+    }
+    if (m_behaviour.ping_rate > 0 && now >= m_next_ping) {
+        m_connection.send("net.ping", timestamp(now));
+        m_next_ping += interval(m_behaviour.ping_rate);
+        if (m_next_ping < now) {
+            m_next_ping = now;
+        }
+    }
+}
+
+bool Bot::isConnecting() const { return m_connection.isConnecting(); }
+
+bool Bot::isOpen() const { return !m_closed && m_connection.isOpen(); }
+
+void Bot::close() {
+    m_closed = true;
+    m_connection.getSocket().close();
+    m_connection.getUDPSocket().close();
+}
+
+client::Connection & Bot::getConnection() { return m_connection; }
+
+void Bot::handleMessage(net::MessageType const & type,
+                        Json const & entity) {
+    m_stats.messages_in.add();
+    if (type == "map.offer") {
+        m_offered = Clock::now();
+        m_stats.connect.record(since(m_started));
+    } else if (type == "world.join") {
+        m_joined = Clock::now();
+        m_next_input = m_joined;
+        m_next_ping = m_joined;
+        m_stats.joined.add();
+        m_stats.join.record(since(m_started));
+    } else if (type == "net.pong") {
+        double sent = entity.number_value();
+        double now = timestamp(Clock::now());
+        if (sent > 0 && sent <= now) {
+            m_stats.round_trip.record((std::uint64_t)(now - sent));
+        }
+    }
+}
+
+std::uint64_t Bot::since(Clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               Clock::now() - time).count();
+}
+
+} // namespace loadgen
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "common/net/wire.hpp"
+#include "common/util/metrics.hpp"
+#include "MapCache.hpp"
+#include "net/Connection.hpp"
+
+namespace loadgen {
+
+typedef std::chrono::steady_clock Clock;
+
+/// Buttons to hold for a while, as a line of an input script
+struct Step {
+    double seconds;
+    /// A bit set of net::input::Button
+    unsigned buttons;
+};
+
+/// What the bots of one thread measure
+///
+/// Only the thread running the bots updates these; the main thread reads
+/// them to report progress. Times are in microseconds.
+struct Stats {
+    typedef common::util::metrics::Counter Counter;
+    typedef common::util::metrics::Histogram Histogram;
+
+    Stats() = default;
+
+    /// From starting to connect until the server's `map.offer` arrives
+    Histogram connect;
+    /// From the `map.offer` until the bot has the map
+    Histogram map_transfer;
+    /// From starting to connect until the `world.join` arrives
+    Histogram join;
+    /// From sending a `net.ping` until its `net.pong` arrives
+    Histogram round_trip;
+
+    Counter started;
+    Counter connected;
+    Counter joined;
+    Counter failed;
+    Counter disconnected;
+    Counter messages_in;
+    Counter inputs_out;
+
+    Stats(Stats const &) = delete;
+    Stats & operator=(Stats const &) = delete;
+};
+
+/// How a bot behaves once it's joined
+struct Behaviour {
+    /// Played on a loop from when the bot joins
+    std::vector<Step> script;
+    /// `input` messages sent a second
+    double input_rate;
+    /// `net.ping` messages sent a second
+    double ping_rate;
+};
+
+/// A headless client, driven by the load generator's event loop
+///
+/// The protocol is handled by the same client::Connection the game uses, so
+/// the bot gets the map, joins the world and acknowledges snapshots exactly
+/// like a real player. Each bot has its own maps directory, so that every
+/// bot downloads the map unless it's already there from an earlier run.
+class Bot {
+public:
+    /// @param maps_directory Created if it doesn't exist
+    Bot(std::string const & maps_directory, net::Framing framing,
+        Behaviour const & behaviour, Stats & stats);
+
+    /// Start connecting to the server
+    ///
+    /// @return false if the connection couldn't even be started
+    bool start(std::string const & host, int port, Clock::time_point now);
+
+    /// Carry on once the socket is writable; the connection has been made
+    /// or has failed
+    void finishConnecting();
+
+    /// Handle everything received from the server
+    void read();
+
+    /// Send whatever input and pings are due
+    void update(Clock::time_point now);
+
+    bool isConnecting() const;
+    /// Whether the connection is open, and hasn't failed or been closed
+    bool isOpen() const;
+
+    /// Close the connection
+    void close();
+
+    client::Connection & getConnection();
+
+private:
+    Bot(Bot const &) = delete;
+    Bot & operator=(Bot const &) = delete;
+
+    void handleMessage(net::MessageType const & type,
+                       json11::Json const & entity);
+
+    /// Microseconds since `time`
+    static std::uint64_t since(Clock::time_point time);
+
+    Behaviour const & m_behaviour;
+    Stats & m_stats;
+    client::MapCache m_map_cache;
+    client::Connection m_connection;
+    bool m_connected = false;
+    bool m_closed = false;
+    Clock::time_point m_started;
+    Clock::time_point m_offered;
+    Clock::time_point m_joined;
+    Clock::time_point m_next_input;
+    Clock::time_point m_next_ping;
+};
+
+} // namespace loadgen
@@ -0,0 +1,384 @@
+/// Simulate many clients to see how much load the server can take
+///
+/// Usage: zordzman-loadgen [options]
+///
+/// Opens connections to the server at a steady rate, each behaving like a
+/// real client: it handshakes, gets the map, joins the world and
+/// acknowledges snapshots. Once joined each plays an input script on a loop
+/// and times `net.ping` round trips. A line of progress is printed every
+/// second, and percentiles of each timing at the end.
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <ftw.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "format.h"
+#include "common/net/input.hpp"
+#include "Bot.hpp"
+
+#define HOST "localhost"   // The default server host.
+#define PORT_NUMBER 4544   // The default server port.
+#define CLIENTS 100        // The default number of clients.
+#define CONNECT_RATE 100   // The default connections opened a second.
+#define DURATION 30        // The default seconds to run for.
+#define INPUT_RATE 20      // The default inputs sent a second.
+#define PING_RATE 1        // The default pings sent a second.
+#define THREADS 1          // The default number of threads running clients.
+
+using namespace loadgen;
+
+namespace {
+
+std::atomic<bool> stopping(false);
+
+void stop(int) { stopping = true; }
+
+/// Everything about how to load the server
+struct Options {
+    std::string host = HOST;
+    int port = PORT_NUMBER;
+    unsigned clients = CLIENTS;
+    double connect_rate = CONNECT_RATE;
+    double duration = DURATION;
+    unsigned threads = THREADS;
+    net::Framing framing = net::Framing::Binary;
+    std::string maps_directory;
+    Behaviour behaviour;
+};
+
+/// Read an input script
+///
+/// Each line is the seconds to hold some buttons for followed by the names
+/// of the buttons (up, down, left, right, fire), if any. Blank lines and
+/// those starting with `#` are skipped.
+bool loadScript(char const * path, std::vector<Step> & script) {
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream words(line);
+        Step step;
+        if (line.empty() || line[0] == '#' || !(words >> step.seconds)) {
+            continue;
+        }
+        step.buttons = 0;
+        std::string button;
+        while (words >> button) {
+            if (button == "up") {
+                step.buttons |= net::input::Up;
+            } else if (button == "down") {
+                step.buttons |= net::input::Down;
+            } else if (button == "left") {
+                step.buttons |= net::input::Left;
+            } else if (button == "right") {
+                step.buttons |= net::input::Right;
+            } else if (button == "fire") {
+                step.buttons |= net::input::Fire;
+            } else {
+                fprintf(stderr, "Unknown button `%s` in %s\n",
+                        button.c_str(), path);
+                return false;
+            }
+        }
+        script.push_back(step);
+    }
+    return !script.empty();
+}
+
+int removeEntry(char const * path, struct stat const *, int,
+                struct FTW *) {
+    return remove(path);
+}
+
+void printTimes(char const * name, std::deque<Stats> const & stats,
+                Stats::Histogram const Stats::*histogram) {
+    Stats::Histogram::Snapshot snapshot;
+    for (auto const & thread : stats) {
+        snapshot.merge((thread.*histogram).snapshot());
+    }
+    printf("  %-14s %8llu %10.3f %10.3f %10.3f %10.3f %10.3f\n", name,
+           (unsigned long long)snapshot.count, snapshot.getMean() / 1000,
+           snapshot.getPercentile(50) / 1000.0,
+           snapshot.getPercentile(90) / 1000.0,
+           snapshot.getPercentile(99) / 1000.0, snapshot.max / 1000.0);
+}
+
+/// Add up a counter over every thread's stats
+unsigned long long total(std::deque<Stats> const & stats,
+                         Stats::Counter const Stats::*counter) {
+    unsigned long long sum = 0;
+    for (auto const & thread : stats) {
+        sum += (thread.*counter).get();
+    }
+    return sum;
+}
+
+void printProgress(double seconds, std::deque<Stats> const & stats) {
+    printf("%6.1fs: %llu started, %llu connected, %llu joined, %llu failed, "
+           "%llu disconnected, %llu messages in, %llu inputs out\n",
+           seconds, total(stats, &Stats::started),
+           total(stats, &Stats::connected), total(stats, &Stats::joined),
+           total(stats, &Stats::failed), total(stats, &Stats::disconnected),
+           total(stats, &Stats::messages_in),
+           total(stats, &Stats::inputs_out));
+    fflush(stdout);
+}
+
+/// Run one thread's share of the clients until the time is up
+///
+/// The thread runs every `threads`th client from `first`, opening
+/// connections at its share of the connect rate, and handles them all with
+/// one epoll instance.
+void runBots(Options const & options, unsigned first, Clock::time_point start,
+             Clock::time_point end, Stats & stats) {
+    int epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll < 0) {
+        fprintf(stderr, "Couldn't create epoll instance: %s\n",
+                strerror(errno));
+        stopping = true;
+        return;
+    }
+    unsigned clients = 0;
+    for (unsigned bot = first; bot < options.clients; bot += options.threads) {
+        clients++;
+    }
+    double connect_rate = options.connect_rate / options.threads;
+
+    std::vector<std::unique_ptr<Bot>> bots;
+    // Each bot's UDP socket is watched once it's opened
+    std::vector<bool> watching_udp;
+    // Events are for a bot's TCP socket, or its UDP socket if the low bit is
+    // set
+    auto watch = [epoll](net::Socket socket, std::uint64_t data,
+                         std::uint32_t events, int op) {
+        epoll_event event;
+        event.events = events;
+        event.data.u64 = data;
+        epoll_ctl(epoll, op, socket, &event);
+    };
+
+    epoll_event events[256];
+    while (!stopping) {
+        auto now = Clock::now();
+        if (now >= end) {
+            break;
+        }
+        double elapsed = std::chrono::duration<double>(now - start).count();
+        // Start the connections due by now
+        while (bots.size() < clients &&
+               (connect_rate <= 0 ||
+                bots.size() < elapsed * connect_rate + 1)) {
+            std::uint64_t index = bots.size();
+            std::string directory = fmt::format(
+                "{}/{}", options.maps_directory,
+                first + index * options.threads);
+            std::unique_ptr<Bot> bot;
+            try {
+                bot.reset(new Bot(directory, options.framing,
+                                  options.behaviour, stats));
+            } catch (std::exception const & except) {
+                fprintf(stderr, "%s\n", except.what());
+                stopping = true;
+                break;
+            }
+            stats.started.add();
+            if (bot->start(options.host, options.port, now)) {
+                watch(bot->getConnection().getSocket().getSocket(),
+                      index << 1, EPOLLOUT, EPOLL_CTL_ADD);
+            }
+            bots.push_back(std::move(bot));
+            watching_udp.push_back(false);
+        }
+
+        int count = epoll_wait(epoll, events, 256, 1);
+        for (int e = 0; e < count; e++) {
+            std::uint64_t index = events[e].data.u64 >> 1;
+            Bot & bot = *bots[index];
+            if (bot.isConnecting()) {
+                bot.finishConnecting();
+                if (bot.isOpen()) {
+                    watch(bot.getConnection().getSocket().getSocket(),
+                          index << 1, EPOLLIN, EPOLL_CTL_MOD);
+                }
+                continue;
+            }
+            bot.read();
+            net::Socket udp = bot.getConnection().getUDPSocket().getSocket();
+            if (!watching_udp[index] && bot.isOpen() && udp >= 0) {
+                watch(udp, index << 1 | 1, EPOLLIN, EPOLL_CTL_ADD);
+                watching_udp[index] = true;
+            }
+        }
+
+        now = Clock::now();
+        for (auto & bot : bots) {
+            bot->update(now);
+        }
+    }
+    bots.clear();
+    close(epoll);
+}
+
+} // Anonymous namespace
+
+int main(int argc, char ** argv) {
+    Options options;
+    options.behaviour.input_rate = INPUT_RATE;
+    options.behaviour.ping_rate = PING_RATE;
+    // Walk around in a square, firing along the way
+    options.behaviour.script = {{1, net::input::Up},
+                                {1, net::input::Right | net::input::Fire},
+                                {1, net::input::Down},
+                                {1, net::input::Left | net::input::Fire},
+                                {0.5, 0}};
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+            printf("Usage: zordzman-loadgen [options]\n"
+                   "  --host <host>            Server host\n"
+                   "  --port <port>            Server port\n"
+                   "  --clients <n>            Clients to simulate\n"
+                   "  --connect-rate <n>       Connections opened a second"
+                   " (0 for all at once)\n"
+                   "  --duration <seconds>     How long to run for\n"
+                   "  --threads <n>            Threads to run clients on\n"
+                   "  --framing <json|binary>  Framing to ask the server"
+                   " for\n"
+                   "  --script <file>          Input script to play\n"
+                   "  --input-rate <n>         Inputs sent a second by each"
+                   " client\n"
+                   "  --ping-rate <n>          Pings sent a second by each"
+                   " client\n"
+                   "  --maps <directory>       Where clients keep maps, one"
+                   " directory each\n"
+                   "\n"
+                   "Default host: %s\n"
+                   "Default port: %d\n"
+                   "Default clients: %d\n"
+                   "Default connect rate: %d\n"
+                   "Default duration: %d\n"
+                   "Default input rate: %d\n"
+                   "Default ping rate: %d\n"
+                   "Default threads: %d\n"
+                   "Default maps: a temporary directory, so every client"
+                   " downloads the map\n",
+                   HOST, PORT_NUMBER, CLIENTS, CONNECT_RATE, DURATION,
+                   INPUT_RATE, PING_RATE, THREADS);
+            return 0;
+        }
+        if (i == argc - 1) {
+            fprintf(stderr, "Argument must be supplied after `%s`.\n",
+                    argv[i]);
+            return 1;
+        }
+        char const * value = argv[++i];
+        if (!strcmp(argv[i - 1], "--host")) {
+            options.host = value;
+        } else if (!strcmp(argv[i - 1], "--port")) {
+            options.port = atoi(value);
+        } else if (!strcmp(argv[i - 1], "--clients")) {
+            options.clients = strtoul(value, NULL, 10);
+        } else if (!strcmp(argv[i - 1], "--connect-rate")) {
+            options.connect_rate = atof(value);
+        } else if (!strcmp(argv[i - 1], "--duration")) {
+            options.duration = atof(value);
+        } else if (!strcmp(argv[i - 1], "--threads")) {
+            options.threads = strtoul(value, NULL, 10);
+            if (options.threads < 1) {
+                fprintf(stderr, "There must be at least one thread.\n");
+                return 1;
+            }
+        } else if (!strcmp(argv[i - 1], "--framing")) {
+            if (!strcmp(value, "json")) {
+                options.framing = net::Framing::Json;
+            } else if (!strcmp(value, "binary")) {
+                options.framing = net::Framing::Binary;
+            } else {
+                fprintf(stderr, "Unknown framing `%s`.\n", value);
+                return 1;
+            }
+        } else if (!strcmp(argv[i - 1], "--script")) {
+            options.behaviour.script.clear();
+            if (!loadScript(value, options.behaviour.script)) {
+                fprintf(stderr, "Couldn't load input script `%s`.\n", value);
+                return 1;
+            }
+        } else if (!strcmp(argv[i - 1], "--input-rate")) {
+            options.behaviour.input_rate = atof(value);
+        } else if (!strcmp(argv[i - 1], "--ping-rate")) {
+            options.behaviour.ping_rate = atof(value);
+        } else if (!strcmp(argv[i - 1], "--maps")) {
+            options.maps_directory = value;
+        } else {
+            fprintf(stderr, "Unknown argument `%s`.\n", argv[i - 1]);
+            return 1;
+        }
+    }
+
+    bool temporary_maps = options.maps_directory.empty();
+    if (temporary_maps) {
+        char path[] = "/tmp/zordzman-loadgen-XXXXXX";
+        if (mkdtemp(path) == NULL) {
+            fprintf(stderr, "Couldn't create a maps directory: %s\n",
+                    strerror(errno));
+            return 1;
+        }
+        options.maps_directory = path;
+    }
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    std::deque<Stats> stats(options.threads);
+    std::vector<std::thread> threads;
+    auto start = Clock::now();
+    auto end = start + std::chrono::duration_cast<Clock::duration>(
+                           std::chrono::duration<double>(options.duration));
+    for (unsigned thread = 0; thread < options.threads; thread++) {
+        threads.emplace_back(runBots, std::cref(options), thread, start, end,
+                             std::ref(stats[thread]));
+    }
+    auto next_progress = start + std::chrono::seconds(1);
+    while (!stopping && next_progress < end) {
+        std::this_thread::sleep_until(next_progress);
+        printProgress(
+            std::chrono::duration<double>(Clock::now() - start).count(),
+            stats);
+        next_progress += std::chrono::seconds(1);
+    }
+    for (auto & thread : threads) {
+        thread.join();
+    }
+
+    printProgress(std::chrono::duration<double>(Clock::now() - start).count(),
+                  stats);
+    printf("\n  %-14s %8s %10s %10s %10s %10s %10s\n", "times (ms)", "count",
+           "mean", "p50", "p90", "p99", "max");
+    printTimes("connect", stats, &Stats::connect);
+    printTimes("map transfer", stats, &Stats::map_transfer);
+    printTimes("join", stats, &Stats::join);
+    printTimes("round trip", stats, &Stats::round_trip);
+
+    if (temporary_maps) {
+        nftw(options.maps_directory.c_str(), removeEntry, 16,
+             FTW_DEPTH | FTW_PHYS);
+    }
+    return 0;
+}
@@ -0,0 +1,180 @@
+#include "Capture.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include "format.h"
+#include "common/net/wire.hpp"
+
+namespace server {
+namespace capture {
+
+namespace {
+char const MAGIC[] = "ZCAP";
+std::size_t const MAGIC_SIZE = 4;
+/// Version of the format, written after the magic bytes
+char const VERSION = 2;
+/// Bytes buffered before they're written to the file
+std::size_t const BUFFER_SIZE = 64 * 1024;
+
+/// Settings as the entity which is written to the file
+///
+/// The limits are an object of [messages, bytes] by message type, with the
+/// connection's under `*` as with --rate-limit.
+json11::Json encodeSettings(Settings const &settings) {
+    rate::Limits const &limits = settings.limits;
+    json11::Json::object types{
+        {"*", json11::Json::array{limits.getConnection().messages,
+                                  limits.getConnection().bytes}},
+    };
+    for (std::size_t type = 0; type < limits.getTypeCount(); type++) {
+        types[limits.getTypeName(type)] = json11::Json::array{
+            limits.getType(type).messages, limits.getType(type).bytes};
+    }
+    return json11::Json::object{
+        {"map_digest", settings.map_digest},
+        {"map_hash", settings.map_hash},
+        {"mobs", (double)settings.mobs},
+        {"tick_rate", (double)limits.getTickRate()},
+        {"max_violations", (double)limits.getMaxViolations()},
+        {"limits", types},
+    };
+}
+
+/// Read settings written by encodeSettings(), returning false if they're
+/// malformed
+bool decodeSettings(json11::Json const &entity, Settings &settings) {
+    std::string error;
+    if (!entity.has_shape({{"map_digest", json11::Json::STRING},
+                           {"map_hash", json11::Json::STRING},
+                           {"mobs", json11::Json::NUMBER},
+                           {"tick_rate", json11::Json::NUMBER},
+                           {"max_violations", json11::Json::NUMBER},
+                           {"limits", json11::Json::OBJECT}},
+                          error)) {
+        return false;
+    }
+    settings.map_digest = entity["map_digest"].string_value();
+    settings.map_hash = entity["map_hash"].string_value();
+    settings.mobs = entity["mobs"].int_value();
+    settings.limits = rate::Limits(entity["tick_rate"].int_value());
+    settings.limits.setMaxViolations(entity["max_violations"].int_value());
+    for (auto const &type : entity["limits"].object_items()) {
+        auto const &values = type.second.array_items();
+        if (values.size() != 2 || !values[0].is_number() ||
+            !values[1].is_number()) {
+            return false;
+        }
+        rate::Limit limit{values[0].number_value(), values[1].number_value()};
+        if (type.first == "*") {
+            settings.limits.setConnection(limit);
+        } else {
+            settings.limits.setType(type.first, limit);
+        }
+    }
+    return true;
+}
+} // Anonymous namespace
+
+Recorder::Recorder(std::string const &path, Settings const &settings)
+    : m_start(std::chrono::steady_clock::now()), m_time(0) {
+    m_file = fopen(path.c_str(), "wb");
+    if (m_file == nullptr) {
+        throw std::runtime_error(fmt::format(
+            "Failed to open capture file {}: {}", path, strerror(errno)));
+    }
+    setvbuf(m_file, nullptr, _IOFBF, BUFFER_SIZE);
+    fwrite(MAGIC, 1, MAGIC_SIZE, m_file);
+    fputc(VERSION, m_file);
+    std::string header;
+    net::wire::encodeEntity(header, encodeSettings(settings));
+    fwrite(header.data(), 1, header.size(), m_file);
+}
+
+Recorder::~Recorder() { fclose(m_file); }
+
+void Recorder::record(Event event, std::uint32_t client, char const *data,
+                      std::size_t size) {
+    std::string header;
+    header.push_back((char)event);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // Taking the time under the lock keeps the records in time order
+    std::uint64_t time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             std::chrono::steady_clock::now() - m_start)
+                             .count();
+    net::wire::putVarint(header, time - m_time);
+    net::wire::putVarint(header, client);
+    net::wire::putVarint(header, size);
+    m_time = time;
+    fwrite(header.data(), 1, header.size(), m_file);
+    if (size > 0) {
+        fwrite(data, 1, size, m_file);
+    }
+}
+
+void Recorder::flush() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    fflush(m_file);
+}
+
+Reader::Reader(std::string const &path)
+    : m_file(new common::util::file::MappedFile(path)),
+      m_settings{"", "", 0, rate::Limits(0)}, m_offset(MAGIC_SIZE + 1),
+      m_time(0) {
+    if (m_file->size() < MAGIC_SIZE + 1 ||
+        memcmp(m_file->data(), MAGIC, MAGIC_SIZE) != 0) {
+        throw std::runtime_error(
+            fmt::format("{} isn't a capture file", path));
+    }
+    if (m_file->data()[MAGIC_SIZE] != VERSION) {
+        throw std::runtime_error(
+            fmt::format("{} is a capture file of unknown version {}", path,
+                        (int)m_file->data()[MAGIC_SIZE]));
+    }
+    char const *data = m_file->data() + m_offset;
+    json11::Json settings;
+    if (!net::wire::decodeEntity(data, m_file->data() + m_file->size(),
+                                 settings) ||
+        !decodeSettings(settings, m_settings)) {
+        throw std::runtime_error(
+            fmt::format("{} has corrupt settings", path));
+    }
+    m_offset = data - m_file->data();
+}
+
+Settings const &Reader::getSettings() const { return m_settings; }
+
+bool Reader::next(Record &record) {
+    char const *data = m_file->data();
+    std::size_t size = m_file->size();
+    if (m_offset == size) {
+        return false;
+    }
+    record.event = (Event)data[m_offset++];
+    std::uint64_t fields[3];
+    for (auto &field : fields) {
+        int length = net::wire::getVarint(data + m_offset, size - m_offset,
+                                          field);
+        if (length <= 0) {
+            throw std::runtime_error(
+                fmt::format("Corrupt capture record at offset {}", m_offset));
+        }
+        m_offset += length;
+    }
+    if (record.event < Event::Connect || record.event > Event::Disconnect ||
+        fields[2] > size - m_offset) {
+        throw std::runtime_error(
+            fmt::format("Corrupt capture record at offset {}", m_offset));
+    }
+    m_time += fields[0];
+    record.time = m_time;
+    record.client = fields[1];
+    record.data = data + m_offset;
+    record.size = fields[2];
+    m_offset += record.size;
+    return true;
+}
+
+} // namespace capture
+} // namespace server
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "common/util/mappedfile.hpp"
+
+#include "RateLimit.hpp"
+
+namespace server {
+
+/// Recording what clients send the server, to replay it later
+///
+/// A capture file starts with the magic bytes `ZCAP`, a version octet and
+/// the Settings the server was recorded with, encoded as an object with
+/// wire::encodeEntity(). Then there's a record for everything that happened
+/// to a client:
+///
+/// ```
+/// event (u8) | time (varint) | client (varint) | size (varint) | data
+/// ```
+///
+/// `time` is nanoseconds since the previous record (the first is since
+/// recording started) and `client` the client's slot, which is only reused
+/// once the client has gone. A `Data` record holds bytes exactly as they were
+/// read from the client's TCP socket, handshake included, so replaying them
+/// exercises the same decoding as the live server. A `Datagram` record holds
+/// the message of a datagram accepted from the client as a binary frame.
+namespace capture {
+
+enum class Event : unsigned char {
+    /// A client connected
+    Connect = 1,
+    /// Bytes were read from a client's socket
+    Data = 2,
+    /// A datagram was accepted from a client
+    Datagram = 3,
+    /// A client closed its connection
+    Disconnect = 4,
+};
+
+/// What the server was run with whilst recording, which a replay must be
+/// run with too to do the same work
+struct Settings {
+    /// Name of the digest the map was hashed with
+    std::string map_digest;
+    /// Hex encoded hash of the map
+    std::string map_hash;
+    unsigned int mobs;
+    rate::Limits limits;
+};
+
+struct Record {
+    Event event;
+    /// Nanoseconds since recording started
+    std::uint64_t time;
+    std::uint32_t client;
+    char const *data;
+    std::size_t size;
+};
+
+/// Appends records to a capture file
+///
+/// Safe to use from every shard's thread at once; records are written in
+/// the order they're made. They're buffered, and only written out when the
+/// buffer fills or flush() is called.
+class Recorder {
+public:
+    /// Create or truncate the capture file at `path`
+    ///
+    /// Throws std::runtime_error if it can't be opened.
+    Recorder(std::string const &path, Settings const &settings);
+    ~Recorder();
+
+    void record(Event event, std::uint32_t client, char const *data = nullptr,
+                std::size_t size = 0);
+
+    /// Write out everything recorded so far
+    void flush();
+
+    Recorder(Recorder const &) = delete;
+    Recorder &operator=(Recorder const &) = delete;
+
+private:
+    std::mutex m_mutex;
+    FILE *m_file;
+    std::chrono::steady_clock::time_point m_start;
+    /// Time of the last record, in nanoseconds since m_start
+    std::uint64_t m_time;
+};
+
+/// Reads the records of a capture file in order
+class Reader {
+public:
+    /// Throws std::runtime_error if the file can't be read or isn't a
+    /// capture
+    explicit Reader(std::string const &path);
+
+    /// What the capture was recorded with
+    Settings const &getSettings() const;
+
+    /// Read the next record
+    ///
+    /// The record's data points into the file, and stays valid as long as
+    /// the reader does. Returns false at the end of the file. Throws
+    /// std::runtime_error if the file is truncated or corrupt.
+    bool next(Record &record);
+
+private:
+    std::unique_ptr<common::util::file::MappedFile> m_file;
+    Settings m_settings;
+    std::size_t m_offset;
+    std::uint64_t m_time;
+};
+
+} // namespace capture
+} // namespace server
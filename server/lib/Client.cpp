@@ -1,151 +1,558 @@
 #include "Client.hpp"
 #include "format.h"
 
+#include "common/net/datagram.hpp"
 #include "common/util/net.hpp"
 
-// Last octet can be the protocol version if we ever decide to care
-#define MAGIC_NUMBER "\xCA\xC3\x55\x01"
+#include <cerrno>
+#include <cstring>
+#include <memory>
+
+#include <time.h>
+
+#include <sys/sendfile.h>
+#include <sys/uio.h>
 
 namespace server {
 
 using namespace json11;
+using common::LogLevel;
+
+namespace {
+/// Most buffers of pending messages kept for reuse, and the largest
+///
+/// The limit on size is so that a burst of messages doesn't tie up memory
+/// for the rest of the connection.
+std::size_t const MAX_SPARE_BUFFERS = 2;
+std::size_t const MAX_SPARE_CAPACITY = 64 * 1024;
 
-Client::Client(struct sockaddr_in addr, int socket)
-    : m_logger(stderr, [=] {
+std::uint64_t monotonicTime() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+} // Anonymous namespace
+
+Client::Client(struct sockaddr_in addr, int socket,
+               rate::Limits const &limits, std::uint64_t now,
+               Metrics &metrics)
+    : m_limiter(limits, now), m_throttled(false), m_decode_errors(0),
+      m_metrics(&metrics),
+      m_recorder(nullptr), m_capture_slot(0),
+      m_logger(stderr, [=] {
             return fmt::format("{}: ",
                    common::util::net::ipaddr(addr));
       }) {
     m_tcp_socket = socket;
+    m_udp_socket = -1;
+    m_egress_sent = 0;
     m_state = Pending;
     m_channel = -1;
-    m_logger.log("Client connected (state = Pending)");
+    m_map_offset = -1;
+    m_entity = 0;
+    m_snapshot_ack = 0;
+    m_last_heard = 0;
+    m_peer_address = addr;
+    m_udp_address = addr;
+    m_udp_confirmed = false;
+    m_udp_egress_sequence = 0;
+    m_udp_ingress_sequence = 0;
+    m_logger.log(LogLevel::Info, "Client connected (state = Pending)");
 }
 
 void Client::checkProtocolVersion() {
-    // TODO: This needs timeout logic so that if the magic number is not
-    // found after some time then client is also disconnected. Otherwise this
-    // would enable rouge clients to perform DoS by holding their sockets open
-    // but not actually sending anything.
+    // Clients which never send the magic number are disconnected by the
+    // server's handshake timer (see Server::startTimers()) rather than being
+    // able to hold their sockets open forever.
     if (m_state != Pending) {
         return;
     }
-    if (m_buffer.size() < strlen(MAGIC_NUMBER)) {
+    if (m_buffer.size() < MAGIC_NUMBER_SIZE) {
         return;
     } else {
-        char magic[] = MAGIC_NUMBER;
-        for (std::size_t i = 0; i < strlen(MAGIC_NUMBER); i++) {
-            char front = m_buffer.front();
-            m_buffer.pop_front();
-            if (front != magic[i]) {
+        char magic[] = MAGIC_PREFIX;
+        for (std::size_t i = 0; i < MAGIC_PREFIX_SIZE; i++) {
+            if (m_buffer.data()[i] != magic[i]) {
                 disconnect(fmt::format("Bad magic number at pos {}", i), false);
                 return;
             }
         }
+        // The last octet is the protocol version, which picks the framing
+        unsigned char version = m_buffer.data()[MAGIC_PREFIX_SIZE];
+        if (!isSupportedFraming(version)) {
+            disconnect(fmt::format("Unsupported protocol version {}",
+                                   (int)version), false);
+            return;
+        }
+        m_buffer.consume(MAGIC_NUMBER_SIZE);
+        m_buffer.setFraming((Framing)version);
         m_state = Connected;
-        m_logger.log("Correct magic number (state = Connected)");
+        // Now the framing is known whatever was sent whilst Pending can be
+        // encoded
+        while (!m_send_queue.empty()) {
+            Message const & message = m_send_queue.front();
+            m_writer.begin(getFraming(), std::get<0>(message), m_pending)
+                .value(std::get<1>(message));
+            m_writer.end();
+            m_send_queue.pop();
+        }
+        m_logger.log(LogLevel::Info,
+                     "Correct magic number, protocol version {} "
+                     "(state = Connected)", (int)version);
     }
 }
 
-std::vector<Json> Client::exec() {
+std::vector<Received> const &Client::exec(std::uint64_t now) {
+    m_received.clear();
+    m_ingress.clear();
     if (m_state == Disconnected) {
-        return std::vector<Json>();
-    }
-    char buffer[RECV_BUFFER_SIZE];
-    memset(buffer, 0, RECV_BUFFER_SIZE);
-    auto orig_buffer_size = m_buffer.size();
-    int bytes_recv =
-        recv(m_tcp_socket, buffer, RECV_BUFFER_SIZE - m_buffer.size(), 0);
-    if (bytes_recv <= 0) {
+        return m_received;
+    }
+    m_throttled = false;
+    // Messages held back by the last call go first, and nothing more is read
+    // until they're all handled. Reading could move the buffer they refer
+    // to, so even once they're all out the rest waits for the next tick.
+    if (m_state == Connected &&
+        (!processMessages(now) || !m_received.empty())) {
+        m_throttled = true;
+        return m_received;
+    }
+    while (m_tcp_socket >= 0) {
+        std::size_t allowed = m_limiter.allowBytes(RECV_BUFFER_SIZE, now);
+        if (allowed == 0) {
+            m_throttled = true;
+            break;
+        }
+        char *buffer = m_buffer.prepare(allowed);
+        ssize_t bytes_recv = recv(m_tcp_socket, buffer, allowed, 0);
+        if (bytes_recv > 0) {
+            if (m_recorder != nullptr) {
+                m_recorder->record(capture::Event::Data, m_capture_slot,
+                                   buffer, bytes_recv);
+            }
+            m_buffer.commit(bytes_recv);
+            m_limiter.takeBytes(bytes_recv, now);
+            m_metrics->bytes_in.add(bytes_recv);
+            continue;
+        }
         if (bytes_recv == 0) {
             // Socket is likely closed so there's no reason to send the
             // disconnect message
-            disconnect(
-                fmt::format("Left server (recv: {})", bytes_recv), false);
-        } else {
-            return std::vector<Json>();
+            disconnect("Left server (recv: 0)", false);
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            disconnect(fmt::format("Left server (recv: {})", strerror(errno)),
+                       false);
         }
-    }
-    for (int i = 0; i < bytes_recv; i++) {
-        m_buffer.push_back(buffer[i]);
+        if (m_state == Disconnected && m_recorder != nullptr) {
+            m_recorder->record(capture::Event::Disconnect, m_capture_slot);
+        }
+        break;
     }
     checkProtocolVersion();
-    if (m_state == Connected) {
-        flushSendQueue();
-        if (m_buffer.size() != orig_buffer_size) {
-            // If the buffer hasn't changed size then its not in a parsable
-            // state or its empty
-            return processMessages();
-        }
+    // Only the newly received bytes are scanned, so this is cheap even if
+    // nothing new is complete
+    if (m_state == Connected && !processMessages(now)) {
+        m_throttled = true;
     }
-    return std::vector<Json>();
+    return m_received;
+}
+
+void Client::receive(char const *data, std::size_t size,
+                     std::uint64_t now) {
+    memcpy(m_buffer.prepare(size), data, size);
+    m_buffer.commit(size);
+    m_limiter.takeBytes(size, now);
+    m_metrics->bytes_in.add(size);
+}
+
+void Client::record(capture::Recorder *recorder, std::uint32_t slot) {
+    m_recorder = recorder;
+    m_capture_slot = slot;
+}
+
+bool Client::isThrottled() const { return m_throttled; }
+
+bool Client::admit(MessageType const &type, std::size_t bytes,
+                   std::uint64_t now) {
+    if (m_limiter.admit(type, bytes, now)) {
+        return true;
+    }
+    // Only the first is logged, or flooding the server would flood the log
+    if (m_limiter.getViolations() == 1) {
+        m_logger.log(LogLevel::Warning,
+                     "Dropped '{}' message over its rate limit", type);
+    }
+    if (m_limiter.isFlooding() && m_state != Disconnected) {
+        disconnect(fmt::format("Flooding ({} messages over rate limits)",
+                               m_limiter.getViolations()));
+    }
+    return false;
 }
 
 void Client::send(std::string type, Json entity) {
-    Json message = Json::object{
-        { "type", type }, { "entity", entity },
-    };
-    m_send_queue.push(message);
+    m_logger.log(LogLevel::Debug, "Send: {}", type);
+    if (m_state == Pending) {
+        m_send_queue.emplace(std::move(type), std::move(entity));
+    } else {
+        m_writer.begin(getFraming(), type, m_pending).value(entity);
+        m_writer.end();
+    }
 }
 
-void Client::flushSendQueue() {
-    while (!m_send_queue.empty()) {
-        json11::Json message = m_send_queue.front();
-        m_send_queue.pop();
-        std::string encoded_message = message.dump() + " ";
-        // Using cppformat or the logger with the encoded_message causes
-        // wierdness I don't understand
-        printf("Send: %s\n", encoded_message.c_str());
-        if (::send(m_tcp_socket,
-                 encoded_message.data(),
-                 encoded_message.length(), 0) < (int)encoded_message.length()) {
-            // We just failed a flush, don't try to flush again whilst
-            // disconnecting
-            disconnect(
-                fmt::format("Failed to send: {}", strerror(errno)), false);
-        }
-    }
-}
-
-std::vector<Json> Client::processMessages() {
-    if (m_buffer.empty()) {
-        return std::vector<Json>();
-    }
-    std::string json_error;
-    // Well this seems stupidly inefficient. Why can't m_buffer be a
-    // std::string?
-    std::string raw(m_buffer.begin(), m_buffer.end());
-    std::vector<Json> messages = Json::parse_multi(raw, json_error);
-    // Parsing will fail if the buffer contains a partial message, so the JSON
-    // may be well formed but incomplete. This is not ideal. Ideally we should
-    // be able to read all the complete messages and only leave the incomplete
-    // one in the buffer.
-    if (json_error.size()) {
-        m_logger.log(fmt::format("JSON decode failed: {}", json_error));
+Writer &Client::write(MessageType const &type) {
+    m_logger.log(LogLevel::Debug, "Send: {}", type);
+    return m_writer.begin(getFraming(), type, m_pending);
+}
+
+void Client::sendFrame(Frame frame) {
+    // Whatever was sent before the frame has to go out before it
+    sealPending();
+    std::size_t size = frame->size();
+    m_egress.push_back(Segment{std::move(frame), nullptr, 0, size, false});
+}
+
+void Client::sendFile(
+    std::shared_ptr<common::util::file::MappedFile const> file,
+    std::size_t offset, std::size_t size) {
+    sealPending();
+    m_egress.push_back(
+        Segment{nullptr, std::move(file), offset, size, false});
+}
+
+Framing Client::getFraming() const { return m_buffer.getFraming(); }
+
+void Client::sealPending() {
+    if (m_pending.empty()) {
+        return;
+    }
+    std::shared_ptr<std::string> buffer;
+    if (m_spare.empty()) {
+        buffer = std::make_shared<std::string>();
     } else {
-        // Consume the buffer
-        m_buffer.erase(m_buffer.begin(), m_buffer.end());
+        buffer = std::move(m_spare.back());
+        m_spare.pop_back();
+    }
+    // m_pending takes the spare's capacity in exchange
+    buffer->swap(m_pending);
+    std::size_t size = buffer->size();
+    m_egress.push_back(Segment{std::move(buffer), nullptr, 0, size, true});
+}
+
+void Client::popSegment() {
+    Segment &segment = m_egress.front();
+    if (segment.spare && m_spare.size() < MAX_SPARE_BUFFERS &&
+        segment.frame->capacity() <= MAX_SPARE_CAPACITY) {
+        // Only the client ever had the buffer, which it made non-const
+        auto buffer = std::const_pointer_cast<std::string>(segment.frame);
+        buffer->clear();
+        m_spare.push_back(std::move(buffer));
     }
-    return messages;
+    m_egress.pop_front();
+}
+
+void Client::flushSendQueue() {
+    sealPending();
+    if (!m_egress.empty()) {
+        std::size_t queued = 0;
+        for (auto const &segment : m_egress) {
+            queued += segment.size;
+        }
+        m_metrics->send_queue.record(queued - m_egress_sent);
+        if (m_tcp_socket < 0) {
+            // Nowhere to send it, so it's as good as sent
+            m_metrics->bytes_out.add(queued - m_egress_sent);
+            while (!m_egress.empty()) {
+                popSegment();
+            }
+            m_egress_sent = 0;
+            return;
+        }
+    }
+    while (!m_egress.empty()) {
+        if (!m_egress.front().frame) {
+            if (!flushFile()) {
+                break;
+            }
+            continue;
+        }
+        // Gather as many frames as will fit into one sendmsg(2), up to the
+        // next file
+        struct iovec iov[64];
+        std::size_t count = 0;
+        std::size_t length = 0;
+        for (auto segment = m_egress.begin();
+             segment != m_egress.end() && segment->frame && count < 64;
+             ++segment, ++count) {
+            std::size_t offset = count == 0 ? m_egress_sent : 0;
+            iov[count].iov_base =
+                const_cast<char *>(segment->frame->data()) + offset;
+            iov[count].iov_len = segment->size - offset;
+            length += iov[count].iov_len;
+        }
+        struct msghdr header;
+        memset(&header, 0, sizeof header);
+        header.msg_iov = iov;
+        header.msg_iovlen = count;
+        ssize_t bytes_sent = sendmsg(m_tcp_socket, &header, MSG_NOSIGNAL);
+        if (bytes_sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                // We just failed a flush, don't try to flush again whilst
+                // disconnecting
+                m_egress.clear();
+                m_egress_sent = 0;
+                disconnect(
+                    fmt::format("Failed to send: {}", strerror(errno)), false);
+            }
+            break;
+        }
+        m_metrics->bytes_out.add(bytes_sent);
+        // Release the frames that were written completely
+        std::size_t remaining = bytes_sent;
+        while (!m_egress.empty() && m_egress.front().frame &&
+               remaining >= m_egress.front().size - m_egress_sent) {
+            remaining -= m_egress.front().size - m_egress_sent;
+            popSegment();
+            m_egress_sent = 0;
+        }
+        m_egress_sent += remaining;
+        if ((std::size_t)bytes_sent < length) {
+            // The socket's send buffer is full. The rest is sent when the
+            // event loop says the socket is writable again.
+            break;
+        }
+    }
+}
+
+bool Client::flushFile() {
+    Segment const &segment = m_egress.front();
+    off_t offset = segment.offset + m_egress_sent;
+    ssize_t bytes_sent =
+        sendfile(m_tcp_socket, segment.file->descriptor(), &offset,
+                 segment.size - m_egress_sent);
+    if (bytes_sent < 0) {
+        if (errno == EINTR) {
+            return true;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            m_egress.clear();
+            m_egress_sent = 0;
+            disconnect(fmt::format("Failed to send: {}", strerror(errno)),
+                       false);
+        }
+        return false;
+    }
+    if (bytes_sent == 0) {
+        // The file has been truncated underneath us, so the client would
+        // wait forever for the rest of the frame
+        m_egress.clear();
+        m_egress_sent = 0;
+        disconnect("Failed to send: file truncated", false);
+        return false;
+    }
+    m_metrics->bytes_out.add(bytes_sent);
+    m_egress_sent += bytes_sent;
+    if (m_egress_sent == segment.size) {
+        m_egress.pop_front();
+        m_egress_sent = 0;
+        return true;
+    }
+    return false;
+}
+
+bool Client::hasPendingEgress() const { return !m_egress.empty(); }
+
+bool Client::processMessages(std::uint64_t now) {
+    if (m_buffer.size() == 0) {
+        return true;
+    }
+    std::uint64_t start = monotonicTime();
+    bool complete = true;
+    MessageType type;
+    json::Value entity;
+    std::string error;
+    while (m_state == Connected) {
+        if (!m_limiter.allowMessage(now)) {
+            complete = false;
+            break;
+        }
+        std::size_t before = m_buffer.size();
+        if (!m_buffer.next(type, m_ingress, entity, error)) {
+            break;
+        }
+        m_limiter.takeMessage(now);
+        if (error.empty()) {
+            if (admit(type, before - m_buffer.size(), now)) {
+                m_received.push_back(Received{type, entity});
+            }
+        } else if (m_buffer.getFraming() == Framing::Json &&
+                   !m_buffer.isLost()) {
+            // Only the first is logged, like messages over the rate limits
+            if (++m_decode_errors == 1) {
+                m_logger.log(LogLevel::Warning, "JSON decode failed: {}",
+                             error);
+            }
+        } else {
+            // A bad binary frame means we've probably lost track of where
+            // frames start, as has a JSON value too long to keep, so there's
+            // no recovering the stream
+            disconnect(fmt::format("Bad message: {}", error), false);
+            break;
+        }
+    }
+    m_metrics->parse_time.record(monotonicTime() - start);
+    return complete;
 }
 
 Client::State Client::getState() const { return m_state; }
 
+void Client::bindChannel(Socket udp_socket, int channel, std::uint16_t port) {
+    m_udp_socket = udp_socket;
+    m_channel = channel;
+    m_udp_address = m_peer_address;
+    m_udp_address.sin_port = htons(port);
+    m_udp_confirmed = false;
+    m_logger.log(LogLevel::Info, "UDP channel {} bound to port {}", channel,
+                 port);
+}
+
+bool Client::acceptDatagram(struct sockaddr_in const &source,
+                            std::uint32_t sequence) {
+    if (source.sin_addr.s_addr != m_peer_address.sin_addr.s_addr ||
+        (m_udp_confirmed &&
+         !datagram::isNewer(sequence, m_udp_ingress_sequence))) {
+        return false;
+    }
+    m_udp_ingress_sequence = sequence;
+    m_udp_address = source;
+    m_udp_confirmed = true;
+    return true;
+}
+
+bool Client::hasDatagramChannel() const {
+    return m_channel >= 0 && m_udp_confirmed;
+}
+
+bool Client::sendDatagram(Frame frame) {
+    return sendDatagram(frame->data(), frame->size());
+}
+
+bool Client::sendDatagram(char const *frame, std::size_t size) {
+    if (!hasDatagramChannel() ||
+        datagram::HEADER_SIZE + size > datagram::MAX_SIZE) {
+        return false;
+    }
+    std::string header;
+    datagram::encodeHeader(header, m_channel, ++m_udp_egress_sequence);
+    iovec parts[2];
+    parts[0].iov_base = &header[0];
+    parts[0].iov_len = header.size();
+    parts[1].iov_base = const_cast<char *>(frame);
+    parts[1].iov_len = size;
+    msghdr message;
+    std::memset(&message, 0, sizeof message);
+    message.msg_name = &m_udp_address;
+    message.msg_namelen = sizeof m_udp_address;
+    message.msg_iov = parts;
+    message.msg_iovlen = 2;
+    // A datagram that can't be sent right now is as good as lost, which
+    // the receiver has to cope with anyway
+    ssize_t sent =
+        sendmsg(m_udp_socket, &message, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (sent > 0) {
+        m_metrics->bytes_out.add(sent);
+    }
+    return true;
+}
+
 Client::Client(Client &&other)
-    : m_tcp_socket(other.m_tcp_socket),
-      m_state(other.m_state), m_buffer(std::move(other.m_buffer))
-       {
+    : m_channel(other.m_channel), m_map_offset(other.m_map_offset),
+      m_entity(other.m_entity), m_snapshots(std::move(other.m_snapshots)),
+      m_snapshot_ack(other.m_snapshot_ack),
+      m_interest(std::move(other.m_interest)),
+      m_last_heard(other.m_last_heard),
+      m_handshake_timer(other.m_handshake_timer),
+      m_idle_timer(other.m_idle_timer), m_ping_timer(other.m_ping_timer),
+      m_tcp_socket(other.m_tcp_socket),
+      m_udp_socket(other.m_udp_socket), m_state(other.m_state),
+      m_buffer(std::move(other.m_buffer)),
+      // m_ingress and m_received start empty rather than being moved, as
+      // what was received last is only valid until the next exec() anyway
+      m_ingress(), m_received(),
+      m_limiter(std::move(other.m_limiter)),
+      m_throttled(other.m_throttled),
+      m_decode_errors(other.m_decode_errors), m_metrics(other.m_metrics),
+      m_recorder(other.m_recorder), m_capture_slot(other.m_capture_slot),
+      m_logger(std::move(other.m_logger)),
+      m_send_queue(std::move(other.m_send_queue)),
+      m_pending(std::move(other.m_pending)),
+      m_writer(std::move(other.m_writer)),
+      m_spare(std::move(other.m_spare)),
+      m_egress(std::move(other.m_egress)), m_egress_sent(other.m_egress_sent),
+      m_peer_address(other.m_peer_address),
+      m_udp_address(other.m_udp_address),
+      m_udp_confirmed(other.m_udp_confirmed),
+      m_udp_egress_sequence(other.m_udp_egress_sequence),
+      m_udp_ingress_sequence(other.m_udp_ingress_sequence) {
     other.m_tcp_socket = -1;
 }
 
 Client &Client::operator=(Client &&other) {
+    if (this == &other) {
+        return *this;
+    }
+    if (m_tcp_socket >= 0) {
+        close(m_tcp_socket);
+    }
+    m_channel = other.m_channel;
+    m_map_offset = other.m_map_offset;
+    m_entity = other.m_entity;
+    m_snapshots = std::move(other.m_snapshots);
+    m_snapshot_ack = other.m_snapshot_ack;
+    m_interest = std::move(other.m_interest);
+    m_last_heard = other.m_last_heard;
+    m_handshake_timer = other.m_handshake_timer;
+    m_idle_timer = other.m_idle_timer;
+    m_ping_timer = other.m_ping_timer;
     m_state = other.m_state;
     m_buffer = std::move(other.m_buffer);
+    // What was received last refers to the old buffer, and is only valid
+    // until the next exec() anyway, so it's dropped rather than moved
+    m_ingress.clear();
+    m_received.clear();
+    m_limiter = std::move(other.m_limiter);
+    m_throttled = other.m_throttled;
+    m_decode_errors = other.m_decode_errors;
+    m_metrics = other.m_metrics;
+    m_recorder = other.m_recorder;
+    m_capture_slot = other.m_capture_slot;
+    m_logger = std::move(other.m_logger);
+    m_send_queue = std::move(other.m_send_queue);
+    m_pending = std::move(other.m_pending);
+    m_writer = std::move(other.m_writer);
+    m_spare = std::move(other.m_spare);
+    m_egress = std::move(other.m_egress);
+    m_egress_sent = other.m_egress_sent;
+    m_peer_address = other.m_peer_address;
+    m_udp_address = other.m_udp_address;
+    m_udp_confirmed = other.m_udp_confirmed;
+    m_udp_egress_sequence = other.m_udp_egress_sequence;
+    m_udp_ingress_sequence = other.m_udp_ingress_sequence;
     m_tcp_socket = other.m_tcp_socket;
+    m_udp_socket = other.m_udp_socket;
     other.m_tcp_socket = -1;
     return *this;
 }
 
-Client::~Client() { close(m_tcp_socket); }
+Client::~Client() {
+    if (m_tcp_socket >= 0) {
+        close(m_tcp_socket);
+    }
+}
 
 void Client::disconnect(std::string reason, bool flush) {
     send("disconnect", reason);
@@ -153,7 +560,8 @@ void Client::disconnect(std::string reason, bool flush) {
         flushSendQueue();
     }
     m_state = Disconnected;
-    m_logger.log("Client disconnected (state = Disconnected): {} ", reason);
+    m_logger.log(LogLevel::Info,
+                 "Client disconnected (state = Disconnected): {} ", reason);
 }
 
 void Client::disconnect(std::string reason) { disconnect(reason, true); }
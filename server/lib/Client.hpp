@@ -2,12 +2,20 @@
 
 #include <deque>
 #include <map>
+#include <memory>
 #include <queue>
 #include <string>
 #include <vector>
 
 #include "json11.hpp"
+#include "common/net/framer.hpp"
 #include "common/net/message.hpp"
+#include "common/net/snapshot.hpp"
+#include "common/net/writer.hpp"
+#include "common/util/json.hpp"
+#include "common/util/mappedfile.hpp"
+#include "common/util/slotmap.hpp"
+#include "common/util/timerwheel.hpp"
 
 #include <stdio.h>
 #include <sys/socket.h>
@@ -19,17 +27,37 @@
 
 #include "common/logger/Logger.hpp"
 
+#include "Capture.hpp"
+#include "Metrics.hpp"
+#include "RateLimit.hpp"
+
 #define RECV_BUFFER_SIZE 1024
 
 using namespace net;
 
 namespace server {
 
+namespace json = common::util::json;
+
+/// A message received from a client
+///
+/// The entity refers to the client's receive buffer and to the document it
+/// was decoded into, which are reused for the next messages received.
+struct Received {
+    MessageType type;
+    json::Value entity;
+};
+
 /// Represents a connected client
 ///
-/// When a message handler is called it is passed the client instance from which
-/// the message originated. Therefore this used be used for persisting anything
-/// about the client that needs to be passed between subsystems.
+/// When a message handler is called it is passed the handle of the client
+/// from which the message originated. Therefore this used be used for
+/// persisting anything about the client that needs to be passed between
+/// subsystems.
+///
+/// The client owns its TCP socket and closes it when destroyed. A client
+/// created without a socket (-1), as when replaying a capture, is given what
+/// it receives with receive() and discards whatever it sends.
 class Client {
 
 public:
@@ -43,21 +71,61 @@ public:
     };
 
     /// UDP socket channel, -1 if no channel set yet
+    ///
+    /// This is the number datagrams to and from the client are marked with
+    /// (see net::datagram). It's set by bindChannel().
     int m_channel;
 
+    /// Offset of the next map chunk to send, -1 if not sending the map
+    long m_map_offset;
+
+    /// ID of the client's player in the world, 0 if it hasn't joined yet
+    std::uint32_t m_entity;
+
+    /// The world snapshots recently sent to the client
+    net::snapshot::SnapshotRing m_snapshots;
+
+    /// Tick of the latest snapshot the client has acknowledged, 0 if none
+    ///
+    /// Snapshots are sent relative to this one whilst it's in m_snapshots.
+    std::uint64_t m_snapshot_ack;
+
+    /// Sorted IDs of the entities the client is being sent
+    ///
+    /// See interest::Grid::select().
+    std::vector<std::uint32_t> m_interest;
+
+    /// Tick the client last sent anything, over TCP or UDP
+    std::uint64_t m_last_heard;
+
+    /// Timers the server schedules for the client
+    ///
+    /// These are cancelled when the client is removed.
+    common::util::timer::TimerId m_handshake_timer;
+    common::util::timer::TimerId m_idle_timer;
+    common::util::timer::TimerId m_ping_timer;
+
     /// Construct a new Client instance
     ///
     /// The client's initial state will be set to PENDING.
-    Client(struct sockaddr_in addr, int file);
+    ///
+    /// @param limits What the client may send, which must outlive it
+    /// @param now The current tick
+    /// @param metrics Where the client's traffic is counted, which must
+    ///     outlive it
+    Client(struct sockaddr_in addr, int file, rate::Limits const &limits,
+           std::uint64_t now, Metrics &metrics);
 
     /// Enqueue a message to be sent to the client
     ///
-    /// The message will be encoded as a JSON object with two fields: the
-    /// 'type' and 'entity' which will be set to given corresponding
-    /// parameters.
+    /// The message will be encoded with two fields: the 'type' and 'entity'
+    /// which will be set to given corresponding parameters. Whether it's
+    /// encoded as JSON or a binary frame depends on the protocol version the
+    /// client asked for in the handshake.
     ///
     /// Note that this doesn't send message immediately. Rather a buffer of
-    /// pending messages is sent with each call to exec(). Also note that
+    /// pending messages is sent with each call to flushSendQueue(), which the
+    /// server does once per tick. Also note that
     /// messages are only actually sent when the client is in the Connected
     /// state, but messages can be enqueued whilst the client is in any state.
     ///
@@ -65,17 +133,81 @@ public:
     /// they arrive at the client in.
     void send(std::string type, json11::Json entity);
 
-    // TODO: Rewrite this completely fucking wrong doc string or whatever
-    // you call it
-    /// Read bytes from the socket into the buffer
+    /// Start writing a message to be sent to the client
+    ///
+    /// This is the same as send() except the entity is written with the
+    /// returned writer straight into the buffer of pending messages rather
+    /// than built as a json11::Json first, so it doesn't allocate. Finish it
+    /// with Writer::end() before anything else is sent to the client.
     ///
-    /// Reads up to RECV_BUFFER_SIZE bytes into the buffer.
-    /// Therefore the caller is responsible for calling both
-    /// SDLNet_CheckSockets and SDLNet_SocketReady
-    /// on the socket set containing the client's socket.
+    /// @code
+    /// client->write("world.join").value(player).end();
+    /// @endcode
     ///
-    /// Returns all the messages that were received by the client.
-    std::vector<json11::Json> exec();
+    /// The client mustn't be Pending, as its framing isn't known yet.
+    Writer &write(MessageType const &type);
+
+    /// Enqueue an already encoded message to be sent to the client
+    ///
+    /// This is the same as send() except the message has already been
+    /// encoded, so the same frame can be queued on many clients without
+    /// encoding or copying it for each one. The frame must have been encoded
+    /// with the client's framing, so the client must be Connected.
+    void sendFrame(Frame frame);
+
+    /// Enqueue part of a file to be sent to the client as is
+    ///
+    /// The bytes are written straight from the file to the socket by
+    /// sendfile(2) when the send queue is flushed, without being copied
+    /// through userspace. This is for the payload following a frame prefix
+    /// enqueued by sendFrame(). The file is kept open until it's been sent.
+    void sendFile(std::shared_ptr<common::util::file::MappedFile const> file,
+                  std::size_t offset, std::size_t size);
+
+    /// The framing the client asked for in the handshake
+    ///
+    /// This is only meaningful once the client is Connected.
+    Framing getFraming() const;
+
+    /// Read everything available on the socket into the buffer
+    ///
+    /// The socket is registered with the server's event loop as
+    /// edge-triggered, so this reads until recv(2) would block. If the peer
+    /// has closed the connection or the socket errors then the client is
+    /// disconnected.
+    ///
+    /// Reading stops early if the client goes over its connection's rate
+    /// limits, leaving the rest in the socket, and the client is throttled
+    /// until this is called again on a later tick (see isThrottled()).
+    /// Messages over their type's limits are dropped (see admit()).
+    ///
+    /// Returns all the messages that were received by the client, which are
+    /// only valid until the next call.
+    std::vector<Received> const &exec(std::uint64_t now);
+
+    /// Add bytes to the receive buffer as if they'd been read from the socket
+    ///
+    /// They're decoded by the next call to exec(). This is for replaying
+    /// captures into clients without a socket.
+    void receive(char const *data, std::size_t size, std::uint64_t now);
+
+    /// Record everything received from now on in a capture
+    ///
+    /// @param recorder Where to record it, which must outlive the client
+    /// @param slot Identifies the client in the capture
+    void record(capture::Recorder *recorder, std::uint32_t slot);
+
+    /// Check if exec() stopped reading because of the rate limits
+    ///
+    /// As the socket is edge-triggered, nothing more will be heard from it
+    /// until exec() is called again.
+    bool isThrottled() const;
+
+    /// Check a message against the rate limits for its type
+    ///
+    /// Returns false if the message should be dropped. This counts as a
+    /// violation, and clients with too many violations are disconnected.
+    bool admit(MessageType const &type, std::size_t bytes, std::uint64_t now);
 
     /// Disconnect for `reason`
     ///
@@ -97,15 +229,67 @@ public:
 
     State getState() const;
 
+    /// Send all enqueued messages to the client
+    ///
+    /// All the frames enqueued by sendFrame() and the messages enqueued by
+    /// send() (which are encoded into a buffer as they're enqueued) are
+    /// written with one gathering sendmsg(2) call, so flushing costs one
+    /// system call no matter how many messages were queued. Files enqueued
+    /// by sendFile() are written with a sendfile(2) call each.
+    ///
+    /// This consumes the send queue entirely. If the socket's send buffer
+    /// fills up then whatever couldn't be written is kept and sent first by
+    /// the next call; the server calls this again when the socket becomes
+    /// writable.
+    void flushSendQueue();
+
+    /// Check if there is encoded data still waiting to be written
+    bool hasPendingEgress() const;
+
+    /// Give the client a UDP channel
+    ///
+    /// Datagrams are sent through `udp_socket` to the client's IP address
+    /// at `port` until one is received from it, after which they're sent to
+    /// wherever it was received from. This is so that clients behind NAT
+    /// can be reached.
+    void bindChannel(Socket udp_socket, int channel, std::uint16_t port);
+
+    /// Check a datagram received on the client's channel
+    ///
+    /// Datagrams must come from the client's IP address, and are dropped if
+    /// their sequence number isn't newer than the last one accepted.
+    ///
+    /// Returns true if the datagram should be handled.
+    bool acceptDatagram(struct sockaddr_in const &source,
+                        std::uint32_t sequence);
+
+    /// Check if messages can be sent to the client by sendDatagram()
+    ///
+    /// This is only once a datagram from the client has been accepted, which
+    /// proves datagrams can get through.
+    bool hasDatagramChannel() const;
+
+    /// Send a frame to the client in a datagram
+    ///
+    /// Unlike sendFrame() this is sent immediately, and it might never
+    /// arrive. The frame must be binary framed, whatever the client's
+    /// framing is.
+    ///
+    /// Returns false without sending anything if the client doesn't have a
+    /// datagram channel or the frame is too big for a datagram, in which case
+    /// it should be sent over TCP instead.
+    bool sendDatagram(Frame frame);
+    bool sendDatagram(char const *frame, std::size_t size);
+
     // Forbid copying
     Client(const Client &) = delete;
     Client &operator=(const Client &) = delete;
 
-    // Move operations
+    // Move operations; the socket moves with the client
     Client(Client &&);
     Client &operator=(Client &&);
 
-    // Destructor
+    // Destructor; closes the TCP socket
     ~Client();
 
     Socket m_tcp_socket;
@@ -113,10 +297,70 @@ public:
 
 private:
     State m_state;
-    std::deque<char> m_buffer;
+    Framer m_buffer;
+    /// What the messages returned by exec() are decoded into
+    json::Document m_ingress;
+    std::vector<Received> m_received;
+    rate::Limiter m_limiter;
+    bool m_throttled;
+    /// Number of messages which failed to decode
+    std::uint64_t m_decode_errors;
+    Metrics *m_metrics;
+    /// Where received bytes are recorded, if anywhere
+    capture::Recorder *m_recorder;
+    std::uint32_t m_capture_slot;
 
     common::Logger m_logger;
-    std::queue<json11::Json> m_send_queue;
+    /// Messages sent whilst Pending, when the framing isn't known yet
+    std::queue<Message> m_send_queue;
+    /// Messages encoded by send() since the last frame was enqueued
+    std::string m_pending;
+    /// What send() and write() encode messages into m_pending with
+    Writer m_writer;
+    /// Buffers of pending messages which have been written to the socket,
+    /// to be swapped for m_pending when it's next enqueued
+    ///
+    /// This way m_pending keeps its capacity rather than being reallocated
+    /// every tick.
+    std::vector<std::shared_ptr<std::string>> m_spare;
+    /// Something enqueued to be written to the socket
+    ///
+    /// This is either a whole frame or, if `frame` is null, `size` bytes of
+    /// `file` starting from `offset`.
+    struct Segment {
+        Frame frame;
+        std::shared_ptr<common::util::file::MappedFile const> file;
+        std::size_t offset;
+        std::size_t size;
+        /// Whether `frame` is a buffer of pending messages, which is kept
+        /// in m_spare once it's been written
+        bool spare;
+    };
+    /// Segments not yet written to the socket
+    std::deque<Segment> m_egress;
+    /// How many bytes of the first segment have already been written
+    std::size_t m_egress_sent;
+
+    /// Address of the client's end of the TCP connection
+    struct sockaddr_in m_peer_address;
+    /// Where datagrams to the client are sent
+    struct sockaddr_in m_udp_address;
+    /// Whether a datagram has been accepted from the client
+    bool m_udp_confirmed;
+    /// Sequence numbers of the last datagrams sent and accepted
+    std::uint32_t m_udp_egress_sequence;
+    std::uint32_t m_udp_ingress_sequence;
+
+    /// Write the file segment at the front of m_egress
+    ///
+    /// Returns false if nothing more can be written for now.
+    bool flushFile();
+
+    /// Move m_pending onto the end of m_egress as a frame of its own
+    void sealPending();
+
+    /// Remove the segment at the front of m_egress once it's been written
+    void popSegment();
 
     /// Assert the client is using the correct protocol version
     ///
@@ -125,6 +369,10 @@ private:
     /// then the client state is set to connected. If the front of the buffer
     /// doesn't match the magic number the client is disconnected.
     ///
+    /// The last octet of the magic number is the protocol version, which
+    /// selects the framing used for the rest of the connection. Clients
+    /// asking for an unsupported version are disconnected.
+    ///
     /// If the client is any state other than Pending or the buffer does not
     /// at least contain the minimum number of bytes for the magic number,
     /// this method has no effect.
@@ -132,10 +380,10 @@ private:
     /// The magic number is consumed from the buffer.
     void checkProtocolVersion();
 
-    /// Process JSON-encoded messages from the buffer
+    /// Process encoded messages from the buffer
     ///
-    /// This parses all whitespace-delimited JSON objects from the buffer and
-    /// calls the appropriate handlers for the the message types.
+    /// This decodes all complete messages from the buffer, either
+    /// whitespace-delimited JSON objects or binary frames.
     ///
     /// Each JSON message should be an object at the top level with a string
     /// 'type' field. There should also be a 'entity' field which can be of any
@@ -146,19 +394,20 @@ private:
     /// type field is the wrong type then the message is ignored. The buffer
     /// will still be consumed as with well formed messages.
     ///
-    /// If the buffer contains incomplete or malformed JSON then no messages
-    /// are processed. No handlers called. The buffer is not consumed.
-    ///
-    /// All the parsed messages are returned in a vector. The vector may be
-    /// be empty.
-    std::vector<json11::Json> processMessages();
-
-    /// Encode and dend all enqueued messages to the client
-    ///
-    /// Each JSON message that has been enqueued by send() is encoded into JSON
-    /// and is sent to the client with a whitespace terminator.
+    /// A trailing incomplete message is left in the buffer and picked up
+    /// where it left off by the next call, so it's never reparsed. Malformed
+    /// JSON messages are logged and skipped. Malformed binary frames cause
+    /// the client to be disconnected.
     ///
-    /// This consumes the send queue entirely.
-    void flushSendQueue();
+    /// The parsed messages are appended to m_received. Returns false if it
+    /// stopped because the connection is out of messages for now, leaving
+    /// the rest in the buffer.
+    bool processMessages(std::uint64_t now);
 };
+
+/// Identifies one of a Server's clients
+///
+/// Unlike a pointer, a handle stays valid as other clients come and go, and
+/// safely finds nothing once its client has gone. See Server::getClient().
+typedef common::util::container::SlotHandle ClientHandle;
 } // namespace server
@@ -0,0 +1,126 @@
+#include "Cluster.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <thread>
+
+using common::LogLevel;
+
+namespace server {
+
+Cluster::Cluster(int port, int udp_port, unsigned int max_clients,
+                 std::string map_name, std::string map_digest,
+                 unsigned int mobs, unsigned int threads,
+                 rate::Limits limits, std::string admin_socket,
+                 std::string capture)
+    : m_logger(stderr, [] { return "SERVER: "; }), m_world(m_map),
+      m_limits(std::move(limits)), m_admin_socket(std::move(admin_socket)),
+      m_start(std::chrono::steady_clock::now()), m_max_clients(max_clients),
+      m_clients(0), m_shard_count(threads) {
+    try {
+        m_map.loadLevel(map_name, map_digest);
+    } catch (std::runtime_error &error) {
+        m_logger.log(LogLevel::Error, "{}", error.what());
+        exit(1);
+    }
+    m_logger.log(LogLevel::Info, "Map hash: {} ({})", m_map.getHash(),
+                 m_map.getDigest());
+    m_world.addEyenados(mobs);
+    if (!capture.empty()) {
+        try {
+            m_recorder.reset(new capture::Recorder(
+                capture, capture::Settings{m_map.getDigest(), m_map.getHash(),
+                                           mobs, m_limits}));
+        } catch (std::runtime_error &error) {
+            m_logger.log(LogLevel::Error, "{}", error.what());
+            exit(1);
+        }
+        m_logger.log(LogLevel::Info, "Recording capture to {}", capture);
+    }
+
+    for (unsigned int shard = 0; shard < m_shard_count; shard++) {
+        m_shards.emplace_back(new Server(*this, shard, port, udp_port));
+    }
+    if (m_shard_count > 1) {
+        m_logger.log(LogLevel::Info, "Running {} shards", m_shard_count);
+    }
+}
+
+int Cluster::exec() {
+    std::vector<std::thread> threads;
+    for (unsigned int shard = 1; shard < m_shard_count; shard++) {
+        Server *server = m_shards[shard].get();
+        threads.emplace_back([server] { server->exec(); });
+    }
+    int result = m_shards[0]->exec();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    return result;
+}
+
+int Cluster::replay(capture::Reader &reader, bool real_time) {
+    capture::Settings const &settings = reader.getSettings();
+    if (settings.map_hash != m_map.getHash()) {
+        m_logger.log(LogLevel::Error,
+                     "The capture was recorded with a different map ({} {})",
+                     settings.map_digest, settings.map_hash);
+        exit(1);
+    }
+    if (settings.limits.getTickRate() != m_limits.getTickRate()) {
+        m_logger.log(LogLevel::Error,
+                     "The capture was recorded at {} ticks a second, not {}",
+                     settings.limits.getTickRate(), m_limits.getTickRate());
+        exit(1);
+    }
+    try {
+        m_shards[0]->replay(reader, real_time);
+    } catch (std::runtime_error &error) {
+        m_logger.log(LogLevel::Error, "{}", error.what());
+        exit(1);
+    }
+    printf("%s", renderMetrics(false).c_str());
+    return 0;
+}
+
+unsigned int Cluster::getShardCount() const { return m_shard_count; }
+
+Server &Cluster::getShard(unsigned int shard) { return *m_shards[shard]; }
+
+map::Level const &Cluster::getMap() const { return m_map; }
+
+rate::Limits const &Cluster::getLimits() const { return m_limits; }
+
+std::string const &Cluster::getAdminSocket() const { return m_admin_socket; }
+
+capture::Recorder *Cluster::getRecorder() { return m_recorder.get(); }
+
+std::string Cluster::renderMetrics(bool json) const {
+    std::vector<Metrics const *> shards;
+    for (auto const &shard : m_shards) {
+        shards.push_back(&shard->getMetrics());
+    }
+    std::chrono::duration<double> uptime =
+        std::chrono::steady_clock::now() - m_start;
+    return server::renderMetrics(shards, uptime.count(), json);
+}
+
+world::World &Cluster::getWorld() { return m_world; }
+
+bool Cluster::addClient() {
+    unsigned int clients = m_clients.load(std::memory_order_relaxed);
+    do {
+        if (clients >= m_max_clients) {
+            return false;
+        }
+    } while (!m_clients.compare_exchange_weak(clients, clients + 1,
+                                              std::memory_order_relaxed));
+    return true;
+}
+
+void Cluster::removeClient() {
+    m_clients.fetch_sub(1, std::memory_order_relaxed);
+}
+
+} // namespace server
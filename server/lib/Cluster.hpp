@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common/logger/Logger.hpp"
+
+#include "Capture.hpp"
+#include "Map.hpp"
+#include "RateLimit.hpp"
+#include "Server.hpp"
+#include "World.hpp"
+
+namespace server {
+
+/// A server split into shards which each run on their own thread
+///
+/// Every shard is a `Server` with its own event loop, its own listening
+/// sockets and its own clients. The listening sockets are all bound to the
+/// same ports with SO_REUSEPORT, so the kernel spreads new connections
+/// between the shards and each connection is only ever touched by the thread
+/// of the shard which accepted it. Accepting, reading, parsing and sending
+/// therefore scale with the number of shards.
+///
+/// What the shards share lives here. The level is loaded before any shard
+/// starts and is read-only after that. The world belongs to shard 0, which
+/// steps it and publishes each snapshot along with its interest grid to the
+/// other shards; these are immutable, so every shard reads them without
+/// locking. Other shards change the world by posting tasks to shard 0's
+/// mailbox (see Mailbox), and broadcasts are likewise posted to every
+/// shard's mailbox.
+class Cluster {
+public:
+    /// Load the level and set up `threads` shards
+    ///
+    /// Exits if the level can't be loaded or a shard can't listen.
+    ///
+    /// @param limits What each client may send the server
+    /// @param admin_socket Path of the admin socket, or empty for none
+    /// @param capture Path of a capture to record everything clients send
+    ///     to, or empty for none; see capture::Recorder
+    Cluster(int port, int udp_port, unsigned int max_clients,
+            std::string map_name, std::string map_digest, unsigned int mobs,
+            unsigned int threads, rate::Limits limits,
+            std::string admin_socket, std::string capture);
+
+    /// Run the server
+    ///
+    /// Shard 0 runs on the calling thread and every other shard on a thread
+    /// of its own. See Server::exec().
+    int exec();
+
+    /// Replay a capture instead of running the server
+    ///
+    /// The cluster must have a single shard and no sockets (port 0), and be
+    /// created with the capture's settings and no limit on clients. Prints
+    /// the metrics when the capture is over; see Server::replay(). Exits if
+    /// the capture was recorded with a different map or can't be read.
+    int replay(capture::Reader &reader, bool real_time);
+
+    /// Number of shards; fixed when the cluster is created
+    unsigned int getShardCount() const;
+
+    Server &getShard(unsigned int shard);
+
+    map::Level const &getMap() const;
+
+    /// The rate limits for clients of every shard
+    rate::Limits const &getLimits() const;
+
+    /// Path of the admin socket shard 0 listens on, empty if none
+    std::string const &getAdminSocket() const;
+
+    /// Where the shards record what clients send, or nullptr if they don't
+    capture::Recorder *getRecorder();
+
+    /// Render the metrics of every shard; see renderMetrics()
+    std::string renderMetrics(bool json) const;
+
+    /// The world
+    ///
+    /// Only shard 0's thread may use this, apart from World::reserveId().
+    world::World &getWorld();
+
+    /// Count a new client towards the maximum number of clients
+    ///
+    /// Returns false, without counting it, if the server is already full.
+    bool addClient();
+
+    /// Stop counting a client added by addClient()
+    void removeClient();
+
+    Cluster(const Cluster &) = delete;
+    Cluster &operator=(const Cluster &) = delete;
+
+private:
+    common::Logger m_logger;
+    map::Level m_map;
+    world::World m_world;
+    rate::Limits m_limits;
+    std::string m_admin_socket;
+    std::chrono::steady_clock::time_point m_start;
+    unsigned int m_max_clients;
+    /// Clients connected to any shard
+    std::atomic<unsigned int> m_clients;
+    unsigned int m_shard_count;
+    std::unique_ptr<capture::Recorder> m_recorder;
+    std::vector<std::unique_ptr<Server>> m_shards;
+};
+
+} // namespace server
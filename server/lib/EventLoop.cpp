@@ -0,0 +1,163 @@
+#include "EventLoop.hpp"
+
+#include "format.h"
+
+#include <cerrno>
+#include <stdexcept>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/timerfd.h>
+
+namespace server {
+
+namespace {
+const int MAX_EVENTS = 256;
+
+const long NS_PER_SECOND = 1000000000L;
+
+std::uint64_t pack(int fd, std::uint32_t generation) {
+    return (std::uint64_t)generation << 32 | (std::uint32_t)fd;
+}
+
+/// Nanoseconds from the start of a fixed rate timer until tick `tick`
+///
+/// Split so that neither product can overflow before the timer has been
+/// running for centuries.
+std::uint64_t tickOffset(std::uint64_t tick, unsigned long rate) {
+    return tick / rate * NS_PER_SECOND + tick % rate * NS_PER_SECOND / rate;
+}
+
+/// Number of ticks of a fixed rate timer due `elapsed_ns` after its start
+std::uint64_t ticksDue(std::uint64_t elapsed_ns, unsigned long rate) {
+    return elapsed_ns / NS_PER_SECOND * rate +
+           elapsed_ns % NS_PER_SECOND * rate / NS_PER_SECOND;
+}
+
+std::uint64_t nanoseconds(timespec const &time) {
+    return (std::uint64_t)time.tv_sec * NS_PER_SECOND + time.tv_nsec;
+}
+} // Anonymous namespace
+
+EventLoop::EventLoop() : m_running(false), m_events(MAX_EVENTS) {
+    m_epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epoll == -1) {
+        throw std::runtime_error(
+            fmt::format("Failed to create epoll instance: {}",
+                        strerror(errno)));
+    }
+}
+
+EventLoop::~EventLoop() { close(m_epoll); }
+
+void EventLoop::add(int fd, std::uint32_t events, Callback callback) {
+    if ((std::size_t)fd >= m_registrations.size()) {
+        m_registrations.resize(fd + 1);
+    }
+    Registration &registration = m_registrations[fd];
+    registration.callback.reset(new Callback(std::move(callback)));
+    epoll_event event;
+    event.events = events | EPOLLET;
+    event.data.u64 = pack(fd, registration.generation);
+    if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &event) == -1) {
+        registration.callback.reset();
+        throw std::runtime_error(fmt::format(
+            "Failed to add descriptor {} to epoll: {}", fd, strerror(errno)));
+    }
+}
+
+void EventLoop::modify(int fd, std::uint32_t events) {
+    epoll_event event;
+    event.events = events | EPOLLET;
+    event.data.u64 = pack(fd, m_registrations[fd].generation);
+    epoll_ctl(m_epoll, EPOLL_CTL_MOD, fd, &event);
+}
+
+void EventLoop::remove(int fd) {
+    if (fd < 0 || (std::size_t)fd >= m_registrations.size() ||
+        !m_registrations[fd].callback) {
+        return;
+    }
+    Registration &registration = m_registrations[fd];
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, nullptr);
+    m_removed.push_back(std::move(registration.callback));
+    registration.generation++;
+}
+
+int EventLoop::addFixedRateTimer(unsigned long rate,
+                                 TimerCallback callback) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd == -1) {
+        throw std::runtime_error(
+            fmt::format("Failed to create timer: {}", strerror(errno)));
+    }
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    std::uint64_t start = nanoseconds(now);
+    // Number of ticks the callback has been told about
+    auto ticks = std::make_shared<std::uint64_t>(0);
+    // The timer is one-shot and rearmed with an absolute deadline each time
+    // it fires, as a periodic timerfd's interval would be rounded
+    auto arm = [fd, rate, start, ticks] {
+        std::uint64_t deadline = start + tickOffset(*ticks + 1, rate);
+        itimerspec spec;
+        spec.it_interval.tv_sec = 0;
+        spec.it_interval.tv_nsec = 0;
+        spec.it_value.tv_sec = deadline / NS_PER_SECOND;
+        spec.it_value.tv_nsec = deadline % NS_PER_SECOND;
+        timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+    };
+    arm();
+    add(fd, EPOLLIN, [fd, rate, start, ticks, arm, callback](std::uint32_t) {
+        std::uint64_t expirations;
+        if (read(fd, &expirations, sizeof expirations) !=
+            sizeof expirations) {
+            return;
+        }
+        // Count every deadline that has passed, not just the one the timer
+        // was armed for, in case the loop was held up
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        std::uint64_t due = ticksDue(nanoseconds(now) - start, rate);
+        std::uint64_t count = due - *ticks;
+        *ticks = due;
+        arm();
+        if (count > 0) {
+            callback(count);
+        }
+    });
+    return fd;
+}
+
+void EventLoop::poll(int timeout_ms) {
+    int count = epoll_wait(m_epoll, m_events.data(), m_events.size(),
+                           timeout_ms);
+    if (count == -1) {
+        if (errno != EINTR) {
+            throw std::runtime_error(
+                fmt::format("epoll_wait failed: {}", strerror(errno)));
+        }
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        int fd = (int)(m_events[i].data.u64 & 0xFFFFFFFF);
+        std::uint32_t generation = m_events[i].data.u64 >> 32;
+        Registration &registration = m_registrations[fd];
+        if (!registration.callback || registration.generation != generation) {
+            continue;
+        }
+        (*registration.callback)(m_events[i].events);
+    }
+    m_removed.clear();
+}
+
+void EventLoop::run() {
+    m_running = true;
+    while (m_running) {
+        poll(-1);
+    }
+}
+
+void EventLoop::stop() { m_running = false; }
+} // namespace server
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <sys/epoll.h>
+
+namespace server {
+
+/// Edge-triggered epoll(7) reactor
+///
+/// File descriptors are registered along with a callback that is invoked with
+/// the ready event mask (`EPOLLIN`, `EPOLLOUT`, etc.) whenever the descriptor
+/// becomes ready. Every descriptor is registered as edge-triggered, so a
+/// callback must consume everything that is available -- read or write until
+/// `EAGAIN` -- otherwise it will not be woken up again.
+///
+/// Periodic timers are implemented with timerfd(2) and are dispatched through
+/// the same loop as sockets, so nothing is ever polled.
+class EventLoop {
+public:
+    typedef std::function<void(std::uint32_t events)> Callback;
+    /// Timer callbacks are passed the number of expirations since they were
+    /// last called. This will be greater than one if the loop fell behind.
+    typedef std::function<void(std::uint64_t expirations)> TimerCallback;
+
+    EventLoop();
+    ~EventLoop();
+
+    /// Register a descriptor with the loop
+    ///
+    /// `EPOLLET` is implicitly added to `events`. The descriptor must not
+    /// already be registered.
+    void add(int fd, std::uint32_t events, Callback callback);
+
+    /// Change the events a registered descriptor is interested in
+    void modify(int fd, std::uint32_t events);
+
+    /// Deregister a descriptor
+    ///
+    /// This must be called before the descriptor is closed. It's safe to call
+    /// this from within a callback, including the descriptor's own callback.
+    /// Any events still pending for the descriptor in the current batch are
+    /// discarded.
+    void remove(int fd);
+
+    /// Create a timer which fires `rate` times a second without drifting
+    ///
+    /// Tick `n` is due exactly `n / rate` seconds after the timer is created.
+    /// Each deadline is worked out from the start time rather than from the
+    /// previous deadline, so the rounding of `1 / rate` to whole nanoseconds
+    /// never accumulates and the timer stays in step with CLOCK_MONOTONIC
+    /// indefinitely.
+    ///
+    /// The callback is passed the number of ticks which have come due since
+    /// it was last called, which is more than one if the loop fell behind.
+    ///
+    /// @return The timer descriptor
+    int addFixedRateTimer(unsigned long rate, TimerCallback callback);
+
+    /// Wait for events and dispatch them
+    ///
+    /// Blocks for up to `timeout_ms` milliseconds, or indefinitely if
+    /// negative.
+    void poll(int timeout_ms);
+
+    /// Dispatch events until stop() is called
+    void run();
+
+    /// Make run() return after the current batch of events
+    void stop();
+
+    EventLoop(const EventLoop &) = delete;
+    EventLoop &operator=(const EventLoop &) = delete;
+
+private:
+    struct Registration {
+        /// Heap allocated so that it stays put whilst executing, even if the
+        /// registration table grows or the descriptor is removed.
+        std::unique_ptr<Callback> callback;
+        /// Incremented each time the descriptor is removed so events queued
+        /// for a previous owner of a reused descriptor number can be ignored.
+        std::uint32_t generation = 0;
+    };
+
+    int m_epoll;
+    bool m_running;
+    /// Indexed by descriptor
+    std::vector<Registration> m_registrations;
+    std::vector<epoll_event> m_events;
+    /// Callbacks removed during dispatch are kept alive until the batch
+    /// completes as they may be currently executing.
+    std::vector<std::unique_ptr<Callback>> m_removed;
+};
+} // namespace server
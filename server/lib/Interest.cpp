@@ -0,0 +1,102 @@
+#include "Interest.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace server {
+
+namespace interest {
+
+using namespace net::snapshot;
+
+namespace {
+/// Side of a cell in the units snapshot positions are in
+int const CELL_SIZE = INTEREST_CELL_TILES * 32 * POSITION_SCALE;
+} // Anonymous namespace
+
+Grid::Grid(map::Level const &level)
+    : m_columns((level.getWidth() + INTEREST_CELL_TILES - 1) /
+                INTEREST_CELL_TILES),
+      m_rows((level.getHeight() + INTEREST_CELL_TILES - 1) /
+             INTEREST_CELL_TILES) {
+    m_columns = std::max(m_columns, 1);
+    m_rows = std::max(m_rows, 1);
+    m_cell_start.resize(m_columns * m_rows + 1);
+}
+
+void Grid::cellOf(EntityState const &entity, int &x, int &y) const {
+    x = std::min(std::max(entity.fields[EntityState::X] / CELL_SIZE, 0),
+                 m_columns - 1);
+    y = std::min(std::max(entity.fields[EntityState::Y] / CELL_SIZE, 0),
+                 m_rows - 1);
+}
+
+void Grid::update(std::shared_ptr<Snapshot const> update) {
+    // A counting sort by cell: count the entities in each cell, turn the
+    // counts into where each cell starts and then place the entities
+    m_snapshot = std::move(update);
+    Snapshot const &snapshot = *m_snapshot;
+    std::vector<int> cells(snapshot.entities.size());
+    std::fill(m_cell_start.begin(), m_cell_start.end(), 0);
+    for (std::size_t i = 0; i < snapshot.entities.size(); i++) {
+        int x, y;
+        cellOf(snapshot.entities[i], x, y);
+        cells[i] = x + y * m_columns;
+        m_cell_start[cells[i] + 1]++;
+    }
+    for (std::size_t cell = 1; cell < m_cell_start.size(); cell++) {
+        m_cell_start[cell] += m_cell_start[cell - 1];
+    }
+    std::vector<std::size_t> next(m_cell_start.begin(),
+                                  m_cell_start.end() - 1);
+    m_order.resize(snapshot.entities.size());
+    for (std::size_t i = 0; i < snapshot.entities.size(); i++) {
+        m_order[next[cells[i]]++] = i;
+    }
+}
+
+std::shared_ptr<Snapshot const> const &Grid::getSnapshot() const {
+    return m_snapshot;
+}
+
+void Grid::select(EntityState const &viewer,
+                  std::vector<std::uint32_t> &visible,
+                  Snapshot &snapshot) const {
+    snapshot.tick = m_snapshot->tick;
+    snapshot.entities.clear();
+    int viewer_x, viewer_y;
+    cellOf(viewer, viewer_x, viewer_y);
+    int const reach = INTEREST_RADIUS + 1;
+    for (int y = std::max(viewer_y - reach, 0);
+         y <= std::min(viewer_y + reach, m_rows - 1); y++) {
+        for (int x = std::max(viewer_x - reach, 0);
+             x <= std::min(viewer_x + reach, m_columns - 1); x++) {
+            int distance =
+                std::max(std::abs(x - viewer_x), std::abs(y - viewer_y));
+            std::size_t cell = x + y * m_columns;
+            for (std::size_t i = m_cell_start[cell];
+                 i < m_cell_start[cell + 1]; i++) {
+                EntityState const &entity = m_snapshot->entities[m_order[i]];
+                // Entities in the outer ring are only kept if they were
+                // already in view
+                if (distance <= INTEREST_RADIUS ||
+                    std::binary_search(visible.begin(), visible.end(),
+                                       entity.id)) {
+                    snapshot.entities.push_back(entity);
+                }
+            }
+        }
+    }
+    std::sort(snapshot.entities.begin(), snapshot.entities.end(),
+              [](EntityState const &a, EntityState const &b) {
+        return a.id < b.id;
+    });
+    visible.clear();
+    for (auto const &entity : snapshot.entities) {
+        visible.push_back(entity.id);
+    }
+}
+
+} // namespace interest
+
+} // namespace server
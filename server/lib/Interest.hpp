@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "common/net/snapshot.hpp"
+
+#include "Map.hpp"
+
+/// Side of an interest grid cell in tiles
+#define INTEREST_CELL_TILES 8
+/// How many cells around their own a client is interested in
+///
+/// Entities are sent to a client once they're within this many cells of the
+/// client's player in either direction, and stop being sent once they're
+/// further than this plus one.
+#define INTEREST_RADIUS 2
+
+namespace server {
+
+/// Interest management: working out which entities each client needs to
+/// hear about
+namespace interest {
+
+/// A uniform grid over the level for finding entities near a point
+///
+/// The grid is rebuilt from each world snapshot by bucketing the entities by
+/// cell, which takes time proportional to the number of entities. Picking out
+/// the entities near a client then only looks at the cells around it, so the
+/// cost per client depends on how crowded it is around the client rather than
+/// on the size of the world.
+///
+/// To stop entities on the edge of a client's area of interest being added
+/// and removed over and over as they move back and forth across it, there's
+/// hysteresis: an entity comes into view within INTEREST_RADIUS cells of the
+/// client, but only goes out of view once it's more than INTEREST_RADIUS + 1
+/// cells away.
+///
+/// Once updated, a grid isn't changed by select(), so one grid can be shared
+/// by threads picking out entities for different clients at the same time.
+class Grid {
+public:
+    /// @param level The level, which determines the size of the grid
+    Grid(map::Level const &level);
+
+    /// Bucket the entities in a snapshot by cell
+    ///
+    /// The grid holds on to the snapshot until the next update.
+    void update(std::shared_ptr<net::snapshot::Snapshot const> snapshot);
+
+    /// The snapshot of the last update()
+    std::shared_ptr<net::snapshot::Snapshot const> const &getSnapshot() const;
+
+    /// Pick out the entities a client is interested in
+    ///
+    /// @param viewer Where the client is; normally its player
+    /// @param visible The sorted IDs of the entities the client was
+    ///     interested in last time, which is updated
+    /// @param snapshot Set to the tick and entities of the last update()
+    ///     which the client is interested in
+    void select(net::snapshot::EntityState const &viewer,
+                std::vector<std::uint32_t> &visible,
+                net::snapshot::Snapshot &snapshot) const;
+
+private:
+    /// Get the cell coordinates of an entity, clamped to the grid
+    void cellOf(net::snapshot::EntityState const &entity, int &x,
+                int &y) const;
+
+    int m_columns;
+    int m_rows;
+    std::shared_ptr<net::snapshot::Snapshot const> m_snapshot;
+    /// Indices of the entities of m_snapshot ordered by cell
+    std::vector<std::size_t> m_order;
+    /// The entities of cell `i` are m_order[m_cell_start[i]] up to
+    /// m_order[m_cell_start[i + 1]]
+    std::vector<std::size_t> m_cell_start;
+};
+
+} // namespace interest
+
+} // namespace server
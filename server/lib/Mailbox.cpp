@@ -0,0 +1,111 @@
+#include "Mailbox.hpp"
+
+#include "format.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <stdexcept>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/eventfd.h>
+
+namespace server {
+
+Mailbox::Mailbox() : m_head(&m_stub), m_tail(&m_stub), m_signalled(false) {
+    m_stub.next.store(nullptr, std::memory_order_relaxed);
+    m_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_event == -1) {
+        throw std::runtime_error(
+            fmt::format("Failed to create mailbox eventfd: {}",
+                        strerror(errno)));
+    }
+}
+
+Mailbox::~Mailbox() {
+    Task task;
+    while (pop(task) == Pop::Task) {
+    }
+    close(m_event);
+}
+
+void Mailbox::post(Task task) {
+    Node *node = new Node;
+    node->task = std::move(task);
+    push(node);
+    wake();
+}
+
+void Mailbox::drain() {
+    std::uint64_t count;
+    while (read(m_event, &count, sizeof count) == -1 && errno == EINTR) {
+    }
+    // Exchanging rather than storing synchronises with the producer which
+    // set the flag, so everything it pushed beforehand is visible
+    m_signalled.exchange(false, std::memory_order_acq_rel);
+    Task task;
+    for (;;) {
+        Pop result = pop(task);
+        if (result == Pop::Task) {
+            task();
+            continue;
+        }
+        if (result == Pop::Busy) {
+            // The producer that's part way through may have seen the flag
+            // still set and not woken us, so make sure we come back
+            wake();
+        }
+        break;
+    }
+}
+
+int Mailbox::getDescriptor() const { return m_event; }
+
+void Mailbox::push(Node *node) {
+    node->next.store(nullptr, std::memory_order_relaxed);
+    Node *previous = m_head.exchange(node, std::memory_order_acq_rel);
+    // Until this store the consumer can't get past `previous`, which is what
+    // pop() reports as Busy
+    previous->next.store(node, std::memory_order_release);
+}
+
+Mailbox::Pop Mailbox::pop(Task &task) {
+    Node *tail = m_tail;
+    Node *next = tail->next.load(std::memory_order_acquire);
+    if (tail == &m_stub) {
+        if (next == nullptr) {
+            return m_head.load(std::memory_order_acquire) == tail ? Pop::Empty
+                                                                  : Pop::Busy;
+        }
+        m_tail = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+    if (next == nullptr) {
+        if (tail != m_head.load(std::memory_order_acquire)) {
+            return Pop::Busy;
+        }
+        // The tail is the last node, so put the stub back behind it before
+        // taking it off
+        push(&m_stub);
+        next = tail->next.load(std::memory_order_acquire);
+        if (next == nullptr) {
+            return Pop::Busy;
+        }
+    }
+    m_tail = next;
+    task = std::move(tail->task);
+    delete tail;
+    return Pop::Task;
+}
+
+void Mailbox::wake() {
+    if (m_signalled.exchange(true, std::memory_order_acq_rel)) {
+        return;
+    }
+    std::uint64_t one = 1;
+    while (write(m_event, &one, sizeof one) == -1 && errno == EINTR) {
+    }
+}
+
+} // namespace server
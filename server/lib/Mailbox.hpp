@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+
+namespace server {
+
+/// A queue of tasks for a thread running an EventLoop, which any thread can
+/// post to
+///
+/// Posting never takes a lock: tasks are pushed onto an intrusive
+/// multiple-producer single-consumer linked list with a single atomic
+/// exchange, then the consumer is woken through an eventfd(2) registered with
+/// its loop. Only the first post after the consumer last looked writes to
+/// the eventfd, so a busy mailbox costs one system call per batch of tasks
+/// rather than one per task.
+///
+/// Tasks posted by any one thread run in the order they were posted.
+class Mailbox {
+public:
+    typedef std::function<void()> Task;
+
+    Mailbox();
+    ~Mailbox();
+
+    /// Queue a task to be run by the consumer; safe from any thread
+    void post(Task task);
+
+    /// Run every task that has been posted
+    ///
+    /// Must only be called by the consumer, when getDescriptor() is
+    /// readable.
+    void drain();
+
+    /// The eventfd which becomes readable when tasks are posted
+    int getDescriptor() const;
+
+    Mailbox(const Mailbox &) = delete;
+    Mailbox &operator=(const Mailbox &) = delete;
+
+private:
+    struct Node {
+        std::atomic<Node *> next;
+        Task task;
+    };
+
+    enum class Pop { Task, Empty, Busy };
+
+    void push(Node *node);
+    /// Take the oldest task off the queue
+    ///
+    /// Returns Busy if a producer is part way through pushing the next one.
+    Pop pop(Task &task);
+    void wake();
+
+    /// Producers push onto the head; the consumer pops from the tail
+    std::atomic<Node *> m_head;
+    Node *m_tail;
+    /// Kept in the list so that it's never empty
+    Node m_stub;
+    /// Set once the eventfd has been written to and until drain() runs
+    std::atomic<bool> m_signalled;
+    int m_event;
+};
+
+} // namespace server
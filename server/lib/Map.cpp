@@ -1,10 +1,12 @@
 #include "Map.hpp"
 
-#include <vector>
-#include <fstream>
-#include <string>
 #include <algorithm>
-#include "common/util/stream.hpp"
+#include <stdexcept>
+#include <string>
+
+#include "format.h"
+#include "common/util/base64.hpp"
+#include "common/util/digest.hpp"
 
 namespace server {
 
@@ -12,25 +14,84 @@ namespace map {
 
 using namespace common::util;
 
-void Level::loadLevel(std::string map_name) {
-    std::ifstream file(map_name, std::ios::in | std::ios::binary);
-    std::vector<char> data = stream::readToEnd(file);
-    md5.add(data.data(), data.size());
-    m_base64 = base64_encode((unsigned char *)data.data(), data.size());
+void Level::loadLevel(std::string map_name, std::string digest) {
+    m_file = std::make_shared<file::MappedFile>(map_name);
+    byte const *data = (byte const *)m_file->data();
+    std::size_t size = m_file->size();
 
     // Width, height, spawn X and spawn Y are the first 4 bytes.
+    if (size < 4 || size < 4 + (std::size_t)data[0] * data[1]) {
+        throw std::runtime_error(
+            fmt::format("Level {} is truncated", map_name));
+    }
     m_width = data[0];
     m_height = data[1];
     m_spawn_x = data[2] * 32;
     m_spawn_y = data[3] * 32;
-    // Resize the vector to match the width and height.
-    m_tiles.resize(m_width * m_height);
-    // Copy over the level data over to the vector.
-    std::copy(data.begin() + 4, data.begin() + 4 + m_width * m_height,
-              m_tiles.begin());
+    m_tiles = data + 4;
+
+    m_digest = digest;
+    m_hash = digest::hash(digest, data, size);
+
+    std::size_t chunk_count = (size + MAP_CHUNK_SIZE - 1) / MAP_CHUNK_SIZE;
+    m_chunk_frames.clear();
+    m_chunk_prefixes.clear();
+    for (std::size_t chunk = 0; chunk < chunk_count; chunk++) {
+        std::size_t offset = getChunkOffset(chunk);
+        std::size_t chunk_size = getChunkSize(chunk);
+        // The chunk is an array of its offset, the size of the whole level,
+        // its checksum and its bytes
+        json11::Json::array head{
+            (double)offset, (double)size,
+            digest::hash(digest, data + offset, chunk_size),
+        };
+        std::shared_ptr<std::string> prefix = std::make_shared<std::string>();
+        net::wire::encodeArrayPrefix(*prefix, "map.chunk", head, chunk_size);
+        m_chunk_prefixes.push_back(prefix);
+        head.push_back(base64::encode(data + offset, chunk_size));
+        m_chunk_frames.push_back(
+            net::encodeFrame(net::Framing::Json, "map.chunk", head));
+    }
+}
+
+std::string const &Level::getHash() const { return m_hash; }
+
+std::string const &Level::getDigest() const { return m_digest; }
+
+json11::Json Level::getOffer() const {
+    return json11::Json::object{{"hash", m_hash}, {"digest", m_digest}};
 }
 
-std::string Level::asBase64() { return m_base64; }
+byte Level::getWidth() const { return m_width; }
+
+byte Level::getHeight() const { return m_height; }
+
+unsigned int Level::getSpawnX() const { return m_spawn_x; }
+
+unsigned int Level::getSpawnY() const { return m_spawn_y; }
+
+std::shared_ptr<file::MappedFile const> Level::getFile() const {
+    return m_file;
+}
+
+std::size_t Level::getChunkCount() const { return m_chunk_frames.size(); }
+
+std::size_t Level::getChunkOffset(std::size_t chunk) const {
+    return chunk * MAP_CHUNK_SIZE;
+}
+
+std::size_t Level::getChunkSize(std::size_t chunk) const {
+    return std::min<std::size_t>(MAP_CHUNK_SIZE,
+                                 m_file->size() - getChunkOffset(chunk));
+}
+
+net::Frame Level::getChunkFrame(std::size_t chunk) const {
+    return m_chunk_frames[chunk];
+}
+
+net::Frame Level::getChunkPrefix(std::size_t chunk) const {
+    return m_chunk_prefixes[chunk];
+}
 
 } // namespace map
 
@@ -1,10 +1,14 @@
 #pragma once
 
-#include <vector>
+#include <memory>
 #include <string>
+#include <vector>
 
-#include "common/extlib/hash-library/md5.h"
-#include "base64.hpp"
+#include "common/net/wire.hpp"
+#include "common/util/mappedfile.hpp"
+
+/// Number of bytes of the level file sent in each `map.chunk` message
+#define MAP_CHUNK_SIZE (16 * 1024)
 
 namespace server {
 
@@ -12,24 +16,85 @@ namespace map {
 
 typedef unsigned char byte;
 
+/// A level loaded for distribution to clients
+///
+/// The level file is memory mapped rather than read, and everything clients
+/// are sent about it is worked out once when it's loaded: the hash and the
+/// encoded `map.chunk` messages. These are immutable and shared, so sending
+/// the level to any number of clients doesn't copy or re-encode it.
+///
+/// The level is sent in chunks of MAP_CHUNK_SIZE bytes, each with its offset
+/// and checksum, so that a transfer can be interleaved with other messages and
+/// resumed from any chunk.
 class Level {
 public:
-    /// MD5 hash for the level.
-    MD5 md5;
+    /// Load a level.
+    ///
+    /// @param map Path to the level file
+    /// @param digest Name of the digest used to hash the level file and its
+    ///     chunks (see common::util::digest::create())
+    ///
+    /// Throws std::runtime_error if the level can't be loaded.
+    void loadLevel(std::string map, std::string digest);
 
-    /// Get the Base64-encoded raw level data
-    std::string asBase64();
+    /// Hex encoded hash of the level file
+    std::string const &getHash() const;
 
-    /// Load a level.
-    void loadLevel(std::string map);
+    /// Name of the digest the level and its chunks are hashed with
+    std::string const &getDigest() const;
+
+    /// The `map.offer` message entity for the level
+    json11::Json getOffer() const;
+
+    /// Width of the level in tiles
+    byte getWidth() const;
+
+    /// Height of the level in tiles
+    byte getHeight() const;
+
+    /// Player spawn X position in pixels
+    unsigned int getSpawnX() const;
+
+    /// Player spawn Y position in pixels
+    unsigned int getSpawnY() const;
+
+    /// The mapped level file
+    std::shared_ptr<common::util::file::MappedFile const> getFile() const;
+
+    /// Number of chunks the level is sent in
+    std::size_t getChunkCount() const;
+
+    /// Offset of the first byte of a chunk in the level file
+    std::size_t getChunkOffset(std::size_t chunk) const;
+
+    /// Number of bytes in a chunk; only the last chunk can be short
+    std::size_t getChunkSize(std::size_t chunk) const;
+
+    /// Get a chunk's `map.chunk` message for JSON clients
+    ///
+    /// This is a complete frame with the chunk's bytes Base64-encoded.
+    net::Frame getChunkFrame(std::size_t chunk) const;
+
+    /// Get the start of a chunk's `map.chunk` message for binary clients
+    ///
+    /// Binary frames can carry raw bytes, so the chunk isn't encoded.
+    /// Instead the chunk's bytes of getFile() are to be sent straight after
+    /// this prefix, which lets them be sent without being copied into
+    /// userspace.
+    net::Frame getChunkPrefix(std::size_t chunk) const;
 
 private:
     byte m_width;
     byte m_height;
     unsigned int m_spawn_x;
     unsigned int m_spawn_y;
-    std::vector<byte> m_tiles;
-    std::string m_base64;
+    /// The tiles, pointing into the mapped file
+    byte const *m_tiles;
+    std::shared_ptr<common::util::file::MappedFile const> m_file;
+    std::string m_digest;
+    std::string m_hash;
+    std::vector<net::Frame> m_chunk_frames;
+    std::vector<net::Frame> m_chunk_prefixes;
 };
 
 } // namespace map
@@ -0,0 +1,114 @@
+#include "Metrics.hpp"
+
+#include <map>
+
+#include "json11.hpp"
+#include "format.h"
+
+using namespace json11;
+
+namespace server {
+
+namespace {
+
+typedef common::util::metrics::Histogram::Snapshot Snapshot;
+
+/// Percentiles reported for each histogram
+double const PERCENTILES[] = {50, 90, 99, 99.9};
+
+Snapshot mergeHistograms(
+    std::vector<Metrics const *> const &shards,
+    Metrics::Histogram const Metrics::*histogram) {
+    Snapshot merged;
+    for (auto shard : shards) {
+        merged.merge((shard->*histogram).snapshot());
+    }
+    return merged;
+}
+
+Json::object summarise(Snapshot const &snapshot) {
+    Json::object summary;
+    summary["count"] = (double)snapshot.count;
+    summary["mean"] = snapshot.getMean();
+    summary["max"] = (double)snapshot.max;
+    for (double percentile : PERCENTILES) {
+        summary[fmt::format("p{}", percentile)] =
+            (double)snapshot.getPercentile(percentile);
+    }
+    return summary;
+}
+
+/// Write a JSON object out as `name value` lines, naming nested values
+/// `parent.child`
+void writeText(fmt::Writer &writer, std::string const &prefix,
+               Json const &value) {
+    if (!value.is_object()) {
+        writer << prefix << ' ' << value.dump() << '\n';
+        return;
+    }
+    for (auto const &item : value.object_items()) {
+        writeText(writer, prefix.empty() ? item.first
+                                         : prefix + "." + item.first,
+                  item.second);
+    }
+}
+
+} // Anonymous namespace
+
+Metrics::Metrics() {
+    addMessageType(0, "(unhandled)");
+}
+
+void Metrics::addMessageType(unsigned int id, std::string const &type) {
+    while (messages.size() <= id) {
+        messages.emplace_back();
+        message_types.emplace_back();
+    }
+    message_types[id] = type;
+}
+
+std::string renderMetrics(std::vector<Metrics const *> const &shards,
+                          double uptime, bool json) {
+    std::uint64_t accepted = 0;
+    std::uint64_t bytes_in = 0;
+    std::uint64_t bytes_out = 0;
+    std::map<std::string, std::uint64_t> messages;
+    for (auto shard : shards) {
+        accepted += shard->accepted.get();
+        bytes_in += shard->bytes_in.get();
+        bytes_out += shard->bytes_out.get();
+        for (std::size_t id = 0; id < shard->messages.size(); id++) {
+            messages[shard->message_types[id]] += shard->messages[id].get();
+        }
+    }
+    Json::object message_counts;
+    for (auto const &count : messages) {
+        message_counts[count.first] = (double)count.second;
+    }
+    double seconds = uptime > 0 ? uptime : 1;
+    Json metrics = Json::object{
+        {"shards", (double)shards.size()},
+        {"uptime", uptime},
+        {"accepted", (double)accepted},
+        {"accept_rate", accepted / seconds},
+        {"bytes_in", (double)bytes_in},
+        {"bytes_in_rate", bytes_in / seconds},
+        {"bytes_out", (double)bytes_out},
+        {"bytes_out_rate", bytes_out / seconds},
+        {"messages", message_counts},
+        {"tick_time_ns",
+         summarise(mergeHistograms(shards, &Metrics::tick_time))},
+        {"parse_time_ns",
+         summarise(mergeHistograms(shards, &Metrics::parse_time))},
+        {"send_queue_bytes",
+         summarise(mergeHistograms(shards, &Metrics::send_queue))},
+    };
+    if (json) {
+        return metrics.dump() + "\n";
+    }
+    fmt::Writer writer;
+    writeText(writer, "", metrics);
+    return writer.str();
+}
+
+} // namespace server
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "common/util/metrics.hpp"
+
+namespace server {
+
+/// What a shard measures about itself
+///
+/// Only the shard's own thread updates these, from the server and its
+/// clients. The admin socket reads every shard's metrics from shard 0's
+/// thread without locking; see common::util::metrics.
+struct Metrics {
+    typedef common::util::metrics::Counter Counter;
+    typedef common::util::metrics::Histogram Histogram;
+
+    Metrics();
+
+    /// Connections accepted
+    Counter accepted;
+    /// Bytes received and sent, over both TCP and UDP
+    Counter bytes_in;
+    Counter bytes_out;
+    /// Nanoseconds each tick took
+    Histogram tick_time;
+    /// Nanoseconds spent decoding messages each time a client was read
+    Histogram parse_time;
+    /// Bytes in a client's send queue each time it was flushed
+    Histogram send_queue;
+
+    /// Messages received of each type, by the type's ID in Server::Handlers
+    ///
+    /// ID 0 counts messages of types without handlers.
+    std::deque<Counter> messages;
+    std::vector<std::string> message_types;
+
+    /// Name the counter for a type ID, adding counters up to it
+    ///
+    /// Types must all be added before the shard runs.
+    void addMessageType(unsigned int id, std::string const &type);
+
+    Metrics(Metrics const &) = delete;
+    Metrics &operator=(Metrics const &) = delete;
+};
+
+/// Render the metrics of every shard, added up
+///
+/// Histograms are summarised by their count, mean, maximum and a few
+/// percentiles. With `json` the result is a JSON object, otherwise it's a
+/// line of text per figure.
+///
+/// @param uptime Seconds the server has been running, for working out rates
+std::string renderMetrics(std::vector<Metrics const *> const &shards,
+                          double uptime, bool json);
+
+} // namespace server
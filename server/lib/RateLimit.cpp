@@ -0,0 +1,154 @@
+#include "RateLimit.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace server {
+namespace rate {
+
+TokenBucket::TokenBucket()
+    : m_rate(0), m_burst(0), m_tokens(0), m_updated(0) {}
+
+TokenBucket::TokenBucket(double rate, double burst, std::uint64_t now)
+    : m_rate(rate), m_burst(burst), m_tokens(burst), m_updated(now) {}
+
+bool TokenBucket::has(double tokens, std::uint64_t now) {
+    if (!isLimited()) {
+        return true;
+    }
+    refill(now);
+    return m_tokens >= std::min(tokens, m_burst);
+}
+
+bool TokenBucket::take(double tokens, std::uint64_t now) {
+    if (!has(tokens, now)) {
+        return false;
+    }
+    if (isLimited()) {
+        m_tokens -= tokens;
+    }
+    return true;
+}
+
+double TokenBucket::available(std::uint64_t now) {
+    refill(now);
+    return std::max(0.0, std::floor(m_tokens));
+}
+
+bool TokenBucket::isLimited() const { return m_burst > 0; }
+
+void TokenBucket::refill(std::uint64_t now) {
+    if (now > m_updated) {
+        m_tokens = std::min(m_burst, m_tokens + (now - m_updated) * m_rate);
+        m_updated = now;
+    }
+}
+
+Limits::Limits(unsigned int tick_rate)
+    : m_tick_rate(tick_rate), m_connection(Limit{0, 0}),
+      m_max_violations(0) {}
+
+void Limits::setConnection(Limit limit) { m_connection = limit; }
+
+void Limits::setType(net::MessageType const &type, Limit limit) {
+    auto index = m_type_indices.find(type);
+    if (index == m_type_indices.end()) {
+        m_type_indices.emplace(type, m_types.size());
+        m_types.push_back(limit);
+        m_type_names.push_back(type);
+    } else {
+        m_types[index->second] = limit;
+    }
+}
+
+void Limits::setMaxViolations(unsigned int violations) {
+    m_max_violations = violations;
+}
+
+Limit Limits::getConnection() const { return m_connection; }
+
+unsigned int Limits::getMaxViolations() const { return m_max_violations; }
+
+unsigned int Limits::getTickRate() const { return m_tick_rate; }
+
+int Limits::find(net::MessageType const &type) const {
+    auto index = m_type_indices.find(type);
+    return index == m_type_indices.end() ? -1 : index->second;
+}
+
+Limit Limits::getType(int index) const { return m_types[index]; }
+
+net::MessageType const &Limits::getTypeName(int index) const {
+    return m_type_names[index];
+}
+
+std::size_t Limits::getTypeCount() const { return m_types.size(); }
+
+Limiter::Limiter(Limits const &limits, std::uint64_t now)
+    : m_limits(&limits), m_violations(0) {
+    m_messages = makeBucket(limits.getConnection().messages, now);
+    m_bytes = makeBucket(limits.getConnection().bytes, now);
+    for (std::size_t type = 0; type < limits.getTypeCount(); type++) {
+        m_types.push_back(makeBucket(limits.getType(type).messages, now));
+        m_types.push_back(makeBucket(limits.getType(type).bytes, now));
+    }
+}
+
+std::size_t Limiter::allowBytes(std::size_t most, std::uint64_t now) {
+    if (!m_bytes.isLimited()) {
+        return most;
+    }
+    return std::min<double>(most, m_bytes.available(now));
+}
+
+void Limiter::takeBytes(std::size_t bytes, std::uint64_t now) {
+    // Never more than allowBytes() said, so this can't fail
+    m_bytes.take(bytes, now);
+}
+
+bool Limiter::allowMessage(std::uint64_t now) {
+    return m_messages.has(1, now);
+}
+
+void Limiter::takeMessage(std::uint64_t now) { m_messages.take(1, now); }
+
+bool Limiter::admit(net::MessageType const &type, std::size_t bytes,
+                    std::uint64_t now) {
+    int index = m_limits->find(type);
+    if (index < 0) {
+        return true;
+    }
+    TokenBucket &messages = m_types[index * 2];
+    TokenBucket &bytes_bucket = m_types[index * 2 + 1];
+    // Check both before taking from either, so a dropped message doesn't
+    // use up any allowance
+    if (!messages.has(1, now)) {
+        m_violations++;
+        return false;
+    }
+    if (!bytes_bucket.take(bytes, now)) {
+        m_violations++;
+        return false;
+    }
+    messages.take(1, now);
+    return true;
+}
+
+unsigned int Limiter::getViolations() const { return m_violations; }
+
+bool Limiter::isFlooding() const {
+    return m_limits->getMaxViolations() != 0 &&
+           m_violations > m_limits->getMaxViolations();
+}
+
+TokenBucket Limiter::makeBucket(double rate, std::uint64_t now) const {
+    if (rate <= 0) {
+        return TokenBucket();
+    }
+    // A second's worth, but always enough for one of whatever it limits
+    double per_tick = rate / m_limits->getTickRate();
+    return TokenBucket(per_tick, std::max(rate, 1.0), now);
+}
+
+} // namespace rate
+} // namespace server
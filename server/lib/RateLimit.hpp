@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "common/net/wire.hpp"
+
+namespace server {
+
+/// Limiting how much clients can send the server
+namespace rate {
+
+/// A token bucket
+///
+/// The bucket fills up at a fixed rate, to at most its burst size, and each
+/// thing it limits takes tokens out of it. Time is in whatever units the
+/// owner passes in, such as server ticks.
+///
+/// Taking more tokens than the burst size only needs a full bucket, which is
+/// left in debt; nothing else is let through until the debt is repaid. So
+/// rare large messages aren't shut out forever, but the long run rate still
+/// holds.
+class TokenBucket {
+public:
+    /// A bucket that never runs out
+    TokenBucket();
+
+    /// @param rate Tokens added per unit of time
+    /// @param burst Most tokens the bucket holds; it starts full
+    TokenBucket(double rate, double burst, std::uint64_t now);
+
+    /// Check if `tokens` could be taken at time `now`
+    bool has(double tokens, std::uint64_t now);
+
+    /// Take `tokens` if the bucket has enough at time `now`
+    ///
+    /// Returns false, taking nothing, if it hasn't.
+    bool take(double tokens, std::uint64_t now);
+
+    /// Whole tokens in a limited bucket at time `now`
+    double available(std::uint64_t now);
+
+    bool isLimited() const;
+
+private:
+    void refill(std::uint64_t now);
+
+    double m_rate;
+    double m_burst;
+    double m_tokens;
+    std::uint64_t m_updated;
+};
+
+/// Messages and bytes a second; zero means unlimited
+struct Limit {
+    double messages;
+    double bytes;
+};
+
+/// The rate limits for clients, shared by all of them
+///
+/// There are limits for the connection as a whole and for each message type.
+/// A client over its connection's limits is throttled: the server stops
+/// reading from its socket until it's allowed more, so TCP pushes back on the
+/// client. Messages of a type over that type's limits are dropped and count
+/// as violations; a client with too many of those is disconnected.
+///
+/// Limits must all be set before any client uses them.
+class Limits {
+public:
+    /// @param tick_rate Ticks per second of the time passed to the limiters
+    Limits(unsigned int tick_rate);
+
+    /// Set the limits of the connection as a whole
+    void setConnection(Limit limit);
+
+    /// Set the limits of a message type
+    void setType(net::MessageType const &type, Limit limit);
+
+    /// Disconnect clients after this many violations; zero never does
+    void setMaxViolations(unsigned int violations);
+
+    Limit getConnection() const;
+    unsigned int getMaxViolations() const;
+    unsigned int getTickRate() const;
+
+    /// Index of a message type's limits, or -1 if it isn't limited
+    int find(net::MessageType const &type) const;
+
+    /// Get the limits of a message type by its index from find()
+    Limit getType(int index) const;
+
+    /// Get the message type with limits at an index from find()
+    net::MessageType const &getTypeName(int index) const;
+
+    /// Number of message types with limits
+    std::size_t getTypeCount() const;
+
+private:
+    unsigned int m_tick_rate;
+    Limit m_connection;
+    unsigned int m_max_violations;
+    std::unordered_map<net::MessageType, int> m_type_indices;
+    std::vector<Limit> m_types;
+    std::vector<net::MessageType> m_type_names;
+};
+
+/// A client's token buckets
+///
+/// Time is in ticks, at the tick rate of the limits.
+class Limiter {
+public:
+    /// @param limits Must outlive the limiter
+    Limiter(Limits const &limits, std::uint64_t now);
+
+    /// Bytes the connection may read at time `now`, at most `most`
+    std::size_t allowBytes(std::size_t most, std::uint64_t now);
+
+    /// Count `bytes` read from the connection
+    void takeBytes(std::size_t bytes, std::uint64_t now);
+
+    /// Check if the connection may have another message at time `now`
+    ///
+    /// If not, it should be throttled.
+    bool allowMessage(std::uint64_t now);
+
+    /// Count a message received on the connection
+    void takeMessage(std::uint64_t now);
+
+    /// Check a message against the limits of its type
+    ///
+    /// Returns false, counting a violation, if the message should be
+    /// dropped.
+    bool admit(net::MessageType const &type, std::size_t bytes,
+               std::uint64_t now);
+
+    /// Number of messages dropped by admit()
+    unsigned int getViolations() const;
+
+    /// Check if the client has had more violations than it's allowed
+    bool isFlooding() const;
+
+private:
+    /// Make a bucket for `rate` a second; zero makes an unlimited one
+    TokenBucket makeBucket(double rate, std::uint64_t now) const;
+
+    Limits const *m_limits;
+    TokenBucket m_messages;
+    TokenBucket m_bytes;
+    /// Message and byte buckets of each limited message type, by index
+    std::vector<TokenBucket> m_types;
+    unsigned int m_violations;
+};
+
+} // namespace rate
+
+} // namespace server
@@ -1,7 +1,8 @@
 #include "Server.hpp"
 #include "Client.hpp"
+#include "Cluster.hpp"
+#include "common/net/datagram.hpp"
 #include "common/util/container.hpp"
-#include "common/extlib/hash-library/md5.h"
 #include "common/util/stream.hpp"
 #include "common/util/net.hpp"
 #include "Map.hpp"
@@ -9,32 +10,59 @@
 #include <format.h>
 #include <json11.hpp>
 
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
+#include <stdexcept>
+#include <thread>
 #include <cerrno>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
 
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 
 #include <netinet/in.h>
 
 namespace cont = common::util::container;
+namespace snapshot = net::snapshot;
+namespace datagram = net::datagram;
 
 namespace server {
 
 using namespace std::placeholders;
 using namespace json11;
+using common::LogLevel;
 
-Server::Server(int port, unsigned int max_clients,
-               std::string map_name)
-    : m_logger(stderr, [] { return "SERVER: "; }) {
-    m_max_clients = max_clients;
+namespace {
+std::string logPrefix(Cluster const &cluster, unsigned int shard) {
+    if (cluster.getShardCount() == 1) {
+        return "SERVER: ";
+    }
+    return fmt::format("SERVER [{}]: ", shard);
+}
+
+/// Let every shard bind a socket to the same port
+///
+/// Only done when there's more than one shard, so that a single shard
+/// server still can't be started twice on the same port by mistake.
+bool reusePort(Cluster const &cluster, Socket socket) {
+    int on = 1;
+    return cluster.getShardCount() == 1 ||
+           setsockopt(socket, SOL_SOCKET, SO_REUSEPORT, &on, sizeof on) == 0;
+}
+} // Anonymous namespace
 
-    m_map.loadLevel(map_name);
-    // Log this in the map loader maybe?
-    m_logger.log("Map hash: {}", m_map.md5.getHash());
+Server::Server(Cluster &cluster, unsigned int shard, int port, int udp_port)
+    : m_cluster(cluster), m_shard(shard), m_udp_port(udp_port),
+      m_random(std::random_device()()), m_admin_socket(-1),
+      m_logger(stderr,
+               [&cluster, shard] { return logPrefix(cluster, shard); }),
+      m_map(cluster.getMap()), m_world_tick(0), m_tick_stats() {
+    m_udp_socket = -1;
 
 #   ifndef IPV4_ONLY
 #   define host_str NULL
@@ -53,32 +81,33 @@ Server::Server(int port, unsigned int max_clients,
                                         .ai_socktype = SOCK_STREAM,
                                         .ai_flags = AI_PASSIVE },
                     &m_tcp_address) != 0) {
-        m_logger.log("[ERR]  Failed to resolve local stream interface: {}",
+        m_logger.log(LogLevel::Error,
+                     "Failed to resolve local stream interface: {}",
                      strerror(errno));
     }
 
     for (struct addrinfo *a = m_tcp_address; a != NULL; a = a->ai_next) {
         Socket s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
         if (s < 0) {
-            m_logger.log("[WARNING]  Failed to create socket: {}",
+            m_logger.log(LogLevel::Warning, "Failed to create socket: {}",
                          strerror(errno));
             continue;
         }
 
         if (bind(s, a->ai_addr, a->ai_addrlen) < 0) {
-            m_logger.log("[WARNING]  Failed to bind socket: {}",
+            m_logger.log(LogLevel::Warning, "Failed to bind socket: {}",
                          strerror(errno));
             goto cleanup;
 	    }
 
         if (listen(s, SOMAXCONN) == -1) {
-            m_logger.log("[WARNING]  Failed to listen socket: {}",
+            m_logger.log(LogLevel::Warning, "Failed to listen socket: {}",
                          strerror(errno));
             goto cleanup;
         }
 
         if ((fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK) == -1) {
-            m_logger.log("[WARNING]  Failed to fcntl socket: {}",
+            m_logger.log(LogLevel::Warning, "Failed to fcntl socket: {}",
                          strerror(errno));
             goto cleanup;
         }
@@ -121,7 +150,7 @@ Server::Server(int port, unsigned int max_clients,
         }
 
         m_tcp_socket.push_back(s);
-        m_logger.log("[INFO] Bound to interface {}, service {}",
+        m_logger.log(LogLevel::Info, "Bound to interface {}, service {}",
                      std::string(host),
                      std::string(service));
         continue;
@@ -129,17 +158,49 @@ cleanup:close(s);
     }
 
     if (m_tcp_socket.size() == 0) {
-        m_logger.log("[ERR]  Failed to bind to a stream interface");
+        m_logger.log(LogLevel::Error, "Failed to bind to a stream interface");
         exit(1);
     }
 #   else
+    // Replaying a capture needs no sockets; see replay()
+    m_tcp_socket = -1;
+    if (port != 0) {
+        bindSockets(port, udp_port);
+    }
+#   endif
+
+    addHandler("map.request",
+               std::bind(&server::Server::handleMapRequest, this, _1, _2, _3));
+    addHandler("has-map",
+               std::bind(&server::Server::handleHasMap, this, _1, _2, _3));
+    addHandler("world.ack",
+               std::bind(&server::Server::handleWorldAck, this, _1, _2, _3));
+    addHandler("input",
+               std::bind(&server::Server::handleInput, this, _1, _2, _3));
+    addHandler("net.udp",
+               std::bind(&server::Server::handleNetUDP, this, _1, _2, _3));
+    addHandler("net.ping",
+               std::bind(&server::Server::handleNetPing, this, _1, _2, _3));
+    addHandler("net.pong",
+               std::bind(&server::Server::handleNetPong, this, _1, _2, _3));
+}
+
+void Server::bindSockets(int port, int udp_port) {
     if ((m_tcp_socket = socket(PF_INET, SOCK_STREAM, 0)) < 0) {
-        m_logger.log("[ERR]  Failed to create socket: {}", strerror(errno));
+        m_logger.log(LogLevel::Error, "Failed to create socket: {}",
+                     strerror(errno));
         exit(1);
     }
 
     fcntl(m_tcp_socket, F_SETFL, O_NONBLOCK);
 
+    if (!reusePort(m_cluster, m_tcp_socket)) {
+        m_logger.log(LogLevel::Error,
+                     "Failed to share TCP port between shards: {}",
+                     strerror(errno));
+        exit(1);
+    }
+
     memset(&m_tcp_address, 0, sizeof m_tcp_address);
 
     m_tcp_address.sin_family = AF_INET;
@@ -151,155 +212,774 @@ cleanup:close(s);
 
     if (bind(m_tcp_socket, (const struct sockaddr *)&m_tcp_address,
         sizeof m_tcp_address) < 0) {
-        m_logger.log("[ERR]  Failed to bind TCP interface: {}",
+        m_logger.log(LogLevel::Error, "Failed to bind TCP interface: {}",
                      strerror(errno));
     }
 
     listen(m_tcp_socket, SOMAXCONN);
 
-//  if (!(m_udp_socket = socket(AF_INET, SOCK_DGRAM, 0) )) {
-//      m_logger.log("[ERR]  Failed to bind UDP interface: {}",
-//                   strerror(errno));
-//      exit(1);
-//  }
-    m_logger.log("[INFO] Bound to interface {}",
+    m_logger.log(LogLevel::Info, "Bound to interface {}",
                  common::util::net::ipaddr(m_tcp_address));
-#   endif
 
-    addHandler("map.request",
-               std::bind(&server::Server::handleMapRequest, this, _1, _2, _3));
-    //addHandler("net.udp",
-    //          std::bind(&server::Server::handleNetUDP, this, _1, _2, _3));
+    // Without UDP everything is just sent over TCP, so failing to set it up
+    // isn't fatal
+    m_udp_socket = socket(PF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                          0);
+    if (m_udp_socket < 0) {
+        m_logger.log(LogLevel::Warning, "Failed to create UDP socket: {}",
+                     strerror(errno));
+    } else {
+        m_udp_address = m_tcp_address;
+        m_udp_address.sin_port = htons(udp_port);
+        if (!reusePort(m_cluster, m_udp_socket) ||
+            bind(m_udp_socket, (const struct sockaddr *)&m_udp_address,
+                 sizeof m_udp_address) < 0) {
+            m_logger.log(LogLevel::Warning, "Failed to bind UDP interface: {}",
+                         strerror(errno));
+            close(m_udp_socket);
+            m_udp_socket = -1;
+        } else {
+            m_logger.log(LogLevel::Info, "Bound UDP to interface {}",
+                         common::util::net::ipaddr(m_udp_address));
+        }
+    }
 }
 
-Server::~Server() { m_logger.log("[INFO] Server shut down.\n\n"); }
+Server::~Server() { m_logger.log(LogLevel::Info, "Server shut down.\n\n"); }
 
 void Server::sendAll(std::string type, Json entity) {
+    m_logger.log(LogLevel::Debug, "Send (all): {}", type);
+    // Each framing's encoding is done at most once and shared by every
+    // client using it
+    Frame json_frame;
+    Frame binary_frame;
+    if (m_cluster.getShardCount() > 1) {
+        // Every shard shares the same frames, so they're encoded up front
+        json_frame = encodeFrame(Framing::Json, type, entity);
+        binary_frame = encodeFrame(Framing::Binary, type, entity);
+        for (unsigned int shard = 0; shard < m_cluster.getShardCount();
+             shard++) {
+            if (shard == m_shard) {
+                continue;
+            }
+            Server &server = m_cluster.getShard(shard);
+            server.post([&server, type, entity, json_frame, binary_frame] {
+                server.broadcast(type, entity, json_frame, binary_frame);
+            });
+        }
+    }
+    broadcast(type, entity, json_frame, binary_frame);
+}
+
+void Server::post(Mailbox::Task task) { m_mailbox.post(std::move(task)); }
+
+void Server::broadcast(std::string const &type, Json const &entity,
+                       Frame json_frame, Frame binary_frame) {
     for (auto &client : m_clients) {
-        client.send(type, entity);
+        if (client.getState() != Client::Connected) {
+            client.send(type, entity);
+            continue;
+        }
+        Frame &frame =
+            client.getFraming() == Framing::Json ? json_frame : binary_frame;
+        if (!frame) {
+            frame = encodeFrame(client.getFraming(), type, entity);
+        }
+        client.sendFrame(frame);
     }
 }
 
-void Server::addHandler(std::string type,
-                        std::function<void(Server *server, Client *client,
-                                           json11::Json entity)> handler) {
-    m_handlers[type].push_back(handler);
+void Server::addHandler(std::string type, Handlers::Handler handler) {
+    m_metrics.addMessageType(m_handlers.add(type, std::move(handler)), type);
 }
 
-void Server::handleMapRequest(Server */*server*/, Client *client,
-                              json11::Json /*entity*/) {
-    client->send("map.contents", m_map.asBase64());
+Client *Server::getClient(ClientHandle handle) {
+    return m_clients.get(handle);
 }
 
-void Server::handleNetUDP(Server */*server*/,
-                          Client */*client*/, json11::Json /*entity*/) {
+Metrics const &Server::getMetrics() const { return m_metrics; }
+
+void Server::handleMapRequest(Server */*server*/, ClientHandle handle,
+                              json::Value const &entity) {
+    Client *client = getClient(handle);
+    // Resume from the start of the chunk the offset is in
+    double offset = entity["offset"].number_value();
+    std::size_t size = m_map.getFile()->size();
+    if (offset < 0 || offset >= size) {
+        offset = 0;
+    }
+    client->m_map_offset = (long)offset / MAP_CHUNK_SIZE * MAP_CHUNK_SIZE;
+    sendMapChunks(client);
 }
 
-void Server::acceptConnections() {
-#   ifndef IPV4ONLY
-    iterator s = m_tcp_socket.begin();
-    while (s != m_tcp_socket.end()) {
-        struct sockaddr_storage a;
-        socklen_t n = sizeof a;
-        Socket c = accept(*s, &a, &n);
-        if (c < 0) {
-            if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                m_logger.log("[WARNING]  Failed to accept client connection: {}", strerror(errno));
+void Server::sendMapChunks(Client *client) {
+    while (client->getState() == Client::Connected &&
+           client->m_map_offset >= 0 && !client->hasPendingEgress()) {
+        for (int i = 0; i < MAP_CHUNKS_PER_FLUSH && client->m_map_offset >= 0;
+             i++) {
+            std::size_t chunk = client->m_map_offset / MAP_CHUNK_SIZE;
+            std::size_t size = m_map.getChunkSize(chunk);
+            if (client->getFraming() == Framing::Binary) {
+                client->sendFrame(m_map.getChunkPrefix(chunk));
+                client->sendFile(m_map.getFile(), m_map.getChunkOffset(chunk),
+                                 size);
+            } else {
+                client->sendFrame(m_map.getChunkFrame(chunk));
+            }
+            client->m_map_offset += size;
+            if (chunk + 1 == m_map.getChunkCount()) {
+                client->m_map_offset = -1;
             }
-            goto next;
         }
+        client->flushSendQueue();
+    }
+}
+
+void Server::handleHasMap(Server */*server*/, ClientHandle handle,
+                          json::Value const &/*entity*/) {
+    Client *client = getClient(handle);
+    // Players that don't have the map yet join anyway whilst it's sent
+    if (client->m_entity == 0) {
+        world::EntityId player = m_cluster.getWorld().reserveId();
+        client->m_entity = player;
+        updateWorld([player](world::World &world) { world.addPlayer(player); });
+        client->write("world.join").value(player).end();
+    }
+}
+
+void Server::handleWorldAck(Server */*server*/, ClientHandle handle,
+                            json::Value const &entity) {
+    Client *client = getClient(handle);
+    std::uint64_t tick = (std::uint64_t)entity.number_value();
+    // Acknowledgements can only move forwards, and only to snapshots which
+    // can still be used as a baseline
+    if (tick > client->m_snapshot_ack && client->m_snapshots.find(tick)) {
+        client->m_snapshot_ack = tick;
+    }
+}
+
+void Server::updateWorld(std::function<void(world::World &world)> update) {
+    if (m_shard == 0) {
+        update(m_cluster.getWorld());
+        return;
+    }
+    Cluster &cluster = m_cluster;
+    cluster.getShard(0).post(
+        [&cluster, update] { update(cluster.getWorld()); });
+}
+
+void Server::publishWorld() {
+    auto interest = std::make_shared<interest::Grid>(m_map);
+    interest->update(m_cluster.getWorld().makeSnapshot());
+    std::shared_ptr<interest::Grid const> published = interest;
+    for (unsigned int shard = 1; shard < m_cluster.getShardCount(); shard++) {
+        Server &server = m_cluster.getShard(shard);
+        server.post([&server, published] { server.receiveWorld(published); });
+    }
+    // The tick flushes this shard's clients straight after
+    sendSnapshots(*published);
+}
+
+void Server::receiveWorld(std::shared_ptr<interest::Grid const> interest) {
+    sendSnapshots(*interest);
+    for (auto &client : m_clients) {
+        if (client.getState() == Client::Connected) {
+            client.flushSendQueue();
+        }
+    }
+}
 
-        if (fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK) == -1) {
-            m_logger.log("[WARNING]  Failed to fcntl socket: {}", strerror(errno));
-            goto next;
+void Server::sendSnapshots(interest::Grid const &interest) {
+    auto const &world = interest.getSnapshot();
+    m_world_tick = world->tick;
+    // Frames of the whole world's snapshot, keyed by baseline and framing
+    std::map<std::pair<snapshot::Snapshot const *, Framing>, Frame> frames;
+    for (auto &client : m_clients) {
+        if (client.getState() != Client::Connected || client.m_entity == 0) {
+            continue;
         }
-        
-        if (m_clients.size() >= m_max_clients) {
-            // Perhaps issue some kind of "server full" warning. But how would
-            // this be done as the client would be in the PENDING state
-            // intially?
-            close(client_socket);
+        snapshot::EntityState const *player = world->find(client.m_entity);
+        if (player == nullptr) {
             continue;
         }
+        auto selected = std::make_shared<snapshot::Snapshot>();
+        interest.select(*player, client.m_interest, *selected);
+        snapshot::Snapshot const *baseline =
+            client.m_snapshots.find(client.m_snapshot_ack);
+        bool shared = selected->entities.size() == world->entities.size();
+        std::shared_ptr<snapshot::Snapshot const> snapshot = selected;
+        if (shared) {
+            snapshot = world;
+        }
+        auto encode = [&](Writer &writer) {
+            snapshot::encode(writer, *snapshot, baseline);
+            writer.end();
+        };
+        // Snapshots go by UDP where possible as a lost one doesn't need to
+        // be resent, but ones too big for a datagram have to use TCP
+        if (shared) {
+            auto frame = [&](Framing framing) -> Frame {
+                Frame &encoded = frames[std::make_pair(baseline, framing)];
+                if (!encoded) {
+                    auto buffer = std::make_shared<std::string>();
+                    encode(m_writer.begin(framing, "world.snapshot", *buffer));
+                    encoded = std::move(buffer);
+                }
+                return encoded;
+            };
+            if (!client.hasDatagramChannel() ||
+                !client.sendDatagram(frame(Framing::Binary))) {
+                client.sendFrame(frame(client.getFraming()));
+            }
+        } else {
+            // Nobody else gets this one, so it's written into a reused
+            // buffer or straight into the client's pending messages
+            bool sent = false;
+            if (client.hasDatagramChannel()) {
+                m_datagram_frame.clear();
+                encode(m_writer.begin(Framing::Binary, "world.snapshot",
+                                      m_datagram_frame));
+                sent = client.sendDatagram(m_datagram_frame.data(),
+                                           m_datagram_frame.size());
+            }
+            if (!sent) {
+                encode(client.write("world.snapshot"));
+            }
+        }
+        client.m_snapshots.push(snapshot);
+    }
+}
 
+void Server::handleInput(Server */*server*/, ClientHandle handle,
+                         json::Value const &entity) {
+    Client *client = getClient(handle);
+    if (client->m_entity == 0 || !entity[0].is_number() ||
+        !entity[1].is_number()) {
+        return;
+    }
+    world::EntityId player = client->m_entity;
+    std::uint32_t sequence = entity[0].int_value();
+    unsigned buttons = entity[1].int_value();
+    updateWorld([player, sequence, buttons](world::World &world) {
+        world.setInput(player, sequence, buttons);
+    });
+}
 
-        m_clients.emplace_back(a, c); /* XXX: Looks like Client might need a touch of work to accept sockaddr_storage rather than sockaddr_in */
-        m_clients.back().send("map.offer", m_map.md5.getHash());
-        m_clients.back().send("net.udp", UDP_PORT);
-        continue;
-next:   s++;
+void Server::handleNetUDP(Server */*server*/, ClientHandle handle,
+                          json::Value const &entity) {
+    Client *client = getClient(handle);
+    int port = entity.int_value();
+    if (m_udp_socket < 0 || !entity.is_number() || port < 1 || port > 65535) {
+        return;
     }
-#   else
-    socklen_t b = sizeof(m_tcp_socket);
-    while (true) {
-        // Returns immediately with NULL if no pending connections
-        int client_socket = accept(m_tcp_socket,
-                                   (struct sockaddr *)&m_tcp_address, &b);
+    std::uint32_t channel = client->m_channel;
+    if (client->m_channel < 0) {
+        // Channels are picked at random so they're hard to guess, which
+        // makes it harder to spoof another client's datagrams. They're kept
+        // below 2^31 and are this shard's index modulo the number of shards.
+        std::uint32_t shards = m_cluster.getShardCount();
+        do {
+            channel = m_random() % (0x80000000u / shards) * shards + m_shard;
+        } while (m_channels.count(channel));
+        m_channels[channel] = handle;
+    }
+    client->bindChannel(m_udp_socket, channel, port);
+    client->write("net.channel").value(channel).end();
+}
 
-        if (client_socket < 0) {
+void Server::handleNetPing(Server */*server*/, ClientHandle handle,
+                           json::Value const &entity) {
+    getClient(handle)->write("net.pong").value(entity).end();
+}
+
+void Server::handleNetPong(Server */*server*/, ClientHandle /*handle*/,
+                           json::Value const &/*entity*/) {}
+
+void Server::handleDatagrams() {
+    char buffer[datagram::MAX_SIZE];
+    for (;;) {
+        struct sockaddr_in source;
+        socklen_t source_size = sizeof source;
+        ssize_t size = recvfrom(m_udp_socket, buffer, sizeof buffer, 0,
+                                (struct sockaddr *)&source, &source_size);
+        if (size < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
             if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                m_logger.log("Failed to accept client connection: {}",
-                         strerror(errno));
-                break;
-            } else {
-                break;
+                m_logger.log(LogLevel::Warning,
+                             "Failed to receive datagram: {}",
+                             strerror(errno));
             }
+            break;
         }
-
-        struct sockaddr peer_address;
-        socklen_t addrlen = sizeof(peer_address);
-        int error = getpeername(client_socket, &peer_address,
-                                &addrlen);
-        if (error == -1) {
-            throw std::runtime_error("Error getting peer name.");
+        m_metrics.bytes_in.add(size);
+        std::uint32_t channel;
+        std::uint32_t sequence;
+        MessageType type;
+        json::Value entity;
+        std::string error;
+        m_datagrams.clear();
+        if (!datagram::decode(buffer, size, channel, sequence, type,
+                              m_datagrams, entity, error)) {
+            continue;
+        }
+        unsigned int shard = channel % m_cluster.getShardCount();
+        if (shard == m_shard) {
+            receiveDatagram(source, channel, sequence, type, entity, size);
+            continue;
         }
-        struct sockaddr_in *addr_in = (struct sockaddr_in *)&peer_address;
+        // The entity refers to the buffer, so the other shard needs a copy
+        Server &server = m_cluster.getShard(shard);
+        Json copy = entity.toJson11();
+        server.post([&server, source, channel, sequence, type, copy, size] {
+            server.m_datagrams.clear();
+            server.receiveDatagram(source, channel, sequence, type,
+                                   server.m_datagrams.fromJson11(copy),
+                                   size);
+        });
+    }
+}
 
-        fcntl(client_socket, F_SETFL, O_NONBLOCK);
+void Server::receiveDatagram(struct sockaddr_in const &source,
+                             std::uint32_t channel, std::uint32_t sequence,
+                             MessageType const &type,
+                             json::Value const &entity, std::size_t size) {
+    auto handle = m_channels.find(channel);
+    if (handle == m_channels.end()) {
+        return;
+    }
+    Client *client = getClient(handle->second);
+    if (client == nullptr || client->getState() != Client::Connected ||
+        !client->acceptDatagram(source, sequence)) {
+        return;
+    }
+    capture::Recorder *recorder = m_cluster.getRecorder();
+    if (recorder != nullptr) {
+        Frame frame = encodeFrame(Framing::Binary, type, entity.toJson11());
+        recorder->record(capture::Event::Datagram, captureSlot(handle->second),
+                         frame->data(), frame->size());
+    }
+    client->m_last_heard = m_timers.getNow();
+    if (client->admit(type, size, m_timers.getNow())) {
+        unsigned int id = m_handlers.find(type);
+        m_metrics.messages[id].add();
+        m_handlers.dispatch(id, this, handle->second, entity);
+    }
+}
+
+void Server::acceptConnections() {
+    while (true) {
+        struct sockaddr_in peer_address;
+        socklen_t addrlen = sizeof peer_address;
+        // Returns immediately with -1 (EAGAIN) if no pending connections
+        int client_socket = accept4(m_tcp_socket,
+                                    (struct sockaddr *)&peer_address,
+                                    &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
 
-        if (m_clients.size() >= m_max_clients) {
+        if (client_socket < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                m_logger.log(LogLevel::Warning,
+                             "Failed to accept client connection: {}",
+                             strerror(errno));
+            }
+            break;
+        }
+
+        if (!m_cluster.addClient()) {
             // Perhaps issue some kind of "server full" warning. But how would
             // this be done as the client would be in the PENDING state
             // intially?
             close(client_socket);
         } else {
-            m_clients.emplace_back(*addr_in, client_socket);
-            m_clients.back().send("map.offer", m_map.md5.getHash());
-            m_clients.back().send("net.udp", UDP_PORT);
+            ClientHandle handle =
+                m_clients.emplace(peer_address, client_socket,
+                                  m_cluster.getLimits(), m_timers.getNow(),
+                                  m_metrics);
+            m_metrics.accepted.add();
+            capture::Recorder *recorder = m_cluster.getRecorder();
+            if (recorder != nullptr) {
+                std::uint32_t slot = captureSlot(handle);
+                recorder->record(capture::Event::Connect, slot);
+                getClient(handle)->record(recorder, slot);
+            }
+            // Being edge-triggered, EPOLLOUT is only reported once a full
+            // send buffer has drained, which is exactly when a partially
+            // flushed send queue should be resumed
+            m_loop.add(client_socket, EPOLLIN | EPOLLOUT | EPOLLRDHUP,
+                       [this, handle](std::uint32_t events) {
+                handleClientEvents(handle, events);
+            });
+            startTimers(handle);
+            Client *client = getClient(handle);
+            client->send("map.offer", m_map.getOffer());
+            if (m_udp_socket >= 0) {
+                client->send("net.udp", m_udp_port);
+            }
         }
     }
-#   endif
 }
 
-int Server::exec() {
+void Server::handleClientEvents(ClientHandle handle, std::uint32_t events) {
+    Client *client = getClient(handle);
+    if (client == nullptr) {
+        return;
+    }
+    if ((events & EPOLLOUT) && client->hasPendingEgress()) {
+        client->flushSendQueue();
+        sendMapChunks(client);
+    }
+    // Hang-ups and errors are picked up by the recv(2) calls in exec() so
+    // there's no need to treat them differently here
+    std::vector<Received> const &messages = client->exec(m_timers.getNow());
+    if (!messages.empty()) {
+        client->m_last_heard = m_timers.getNow();
+    }
+    if (client->isThrottled() &&
+        std::find(m_throttled.begin(), m_throttled.end(), handle) ==
+            m_throttled.end()) {
+        m_throttled.push_back(handle);
+    }
+    for (auto const &message : messages) {
+        unsigned int id = m_handlers.find(message.type);
+        m_metrics.messages[id].add();
+        m_handlers.dispatch(id, this, handle, message.entity);
+    }
+}
+
+void Server::listenAdmin(std::string const &path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof address);
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof address.sun_path) {
+        m_logger.log(LogLevel::Error, "Admin socket path is too long: {}",
+                     path);
+        exit(1);
+    }
+    strcpy(address.sun_path, path.c_str());
+    m_admin_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK |
+                                         SOCK_CLOEXEC, 0);
+    if (m_admin_socket < 0) {
+        m_logger.log(LogLevel::Error, "Failed to create admin socket: {}",
+                     strerror(errno));
+        exit(1);
+    }
+    // Left behind by a previous run, most likely
+    unlink(path.c_str());
+    if (bind(m_admin_socket, (struct sockaddr *)&address, sizeof address) <
+            0 ||
+        listen(m_admin_socket, SOMAXCONN) < 0) {
+        m_logger.log(LogLevel::Error, "Failed to bind admin socket {}: {}",
+                     path, strerror(errno));
+        exit(1);
+    }
+    m_loop.add(m_admin_socket, EPOLLIN,
+               [this](std::uint32_t) { acceptAdmin(); });
+    m_logger.log(LogLevel::Info, "Admin socket at {}", path);
+}
+
+void Server::acceptAdmin() {
     while (true) {
-        acceptConnections();
-        for (auto &client : m_clients) {
-            for (auto &message : client.exec()) {
-                // We can't use message.has_shape() here because we don't want
-                // to make assumptions about the type of the message entity
-                if (message.is_object()) {
-                    Json type = message["type"];
-                    // If the 'type' field doesn't exist then is_string()
-                    // is falsey
-                    if (type.is_string()) {
-                        for (auto &handler : m_handlers[type.string_value()]) {
-                            handler(this, &client, message["entity"]);
-                        }
-                    }
-                }
+        int socket = accept4(m_admin_socket, nullptr, nullptr,
+                             SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (socket < 0) {
+            if (errno == EINTR) {
+                continue;
             }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                m_logger.log(LogLevel::Warning,
+                             "Failed to accept admin connection: {}",
+                             strerror(errno));
+            }
+            break;
         }
-        // Remove disconnected clients
-        for (size_t i = 0; i < m_clients.size(); ++i) {
-            Client &client = m_clients[i];
+        m_loop.add(socket, EPOLLIN | EPOLLRDHUP,
+                   [this, socket](std::uint32_t) { answerAdmin(socket); });
+    }
+}
+
+void Server::answerAdmin(int socket) {
+    char command[64];
+    ssize_t size = recv(socket, command, sizeof command - 1, 0);
+    if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return;
+    }
+    command[std::max<ssize_t>(size, 0)] = '\0';
+    bool json = strncmp(command, "json", 4) == 0;
+    std::string metrics = m_cluster.renderMetrics(json);
+    // The metrics are much smaller than a socket buffer, so all of them go
+    // in one go unless the other end has gone
+    send(socket, metrics.data(), metrics.size(), MSG_NOSIGNAL);
+    m_loop.remove(socket);
+    close(socket);
+}
 
-            if (client.getState() == Client::Disconnected) {
-                close(client.m_tcp_socket);
-                m_clients.erase(m_clients.begin() + i);
+void Server::startTimers(ClientHandle handle) {
+    Client *client = getClient(handle);
+    client->m_last_heard = m_timers.getNow();
+    client->m_handshake_timer =
+        m_timers.schedule(HANDSHAKE_TIMEOUT * TICK_RATE, [this, handle] {
+            Client *client = getClient(handle);
+            if (client != nullptr && client->getState() == Client::Pending) {
+                client->disconnect("Handshake timed out", false);
             }
+        });
+    client->m_idle_timer = m_timers.schedule(
+        IDLE_TIMEOUT * TICK_RATE, [this, handle] { checkIdle(handle); });
+    client->m_ping_timer = m_timers.schedule(
+        PING_INTERVAL * TICK_RATE, [this, handle] { ping(handle); });
+}
+
+void Server::checkIdle(ClientHandle handle) {
+    Client *client = getClient(handle);
+    if (client == nullptr) {
+        return;
+    }
+    std::uint64_t deadline = client->m_last_heard + IDLE_TIMEOUT * TICK_RATE;
+    if (deadline <= m_timers.getNow()) {
+        client->disconnect("Timed out");
+        return;
+    }
+    client->m_idle_timer =
+        m_timers.schedule(deadline - m_timers.getNow(),
+                          [this, handle] { checkIdle(handle); });
+}
+
+void Server::ping(ClientHandle handle) {
+    Client *client = getClient(handle);
+    if (client == nullptr) {
+        return;
+    }
+    if (client->getState() == Client::Connected) {
+        client->write("net.ping").value(m_timers.getNow()).end();
+    }
+    client->m_ping_timer = m_timers.schedule(
+        PING_INTERVAL * TICK_RATE, [this, handle] { ping(handle); });
+}
+
+void Server::tick(std::uint64_t ticks) {
+    timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    m_timers.advance(m_timers.getNow() + ticks);
+    std::vector<ClientHandle> throttled;
+    throttled.swap(m_throttled);
+    for (auto handle : throttled) {
+        handleClientEvents(handle, EPOLLIN);
+    }
+
+    if (m_shard == 0) {
+        world::World &world = m_cluster.getWorld();
+        std::uint64_t steps =
+            std::min<std::uint64_t>(ticks, MAX_CATCHUP_TICKS);
+        std::uint64_t first = world.getTick();
+        for (std::uint64_t i = 0; i < steps; i++) {
+            world.step();
+        }
+        m_tick_stats.skipped += ticks - steps;
+        if (world.getTick() / SNAPSHOT_INTERVAL !=
+            first / SNAPSHOT_INTERVAL) {
+            publishWorld();
+        }
+    }
+
+    for (auto &client : m_clients) {
+        if (client.getState() == Client::Connected) {
+            client.flushSendQueue();
+            sendMapChunks(&client);
+        }
+    }
+    // Remove disconnected clients. Removing one moves the last client into
+    // its place, which is then looked at next.
+    for (std::size_t i = 0; i < m_clients.size();) {
+        Client &client = m_clients[i];
+        if (client.getState() != Client::Disconnected) {
+            i++;
+            continue;
+        }
+        if (client.m_entity != 0) {
+            world::EntityId player = client.m_entity;
+            updateWorld([player](world::World &world) {
+                world.removeEntity(player);
+            });
+        }
+        m_channels.erase(client.m_channel);
+        m_timers.cancel(client.m_handshake_timer);
+        m_timers.cancel(client.m_idle_timer);
+        m_timers.cancel(client.m_ping_timer);
+        m_cluster.removeClient();
+        // The client closes its socket as it's destroyed
+        m_loop.remove(client.m_tcp_socket);
+        m_clients.erase(m_clients.handleAt(i));
+    }
+
+    capture::Recorder *recorder = m_cluster.getRecorder();
+    if (m_shard == 0 && recorder != nullptr) {
+        recorder->flush();
+    }
+
+    timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    recordTick((end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec -
+               start.tv_nsec);
+}
+
+void Server::recordTick(std::uint64_t duration) {
+    m_metrics.tick_time.record(duration);
+    TickStats &stats = m_tick_stats;
+    if (stats.count == 0 || duration < stats.min) {
+        stats.min = duration;
+    }
+    stats.max = std::max(stats.max, duration);
+    stats.total += duration;
+    stats.count++;
+    if (duration > 1000000000ULL / TICK_RATE) {
+        stats.overruns++;
+    }
+    if (stats.count < TICK_REPORT_INTERVAL * TICK_RATE) {
+        return;
+    }
+    m_logger.log(LogLevel::Info,
+                 "Ticks: {}, {:.3f}/{:.3f}/{:.3f} ms min/avg/max, "
+                 "{} overran, {} skipped; world tick {}",
+                 stats.count, stats.min / 1e6,
+                 stats.total / 1e6 / stats.count, stats.max / 1e6,
+                 stats.overruns, stats.skipped, m_world_tick);
+    stats = TickStats();
+}
+
+std::uint32_t Server::captureSlot(ClientHandle handle) const {
+    return handle.index * m_cluster.getShardCount() + m_shard;
+}
+
+void Server::replay(capture::Reader &reader, bool real_time) {
+    auto start = std::chrono::steady_clock::now();
+    std::uint64_t ticks = 0;
+    // Run every tick due by `time`, in nanoseconds since the capture began
+    auto advance = [&](std::uint64_t time) {
+        std::uint64_t due = time / (1000000000ULL / TICK_RATE);
+        while (ticks < due) {
+            ticks++;
+            if (real_time) {
+                std::this_thread::sleep_until(
+                    start + std::chrono::nanoseconds(
+                                ticks * (1000000000ULL / TICK_RATE)));
+            }
+            tick(1);
+        }
+        if (real_time) {
+            std::this_thread::sleep_until(start +
+                                          std::chrono::nanoseconds(time));
+        }
+    };
+    // Capture slots of the clients connected so far
+    std::unordered_map<std::uint32_t, ClientHandle> slots;
+    std::uint64_t records = 0;
+    std::uint64_t refused = 0;
+    capture::Record record;
+    while (reader.next(record)) {
+        records++;
+        advance(record.time);
+        if (record.event == capture::Event::Connect) {
+            slots.erase(record.client);
+            if (!m_cluster.addClient()) {
+                refused++;
+                continue;
+            }
+            struct sockaddr_in address;
+            memset(&address, 0, sizeof address);
+            address.sin_family = AF_INET;
+            ClientHandle handle =
+                m_clients.emplace(address, -1, m_cluster.getLimits(),
+                                  m_timers.getNow(), m_metrics);
+            m_metrics.accepted.add();
+            startTimers(handle);
+            // Without a UDP socket there's no `net.udp`, so datagrams are
+            // replayed as if they'd arrived on a channel
+            getClient(handle)->send("map.offer", m_map.getOffer());
+            slots[record.client] = handle;
+            continue;
+        }
+        auto slot = slots.find(record.client);
+        Client *client =
+            slot == slots.end() ? nullptr : getClient(slot->second);
+        if (client == nullptr) {
+            // Already disconnected by the server, as it was when recorded
+            continue;
+        }
+        if (record.event == capture::Event::Data) {
+            client->receive(record.data, record.size, m_timers.getNow());
+            handleClientEvents(slot->second, EPOLLIN);
+        } else if (record.event == capture::Event::Datagram) {
+            std::uint64_t size;
+            int length = wire::getVarint(record.data, record.size, size);
+            MessageType type;
+            json::Value entity;
+            std::string error;
+            m_datagrams.clear();
+            if (length <= 0 || size != record.size - length ||
+                !wire::decodeMessage(record.data + length, size, type,
+                                     m_datagrams, entity, error)) {
+                throw std::runtime_error(
+                    fmt::format("Bad datagram in capture: {}", error));
+            }
+            if (client->getState() != Client::Connected) {
+                continue;
+            }
+            client->m_last_heard = m_timers.getNow();
+            if (client->admit(type, record.size, m_timers.getNow())) {
+                unsigned int id = m_handlers.find(type);
+                m_metrics.messages[id].add();
+                m_handlers.dispatch(id, this, slot->second, entity);
+            }
+        } else {
+            if (client->getState() != Client::Disconnected) {
+                client->disconnect("Left server (replayed)", false);
+            }
+            slots.erase(slot);
         }
     }
+    // Let the last of what was received be handled and sent
+    tick(1);
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    m_logger.log(LogLevel::Info,
+                 "Replayed {} records in {:.3f} s ({} ticks, {:.1f} s of "
+                 "capture)",
+                 records, elapsed.count(), ticks + 1,
+                 (double)ticks / TICK_RATE);
+    if (refused > 0) {
+        m_logger.log(LogLevel::Warning,
+                     "{} clients in the capture were refused, as the server "
+                     "was full; what they sent wasn't replayed",
+                     refused);
+    }
+}
+
+int Server::exec() {
+    auto accept = [this](std::uint32_t) { acceptConnections(); };
+#   ifndef IPV4_ONLY
+    for (auto socket : m_tcp_socket) {
+        m_loop.add(socket, EPOLLIN, accept);
+    }
+#   else
+    m_loop.add(m_tcp_socket, EPOLLIN, accept);
+#   endif
+    m_loop.add(m_mailbox.getDescriptor(), EPOLLIN,
+               [this](std::uint32_t) { m_mailbox.drain(); });
+    if (m_udp_socket >= 0) {
+        m_loop.add(m_udp_socket, EPOLLIN,
+                   [this](std::uint32_t) { handleDatagrams(); });
+    }
+    if (m_shard == 0 && !m_cluster.getAdminSocket().empty()) {
+        listenAdmin(m_cluster.getAdminSocket());
+    }
+    m_loop.addFixedRateTimer(TICK_RATE,
+                             [this](std::uint64_t ticks) { tick(ticks); });
+    m_loop.run();
 
     return 1;
 }
@@ -2,16 +2,27 @@
 
 #include <functional>
 
+#include "common/net/dispatch.hpp"
 #include "common/net/message.hpp"
 
 #include "common/logger/Logger.hpp"
+#include "common/util/slotmap.hpp"
+#include "common/util/timerwheel.hpp"
 #include "json11.hpp"
 
+#include "Capture.hpp"
 #include "Client.hpp"
+#include "EventLoop.hpp"
+#include "Interest.hpp"
+#include "Mailbox.hpp"
 #include "Map.hpp"
+#include "Metrics.hpp"
+#include "World.hpp"
 
 #include <vector>
 #include <fstream>
+#include <random>
+#include <unordered_map>
 
 #include <stdio.h>
 #include <sys/socket.h>
@@ -21,40 +32,121 @@
 #include <netinet/in.h>
 
 #define RECV_BUFFER_SIZE 1024
+/// Default port of the UDP socket for unreliable messages (see net::datagram)
 #define UDP_PORT 4545
+/// Number of server ticks per second
+#define TICK_RATE 60
+/// Most world ticks run at once to catch up after the server was held up
+///
+/// If the server falls further behind than this, the extra ticks are skipped
+/// rather than making the next tick take even longer.
+#define MAX_CATCHUP_TICKS 5
+/// Number of ticks between world snapshots sent to clients
+#define SNAPSHOT_INTERVAL 2
+/// Seconds between reports of how long ticks are taking
+#define TICK_REPORT_INTERVAL 60
+/// Number of map chunks queued at a time whilst sending a client the map
+#define MAP_CHUNKS_PER_FLUSH 4
+/// Seconds a client has to send the protocol's magic number after connecting
+#define HANDSHAKE_TIMEOUT 10
+/// Seconds a client may go without sending anything before it's disconnected
+#define IDLE_TIMEOUT 30
+/// Seconds between the `net.ping` messages sent to keep connections alive
+#define PING_INTERVAL 5
 
 using namespace net;
 
 /// The Zordzman server
 namespace server {
 
-// pls help
-// typedef std::function<void(Server *server, Client *client, json11::Json
-// entity)> MessageHandler;
+class Cluster;
 
+/// One shard of the server
+///
+/// A shard owns the clients which connected to its listening socket and
+/// handles everything to do with them on its own thread. See Cluster for how
+/// the shards fit together; with a single shard this is the whole server.
+///
+/// Only shard 0 steps the world. Every other shard hands world changes, such
+/// as players joining and their input, to shard 0 through its mailbox, and
+/// sends its clients the snapshots shard 0 publishes.
+///
+/// UDP channels are numbered so that `channel % shards` is the shard of the
+/// client the channel belongs to. Datagrams which the kernel delivers to
+/// another shard's UDP socket are forwarded to that shard.
 class Server {
 
 public:
-    Server(int port, unsigned int max_clients, std::string map_name);
+    typedef net::Dispatcher<Server *, ClientHandle, json::Value const &>
+        Handlers;
+
+    /// @param cluster The cluster the shard is part of, which must outlive
+    ///     it
+    /// @param shard The shard's index in the cluster
+    /// @param port 0 for no sockets at all, to replay a capture
+    Server(Cluster &cluster, unsigned int shard, int port, int udp_port);
     ~Server();
+
+    /// Run the shard
+    ///
+    /// This registers the listening socket and mailbox with the event loop
+    /// along with a timer for the server tick and then dispatches events
+    /// forever. The shard only wakes up when a socket is ready, a task is
+    /// posted or a tick is due.
+    ///
+    /// Ticks are paced by EventLoop::addFixedRateTimer() so the world runs at
+    /// exactly TICK_RATE ticks per second over any length of time.
     int exec();
 
-    /// Broadcast a message to all clients
+    /// Run the shard on what a capture recorded clients sending, instead of
+    /// on sockets
     ///
-    /// See Client::send().
+    /// Clients are connected, fed what they sent and disconnected when the
+    /// capture says, with the world ticked in between just as it was when
+    /// the capture was recorded; their clients are socket-less and discard
+    /// what they're sent. As fast as possible by default, or paced like the
+    /// recording if `real_time`. Returns once the capture is over.
+    ///
+    /// Only for a cluster of one shard created with no sockets. Throws
+    /// std::runtime_error if the capture is corrupt.
+    void replay(capture::Reader &reader, bool real_time);
+
+    /// Broadcast a message to all clients of every shard
+    ///
+    /// The message is encoded once per framing in use and the encoded frame
+    /// is shared between the clients, rather than each client encoding its
+    /// own copy. See Client::send() and Client::sendFrame().
     void sendAll(std::string type, json11::Json entity);
 
+    /// Have the shard's thread run a task; safe from any thread
+    void post(Mailbox::Task task);
+
     /// Add a message handler
     ///
     /// When a message of the given type is received all handlers for that
     /// message type are called with the message 'entity' field as the Json
-    /// parameter.
-    void addHandler(std::string type,
-                    std::function<void(Server *server, Client *client,
-                                       json11::Json entity)> handler);
+    /// parameter. See net::Dispatcher.
+    ///
+    /// Handlers are passed the handle of the client which sent the message,
+    /// which can be turned into the client with getClient().
+    void addHandler(std::string type, Handlers::Handler handler);
+
+    /// Get one of this shard's clients, or nullptr if it's gone
+    Client *getClient(ClientHandle handle);
+
+    /// What the shard has measured; safe to read from any thread
+    Metrics const &getMetrics() const;
 
 private:
     void initSDL();
+    /// Create, bind and listen on the shard's TCP and UDP sockets
+    ///
+    /// Exits if there's no TCP socket; UDP is optional.
+    void bindSockets(int port, int udp_port);
+
+    /// Identify a client in a capture, uniquely across every shard
+    std::uint32_t captureSlot(ClientHandle handle) const;
+
     /// Accept all pending connections
     ///
     /// This accept(2)s all pending connections on the listening socket. These
@@ -64,38 +156,236 @@ private:
     /// disconnected immediately.
     void acceptConnections();
 
-    void handleMapRequest(Server *server, Client *client, json11::Json entity);
+    /// Handle readiness events for a client's socket
+    ///
+    /// Resumes sending if a previous flush was cut short by a full send
+    /// buffer. Then reads everything available from the client and calls the
+    /// handlers for each complete message received. Clients which are
+    /// throttled by their rate limits are added to m_throttled.
+    void handleClientEvents(ClientHandle handle, std::uint32_t events);
+
+    /// Listen for connections to the admin socket at `path`
+    ///
+    /// Only done by shard 0. Anything already at `path` is removed first.
+    /// Exits if the socket can't be created.
+    void listenAdmin(std::string const &path);
+
+    /// Accept all pending connections to the admin socket
+    void acceptAdmin();
+
+    /// Answer a connection to the admin socket and close it
+    ///
+    /// The connection sends `json` for the metrics of every shard as JSON,
+    /// or anything else for them as text (see renderMetrics()).
+    void answerAdmin(int socket);
+
+    /// Schedule a new client's handshake, idle and ping timers
+    ///
+    /// A client still Pending after HANDSHAKE_TIMEOUT seconds, or which has
+    /// sent nothing for IDLE_TIMEOUT seconds, is disconnected. Connected
+    /// clients are sent a `net.ping` every PING_INTERVAL seconds, which they
+    /// answer, so that quiet but healthy clients aren't taken for idle.
+    void startTimers(ClientHandle handle);
+
+    /// Disconnect a client if it's been idle too long, else check again
+    /// when it next could have been
+    void checkIdle(ClientHandle handle);
+
+    /// Send a client a `net.ping` and schedule the next one
+    void ping(ClientHandle handle);
+
+    /// Advance the shard by `ticks` ticks
+    ///
+    /// Fires any of the shard's timers which are due and reads from
+    /// throttled clients again. On shard 0, steps the world once per tick, up
+    /// to MAX_CATCHUP_TICKS, so that it catches up if the server fell behind,
+    /// and every SNAPSHOT_INTERVAL ticks publishes the world's state with
+    /// publishWorld(). Then flushes the send queues of all connected clients,
+    /// continues their map transfers and removes any clients that have
+    /// disconnected.
+    ///
+    /// How long this takes is recorded in m_tick_stats.
+    void tick(std::uint64_t ticks);
+
+    /// Change the world
+    ///
+    /// Runs `update` straight away on shard 0 and otherwise posts it to
+    /// shard 0. Either way, updates from one shard are applied in order.
+    void updateWorld(std::function<void(world::World &world)> update);
+
+    /// Send a snapshot of the world to the clients of every shard
+    ///
+    /// Only called on shard 0. The snapshot and the interest grid built from
+    /// it are shared by all the shards, which send their clients their part
+    /// of it with sendSnapshots().
+    void publishWorld();
+
+    /// Send clients a snapshot published by shard 0 and flush it out to them
+    void receiveWorld(std::shared_ptr<interest::Grid const> interest);
+
+    /// Queue a message for all of this shard's clients
+    ///
+    /// `json_frame` and `binary_frame` are the message's frames in each
+    /// framing, or null to encode them here when they're first needed.
+    void broadcast(std::string const &type, json11::Json const &entity,
+                   Frame json_frame, Frame binary_frame);
+
+    /// Handle `map.request` messages from clients
+    ///
+    /// This starts sending the map to the client as `map.chunk` messages,
+    /// replacing any transfer already in progress. The entity may be an
+    /// object with an `offset` field to resume an interrupted transfer from.
+    void handleMapRequest(Server *server, ClientHandle handle,
+                          json::Value const &entity);
+
+    /// Queue more of a client's map transfer if its socket can take it
+    ///
+    /// More chunks are only queued once everything queued before them has
+    /// been written to the socket, so a transfer goes as fast as the socket
+    /// drains. Other messages sent to the client are never stuck behind more
+    /// than MAP_CHUNKS_PER_FLUSH chunks, and the server never holds more than
+    /// that much of any transfer in memory.
+    void sendMapChunks(Client *client);
+
+    /// Handle `has-map` messages from clients
+    ///
+    /// The client is ready to play, so its player is added to the world and
+    /// the client is told its ID with a `world.join` message.
+    void handleHasMap(Server *server, ClientHandle handle,
+                      json::Value const &entity);
+
+    /// Send a snapshot of the world to every client of this shard in it
+    ///
+    /// Each client is only sent the entities near its player, as picked out
+    /// by `interest`, so what each client is sent doesn't grow with the size
+    /// of the world. Of those, it's sent just what has changed since the last
+    /// snapshot it acknowledged, or everything if it hasn't acknowledged one
+    /// of those it was recently sent (see net::snapshot).
+    ///
+    /// Clients which are near everything, as on small maps, all get the same
+    /// snapshot. Then, like sendAll(), each encoding is done once and shared:
+    /// clients with the same baseline and framing are sent the same frame.
+    /// Otherwise each is written with a Writer straight into the client's
+    /// pending messages, or into a reused buffer to go in a datagram, so it
+    /// doesn't allocate.
+    void sendSnapshots(interest::Grid const &interest);
+
+    /// Handle `world.ack` messages from clients
+    ///
+    /// The entity is the tick of a snapshot the client has received.
+    void handleWorldAck(Server *server, ClientHandle handle,
+                        json::Value const &entity);
+
+    /// Handle `input` messages from clients
+    ///
+    /// See net::input for the entity.
+    void handleInput(Server *server, ClientHandle handle,
+                     json::Value const &entity);
 
     /// Handle `net.udp` message from clients
     ///
     /// net.udp is used by the client to specify the port number of its UDP
     /// socket. The message entity should be a valid port number as an integer.
     ///
-    /// The handler will attempt to reserve a socket channel for the client,
-    /// disconnecting if it fails to. If successful the client's m_channel is
-    /// set to the allocated channel.
-    void handleNetUDP(Server *server, Client *client, json11::Json entity);
+    /// The handler reserves a socket channel for the client, sets the
+    /// client's m_channel to it and tells the client it with a `net.channel`
+    /// message. Clients asking again keep the channel they were given. If the
+    /// server has no UDP socket or the port is invalid then the message is
+    /// ignored and the client carries on with just TCP.
+    void handleNetUDP(Server *server, ClientHandle handle,
+                      json::Value const &entity);
+
+    /// Handle `net.ping` messages from clients
+    ///
+    /// The client is sent a `net.pong` with the same entity straight back,
+    /// so it can time the round trip.
+    void handleNetPing(Server *server, ClientHandle handle,
+                       json::Value const &entity);
+
+    /// Handle `net.pong` messages from clients
+    ///
+    /// Clients answer every `net.ping` with one. Hearing from the client at
+    /// all is what keeps it from timing out, so there's nothing more to do,
+    /// but they're handled so as not to count as unhandled messages.
+    void handleNetPong(Server *server, ClientHandle handle,
+                       json::Value const &entity);
+
+    /// Receive everything available on the UDP socket
+    ///
+    /// Datagrams are passed to receiveDatagram() on the shard their channel
+    /// belongs to. Malformed ones are dropped.
+    void handleDatagrams();
 
-    unsigned int m_max_clients;
+    /// Handle a datagram for one of this shard's channels
+    ///
+    /// Datagrams for a client's channel are checked with
+    /// Client::acceptDatagram() and Client::admit(), and their message passed
+    /// to the handlers like messages received over TCP. Anything else is
+    /// dropped.
+    void receiveDatagram(struct sockaddr_in const &source,
+                         std::uint32_t channel, std::uint32_t sequence,
+                         MessageType const &type, json::Value const &entity,
+                         std::size_t size);
+
+    Cluster &m_cluster;
+    unsigned int m_shard;
 
 #   define IPV4_ONLY
 #   ifndef IPV4_ONLY
     std::vector<Socket> m_tcp_socket;
     struct sockaddr_in *m_tcp_address;
-    std::vector<Socket> m_udp_socket;
-    struct sockaddr_in *m_udp_address;
 #   else
     Socket m_tcp_socket;
     struct sockaddr_in m_tcp_address;
+#   endif
+    /// Datagrams go through one socket however TCP is listened for
     Socket m_udp_socket;
     struct sockaddr_in m_udp_address;
-#   endif
 
-    std::vector<Client> m_clients;
+    int m_udp_port;
+    /// Maps UDP channels to the client they belong to
+    std::unordered_map<std::uint32_t, ClientHandle> m_channels;
+    /// What datagrams' messages are decoded into
+    json::Document m_datagrams;
+    /// What messages which aren't for any one client's pending messages are
+    /// encoded with, and a buffer for those sent in datagrams
+    Writer m_writer;
+    std::string m_datagram_frame;
+    std::mt19937 m_random;
+
+    common::util::container::SlotMap<Client> m_clients;
+    EventLoop m_loop;
+    Mailbox m_mailbox;
+    Metrics m_metrics;
+    /// The listening admin socket, -1 if there isn't one
+    int m_admin_socket;
+    /// Client timers, in ticks; see startTimers()
+    common::util::timer::TimerWheel m_timers;
+    /// Clients with data left unread because of their rate limits
+    ///
+    /// Their sockets are read again next tick; see Client::isThrottled().
+    std::vector<ClientHandle> m_throttled;
     common::Logger m_logger;
-    map::Level m_map;
-    std::map<std::string,
-             std::vector<std::function<void(Server *server, Client *client,
-                                            json11::Json entity)>>> m_handlers;
+    map::Level const &m_map;
+    /// Tick of the last world snapshot sent to clients
+    std::uint64_t m_world_tick;
+
+    /// How long ticks have taken since they were last reported
+    struct TickStats {
+        /// Number of ticks timed
+        std::uint64_t count;
+        /// Sum, shortest and longest tick duration in nanoseconds
+        std::uint64_t total;
+        std::uint64_t min;
+        std::uint64_t max;
+        /// Ticks which took longer than the tick interval
+        std::uint64_t overruns;
+        /// World ticks skipped to catch up; only on shard 0
+        std::uint64_t skipped;
+    } m_tick_stats;
+
+    /// Add a tick's duration to m_tick_stats, reporting them periodically
+    void recordTick(std::uint64_t duration);
+    Handlers m_handlers;
 };
 } // namespace server
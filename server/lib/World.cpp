@@ -0,0 +1,210 @@
+#include "World.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "common/net/input.hpp"
+
+namespace server {
+
+namespace world {
+
+namespace {
+/// Entities are a tile in size
+float const ENTITY_SIZE = 32;
+/// Eyenados drift diagonally at this many pixels per tick along each axis
+float const EYENADO_DRIFT = 0.1f;
+} // Anonymous namespace
+
+using namespace net::input;
+
+World::World(map::Level const &level)
+    : m_level(level), m_next_id(1), m_tick(0) {}
+
+EntityId World::reserveId() {
+    return m_next_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+void World::add(EntityId id, Entity::Kind kind, float x, float y, float speed,
+                int health) {
+    Entity entity;
+    entity.id = id;
+    entity.kind = kind;
+    entity.x = x;
+    entity.y = y;
+    entity.speed = speed;
+    entity.dx = 0;
+    entity.dy = 0;
+    entity.direction = SOUTH;
+    entity.health = health;
+    entity.distance_walked = 0;
+    entity.ticks = 0;
+    entity.buttons = 0;
+    entity.input_sequence = 0;
+    confine(entity);
+    m_indices[id] = m_entities.size();
+    m_entities.push_back(entity);
+}
+
+void World::addPlayer(EntityId id) {
+    add(id, Entity::Player, m_level.getSpawnX(), m_level.getSpawnY(), 1.0f,
+        100);
+}
+
+EntityId World::addEyenado(float x, float y) {
+    EntityId id = reserveId();
+    add(id, Entity::Eyenado, x, y, 1.8f, 45);
+    Entity *eyenado = find(id);
+    eyenado->dx = EYENADO_DRIFT;
+    eyenado->dy = EYENADO_DRIFT;
+    return id;
+}
+
+void World::addEyenados(unsigned count) {
+    // Spread them along the diagonal so they don't all start on top of each
+    // other
+    for (unsigned i = 0; i < count; i++) {
+        float fraction = (i + 0.5f) / count;
+        addEyenado(fraction * m_level.getWidth() * ENTITY_SIZE,
+                   fraction * m_level.getHeight() * ENTITY_SIZE);
+    }
+}
+
+void World::removeEntity(EntityId id) {
+    auto index = m_indices.find(id);
+    if (index == m_indices.end()) {
+        return;
+    }
+    // Order doesn't matter so fill the gap with the last entity rather than
+    // shifting everything after it down
+    std::size_t gap = index->second;
+    m_indices.erase(index);
+    if (gap != m_entities.size() - 1) {
+        m_entities[gap] = m_entities.back();
+        m_indices[m_entities[gap].id] = gap;
+    }
+    m_entities.pop_back();
+}
+
+Entity *World::find(EntityId id) {
+    auto index = m_indices.find(id);
+    return index == m_indices.end() ? nullptr : &m_entities[index->second];
+}
+
+bool World::setInput(EntityId player, std::uint32_t sequence,
+                     unsigned buttons) {
+    Entity *entity = find(player);
+    if (entity == nullptr || entity->kind != Entity::Player ||
+        (std::int32_t)(sequence - entity->input_sequence) <= 0) {
+        return false;
+    }
+    entity->input_sequence = sequence;
+    entity->buttons = buttons & ALL_BUTTONS;
+    return true;
+}
+
+void World::step() {
+    for (auto &entity : m_entities) {
+        switch (entity.kind) {
+        case Entity::Player:
+            stepPlayer(entity);
+            break;
+        case Entity::Eyenado:
+            stepEyenado(entity);
+            break;
+        }
+    }
+    m_tick++;
+}
+
+std::shared_ptr<net::snapshot::Snapshot const> World::makeSnapshot() const {
+    using net::snapshot::EntityState;
+    auto snapshot = std::make_shared<net::snapshot::Snapshot>();
+    snapshot->tick = m_tick;
+    snapshot->entities.reserve(m_entities.size());
+    for (auto const &entity : m_entities) {
+        EntityState state;
+        state.id = entity.id;
+        state.fields[EntityState::KIND] = entity.kind;
+        state.fields[EntityState::X] =
+            std::lround(entity.x * net::snapshot::POSITION_SCALE);
+        state.fields[EntityState::Y] =
+            std::lround(entity.y * net::snapshot::POSITION_SCALE);
+        state.fields[EntityState::DIRECTION] = entity.direction;
+        state.fields[EntityState::HEALTH] = entity.health;
+        state.fields[EntityState::FRAME] =
+            entity.kind == Entity::Player ? (int)entity.distance_walked
+                                          : entity.ticks;
+        snapshot->entities.push_back(state);
+    }
+    std::sort(snapshot->entities.begin(), snapshot->entities.end(),
+              [](EntityState const &a, EntityState const &b) {
+        return a.id < b.id;
+    });
+    return snapshot;
+}
+
+std::uint64_t World::getTick() const { return m_tick; }
+
+void World::stepPlayer(Entity &player) {
+    // The same as client::Player::input(); only one direction is taken, in
+    // this order of preference. The distance walked drives the walking
+    // animation and goes backwards when walking up or left.
+    if (player.buttons & Left) {
+        player.x -= player.speed;
+        player.distance_walked -= player.speed * 0.8f;
+        player.direction = WEST;
+    } else if (player.buttons & Right) {
+        player.x += player.speed;
+        player.distance_walked += player.speed * 0.8f;
+        player.direction = EAST;
+    } else if (player.buttons & Up) {
+        player.y -= player.speed;
+        player.distance_walked -= player.speed * 0.8f;
+        player.direction = NORTH;
+    } else if (player.buttons & Down) {
+        player.y += player.speed;
+        player.distance_walked += player.speed * 0.8f;
+        player.direction = SOUTH;
+    }
+    confine(player);
+
+    if (player.distance_walked > 60) {
+        player.distance_walked = 0;
+    } else if (player.distance_walked < 0) {
+        player.distance_walked = 60;
+    }
+}
+
+void World::stepEyenado(Entity &eyenado) {
+    // Six frames of animation, 15 ticks each
+    eyenado.ticks = (eyenado.ticks + 1) % 90;
+    float x = eyenado.x + eyenado.dx;
+    float y = eyenado.y + eyenado.dy;
+    eyenado.x = x;
+    eyenado.y = y;
+    if (confine(eyenado)) {
+        // Bounce off the edge of the level
+        if (eyenado.x != x) {
+            eyenado.dx = -eyenado.dx;
+        }
+        if (eyenado.y != y) {
+            eyenado.dy = -eyenado.dy;
+        }
+    }
+}
+
+bool World::confine(Entity &entity) const {
+    float max_x = std::max(0.0f, (m_level.getWidth() - 1) * ENTITY_SIZE);
+    float max_y = std::max(0.0f, (m_level.getHeight() - 1) * ENTITY_SIZE);
+    float x = std::min(std::max(entity.x, 0.0f), max_x);
+    float y = std::min(std::max(entity.y, 0.0f), max_y);
+    bool moved = x != entity.x || y != entity.y;
+    entity.x = x;
+    entity.y = y;
+    return moved;
+}
+
+} // namespace world
+
+} // namespace server
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "common/net/snapshot.hpp"
+
+#include "Map.hpp"
+
+namespace server {
+
+/// The authoritative game simulation
+namespace world {
+
+/// Which way an entity is facing; the same as client::mob::Direction
+enum Direction { NORTH, SOUTH, WEST, EAST };
+
+/// Identifies an entity for as long as it exists; never reused
+///
+/// Zero is never a valid entity ID.
+typedef std::uint32_t EntityId;
+
+/// Something in the world
+///
+/// This is plain data so that the world's state can be copied wholesale,
+/// e.g. to compare it against what a client was last sent.
+struct Entity {
+    enum Kind { Player, Eyenado };
+
+    EntityId id;
+    Kind kind;
+    /// Position in pixels
+    float x;
+    float y;
+    /// Pixels moved per tick by players
+    float speed;
+    /// Pixels moved along each axis per tick by mobs
+    float dx;
+    float dy;
+    Direction direction;
+    int health;
+    /// Walking animation progress; kept between 0 and 60
+    float distance_walked;
+    /// Animation tick, for mobs
+    int ticks;
+    /// The `net::input::Button`s the player is holding
+    unsigned buttons;
+    /// Sequence number of the last input command applied to the player
+    std::uint32_t input_sequence;
+};
+
+/// The world simulation
+///
+/// The world owns every entity and is advanced in fixed steps of one server
+/// tick (1 / TICK_RATE seconds) by step(). Nothing in the simulation depends
+/// on wall clock time, so the same inputs always produce the same world no
+/// matter how late or bunched up the ticks are actually run.
+///
+/// Players are moved by the input commands their clients send, which are
+/// applied with setInput() as they arrive and then acted on by every step
+/// until they change. Mobs move on their own. Nothing collides with the
+/// level's tiles yet; entities are only kept within its bounds.
+class World {
+public:
+    /// @param level The level the world takes place in. It must outlive the
+    ///     world.
+    World(map::Level const &level);
+
+    /// Reserve an ID for an entity to be added later
+    ///
+    /// Unlike the rest of the world this may be called from any thread, so a
+    /// shard can tell a client which player is theirs before shard 0 has got
+    /// round to adding it (see Server).
+    EntityId reserveId();
+
+    /// Add a player at the level's spawn point
+    ///
+    /// @param id An ID from reserveId()
+    void addPlayer(EntityId id);
+
+    /// Add an Eyenado at (x, y)
+    EntityId addEyenado(float x, float y);
+
+    /// Add `count` Eyenados spread evenly over the level
+    void addEyenados(unsigned count);
+
+    /// Remove an entity; does nothing if it doesn't exist
+    void removeEntity(EntityId id);
+
+    /// Apply an input command to a player
+    ///
+    /// Commands with a sequence number no later than the last one applied to
+    /// the player are stale and ignored. Sequence numbers are compared
+    /// modulo 2^32 so they can wrap around.
+    ///
+    /// Returns false if the command wasn't applied.
+    bool setInput(EntityId player, std::uint32_t sequence, unsigned buttons);
+
+    /// Advance the world by one tick
+    void step();
+
+    /// Capture the state of every entity as it's sent to clients
+    std::shared_ptr<net::snapshot::Snapshot const> makeSnapshot() const;
+
+    /// Number of ticks the world has been advanced by
+    std::uint64_t getTick() const;
+
+private:
+    void stepPlayer(Entity &player);
+    void stepEyenado(Entity &eyenado);
+
+    /// Keep an entity inside the level
+    ///
+    /// Returns true if it had to be moved back in.
+    bool confine(Entity &entity) const;
+
+    Entity *find(EntityId id);
+    void add(EntityId id, Entity::Kind kind, float x, float y, float speed,
+             int health);
+
+    map::Level const &m_level;
+    std::vector<Entity> m_entities;
+    /// Index of each entity in m_entities, so finding one for every input
+    /// message doesn't cost a scan of the whole world
+    std::unordered_map<EntityId, std::size_t> m_indices;
+    std::atomic<EntityId> m_next_id;
+    std::uint64_t m_tick;
+};
+
+} // namespace world
+
+} // namespace server
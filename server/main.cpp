@@ -1,15 +1,47 @@
 #include <climits>
 #include <cerrno>
+#include <csignal>
 #include <cstdlib>
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include <stdexcept>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 
-#include "lib/Server.hpp"
+#include "lib/Cluster.hpp"
+#include "common/util/digest.hpp"
 
 #define PORT_NUMBER 4544 // The default port number.
+#define MAX_CLIENTS 5     // The default maximum number of clients.
+#define MAP_DIGEST "xxh64" // The default digest for map hashes and chunks.
+#define MOBS 0            // The default number of mobs in the world.
+#define THREADS 1         // The default number of shards, one per thread.
+#define RATE_MESSAGES 240 // The default messages a second from each client.
+#define RATE_BYTES 16384  // The default bytes a second from each client.
+#define MAP_REQUEST_RATE 0.2 // The default map requests a second.
+#define MAX_VIOLATIONS 100 // The default messages over rate limits allowed.
+#define LOG_LEVEL "info"  // The default level of messages logged.
+
+// Parse a rate limit in the form <type>=<messages>/<bytes>
+static bool parseLimit(char const *arg, std::string &type,
+                       server::rate::Limit &limit) {
+    char const *equals = strchr(arg, '=');
+    if (equals == NULL || equals == arg) {
+        return false;
+    }
+    type.assign(arg, equals);
+    char *end;
+    limit.messages = strtod(equals + 1, &end);
+    if (end == equals + 1 || *end != '/') {
+        return false;
+    }
+    char const *bytes = end + 1;
+    limit.bytes = strtod(bytes, &end);
+    return end != bytes && *end == '\0' && limit.messages >= 0 &&
+           limit.bytes >= 0;
+}
 
 int main(int argc, char **argv) {
 
@@ -17,16 +49,74 @@ int main(int argc, char **argv) {
     // here. This would be done after this variable
     // is assigned to PORT_NUMBER.
     int port = PORT_NUMBER;
+    int udp_port = UDP_PORT;
+    unsigned int max_clients = MAX_CLIENTS;
 
     bool map_given = false;
     std::string map_name;
+    std::string map_digest = MAP_DIGEST;
+    unsigned int mobs = MOBS;
+    unsigned int threads = THREADS;
+
+    server::rate::Limits limits(TICK_RATE);
+    limits.setConnection(server::rate::Limit{RATE_MESSAGES, RATE_BYTES});
+    limits.setType("map.request", server::rate::Limit{MAP_REQUEST_RATE, 0});
+    limits.setMaxViolations(MAX_VIOLATIONS);
+
+    bool async_log = true;
+    std::string admin_socket;
+    std::string record;
+    std::string replay;
+    bool real_time = false;
 
     for (int i = 1; i < argc; i++) {
         if (!strcmp(argv[i], "--help")) {
             printf("HELP:\n");
             printf("    --map <mapfile> : Specify map to load\n");
-            printf("    --port <port>   : Listen on port <port>\n\n");
+            printf("    --port <port>   : Listen on port <port>\n");
+            printf("    --udp-port <port> : Send and receive datagrams on "
+                   "port <port>\n");
+            printf("    --max-clients <n> : Accept at most <n> clients\n");
+            printf("    --map-digest <name> : Identify the map and check map "
+                   "chunks with digest <name>\n");
+            printf("    --mobs <n>      : Put <n> Eyenados in the world\n");
+            printf("    --threads <n>   : Split the clients between <n> "
+                   "threads\n");
+            printf("    --rate-limit <type>=<messages>/<bytes> : Limit each "
+                   "client to <messages> and <bytes> a second of messages "
+                   "of <type>, or of all messages if <type> is *; 0 is "
+                   "unlimited\n");
+            printf("    --max-violations <n> : Disconnect clients which send "
+                   "<n> messages over the rate limits; 0 never does\n");
+            printf("    --log-level <level> : Only log messages at <level> "
+                   "or above: debug, info, warning or error\n");
+            printf("    --sync-log      : Write log messages as they're "
+                   "logged rather than on a background thread\n");
+            printf("    --admin-socket <path> : Serve metrics on a UNIX "
+                   "socket at <path>; send it `json` or `text`\n");
+            printf("    --record <path> : Record everything clients send to "
+                   "a capture at <path>\n");
+            printf("    --replay <path> : Replay the capture at <path> with "
+                   "no sockets, print the metrics and exit; the map must be "
+                   "the one it was recorded with, and the mobs and rate "
+                   "limits are taken from it\n");
+            printf("    --real-time     : Replay at the speed the capture "
+                   "was recorded rather than as fast as possible\n\n");
             printf("Default port: 4544\n");
+            printf("Default UDP port: %d\n", UDP_PORT);
+            printf("Default max clients: %d\n", MAX_CLIENTS);
+            printf("Default map digest: %s\n", MAP_DIGEST);
+            printf("Default mobs: %d\n", MOBS);
+            printf("Default threads: %d\n", THREADS);
+            printf("Default rate limits: *=%d/%d map.request=%g/0\n",
+                   RATE_MESSAGES, RATE_BYTES, MAP_REQUEST_RATE);
+            printf("Default max violations: %d\n", MAX_VIOLATIONS);
+            printf("Default log level: %s\n", LOG_LEVEL);
+            printf("Map digests:");
+            for (auto const &name : common::util::digest::names()) {
+                printf(" %s", name.c_str());
+            }
+            printf("\n");
             exit(0);
         }
         if (!strcmp(argv[i], "--port")) {
@@ -44,6 +134,34 @@ int main(int argc, char **argv) {
                 port = temp_port;
             }
             i++;
+        } else if (!strcmp(argv[i], "--udp-port")) {
+            if (i == argc - 1) {
+                printf("SERVER: [ERR]  Argument must be supplied after"
+                       " `--udp-port`.\n");
+                exit(1);
+            }
+            int temp_port = strtol(argv[i + 1], NULL, 10);
+            if (temp_port < 1 || temp_port > 65535) {
+                printf("SERVER: [ERR]  Invalid UDP port! Must be between 1 "
+                       "and 65535.\n");
+                exit(1);
+            }
+            udp_port = temp_port;
+            i++;
+        } else if (!strcmp(argv[i], "--max-clients")) {
+            if (i == argc - 1) {
+                printf("SERVER: [ERR]  Argument must be supplied after"
+                       " `--max-clients`.\n");
+                exit(1);
+            }
+            long temp_max_clients = strtol(argv[i + 1], NULL, 10);
+            if (temp_max_clients < 1) {
+                printf("SERVER: [ERR]  Invalid max clients! Must be at least "
+                       "1.\n");
+                exit(1);
+            }
+            max_clients = temp_max_clients;
+            i++;
         } else if (!strcmp(argv[i], "--map")) {
             if (i == argc - 1) {
                 printf("SERVER: [ERR]  Nothing given for map.\n");
@@ -52,9 +170,136 @@ int main(int argc, char **argv) {
             map_name = argv[i + 1];
             i++;
             map_given = true;
+        } else if (!strcmp(argv[i], "--map-digest")) {
+            if (i == argc - 1) {
+                printf("SERVER: [ERR]  Argument must be supplied after"
+                       " `--map-digest`.\n");
+                exit(1);
+            }
+            if (!common::util::digest::create(argv[i + 1])) {
+                printf("SERVER: [ERR]  Unknown map digest '%s'. See --help.\n",
+                       argv[i + 1]);
+                exit(1);
+            }
+            map_digest = argv[i + 1];
+            i++;
+        } else if (!strcmp(argv[i], "--mobs")) {
+            if (i == argc - 1) {
+                printf("SERVER: [ERR]  Argument must be supplied after"
+                       " `--mobs`.\n");
+                exit(1);
+            }
+            long temp_mobs = strtol(argv[i + 1], NULL, 10);
+            if (temp_mobs < 0 || temp_mobs > 10000) {
+                printf("SERVER: [ERR]  Invalid number of mobs! Must be "
+                       "between 0 and 10000.\n");
+                exit(1);
+            }
+            mobs = temp_mobs;
+            i++;
+        } else if (!strcmp(argv[i], "--threads")) {
+            if (i == argc - 1) {
+                printf("SERVER: [ERR]  Argument must be supplied after"
+                       " `--threads`.\n");
+                exit(1);
+            }
+            long temp_threads = strtol(argv[i + 1], NULL, 10);
+            if (temp_threads < 1 || temp_threads > 256) {
+                printf("SERVER: [ERR]  Invalid number of threads! Must be "
+                       "between 1 and 256.\n");
+                exit(1);
+            }
+            threads = temp_threads;
+            i++;
+        } else if (!strcmp(argv[i], "--rate-limit")) {
+            if (i == argc - 1) {
+                printf("SERVER: [ERR]  Argument must be supplied after"
+                       " `--rate-limit`.\n");
+                exit(1);
+            }
+            std::string type;
+            server::rate::Limit limit;
+            if (!parseLimit(argv[i + 1], type, limit)) {
+                printf("SERVER: [ERR]  Invalid rate limit '%s'! Must be "
+                       "<type>=<messages>/<bytes>.\n", argv[i + 1]);
+                exit(1);
+            }
+            if (type == "*") {
+                limits.setConnection(limit);
+            } else {
+                limits.setType(type, limit);
+            }
+            i++;
+        } else if (!strcmp(argv[i], "--max-violations")) {
+            if (i == argc - 1) {
+                printf("SERVER: [ERR]  Argument must be supplied after"
+                       " `--max-violations`.\n");
+                exit(1);
+            }
+            long temp_violations = strtol(argv[i + 1], NULL, 10);
+            if (temp_violations < 0) {
+                printf("SERVER: [ERR]  Invalid max violations! Must be at "
+                       "least 0.\n");
+                exit(1);
+            }
+            limits.setMaxViolations(temp_violations);
+            i++;
+        } else if (!strcmp(argv[i], "--log-level")) {
+            if (i == argc - 1) {
+                printf("SERVER: [ERR]  Argument must be supplied after"
+                       " `--log-level`.\n");
+                exit(1);
+            }
+            if (!strcmp(argv[i + 1], "debug")) {
+                common::Logger::setLevel(common::LogLevel::Debug);
+            } else if (!strcmp(argv[i + 1], "info")) {
+                common::Logger::setLevel(common::LogLevel::Info);
+            } else if (!strcmp(argv[i + 1], "warning")) {
+                common::Logger::setLevel(common::LogLevel::Warning);
+            } else if (!strcmp(argv[i + 1], "error")) {
+                common::Logger::setLevel(common::LogLevel::Error);
+            } else {
+                printf("SERVER: [ERR]  Unknown log level '%s'. See --help.\n",
+                       argv[i + 1]);
+                exit(1);
+            }
+            i++;
+        } else if (!strcmp(argv[i], "--sync-log")) {
+            async_log = false;
+        } else if (!strcmp(argv[i], "--admin-socket")) {
+            if (i == argc - 1) {
+                printf("SERVER: [ERR]  Argument must be supplied after"
+                       " `--admin-socket`.\n");
+                exit(1);
+            }
+            admin_socket = argv[i + 1];
+            i++;
+        } else if (!strcmp(argv[i], "--record")) {
+            if (i == argc - 1) {
+                printf("SERVER: [ERR]  Argument must be supplied after"
+                       " `--record`.\n");
+                exit(1);
+            }
+            record = argv[i + 1];
+            i++;
+        } else if (!strcmp(argv[i], "--replay")) {
+            if (i == argc - 1) {
+                printf("SERVER: [ERR]  Argument must be supplied after"
+                       " `--replay`.\n");
+                exit(1);
+            }
+            replay = argv[i + 1];
+            i++;
+        } else if (!strcmp(argv[i], "--real-time")) {
+            real_time = true;
         }
     }
 
+    if (!replay.empty() && !record.empty()) {
+        printf("SERVER: [ERR]  Can't record whilst replaying.\n");
+        exit(1);
+    }
+
     // How could we run the server if we had no map?
     if (!map_given) {
         printf("SERVER: [ERR]  No map given. I'm going to close my self "
@@ -88,6 +333,34 @@ int main(int argc, char **argv) {
     }
     map_file.close();
 
-    server::Server server(port, 5, map_name);
+    // Writes to a client that has hung up would otherwise kill the server.
+    // Most are sent with MSG_NOSIGNAL, but sendfile(2) has no such flag.
+    signal(SIGPIPE, SIG_IGN);
+
+    // Logging from the network loop mustn't wait on the terminal or disk
+    if (async_log) {
+        common::Logger::startAsync();
+    }
+
+    if (!replay.empty()) {
+        std::unique_ptr<server::capture::Reader> reader;
+        try {
+            reader.reset(new server::capture::Reader(replay));
+        } catch (std::runtime_error &error) {
+            printf("SERVER: [ERR]  %s\n", error.what());
+            exit(1);
+        }
+        // Replays are run on one thread with no sockets, so that they do
+        // the same work every time. They're run with what the capture was
+        // recorded with, and let in every client it has; the ones the
+        // server refused were never recorded.
+        server::capture::Settings const &settings = reader->getSettings();
+        server::Cluster server(0, 0, UINT_MAX, map_name, settings.map_digest,
+                               settings.mobs, 1, settings.limits, "", "");
+        return server.replay(*reader, real_time);
+    }
+
+    server::Cluster server(port, udp_port, max_clients, map_name, map_digest,
+                           mobs, threads, limits, admin_socket, record);
     server.exec();
 }